@@ -30,11 +30,18 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <time.h>
 #include <sys/time.h>
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "driver/i2c.h"
 
 #include "icm20948.h"
@@ -70,6 +77,19 @@
 #define ICM20948_INT_STATUS_2   0x1B
 #define ICM20948_INT_STATUS_3   0x1C
 
+/* INT_PIN_CFG bits */
+#define ICM20948_INT1_ACTL          0x80
+#define ICM20948_INT1_OPEN          0x40
+#define ICM20948_INT1_LATCH_EN      0x20
+#define ICM20948_INT_ANYRD_2CLEAR   0x10
+
+/* Bits of INT_ENABLE .. INT_ENABLE_3 and of INT_STATUS .. INT_STATUS_3 */
+#define ICM20948_I2C_MST_INT_EN     0x01	/* INT_ENABLE */
+#define ICM20948_WOM_INT_EN         0x08	/* INT_ENABLE */
+#define ICM20948_RAW_DATA_0_RDY_EN  0x01	/* INT_ENABLE_1 */
+#define ICM20948_FIFO_OVERFLOW_EN   0x01	/* INT_ENABLE_2, FIFO 0 */
+#define ICM20948_FIFO_WM_EN         0x01	/* INT_ENABLE_3, FIFO 0 */
+
 #define ICM20948_DELAY_TIMEH    0x28
 #define ICM20948_DELAY_TIMEL    0x29
 
@@ -195,6 +215,66 @@
 #define M_REG_TS1              0x33
 #define M_REG_TS2              0x34
 
+/* HXL to HZH, the dummy register and ST2: SLV0 reads these 8 bytes into EXT_SLV_SENS_DATA_00.. */
+#define ICM20948_MAG_DATA_LEN  8
+
+/* ACCEL_XOUT_H to the magnetometer ST2: accel, gyro, temp and the SLV0 bytes are contiguous in bank 0 */
+#define ICM20948_ALL_DATA_LEN  (ICM20948_EXT_SLV_SENS_DATA_00 - ICM20948_ACCEL_XOUT_H + ICM20948_MAG_DATA_LEN)
+
+/* Start, address, register, then a write or a repeated start, address and read, and stop */
+#define ICM20948_CMD_LINK_SIZE	I2C_LINK_RECOMMENDED_SIZE(2)
+#define ICM20948_ASYNC_STOP		0xFF	/* Queued instead of a slot to end the transaction task */
+
+#define ICM20948_TEMP_SENSITIVITY	333.87f	/* LSB per degree C */
+#define ICM20948_TEMP_OFFSET		21.0f	/* degrees C at a reading of 0 */
+#define ICM20948_MAG_SENSITIVITY	0.15f	/* uT per LSB of the AK09916 */
+
+/* USER_CTRL bits */
+#define ICM20948_USER_CTRL_FIFO_EN    0x40
+#define ICM20948_USER_CTRL_I2C_MST_EN 0x20
+
+/* FIFO_EN_1 / FIFO_EN_2 bits */
+#define ICM20948_FIFO_SLV_0_EN  0x01
+#define ICM20948_FIFO_ACCEL_EN  0x10
+#define ICM20948_FIFO_GYRO_EN   0x0E	/* GYRO_X, GYRO_Y and GYRO_Z */
+
+/* Internal sample rate of the gyroscope with the DLPF enabled (Hz) */
+#define ICM20948_GYRO_BASE_RATE	1100
+#define ICM20948_ACCE_BASE_RATE	1125
+
+/* Interrupt sources of icm20948_enable_interrupts, each maps to a bit of one of the INT_ENABLE registers */
+const uint8_t icm20948_DATA_RDY_INT_BIT = 0x01;
+const uint8_t icm20948_I2C_MASTER_INT_BIT = 0x02;
+const uint8_t icm20948_FIFO_OVERFLOW_INT_BIT = 0x04;
+const uint8_t icm20948_MOT_DETECT_INT_BIT = 0x08;
+const uint8_t icm20948_FIFO_WATERMARK_INT_BIT = 0x10;
+const uint8_t icm20948_ALL_INTERRUPTS = 0x1F;
+
+typedef struct {
+	uint8_t cmd_buf[ICM20948_CMD_LINK_SIZE];	/*!< Storage of the command link */
+	i2c_cmd_handle_t cmd;
+	bool read;
+	size_t data_len;
+	esp_err_t ret;								/*!< Result, valid once done is given */
+	uint8_t data[ICM20948_ALL_DATA_LEN];		/*!< Burst of icm20948_get_all_async */
+	float acce_sensitivity;						/*!< Scales of icm20948_get_all_async, taken when queued */
+	float gyro_sensitivity;
+	SemaphoreHandle_t done;
+	StaticSemaphore_t done_buf;
+} icm20948_xfer_slot_t;
+
+typedef struct {
+	icm20948_xfer_slot_t slots[ICM20948_ASYNC_DEPTH];
+	QueueHandle_t free;							/*!< Indexes of the slots not in use */
+	StaticQueue_t free_buf;
+	uint8_t free_storage[ICM20948_ASYNC_DEPTH];
+	QueueHandle_t pending;						/*!< Indexes of the slots to run, in order, and ICM20948_ASYNC_STOP */
+	StaticQueue_t pending_buf;
+	uint8_t pending_storage[ICM20948_ASYNC_DEPTH + 1];
+	SemaphoreHandle_t stopped;					/*!< Given by the transaction task when it ends */
+	StaticSemaphore_t stopped_buf;
+} icm20948_async_t;
+
 typedef struct {
 	i2c_port_t bus;
 	gpio_num_t int_pin;
@@ -202,15 +282,28 @@ typedef struct {
 	uint32_t counter;
 	float dt; /*!< delay time between two measurements, dt should be small (ms level) */
 	struct timeval *timer;
+	icm20948_fifo_config_t fifo;	/*!< FIFO configuration, valid when fifo_frame_size != 0 */
+	uint8_t fifo_frame_size;		/*!< Bytes per FIFO frame, 0 when the FIFO is off */
+	uint32_t fifo_period_us;		/*!< Sample period of the FIFO frames */
+	int64_t fifo_next_timestamp;	/*!< Expected time of the next frame, 0 after an overflow or reset */
+	uint32_t fifo_overflows;		/*!< Number of overflows since icm20948_fifo_enable */
+	int8_t bank;					/*!< Selected register bank, -1 when unknown */
+	uint8_t accel_config;			/*!< Shadow of ACCEL_CONFIG: DLPF, full scale and FCHOICE */
+	uint8_t gyro_config_1;			/*!< Shadow of GYRO_CONFIG_1: DLPF, full scale and FCHOICE */
+	bool accel_config_valid;
+	bool gyro_config_valid;
+	icm20948_bus_stats_t stats;
+	bool isr_registered;			/*!< An ISR is attached to int_pin */
+	icm20948_async_t *async;		/*!< Queued transactions, NULL until icm20948_async_start */
 } icm20948_dev_t;
 
-static esp_err_t
-icm20948_write(icm20948_handle_t sensor, const uint8_t reg_start_addr, const uint8_t *const data_buf, const uint8_t data_len)
+static i2c_cmd_handle_t
+icm20948_write_cmd(icm20948_dev_t *sens, uint8_t *cmd_buf, const uint8_t reg_start_addr, const uint8_t *const data_buf, const size_t data_len)
 {
-	icm20948_dev_t *sens = (icm20948_dev_t *)sensor;
 	esp_err_t ret;
 
-	i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+	// The command link lives in cmd_buf, no heap allocation per transaction
+	i2c_cmd_handle_t cmd = i2c_cmd_link_create_static(cmd_buf, ICM20948_CMD_LINK_SIZE);
 	ret = i2c_master_start(cmd);
 	assert(ESP_OK == ret);
 	ret = i2c_master_write_byte(cmd, sens->dev_addr | I2C_MASTER_WRITE, true);
@@ -221,9 +314,58 @@ icm20948_write(icm20948_handle_t sensor, const uint8_t reg_start_addr, const uin
 	assert(ESP_OK == ret);
 	ret = i2c_master_stop(cmd);
 	assert(ESP_OK == ret);
+	return cmd;
+}
+
+static i2c_cmd_handle_t
+icm20948_read_cmd(icm20948_dev_t *sens, uint8_t *cmd_buf, const uint8_t reg_start_addr, uint8_t *const data_buf, const size_t data_len)
+{
+	esp_err_t ret;
+
+	i2c_cmd_handle_t cmd = i2c_cmd_link_create_static(cmd_buf, ICM20948_CMD_LINK_SIZE);
+	ret = i2c_master_start(cmd);
+	assert(ESP_OK == ret);
+	ret = i2c_master_write_byte(cmd, sens->dev_addr | I2C_MASTER_WRITE, true);
+	assert(ESP_OK == ret);
+	ret = i2c_master_write_byte(cmd, reg_start_addr, true);
+	assert(ESP_OK == ret);
+	ret = i2c_master_start(cmd);
+	assert(ESP_OK == ret);
+	ret = i2c_master_write_byte(cmd, sens->dev_addr | I2C_MASTER_READ, true);
+	assert(ESP_OK == ret);
+	ret = i2c_master_read(cmd, data_buf, data_len, I2C_MASTER_LAST_NACK);
+	assert(ESP_OK == ret);
+	ret = i2c_master_stop(cmd);
+	assert(ESP_OK == ret);
+	return cmd;
+}
+
+static void
+icm20948_count_transaction(icm20948_dev_t *sens, esp_err_t ret, bool read, size_t data_len)
+{
+	sens->stats.transactions++;
+	if (read) {
+		sens->stats.reads++;
+		sens->stats.bytes_read += data_len;
+	} else {
+		sens->stats.bytes_written += data_len;
+	}
+	if (ret != ESP_OK)
+		sens->stats.errors++;
+}
+
+static esp_err_t
+icm20948_write(icm20948_handle_t sensor, const uint8_t reg_start_addr, const uint8_t *const data_buf, const uint8_t data_len)
+{
+	icm20948_dev_t *sens = (icm20948_dev_t *)sensor;
+	uint8_t cmd_buf[ICM20948_CMD_LINK_SIZE];
+	esp_err_t ret;
+
+	i2c_cmd_handle_t cmd = icm20948_write_cmd(sens, cmd_buf, reg_start_addr, data_buf, data_len);
 	ret = i2c_master_cmd_begin(sens->bus, cmd, 1000 / portTICK_PERIOD_MS);
-	i2c_cmd_link_delete(cmd);
+	i2c_cmd_link_delete_static(cmd);
 
+	icm20948_count_transaction(sens, ret, false, data_len);
 	return ret;
 }
 
@@ -259,29 +401,17 @@ icm20948_write_MAG(icm20948_handle_t sensor, const uint8_t reg_start_addr, const
 }
 
 static esp_err_t
-icm20948_read(icm20948_handle_t sensor, const uint8_t reg_start_addr, uint8_t *const data_buf, const uint8_t data_len)
+icm20948_read(icm20948_handle_t sensor, const uint8_t reg_start_addr, uint8_t *const data_buf, const size_t data_len)
 {
 	icm20948_dev_t *sens = (icm20948_dev_t *)sensor;
+	uint8_t cmd_buf[ICM20948_CMD_LINK_SIZE];
 	esp_err_t ret;
 
-	i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-	ret = i2c_master_start(cmd);
-	assert(ESP_OK == ret);
-	ret = i2c_master_write_byte(cmd, sens->dev_addr | I2C_MASTER_WRITE, true);
-	assert(ESP_OK == ret);
-	ret = i2c_master_write_byte(cmd, reg_start_addr, true);
-	assert(ESP_OK == ret);
-	ret = i2c_master_start(cmd);
-	assert(ESP_OK == ret);
-	ret = i2c_master_write_byte(cmd, sens->dev_addr | I2C_MASTER_READ, true);
-	assert(ESP_OK == ret);
-	ret = i2c_master_read(cmd, data_buf, data_len, I2C_MASTER_LAST_NACK);
-	assert(ESP_OK == ret);
-	ret = i2c_master_stop(cmd);
-	assert(ESP_OK == ret);
+	i2c_cmd_handle_t cmd = icm20948_read_cmd(sens, cmd_buf, reg_start_addr, data_buf, data_len);
 	ret = i2c_master_cmd_begin(sens->bus, cmd, 1000 / portTICK_PERIOD_MS);
-	i2c_cmd_link_delete(cmd);
+	i2c_cmd_link_delete_static(cmd);
 
+	icm20948_count_transaction(sens, ret, true, data_len);
 	return ret;
 }
 
@@ -322,6 +452,8 @@ icm20948_create(i2c_port_t port, const uint16_t dev_addr)
 	sensor->counter = 0;
 	sensor->dt = 0;
 	sensor->timer = (struct timeval *)calloc(1, sizeof(struct timeval));
+	sensor->bank = -1;
+	sensor->int_pin = GPIO_NUM_NC;
 	return (icm20948_handle_t)sensor;
 }
 
@@ -329,6 +461,15 @@ void
 icm20948_delete(icm20948_handle_t sensor)
 {
 	icm20948_dev_t *sens = (icm20948_dev_t *)sensor;
+	if (sens->isr_registered)
+		gpio_isr_handler_remove(sens->int_pin);
+	if (sens->async != NULL) {
+		const uint8_t stop = ICM20948_ASYNC_STOP;
+		xQueueSend(sens->async->pending, &stop, portMAX_DELAY);
+		xSemaphoreTake(sens->async->stopped, portMAX_DELAY);
+		free(sens->async);
+	}
+	free(sens->timer);
 	free(sens);
 }
 
@@ -343,6 +484,10 @@ icm20948_wake_up(icm20948_handle_t sensor)
 {
 	esp_err_t ret;
 	uint8_t tmp;
+	ret = icm20948_set_bank(sensor, 0);
+	if (ESP_OK != ret) {
+		return ret;
+	}
 	ret = icm20948_read(sensor, ICM20948_PWR_MGMT_1, &tmp, 1);
 	if (ESP_OK != ret) {
 		return ret;
@@ -357,6 +502,10 @@ icm20948_sleep(icm20948_handle_t sensor)
 {
 	esp_err_t ret;
 	uint8_t tmp;
+	ret = icm20948_set_bank(sensor, 0);
+	if (ESP_OK != ret) {
+		return ret;
+	}
 	ret = icm20948_read(sensor, ICM20948_PWR_MGMT_1, &tmp, 1);
 	if (ESP_OK != ret) {
 		return ret;
@@ -369,42 +518,117 @@ icm20948_sleep(icm20948_handle_t sensor)
 esp_err_t
 icm20948_reset(icm20948_handle_t sensor)
 {
+	icm20948_dev_t *sens = (icm20948_dev_t *)sensor;
 	esp_err_t ret;
 	uint8_t tmp;
 
+	ret = icm20948_set_bank(sensor, 0);
+	if (ret != ESP_OK)
+		return ret;
+
 	ret = icm20948_read(sensor, ICM20948_PWR_MGMT_1, &tmp, 1);
 	if (ret != ESP_OK)
 		return ret;
 	tmp |= 0x80;
 	ret = icm20948_write(sensor, ICM20948_PWR_MGMT_1, &tmp, 1);
-	if (ret != ESP_OK)
-		return ret;
 
+	// The registers return to their defaults, read them again before trusting the shadows
+	sens->bank = -1;
+	sens->accel_config_valid = false;
+	sens->gyro_config_valid = false;
+	sens->fifo_frame_size = 0;
 	return ret;
 }
 
 esp_err_t
 icm20948_set_bank(icm20948_handle_t sensor, uint8_t bank)
 {
+	icm20948_dev_t *sens = (icm20948_dev_t *)sensor;
 	esp_err_t ret;
+	uint8_t tmp;
 	if (bank > 3)
 		return ESP_FAIL;
-	bank = (bank << 4) & 0x30;
-	ret = icm20948_write(sensor, ICM20948_REG_BANK_SEL, &bank, 1);
+	if (sens->bank == bank) {
+		sens->stats.bank_switches_skipped++;
+		return ESP_OK;
+	}
+	tmp = (bank << 4) & 0x30;
+	ret = icm20948_write(sensor, ICM20948_REG_BANK_SEL, &tmp, 1);
+	sens->stats.bank_switches++;
+	sens->bank = ret == ESP_OK ? (int8_t)bank : -1;
 	return ret;
 }
 
-esp_err_t
-icm20948_set_gyro_fs(icm20948_handle_t sensor, icm20948_gyro_fs_t gyro_fs)
+static esp_err_t
+icm20948_get_config(icm20948_handle_t sensor, const uint8_t reg, uint8_t *const value)
 {
+	/* ACCEL_CONFIG or GYRO_CONFIG_1 of bank 2, read once and then taken from the shadow */
+	icm20948_dev_t *sens = (icm20948_dev_t *)sensor;
+	uint8_t *shadow = reg == ICM20948_ACCEL_CONFIG ? &sens->accel_config : &sens->gyro_config_1;
+	bool *valid = reg == ICM20948_ACCEL_CONFIG ? &sens->accel_config_valid : &sens->gyro_config_valid;
 	esp_err_t ret;
-	uint8_t tmp;
+
+	if (*valid) {
+		*value = *shadow;
+		return ESP_OK;
+	}
+
+	ret = icm20948_set_bank(sensor, 2);
+	if (ret != ESP_OK)
+		return ret;
+
+	ret = icm20948_read(sensor, reg, value, 1);
+	if (ret != ESP_OK)
+		return ret;
+
+	*shadow = *value;
+	*valid = true;
+	return ret;
+}
+
+static esp_err_t
+icm20948_set_config(icm20948_handle_t sensor, const uint8_t reg, const uint8_t value)
+{
+	/* Writes ACCEL_CONFIG or GYRO_CONFIG_1 unless the shadow already holds the value */
+	icm20948_dev_t *sens = (icm20948_dev_t *)sensor;
+	uint8_t *shadow = reg == ICM20948_ACCEL_CONFIG ? &sens->accel_config : &sens->gyro_config_1;
+	bool *valid = reg == ICM20948_ACCEL_CONFIG ? &sens->accel_config_valid : &sens->gyro_config_valid;
+	esp_err_t ret;
+
+	if (*valid && *shadow == value)
+		return ESP_OK;
 
 	ret = icm20948_set_bank(sensor, 2);
 	if (ret != ESP_OK)
 		return ret;
 
-	ret = icm20948_read(sensor, ICM20948_GYRO_CONFIG_1, &tmp, 1);
+	ret = icm20948_write(sensor, reg, &value, 1);
+	*shadow = value;
+	*valid = ret == ESP_OK;
+	return ret;
+}
+
+void
+icm20948_get_bus_stats(icm20948_handle_t sensor, icm20948_bus_stats_t *const stats)
+{
+	icm20948_dev_t *sens = (icm20948_dev_t *)sensor;
+	*stats = sens->stats;
+}
+
+void
+icm20948_reset_bus_stats(icm20948_handle_t sensor)
+{
+	icm20948_dev_t *sens = (icm20948_dev_t *)sensor;
+	memset(&sens->stats, 0, sizeof(sens->stats));
+}
+
+esp_err_t
+icm20948_set_gyro_fs(icm20948_handle_t sensor, icm20948_gyro_fs_t gyro_fs)
+{
+	esp_err_t ret;
+	uint8_t tmp;
+
+	ret = icm20948_get_config(sensor, ICM20948_GYRO_CONFIG_1, &tmp);
 
 #if CONFIG_LOG_DEFAULT_LEVEL == 4
 	printf(BYTE_TO_BINARY_PATTERN "\n", BYTE_TO_BINARY(tmp));
@@ -412,14 +636,14 @@ icm20948_set_gyro_fs(icm20948_handle_t sensor, icm20948_gyro_fs_t gyro_fs)
 
 	if (ret != ESP_OK)
 		return ret;
-	tmp &= 0x09;
+	tmp &= 0x39;
 	tmp |= (gyro_fs << 1);
 
 #if CONFIG_LOG_DEFAULT_LEVEL == 4
 	printf(BYTE_TO_BINARY_PATTERN "\n", BYTE_TO_BINARY(tmp));
 #endif
 
-	ret = icm20948_write(sensor, ICM20948_GYRO_CONFIG_1, &tmp, 1);
+	ret = icm20948_set_config(sensor, ICM20948_GYRO_CONFIG_1, tmp);
 	return ret;
 }
 
@@ -429,12 +653,10 @@ icm20948_get_gyro_fs(icm20948_handle_t sensor, icm20948_gyro_fs_t *gyro_fs)
 	esp_err_t ret;
 	uint8_t tmp;
 
-	ret = icm20948_set_bank(sensor, 2);
+	ret = icm20948_get_config(sensor, ICM20948_GYRO_CONFIG_1, &tmp);
 	if (ret != ESP_OK)
 		return ret;
 
-	ret = icm20948_read(sensor, ICM20948_GYRO_CONFIG_1, &tmp, 1);
-
 #if CONFIG_LOG_DEFAULT_LEVEL == 4
 	printf(BYTE_TO_BINARY_PATTERN "\n", BYTE_TO_BINARY(tmp));
 #endif
@@ -524,11 +746,7 @@ icm20948_set_acce_fs(icm20948_handle_t sensor, icm20948_acce_fs_t acce_fs)
 	esp_err_t ret;
 	uint8_t tmp;
 
-	ret = icm20948_set_bank(sensor, 2);
-	if (ret != ESP_OK)
-		return ret;
-
-	ret = icm20948_read(sensor, ICM20948_ACCEL_CONFIG, &tmp, 1);
+	ret = icm20948_get_config(sensor, ICM20948_ACCEL_CONFIG, &tmp);
 
 #if CONFIG_LOG_DEFAULT_LEVEL == 4
 	printf(BYTE_TO_BINARY_PATTERN "\n", BYTE_TO_BINARY(tmp));
@@ -536,14 +754,14 @@ icm20948_set_acce_fs(icm20948_handle_t sensor, icm20948_acce_fs_t acce_fs)
 
 	if (ret != ESP_OK)
 		return ret;
-	tmp &= 0x09;
+	tmp &= 0x39;
 	tmp |= (acce_fs << 1);
 
 #if CONFIG_LOG_DEFAULT_LEVEL == 4
 	printf(BYTE_TO_BINARY_PATTERN "\n", BYTE_TO_BINARY(tmp));
 #endif
 
-	ret = icm20948_write(sensor, ICM20948_ACCEL_CONFIG, &tmp, 1);
+	ret = icm20948_set_config(sensor, ICM20948_ACCEL_CONFIG, tmp);
 	return ret;
 }
 
@@ -553,12 +771,10 @@ icm20948_get_acce_fs(icm20948_handle_t sensor, icm20948_acce_fs_t *acce_fs)
 	esp_err_t ret;
 	uint8_t tmp;
 
-	ret = icm20948_set_bank(sensor, 2);
+	ret = icm20948_get_config(sensor, ICM20948_ACCEL_CONFIG, &tmp);
 	if (ret != ESP_OK)
 		return ret;
 
-	ret = icm20948_read(sensor, ICM20948_ACCEL_CONFIG, &tmp, 1);
-
 #if CONFIG_LOG_DEFAULT_LEVEL == 4
 	printf(BYTE_TO_BINARY_PATTERN "\n", BYTE_TO_BINARY(tmp));
 #endif
@@ -587,6 +803,9 @@ icm20948_get_acce_sensitivity(icm20948_handle_t sensor, float *const acce_sensit
 	esp_err_t ret;
 	icm20948_acce_fs_t acce_fs;
 	ret = icm20948_get_acce_fs(sensor, &acce_fs);
+	if (ret != ESP_OK)
+		return ret;
+
 	switch (acce_fs) {
 	case ACCE_FS_2G:
 		*acce_sensitivity = 16384;
@@ -643,18 +862,14 @@ icm20948_set_acce_dlpf(icm20948_handle_t sensor, icm20948_dlpf_t dlpf_acce)
 	esp_err_t ret;
 	uint8_t tmp;
 
-	ret = icm20948_set_bank(sensor, 2);
-	if (ret != ESP_OK)
-		return ESP_FAIL;
-
-	ret = icm20948_read(sensor, ICM20948_ACCEL_CONFIG, &tmp, 1);
+	ret = icm20948_get_config(sensor, ICM20948_ACCEL_CONFIG, &tmp);
 	if (ret != ESP_OK)
 		return ESP_FAIL;
 
 	tmp &= 0xC7;
 	tmp |= dlpf_acce << 3;
 
-	ret = icm20948_write(sensor, ICM20948_ACCEL_CONFIG, &tmp, 1);
+	ret = icm20948_set_config(sensor, ICM20948_ACCEL_CONFIG, tmp);
 	if (ret != ESP_OK)
 		return ESP_FAIL;
 
@@ -667,18 +882,14 @@ icm20948_set_gyro_dlpf(icm20948_handle_t sensor, icm20948_dlpf_t dlpf_gyro)
 	esp_err_t ret;
 	uint8_t tmp;
 
-	ret = icm20948_set_bank(sensor, 2);
-	if (ret != ESP_OK)
-		return ESP_FAIL;
-
-	ret = icm20948_read(sensor, ICM20948_GYRO_CONFIG_1, &tmp, 1);
+	ret = icm20948_get_config(sensor, ICM20948_GYRO_CONFIG_1, &tmp);
 	if (ret != ESP_OK)
 		return ESP_FAIL;
 
 	tmp &= 0xC7;
 	tmp |= dlpf_gyro << 3;
 
-	ret = icm20948_write(sensor, ICM20948_GYRO_CONFIG_1, &tmp, 1);
+	ret = icm20948_set_config(sensor, ICM20948_GYRO_CONFIG_1, tmp);
 	if (ret != ESP_OK)
 		return ESP_FAIL;
 
@@ -691,11 +902,7 @@ icm20948_enable_dlpf(icm20948_handle_t sensor, bool enable)
 	esp_err_t ret;
 	uint8_t tmp;
 
-	ret = icm20948_set_bank(sensor, 2);
-	if (ret != ESP_OK)
-		return ESP_FAIL;
-
-	ret = icm20948_read(sensor, ICM20948_ACCEL_CONFIG, &tmp, 1);
+	ret = icm20948_get_config(sensor, ICM20948_ACCEL_CONFIG, &tmp);
 	if (ret != ESP_OK)
 		return ESP_FAIL;
 
@@ -704,11 +911,11 @@ icm20948_enable_dlpf(icm20948_handle_t sensor, bool enable)
 	else
 		tmp &= 0xFE;
 
-	ret = icm20948_write(sensor, ICM20948_ACCEL_CONFIG, &tmp, 1);
+	ret = icm20948_set_config(sensor, ICM20948_ACCEL_CONFIG, tmp);
 	if (ret != ESP_OK)
 		return ESP_FAIL;
 
-	ret = icm20948_read(sensor, ICM20948_GYRO_CONFIG_1, &tmp, 1);
+	ret = icm20948_get_config(sensor, ICM20948_GYRO_CONFIG_1, &tmp);
 	if (ret != ESP_OK)
 		return ESP_FAIL;
 
@@ -717,7 +924,7 @@ icm20948_enable_dlpf(icm20948_handle_t sensor, bool enable)
 	else
 		tmp &= 0xFE;
 
-	ret = icm20948_write(sensor, ICM20948_GYRO_CONFIG_1, &tmp, 1);
+	ret = icm20948_set_config(sensor, ICM20948_GYRO_CONFIG_1, tmp);
 	if (ret != ESP_OK)
 		return ESP_FAIL;
 
@@ -798,7 +1005,7 @@ icm20948_mag_init(icm20948_handle_t sensor)
 	if (ret != ESP_OK)
 		return ret;
 
-	ret = icm20948_read_MAG(sensor, M_REG_HXL, 8);
+	ret = icm20948_read_MAG(sensor, M_REG_HXL, ICM20948_MAG_DATA_LEN);
 	if(ret != ESP_OK){
 		return ret;
 	}
@@ -810,7 +1017,7 @@ icm20948_mag_init(icm20948_handle_t sensor)
 esp_err_t
 icm20948_get_raw_mag(icm20948_handle_t sensor, icm20948_raw_sensor_data_t *const raw_mag_value)
 {
-	uint8_t data_rd[8] = {0,0,0,0,0,0,0,0};
+	uint8_t data_rd[ICM20948_MAG_DATA_LEN] = {0,0,0,0,0,0,0,0};
 	esp_err_t ret;
 
 	ret = icm20948_set_bank(sensor, 0);
@@ -825,4 +1032,609 @@ icm20948_get_raw_mag(icm20948_handle_t sensor, icm20948_raw_sensor_data_t *const
 	raw_mag_value->raw_mag_y = (int16_t)((data_rd[3] << 8) + (data_rd[2]));
 	raw_mag_value->raw_mag_z = (int16_t)((data_rd[5] << 8) + (data_rd[4]));
 	return ret;
-}
\ No newline at end of file
+}
+
+static void
+icm20948_parse_all(const uint8_t *data_rd, float acce_sensitivity, float gyro_sensitivity, icm20948_sensor_data_t *const sensor_value)
+{
+	const uint8_t *mag = data_rd + (ICM20948_EXT_SLV_SENS_DATA_00 - ICM20948_ACCEL_XOUT_H);
+
+	sensor_value->acce_x = (int16_t)((data_rd[0] << 8) + (data_rd[1])) / acce_sensitivity;
+	sensor_value->acce_y = (int16_t)((data_rd[2] << 8) + (data_rd[3])) / acce_sensitivity;
+	sensor_value->acce_z = (int16_t)((data_rd[4] << 8) + (data_rd[5])) / acce_sensitivity;
+	sensor_value->gyro_x = (int16_t)((data_rd[6] << 8) + (data_rd[7])) / gyro_sensitivity;
+	sensor_value->gyro_y = (int16_t)((data_rd[8] << 8) + (data_rd[9])) / gyro_sensitivity;
+	sensor_value->gyro_z = (int16_t)((data_rd[10] << 8) + (data_rd[11])) / gyro_sensitivity;
+	sensor_value->temp = (int16_t)((data_rd[12] << 8) + (data_rd[13])) / ICM20948_TEMP_SENSITIVITY + ICM20948_TEMP_OFFSET;
+	sensor_value->mag_x = (int16_t)((mag[1] << 8) + (mag[0])) * ICM20948_MAG_SENSITIVITY;
+	sensor_value->mag_y = (int16_t)((mag[3] << 8) + (mag[2])) * ICM20948_MAG_SENSITIVITY;
+	sensor_value->mag_z = (int16_t)((mag[5] << 8) + (mag[4])) * ICM20948_MAG_SENSITIVITY;
+}
+
+esp_err_t
+icm20948_get_all(icm20948_handle_t sensor, icm20948_sensor_data_t *const sensor_value)
+{
+	uint8_t data_rd[ICM20948_ALL_DATA_LEN];
+	float acce_sensitivity;
+	float gyro_sensitivity;
+	esp_err_t ret;
+
+	// The sensitivities come from the shadowed configuration, so this is the only transaction once the bank is selected
+	ret = icm20948_get_acce_sensitivity(sensor, &acce_sensitivity);
+	if (ret != ESP_OK)
+		return ret;
+
+	ret = icm20948_get_gyro_sensitivity(sensor, &gyro_sensitivity);
+	if (ret != ESP_OK)
+		return ret;
+
+	ret = icm20948_set_bank(sensor, 0);
+	if (ret != ESP_OK)
+		return ret;
+
+	ret = icm20948_read(sensor, ICM20948_ACCEL_XOUT_H, data_rd, sizeof(data_rd));
+	if (ret != ESP_OK)
+		return ret;
+
+	icm20948_parse_all(data_rd, acce_sensitivity, gyro_sensitivity, sensor_value);
+	return ESP_OK;
+}
+
+static void
+icm20948_parse_fifo_frame(const icm20948_fifo_config_t *fifo, const uint8_t *frame, icm20948_raw_sensor_data_t *const raw)
+{
+	/* Frames hold the enabled sources in register order: accel, gyro, then the SLV0 (magnetometer) bytes */
+	memset(raw, 0, sizeof(*raw));
+	if (fifo->accel) {
+		raw->raw_acce_x = (int16_t)((frame[0] << 8) + (frame[1]));
+		raw->raw_acce_y = (int16_t)((frame[2] << 8) + (frame[3]));
+		raw->raw_acce_z = (int16_t)((frame[4] << 8) + (frame[5]));
+		frame += 6;
+	}
+	if (fifo->gyro) {
+		raw->raw_gyro_x = (int16_t)((frame[0] << 8) + (frame[1]));
+		raw->raw_gyro_y = (int16_t)((frame[2] << 8) + (frame[3]));
+		raw->raw_gyro_z = (int16_t)((frame[4] << 8) + (frame[5]));
+		frame += 6;
+	}
+	if (fifo->mag) {
+		raw->raw_mag_x = (int16_t)((frame[1] << 8) + (frame[0]));
+		raw->raw_mag_y = (int16_t)((frame[3] << 8) + (frame[2]));
+		raw->raw_mag_z = (int16_t)((frame[5] << 8) + (frame[4]));
+	}
+}
+
+esp_err_t
+icm20948_fifo_reset(icm20948_handle_t sensor)
+{
+	icm20948_dev_t *sens = (icm20948_dev_t *)sensor;
+	esp_err_t ret;
+	uint8_t tmp;
+
+	ret = icm20948_set_bank(sensor, 0);
+	if (ret != ESP_OK)
+		return ret;
+
+	tmp = 0x1F;
+	ret = icm20948_write(sensor, ICM20948_FIFO_RST, &tmp, 1);
+	if (ret != ESP_OK)
+		return ret;
+
+	tmp = 0x00;
+	ret = icm20948_write(sensor, ICM20948_FIFO_RST, &tmp, 1);
+	if (ret != ESP_OK)
+		return ret;
+
+	sens->fifo_next_timestamp = 0;
+	return ret;
+}
+
+esp_err_t
+icm20948_set_sample_rate_div(icm20948_handle_t sensor, uint8_t sample_rate_div)
+{
+	esp_err_t ret;
+	uint8_t tmp;
+
+	// Same output data rate for both sensors, aligned
+	ret = icm20948_set_bank(sensor, 2);
+	if (ret != ESP_OK)
+		return ret;
+
+	ret = icm20948_write(sensor, ICM20948_GYRO_SMPLRT_DIV, &sample_rate_div, 1);
+	if (ret != ESP_OK)
+		return ret;
+
+	tmp = 0x00;
+	ret = icm20948_write(sensor, ICM20948_ACCEL_SMPLRT_DIV_1, &tmp, 1);
+	if (ret != ESP_OK)
+		return ret;
+
+	ret = icm20948_write(sensor, ICM20948_ACCEL_SMPLRT_DIV_2, &sample_rate_div, 1);
+	if (ret != ESP_OK)
+		return ret;
+
+	tmp = 0x01;
+	ret = icm20948_write(sensor, ICM20948_ODR_ALIGN_EN, &tmp, 1);
+	return ret;
+}
+
+esp_err_t
+icm20948_fifo_enable(icm20948_handle_t sensor, const icm20948_fifo_config_t *config)
+{
+	icm20948_dev_t *sens = (icm20948_dev_t *)sensor;
+	esp_err_t ret;
+	uint8_t tmp;
+	uint8_t frame_size = (config->accel ? 6 : 0) + (config->gyro ? 6 : 0) + (config->mag ? ICM20948_MAG_DATA_LEN : 0);
+
+	if (frame_size == 0 || config->sample_rate_div > 0xFF)
+		return ESP_ERR_INVALID_ARG;
+
+	ret = icm20948_fifo_disable(sensor);
+	if (ret != ESP_OK)
+		return ret;
+
+	ret = icm20948_set_sample_rate_div(sensor, (uint8_t)config->sample_rate_div);
+	if (ret != ESP_OK)
+		return ret;
+
+	// Sources written into the FIFO
+	ret = icm20948_set_bank(sensor, 0);
+	if (ret != ESP_OK)
+		return ret;
+
+	tmp = config->mag ? ICM20948_FIFO_SLV_0_EN : 0x00;
+	ret = icm20948_write(sensor, ICM20948_FIFO_EN_1, &tmp, 1);
+	if (ret != ESP_OK)
+		return ret;
+
+	tmp = (config->accel ? ICM20948_FIFO_ACCEL_EN : 0x00) | (config->gyro ? ICM20948_FIFO_GYRO_EN : 0x00);
+	ret = icm20948_write(sensor, ICM20948_FIFO_EN_2, &tmp, 1);
+	if (ret != ESP_OK)
+		return ret;
+
+	// Snapshot mode: a full FIFO stops taking frames instead of overwriting the oldest bytes, so frames stay aligned
+	tmp = 0x1F;
+	ret = icm20948_write(sensor, ICM20948_FIFO_MODE, &tmp, 1);
+	if (ret != ESP_OK)
+		return ret;
+
+	ret = icm20948_fifo_reset(sensor);
+	if (ret != ESP_OK)
+		return ret;
+
+	ret = icm20948_read(sensor, ICM20948_USER_CTRL, &tmp, 1);
+	if (ret != ESP_OK)
+		return ret;
+	tmp |= ICM20948_USER_CTRL_FIFO_EN;
+	ret = icm20948_write(sensor, ICM20948_USER_CTRL, &tmp, 1);
+	if (ret != ESP_OK)
+		return ret;
+
+	sens->fifo = *config;
+	sens->fifo_frame_size = frame_size;
+	sens->fifo_period_us = (uint32_t)((1 + config->sample_rate_div) * 1000000ULL /
+	                                  (config->gyro ? ICM20948_GYRO_BASE_RATE : ICM20948_ACCE_BASE_RATE));
+	sens->fifo_overflows = 0;
+	return ret;
+}
+
+esp_err_t
+icm20948_fifo_disable(icm20948_handle_t sensor)
+{
+	icm20948_dev_t *sens = (icm20948_dev_t *)sensor;
+	esp_err_t ret;
+	uint8_t tmp;
+
+	ret = icm20948_set_bank(sensor, 0);
+	if (ret != ESP_OK)
+		return ret;
+
+	ret = icm20948_read(sensor, ICM20948_USER_CTRL, &tmp, 1);
+	if (ret != ESP_OK)
+		return ret;
+	tmp &= ~ICM20948_USER_CTRL_FIFO_EN;
+	ret = icm20948_write(sensor, ICM20948_USER_CTRL, &tmp, 1);
+	if (ret != ESP_OK)
+		return ret;
+
+	tmp = 0x00;
+	ret = icm20948_write(sensor, ICM20948_FIFO_EN_1, &tmp, 1);
+	if (ret != ESP_OK)
+		return ret;
+	ret = icm20948_write(sensor, ICM20948_FIFO_EN_2, &tmp, 1);
+	if (ret != ESP_OK)
+		return ret;
+
+	sens->fifo_frame_size = 0;
+	return icm20948_fifo_reset(sensor);
+}
+
+esp_err_t
+icm20948_fifo_get_count(icm20948_handle_t sensor, uint16_t *const count)
+{
+	uint8_t data_rd[2];
+	esp_err_t ret = icm20948_read(sensor, ICM20948_FIFO_COUNTH, data_rd, sizeof(data_rd));
+
+	*count = (uint16_t)(((data_rd[0] & 0x1F) << 8) + (data_rd[1]));
+	return ret;
+}
+
+esp_err_t
+icm20948_fifo_read(icm20948_handle_t sensor, icm20948_fifo_batch_t *const batch)
+{
+	icm20948_dev_t *sens = (icm20948_dev_t *)sensor;
+	uint8_t data_rd[ICM20948_FIFO_SIZE];
+	esp_err_t ret;
+	uint16_t count;
+	size_t frames, available, i;
+	int64_t now, first;
+
+	batch->count = 0;
+	batch->overflow = false;
+	if (sens->fifo_frame_size == 0)
+		return ESP_ERR_INVALID_STATE;
+
+	ret = icm20948_set_bank(sensor, 0);
+	if (ret != ESP_OK)
+		return ret;
+
+	ret = icm20948_fifo_get_count(sensor, &count);
+	if (ret != ESP_OK)
+		return ret;
+	now = esp_timer_get_time();
+
+	/* In snapshot mode a full FIFO has dropped the newer samples. The 13 bit count can read past the FIFO
+	   size after an overflow or a bus glitch, never read more than the FIFO holds into data_rd. */
+	batch->overflow = count >= ICM20948_FIFO_SIZE;
+	available = count / sens->fifo_frame_size;
+	if (available > ICM20948_FIFO_SIZE / sens->fifo_frame_size)
+		available = ICM20948_FIFO_SIZE / sens->fifo_frame_size;
+	frames = available < batch->capacity ? available : batch->capacity;
+
+	if (frames > 0) {
+		ret = icm20948_read(sensor, ICM20948_FIFO_R_W, data_rd, frames * sens->fifo_frame_size);
+		if (ret != ESP_OK)
+			return ret;
+		for (i = 0; i < frames; i++)
+			icm20948_parse_fifo_frame(&sens->fifo, data_rd + i * sens->fifo_frame_size, &batch->samples[i]);
+	}
+
+	/* The newest frame was sampled less than a period before the count was read. Frames continue the previous
+	   batch unless that drifted by more than a period from this estimate. */
+	first = now - (int64_t)(available > 0 ? available - 1 : 0) * sens->fifo_period_us;
+	if (sens->fifo_next_timestamp != 0 && llabs(sens->fifo_next_timestamp - first) < sens->fifo_period_us)
+		first = sens->fifo_next_timestamp;
+	batch->count = frames;
+	batch->timestamp_us = first;
+	batch->sample_period_us = sens->fifo_period_us;
+	sens->fifo_next_timestamp = first + (int64_t)frames * sens->fifo_period_us;
+
+	if (batch->overflow) {
+		/* Restart after the gap: frames not read and the partial frame are dropped, the next batch is re-timed */
+		sens->fifo_overflows++;
+		ret = icm20948_fifo_reset(sensor);
+	}
+	batch->overflows = sens->fifo_overflows;
+	return ret;
+}
+
+esp_err_t
+icm20948_config_interrupts(icm20948_handle_t sensor, const icm20948_int_config_t *const interrupt_configuration)
+{
+	icm20948_dev_t *sens = (icm20948_dev_t *)sensor;
+	esp_err_t ret;
+	uint8_t tmp;
+
+	if (interrupt_configuration == NULL || interrupt_configuration->interrupt_pin < 0)
+		return ESP_ERR_INVALID_ARG;
+	if (sens->isr_registered)
+		return ESP_ERR_INVALID_STATE;
+
+	ret = icm20948_set_bank(sensor, 0);
+	if (ret != ESP_OK)
+		return ret;
+
+	// Keep the bypass and FSYNC bits, replace the INT1 pin configuration
+	ret = icm20948_read(sensor, ICM20948_INT_PIN_CFG, &tmp, 1);
+	if (ret != ESP_OK)
+		return ret;
+	tmp &= ~(ICM20948_INT1_ACTL | ICM20948_INT1_OPEN | ICM20948_INT1_LATCH_EN | ICM20948_INT_ANYRD_2CLEAR);
+	if (interrupt_configuration->active_level == INTERRUPT_PIN_ACTIVE_LOW)
+		tmp |= ICM20948_INT1_ACTL;
+	if (interrupt_configuration->pin_mode == INTERRUPT_PIN_OPEN_DRAIN)
+		tmp |= ICM20948_INT1_OPEN;
+	if (interrupt_configuration->interrupt_latch == INTERRUPT_LATCH_UNTIL_CLEARED)
+		tmp |= ICM20948_INT1_LATCH_EN;
+	if (interrupt_configuration->interrupt_clear_behavior == INTERRUPT_CLEAR_ON_ANY_READ)
+		tmp |= ICM20948_INT_ANYRD_2CLEAR;
+	ret = icm20948_write(sensor, ICM20948_INT_PIN_CFG, &tmp, 1);
+	if (ret != ESP_OK)
+		return ret;
+
+	// Interrupt on the edge into the active level, an open drain INT pin needs the pull-up
+	gpio_config_t int_gpio_config = {
+		.pin_bit_mask = 1ULL << interrupt_configuration->interrupt_pin,
+		.mode = GPIO_MODE_INPUT,
+		.pull_up_en = interrupt_configuration->pin_mode == INTERRUPT_PIN_OPEN_DRAIN ? GPIO_PULLUP_ENABLE : GPIO_PULLUP_DISABLE,
+		.pull_down_en = GPIO_PULLDOWN_DISABLE,
+		.intr_type = interrupt_configuration->active_level == INTERRUPT_PIN_ACTIVE_LOW ? GPIO_INTR_NEGEDGE : GPIO_INTR_POSEDGE,
+	};
+	ret = gpio_config(&int_gpio_config);
+	if (ret != ESP_OK)
+		return ret;
+
+	sens->int_pin = interrupt_configuration->interrupt_pin;
+	return ret;
+}
+
+esp_err_t
+icm20948_register_isr(icm20948_handle_t sensor, const icm20948_isr_t isr, void *const isr_arg)
+{
+	icm20948_dev_t *sens = (icm20948_dev_t *)sensor;
+	esp_err_t ret;
+
+	if (isr == NULL)
+		return ESP_ERR_INVALID_ARG;
+	if (sens->int_pin == GPIO_NUM_NC || sens->isr_registered)
+		return ESP_ERR_INVALID_STATE;
+
+	// The service may already be installed by another driver
+	ret = gpio_install_isr_service(0);
+	if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE)
+		return ret;
+
+	ret = gpio_isr_handler_add(sens->int_pin, isr, isr_arg);
+	if (ret != ESP_OK)
+		return ret;
+
+	sens->isr_registered = true;
+	return ret;
+}
+
+static esp_err_t
+icm20948_update_interrupts(icm20948_handle_t sensor, uint8_t interrupt_sources, bool enable)
+{
+	esp_err_t ret;
+	uint8_t int_enable[4];
+	uint8_t mask[4] = {0, 0, 0, 0};
+
+	if (interrupt_sources & ~icm20948_ALL_INTERRUPTS)
+		return ESP_ERR_INVALID_ARG;
+
+	if (interrupt_sources & icm20948_I2C_MASTER_INT_BIT)
+		mask[0] |= ICM20948_I2C_MST_INT_EN;
+	if (interrupt_sources & icm20948_MOT_DETECT_INT_BIT)
+		mask[0] |= ICM20948_WOM_INT_EN;
+	if (interrupt_sources & icm20948_DATA_RDY_INT_BIT)
+		mask[1] |= ICM20948_RAW_DATA_0_RDY_EN;
+	if (interrupt_sources & icm20948_FIFO_OVERFLOW_INT_BIT)
+		mask[2] |= ICM20948_FIFO_OVERFLOW_EN;
+	if (interrupt_sources & icm20948_FIFO_WATERMARK_INT_BIT)
+		mask[3] |= ICM20948_FIFO_WM_EN;
+
+	ret = icm20948_set_bank(sensor, 0);
+	if (ret != ESP_OK)
+		return ret;
+
+	// INT_ENABLE to INT_ENABLE_3 are contiguous, one read and one write
+	ret = icm20948_read(sensor, ICM20948_INT_ENABLE, int_enable, sizeof(int_enable));
+	if (ret != ESP_OK)
+		return ret;
+	for (size_t i = 0; i < sizeof(int_enable); i++)
+		int_enable[i] = enable ? int_enable[i] | mask[i] : int_enable[i] & ~mask[i];
+
+	ret = icm20948_write(sensor, ICM20948_INT_ENABLE, int_enable, sizeof(int_enable));
+	return ret;
+}
+
+esp_err_t
+icm20948_enable_interrupts(icm20948_handle_t sensor, uint8_t interrupt_sources)
+{
+	return icm20948_update_interrupts(sensor, interrupt_sources, true);
+}
+
+esp_err_t
+icm20948_disable_interrupts(icm20948_handle_t sensor, uint8_t interrupt_sources)
+{
+	return icm20948_update_interrupts(sensor, interrupt_sources, false);
+}
+
+esp_err_t
+icm20948_get_interrupt_status(icm20948_handle_t sensor, uint8_t *const out_intr_status)
+{
+	esp_err_t ret;
+	uint8_t int_status[4];
+
+	ret = icm20948_set_bank(sensor, 0);
+	if (ret != ESP_OK)
+		return ret;
+
+	// Reading INT_STATUS to INT_STATUS_3 clears them
+	ret = icm20948_read(sensor, ICM20948_INT_STATUS, int_status, sizeof(int_status));
+	if (ret != ESP_OK)
+		return ret;
+
+	*out_intr_status = 0;
+	if (int_status[0] & ICM20948_I2C_MST_INT_EN)
+		*out_intr_status |= icm20948_I2C_MASTER_INT_BIT;
+	if (int_status[0] & ICM20948_WOM_INT_EN)
+		*out_intr_status |= icm20948_MOT_DETECT_INT_BIT;
+	if (int_status[1] & ICM20948_RAW_DATA_0_RDY_EN)
+		*out_intr_status |= icm20948_DATA_RDY_INT_BIT;
+	if (int_status[2] & ICM20948_FIFO_OVERFLOW_EN)
+		*out_intr_status |= icm20948_FIFO_OVERFLOW_INT_BIT;
+	if (int_status[3] & ICM20948_FIFO_WM_EN)
+		*out_intr_status |= icm20948_FIFO_WATERMARK_INT_BIT;
+	return ret;
+}
+
+static void
+icm20948_async_task(void *args)
+{
+	icm20948_dev_t *sens = (icm20948_dev_t *)args;
+	icm20948_async_t *async = sens->async;
+	icm20948_xfer_slot_t *slot;
+	uint8_t index;
+
+	// The task blocks here and in i2c_master_cmd_begin, the queuing task runs meanwhile
+	while (xQueueReceive(async->pending, &index, portMAX_DELAY) == pdTRUE && index != ICM20948_ASYNC_STOP) {
+		slot = &async->slots[index];
+		slot->ret = i2c_master_cmd_begin(sens->bus, slot->cmd, 1000 / portTICK_PERIOD_MS);
+		i2c_cmd_link_delete_static(slot->cmd);
+		// Counted by icm20948_collect_xfer, the stats are only updated from the task that uses the sensor
+		xSemaphoreGive(slot->done);
+	}
+
+	xSemaphoreGive(async->stopped);
+	vTaskDelete(NULL);
+}
+
+esp_err_t
+icm20948_async_start(icm20948_handle_t sensor, UBaseType_t priority, BaseType_t core_id)
+{
+	icm20948_dev_t *sens = (icm20948_dev_t *)sensor;
+	icm20948_async_t *async;
+
+	if (sens->async != NULL)
+		return ESP_ERR_INVALID_STATE;
+
+	// Everything the transactions need is allocated here once
+	async = (icm20948_async_t *)calloc(1, sizeof(icm20948_async_t));
+	if (async == NULL)
+		return ESP_ERR_NO_MEM;
+
+	async->free = xQueueCreateStatic(ICM20948_ASYNC_DEPTH, 1, async->free_storage, &async->free_buf);
+	async->pending = xQueueCreateStatic(ICM20948_ASYNC_DEPTH + 1, 1, async->pending_storage, &async->pending_buf);
+	async->stopped = xSemaphoreCreateBinaryStatic(&async->stopped_buf);
+	for (uint8_t i = 0; i < ICM20948_ASYNC_DEPTH; i++) {
+		async->slots[i].done = xSemaphoreCreateBinaryStatic(&async->slots[i].done_buf);
+		xQueueSend(async->free, &i, 0);
+	}
+
+	sens->async = async;
+	if (xTaskCreatePinnedToCore(icm20948_async_task, "icm20948 i2c", 2048, sens, priority, NULL, core_id) != pdPASS) {
+		sens->async = NULL;
+		free(async);
+		return ESP_ERR_NO_MEM;
+	}
+	return ESP_OK;
+}
+
+static esp_err_t
+icm20948_queue_xfer(icm20948_handle_t sensor, const uint8_t reg_start_addr, const uint8_t *const write_buf, uint8_t *read_buf,
+                    const size_t data_len, icm20948_xfer_t *const xfer)
+{
+	/* Builds the command link of a write (write_buf), or of a read into read_buf or into the slot when read_buf is NULL */
+	icm20948_dev_t *sens = (icm20948_dev_t *)sensor;
+	icm20948_xfer_slot_t *slot;
+	uint8_t index;
+
+	if (sens->async == NULL)
+		return ESP_ERR_INVALID_STATE;
+	if (data_len == 0 || (write_buf == NULL && read_buf == NULL && data_len > ICM20948_ALL_DATA_LEN))
+		return ESP_ERR_INVALID_ARG;
+
+	// Every slot pending: the caller collects one first
+	if (xQueueReceive(sens->async->free, &index, 0) != pdTRUE)
+		return ESP_ERR_NO_MEM;
+
+	slot = &sens->async->slots[index];
+	slot->read = write_buf == NULL;
+	slot->data_len = data_len;
+	if (slot->read)
+		slot->cmd = icm20948_read_cmd(sens, slot->cmd_buf, reg_start_addr, read_buf != NULL ? read_buf : slot->data, data_len);
+	else
+		slot->cmd = icm20948_write_cmd(sens, slot->cmd_buf, reg_start_addr, write_buf, data_len);
+
+	xQueueSend(sens->async->pending, &index, portMAX_DELAY);
+	*xfer = index;
+	return ESP_OK;
+}
+
+esp_err_t
+icm20948_read_async(icm20948_handle_t sensor, const uint8_t reg_start_addr, uint8_t *const data_buf, const size_t data_len,
+                    icm20948_xfer_t *const xfer)
+{
+	if (data_buf == NULL)
+		return ESP_ERR_INVALID_ARG;
+	return icm20948_queue_xfer(sensor, reg_start_addr, NULL, data_buf, data_len, xfer);
+}
+
+esp_err_t
+icm20948_write_async(icm20948_handle_t sensor, const uint8_t reg_start_addr, const uint8_t *const data_buf, const size_t data_len,
+                     icm20948_xfer_t *const xfer)
+{
+	if (data_buf == NULL)
+		return ESP_ERR_INVALID_ARG;
+	return icm20948_queue_xfer(sensor, reg_start_addr, data_buf, NULL, data_len, xfer);
+}
+
+static esp_err_t
+icm20948_collect_xfer(icm20948_handle_t sensor, const icm20948_xfer_t xfer, TickType_t ticks_to_wait,
+                      icm20948_sensor_data_t *const sensor_value)
+{
+	/* Waits for a queued transaction, decodes the burst of icm20948_get_all_async into sensor_value if not NULL */
+	icm20948_dev_t *sens = (icm20948_dev_t *)sensor;
+	icm20948_xfer_slot_t *slot;
+	esp_err_t ret;
+
+	if (sens->async == NULL || xfer >= ICM20948_ASYNC_DEPTH)
+		return ESP_ERR_INVALID_ARG;
+
+	// Still pending after ticks_to_wait: the slot stays queued, wait for it again later
+	slot = &sens->async->slots[xfer];
+	if (xSemaphoreTake(slot->done, ticks_to_wait) != pdTRUE)
+		return ESP_ERR_TIMEOUT;
+
+	ret = slot->ret;
+	icm20948_count_transaction(sens, ret, slot->read, slot->data_len);
+	if (ret == ESP_OK && sensor_value != NULL)
+		icm20948_parse_all(slot->data, slot->acce_sensitivity, slot->gyro_sensitivity, sensor_value);
+	xQueueSend(sens->async->free, &xfer, 0);
+	return ret;
+}
+
+esp_err_t
+icm20948_xfer_wait(icm20948_handle_t sensor, const icm20948_xfer_t xfer, TickType_t ticks_to_wait)
+{
+	return icm20948_collect_xfer(sensor, xfer, ticks_to_wait, NULL);
+}
+
+esp_err_t
+icm20948_get_all_async(icm20948_handle_t sensor, icm20948_xfer_t *const xfer)
+{
+	icm20948_dev_t *sens = (icm20948_dev_t *)sensor;
+	float acce_sensitivity;
+	float gyro_sensitivity;
+	esp_err_t ret;
+
+	// Configuration and bank come from the shadows, in the steady state only the burst goes on the bus
+	ret = icm20948_get_acce_sensitivity(sensor, &acce_sensitivity);
+	if (ret != ESP_OK)
+		return ret;
+
+	ret = icm20948_get_gyro_sensitivity(sensor, &gyro_sensitivity);
+	if (ret != ESP_OK)
+		return ret;
+
+	ret = icm20948_set_bank(sensor, 0);
+	if (ret != ESP_OK)
+		return ret;
+
+	ret = icm20948_queue_xfer(sensor, ICM20948_ACCEL_XOUT_H, NULL, NULL, ICM20948_ALL_DATA_LEN, xfer);
+	if (ret != ESP_OK)
+		return ret;
+
+	sens->async->slots[*xfer].acce_sensitivity = acce_sensitivity;
+	sens->async->slots[*xfer].gyro_sensitivity = gyro_sensitivity;
+	return ret;
+}
+
+esp_err_t
+icm20948_get_all_wait(icm20948_handle_t sensor, const icm20948_xfer_t xfer, icm20948_sensor_data_t *const sensor_value,
+                      TickType_t ticks_to_wait)
+{
+	if (sensor_value == NULL)
+		return ESP_ERR_INVALID_ARG;
+	return icm20948_collect_xfer(sensor, xfer, ticks_to_wait, sensor_value);
+}
@@ -72,6 +72,7 @@ extern const uint8_t icm20948_DATA_RDY_INT_BIT;      /*!< DATA READY interrupt b
 extern const uint8_t icm20948_I2C_MASTER_INT_BIT;    /*!< I2C MASTER interrupt bit               */
 extern const uint8_t icm20948_FIFO_OVERFLOW_INT_BIT; /*!< FIFO Overflow interrupt bit */
 extern const uint8_t icm20948_MOT_DETECT_INT_BIT;    /*!< MOTION DETECTION interrupt bit         */
+extern const uint8_t icm20948_FIFO_WATERMARK_INT_BIT; /*!< FIFO watermark interrupt bit */
 extern const uint8_t icm20948_ALL_INTERRUPTS;        /*!< All interrupts supported by icm20948    */
 
 typedef struct {
@@ -96,12 +97,43 @@ typedef struct {
 	float mag_x;
 	float mag_y;
 	float mag_z;
+	float temp;
 } icm20948_sensor_data_t;
 
 typedef struct {
 	float temp;
 } icm20948_temp_value_t;
 
+typedef struct {
+	uint32_t transactions;          /*!< I2C transactions (one command link each) */
+	uint32_t reads;                 /*!< Transactions that read registers */
+	uint32_t bytes_read;            /*!< Register bytes read */
+	uint32_t bytes_written;         /*!< Register bytes written, without the address and register bytes */
+	uint32_t bank_switches;         /*!< REG_BANK_SEL writes */
+	uint32_t bank_switches_skipped; /*!< icm20948_set_bank calls for the bank already selected */
+	uint32_t errors;                /*!< Transactions that failed */
+} icm20948_bus_stats_t;
+
+#define ICM20948_FIFO_SIZE 512 /*!< Bytes of the FIFO */
+
+typedef struct {
+	bool accel;               /*!< Write accelerometer samples into the FIFO */
+	bool gyro;                /*!< Write gyroscope samples into the FIFO */
+	bool mag;                 /*!< Write the magnetometer samples (EXT_SLV_SENS_DATA), needs icm20948_mag_init */
+	uint16_t sample_rate_div; /*!< 0 to 255, ODR = 1100 Hz / (1 + div) for the gyroscope, 1125 Hz / (1 + div) for the
+	                               accelerometer (DLPF enabled) */
+} icm20948_fifo_config_t;
+
+typedef struct {
+	icm20948_raw_sensor_data_t *samples; /*!< Caller's buffer of capacity samples, oldest first */
+	size_t capacity;                     /*!< Samples the buffer holds */
+	size_t count;                        /*!< Samples read */
+	int64_t timestamp_us;                /*!< esp_timer time of samples[0], sample i is at timestamp_us + i * sample_period_us */
+	uint32_t sample_period_us;           /*!< Time between two samples */
+	bool overflow;                       /*!< The FIFO filled up: samples were lost after the last one of this batch */
+	uint32_t overflows;                  /*!< Overflows since icm20948_fifo_enable */
+} icm20948_fifo_batch_t;
+
 typedef struct {
 	float roll;
 	float pitch;
@@ -111,6 +143,10 @@ typedef void *icm20948_handle_t;
 
 typedef gpio_isr_t icm20948_isr_t;
 
+#define ICM20948_ASYNC_DEPTH	4	/*!< Transactions that can be queued on one sensor */
+
+typedef uint8_t icm20948_xfer_t;	/*!< Queued transaction, collected with icm20948_xfer_wait or icm20948_get_all_wait */
+
 /**
  * @brief Create and init sensor object and return a sensor handle
  *
@@ -181,6 +217,9 @@ esp_err_t icm20948_reset(icm20948_handle_t sensor);
  * 1: Select USER BANK 1.
  * 2: Select USER BANK 2.
  * 3: Select USER BANK 3.
+ * The driver remembers the selected bank and skips the write when it is already selected.
+ * Reading and writing registers of the icm20948 through other software than this driver
+ * invalidates that state.
  *
  * @param sensor object handle of icm20948
  * @param bank   user bank number
@@ -191,6 +230,22 @@ esp_err_t icm20948_reset(icm20948_handle_t sensor);
  */
 esp_err_t icm20948_set_bank(icm20948_handle_t sensor, uint8_t bank);
 
+/**
+ * @brief Get the I2C traffic counters of the sensor
+ * Queued transactions are counted when they are collected, so the counters are only updated by the task using the sensor.
+ *
+ * @param sensor object handle of icm20948
+ * @param stats counters since icm20948_create or icm20948_reset_bus_stats
+ */
+void icm20948_get_bus_stats(icm20948_handle_t sensor, icm20948_bus_stats_t *const stats);
+
+/**
+ * @brief Clear the I2C traffic counters of the sensor
+ *
+ * @param sensor object handle of icm20948
+ */
+void icm20948_reset_bus_stats(icm20948_handle_t sensor);
+
 /**
  * @brief Set gyroscope full scale range
  *
@@ -204,7 +259,8 @@ esp_err_t icm20948_set_bank(icm20948_handle_t sensor, uint8_t bank);
 esp_err_t icm20948_set_gyro_fs(icm20948_handle_t sensor, icm20948_gyro_fs_t gyro_fs);
 
 /**
- * @brief Get gyroscope full scale range
+ * @brief Get gyroscope full scale range.
+ * GYRO_CONFIG_1 is read once, afterwards the value set through the driver is returned.
  *
  * @param sensor object handle of icm20948
  * @param gyro_fs gyroscope full scale range
@@ -264,7 +320,8 @@ esp_err_t icm20948_get_raw_gyro(icm20948_handle_t sensor, icm20948_raw_sensor_da
 esp_err_t icm20948_set_acce_fs(icm20948_handle_t sensor, icm20948_acce_fs_t acce_fs);
 
 /**
- * @brief Get accelerometer full scale range
+ * @brief Get accelerometer full scale range.
+ * ACCEL_CONFIG is read once, afterwards the value set through the driver is returned.
  *
  * @param sensor object handle of icm20948
  * @param gyro_fs gyroscope full scale range
@@ -353,4 +410,264 @@ esp_err_t icm20948_mag_init(icm20948_handle_t sensor);
 
 esp_err_t icm20948_get_raw_mag(icm20948_handle_t sensor, icm20948_raw_sensor_data_t *const raw_mag_value);
 
-#endif // !__ICM20948_H__
\ No newline at end of file
+/**
+ * @brief Read accelerometer, gyroscope, temperature and magnetometer measurements in one transaction
+ * The registers from ACCEL_XOUT_H to the magnetometer bytes in EXT_SLV_SENS_DATA are read
+ * in a single burst, so all of the values belong to the same sample.
+ * The magnetometer fields need icm20948_mag_init.
+ *
+ * @param sensor object handle of icm20948
+ * @param sensor_value accelerometer (g), gyroscope (dps), temperature (degrees C) and magnetometer (uT) measurements
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_FAIL Fail
+ */
+esp_err_t icm20948_get_all(icm20948_handle_t sensor, icm20948_sensor_data_t *const sensor_value);
+
+/**
+ * @brief Stream samples into the FIFO.
+ * Sets the sample rate divider of both sensors, selects the sources and resets the FIFO.
+ * The FIFO runs in snapshot mode: when it is full, new samples are dropped
+ * and icm20948_fifo_read reports an overflow.
+ *
+ * @param sensor object handle of icm20948
+ * @param config sources and sample rate
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_ARG No source or divider above 255
+ *     - ESP_FAIL Fail
+ */
+esp_err_t icm20948_fifo_enable(icm20948_handle_t sensor, const icm20948_fifo_config_t *config);
+
+/**
+ * @brief Stop streaming samples into the FIFO and empty it
+ *
+ * @param sensor object handle of icm20948
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_FAIL Fail
+ */
+esp_err_t icm20948_fifo_disable(icm20948_handle_t sensor);
+
+/**
+ * @brief Empty the FIFO
+ *
+ * @param sensor object handle of icm20948
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_FAIL Fail
+ */
+esp_err_t icm20948_fifo_reset(icm20948_handle_t sensor);
+
+/**
+ * @brief Read the number of bytes in the FIFO (bank 0 must be selected)
+ *
+ * @param sensor object handle of icm20948
+ * @param count bytes in the FIFO
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_FAIL Fail
+ */
+esp_err_t icm20948_fifo_get_count(icm20948_handle_t sensor, uint16_t *const count);
+
+/**
+ * @brief Drain the FIFO into a batch of raw samples.
+ * Reads the FIFO count, then up to batch->capacity complete frames in one burst read.
+ * At the full rate drain at least every ICM20948_FIFO_SIZE / frame size samples (25 with accel, gyro and mag).
+ * The samples are timed from the time of the read and the sample period.
+ * On overflow the batch holds the samples before the gap and the FIFO is reset.
+ *
+ * @param sensor object handle of icm20948
+ * @param batch samples and capacity set by the caller, the other fields are filled in
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_STATE The FIFO is not enabled
+ *     - ESP_FAIL Fail
+ */
+esp_err_t icm20948_fifo_read(icm20948_handle_t sensor, icm20948_fifo_batch_t *const batch);
+
+/**
+ * @brief Set the output data rate of the accelerometer and gyroscope to their internal rate / (1 + sample_rate_div).
+ * The data ready interrupt follows this rate. The divider only applies with the DLPF enabled (icm20948_enable_dlpf).
+ *
+ * @param sensor object handle of icm20948
+ * @param sample_rate_div sample rate divider of both sensors
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_FAIL Fail
+ */
+esp_err_t icm20948_set_sample_rate_div(icm20948_handle_t sensor, uint8_t sample_rate_div);
+
+/**
+ * @brief Configure the INT pin of the icm20948 and the GPIO it is connected to.
+ * The GPIO interrupts on the edge into the active level.
+ *
+ * @param sensor object handle of icm20948
+ * @param interrupt_configuration INT pin configuration
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_ARG No interrupt pin
+ *     - ESP_ERR_INVALID_STATE An ISR is already registered
+ *     - ESP_FAIL Fail
+ */
+esp_err_t icm20948_config_interrupts(icm20948_handle_t sensor, const icm20948_int_config_t *const interrupt_configuration);
+
+/**
+ * @brief Attach an ISR to the interrupt pin set by icm20948_config_interrupts.
+ * Installs the GPIO ISR service if needed. The ISR runs in interrupt context: it must not use
+ * the I2C bus, only wake the task that reads the sensor. icm20948_delete detaches it.
+ *
+ * @param sensor object handle of icm20948
+ * @param isr ISR called on every interrupt
+ * @param isr_arg argument of the ISR
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_STATE No interrupt pin configured, or an ISR is already registered
+ *     - ESP_FAIL Fail
+ */
+esp_err_t icm20948_register_isr(icm20948_handle_t sensor, const icm20948_isr_t isr, void *const isr_arg);
+
+/**
+ * @brief Enable interrupt sources
+ *
+ * @param sensor object handle of icm20948
+ * @param interrupt_sources icm20948_*_INT_BIT values or'ed together
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_ARG Unknown source
+ *     - ESP_FAIL Fail
+ */
+esp_err_t icm20948_enable_interrupts(icm20948_handle_t sensor, uint8_t interrupt_sources);
+
+/**
+ * @brief Disable interrupt sources
+ *
+ * @param sensor object handle of icm20948
+ * @param interrupt_sources icm20948_*_INT_BIT values or'ed together
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_ARG Unknown source
+ *     - ESP_FAIL Fail
+ */
+esp_err_t icm20948_disable_interrupts(icm20948_handle_t sensor, uint8_t interrupt_sources);
+
+/**
+ * @brief Read and clear the interrupt status
+ *
+ * @param sensor object handle of icm20948
+ * @param out_intr_status icm20948_*_INT_BIT values of the pending interrupts
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_FAIL Fail
+ */
+esp_err_t icm20948_get_interrupt_status(icm20948_handle_t sensor, uint8_t *const out_intr_status);
+
+/**
+ * @brief Start the transaction task of the sensor.
+ * Queued transactions run in this task: the queuing task keeps running while the bus is busy and
+ * collects the result later. The command links, queues and semaphores of ICM20948_ASYNC_DEPTH
+ * transactions are allocated here once, queuing a transaction does not allocate.
+ * Collect every queued transaction before calling a function that switches the register bank.
+ *
+ * @param sensor object handle of icm20948
+ * @param priority priority of the transaction task, above the tasks queuing transactions
+ * @param core_id core of the transaction task, or tskNO_AFFINITY
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_STATE Already started
+ *     - ESP_ERR_NO_MEM Fail
+ */
+esp_err_t icm20948_async_start(icm20948_handle_t sensor, UBaseType_t priority, BaseType_t core_id);
+
+/**
+ * @brief Queue a read of registers of the selected bank
+ *
+ * @param sensor object handle of icm20948
+ * @param reg_start_addr first register
+ * @param data_buf buffer of data_len bytes, filled in when the transaction is done
+ * @param data_len bytes to read
+ * @param xfer queued transaction
+ *
+ * @return
+ *     - ESP_OK Queued
+ *     - ESP_ERR_INVALID_STATE icm20948_async_start was not called
+ *     - ESP_ERR_NO_MEM ICM20948_ASYNC_DEPTH transactions are already queued
+ */
+esp_err_t icm20948_read_async(icm20948_handle_t sensor, const uint8_t reg_start_addr, uint8_t *const data_buf, const size_t data_len,
+                              icm20948_xfer_t *const xfer);
+
+/**
+ * @brief Queue a write of registers of the selected bank
+ *
+ * @param sensor object handle of icm20948
+ * @param reg_start_addr first register
+ * @param data_buf data_len bytes, read by the transaction task: keep them until the transaction is collected
+ * @param data_len bytes to write
+ * @param xfer queued transaction
+ *
+ * @return
+ *     - ESP_OK Queued
+ *     - ESP_ERR_INVALID_STATE icm20948_async_start was not called
+ *     - ESP_ERR_NO_MEM ICM20948_ASYNC_DEPTH transactions are already queued
+ */
+esp_err_t icm20948_write_async(icm20948_handle_t sensor, const uint8_t reg_start_addr, const uint8_t *const data_buf, const size_t data_len,
+                               icm20948_xfer_t *const xfer);
+
+/**
+ * @brief Wait for a queued transaction and release it
+ *
+ * @param sensor object handle of icm20948
+ * @param xfer transaction of icm20948_read_async or icm20948_write_async
+ * @param ticks_to_wait longest wait
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_TIMEOUT Still pending, wait for it again
+ *     - ESP_FAIL Fail, the result of the transaction
+ */
+esp_err_t icm20948_xfer_wait(icm20948_handle_t sensor, const icm20948_xfer_t xfer, TickType_t ticks_to_wait);
+
+/**
+ * @brief Queue the burst read of icm20948_get_all (selects bank 0 first)
+ *
+ * @param sensor object handle of icm20948
+ * @param xfer queued transaction, collected with icm20948_get_all_wait
+ *
+ * @return
+ *     - ESP_OK Queued
+ *     - ESP_ERR_INVALID_STATE icm20948_async_start was not called
+ *     - ESP_ERR_NO_MEM ICM20948_ASYNC_DEPTH transactions are already queued
+ *     - ESP_FAIL Fail
+ */
+esp_err_t icm20948_get_all_async(icm20948_handle_t sensor, icm20948_xfer_t *const xfer);
+
+/**
+ * @brief Wait for a transaction of icm20948_get_all_async and decode it as icm20948_get_all does
+ *
+ * @param sensor object handle of icm20948
+ * @param xfer transaction of icm20948_get_all_async
+ * @param sensor_value accelerometer (g), gyroscope (dps), temperature (degrees C) and magnetometer (uT) measurements
+ * @param ticks_to_wait longest wait
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_TIMEOUT Still pending, wait for it again
+ *     - ESP_FAIL Fail
+ */
+esp_err_t icm20948_get_all_wait(icm20948_handle_t sensor, const icm20948_xfer_t xfer, icm20948_sensor_data_t *const sensor_value,
+                                TickType_t ticks_to_wait);
+
+#endif // !__ICM20948_H__
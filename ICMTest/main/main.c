@@ -2,6 +2,7 @@
 #include <math.h>
 
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "driver/i2c.h"
 #include "icm20948.h"
 
@@ -10,9 +11,27 @@
 #define I2C_MASTER_NUM     	I2C_NUM_0 			/*!< I2C port number for master dev */
 #define I2C_MASTER_FREQ_HZ 	400000    			/*!< I2C master clock frequency */
 #define PI 3.14159265358979323846
+#define BUS_CHECK_SAMPLES	100					/*!< Samples of the steady state bus traffic check */
+#define ICM_INT_IO			36					/*!< gpio number for the ICM20948 INT pin */
+#define ICM_SAMPLE_RATE_DIV	10					/*!< Data ready at 1100 Hz / (1 + 10) = 100 Hz */
+#define ICM_INT_TIMEOUT_MS	100					/*!< Report a missing data ready interrupt after 10 periods */
+#define STATS_SAMPLES		500					/*!< Samples per orientation and timing report */
+#define ICM_I2C_TASK_PRIORITY	16				/*!< Above icm_read_task, so transactions complete promptly */
 
 static const char *TAG = "icm test";
 static icm20948_handle_t icm20948 = NULL; // Accel and gyro object
+static TaskHandle_t icm_task = NULL; // Woken by the data ready interrupt
+static volatile int64_t icm_int_time = 0; // esp_timer time of the last data ready interrupt
+
+static void IRAM_ATTR
+icm20948_isr(void *arg)
+{
+	BaseType_t woken = pdFALSE;
+
+	icm_int_time = esp_timer_get_time();
+	vTaskNotifyGiveFromISR(icm_task, &woken);
+	portYIELD_FROM_ISR(woken);
+}
 
 static esp_err_t
 i2c_bus_init(void)
@@ -79,9 +98,78 @@ icm20948_configure(icm20948_acce_fs_t acce_fs, icm20948_gyro_fs_t gyro_fs)
 	if (ret != ESP_OK)
 		return ESP_FAIL;
 
+	// The sample rate divider needs the DLPF, it sets the data ready rate
+	ret = icm20948_enable_dlpf(icm20948, true);
+	if (ret != ESP_OK)
+		return ESP_FAIL;
+
+	ret = icm20948_set_sample_rate_div(icm20948, ICM_SAMPLE_RATE_DIV);
+	if (ret != ESP_OK)
+		return ESP_FAIL;
+
+	icm20948_int_config_t int_config = {
+		.interrupt_pin = ICM_INT_IO,
+		.active_level = INTERRUPT_PIN_ACTIVE_HIGH,
+		.pin_mode = INTERRUPT_PIN_PUSH_PULL,
+		.interrupt_latch = INTERRUPT_LATCH_50US,
+		.interrupt_clear_behavior = INTERRUPT_CLEAR_ON_ANY_READ,
+	};
+	ret = icm20948_config_interrupts(icm20948, &int_config);
+	if (ret != ESP_OK)
+		return ESP_FAIL;
+
 	return ret;
 }
 
+static esp_err_t
+icm20948_check_bus_traffic(void)
+{
+	/* Once configured, each accel, gyro or mag read must be a single burst read: no bank switch, no config read */
+	icm20948_sensor_data_t sensorData;
+	icm20948_raw_sensor_data_t rawSensorData;
+	icm20948_bus_stats_t stats;
+	esp_err_t ret;
+
+	ret = icm20948_get_acce(icm20948, &sensorData);
+	if (ret != ESP_OK)
+		return ret;
+
+	icm20948_reset_bus_stats(icm20948);
+	for (int i = 0; i < BUS_CHECK_SAMPLES && ret == ESP_OK; i++) {
+		ret = icm20948_get_acce(icm20948, &sensorData);
+		if (ret == ESP_OK)
+			ret = icm20948_get_gyro(icm20948, &sensorData);
+		if (ret == ESP_OK)
+			ret = icm20948_get_raw_mag(icm20948, &rawSensorData);
+	}
+	if (ret != ESP_OK)
+		return ret;
+
+	icm20948_get_bus_stats(icm20948, &stats);
+	ESP_LOGI(TAG, "%d accel, gyro and mag reads: %lu transactions, %lu bank switches, %lu bytes",
+	         3 * BUS_CHECK_SAMPLES, (unsigned long)stats.transactions, (unsigned long)stats.bank_switches,
+	         (unsigned long)stats.bytes_read);
+	if (stats.transactions != 3 * BUS_CHECK_SAMPLES || stats.reads != stats.transactions) {
+		ESP_LOGE(TAG, "Expected one burst read per sample");
+		return ESP_FAIL;
+	}
+
+	icm20948_reset_bus_stats(icm20948);
+	for (int i = 0; i < BUS_CHECK_SAMPLES && ret == ESP_OK; i++)
+		ret = icm20948_get_all(icm20948, &sensorData);
+	if (ret != ESP_OK)
+		return ret;
+
+	icm20948_get_bus_stats(icm20948, &stats);
+	ESP_LOGI(TAG, "%d combined reads: %lu transactions, %lu bytes", BUS_CHECK_SAMPLES,
+	         (unsigned long)stats.transactions, (unsigned long)stats.bytes_read);
+	if (stats.transactions != BUS_CHECK_SAMPLES) {
+		ESP_LOGE(TAG, "Expected one transaction per combined read");
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
 void
 icm_read_task(void *args)
 {
@@ -92,23 +180,63 @@ icm_read_task(void *args)
 	}
 	ESP_LOGI(TAG, "ICM20948 configuration successfull!");
 
+	ret = icm20948_check_bus_traffic();
+	if (ret != ESP_OK)
+		ESP_LOGE(TAG, "ICM20948 bus traffic check failed");
+
+	// Sleep until the sensor has a new sample instead of polling the bus, and while the bus reads it
+	icm_task = xTaskGetCurrentTaskHandle();
+	ret = icm20948_async_start(icm20948, ICM_I2C_TASK_PRIORITY, tskNO_AFFINITY);
+	if (ret == ESP_OK)
+		ret = icm20948_register_isr(icm20948, icm20948_isr, NULL);
+	if (ret == ESP_OK)
+		ret = icm20948_enable_interrupts(icm20948, icm20948_DATA_RDY_INT_BIT);
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "ICM20948 interrupt setup failure");
+		vTaskDelete(NULL);
+	}
+
 	icm20948_sensor_data_t sensorData;
-	icm20948_raw_sensor_data_t rawSensorData;
-	int count = 0;
+	icm20948_xfer_t xfer;
+	bool have_sample = false;
+	uint32_t samples = 0;
+	uint32_t missed = 0;
+	int64_t last_int_time = 0;
+	int64_t period_min = INT64_MAX;
+	int64_t period_max = 0;
+	int64_t latency_max = 0;
+	int64_t busy_us = 0;
+	int64_t window_start = esp_timer_get_time();
+	float elevation = 0;
+	float azimuthY = 0;
+
         while(1){
-			
-            ret = icm20948_get_acce(icm20948, &sensorData);
-            float elevation = -1*atan(sensorData.acce_z/sqrt(pow(sensorData.acce_x, 2) + pow(sensorData.acce_y,2)))*180/PI+90;
-            /*if(ret == ESP_OK){
-                //ESP_LOGI(TAG, "ax: %lf ay: %lf az: %lf", sensorData.acce_x, sensorData.acce_y, sensorData.acce_z);
-                ESP_LOGI(TAG, "Elevation: %lf degrees", elevation);
-            }*/
-
-			/*
-			ret = icm20948_get_gyro(icm20948, &sensorData);
-			if (ret == ESP_OK)
-				ESP_LOGI(TAG, "gx: %lf gy: %lf gz: %lf", sensorData.gyro_x, sensorData.gyro_y, sensorData.gyro_z);
-			*/
+			uint32_t pending = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ICM_INT_TIMEOUT_MS));
+			int64_t wake_time = esp_timer_get_time();
+			if (pending == 0) {
+				ESP_LOGW(TAG, "No data ready interrupt for %d ms", ICM_INT_TIMEOUT_MS);
+				last_int_time = 0;
+				continue;
+			}
+
+			// More than one notification: samples were overwritten before this task ran
+			missed += pending - 1;
+			int64_t int_time = icm_int_time;
+			if (last_int_time != 0) {
+				int64_t period = int_time - last_int_time;
+				period_min = period < period_min ? period : period_min;
+				period_max = period > period_max ? period : period_max;
+			}
+			latency_max = wake_time - int_time > latency_max ? wake_time - int_time : latency_max;
+			last_int_time = int_time;
+
+			// One burst for accel, gyro, temp and mag, so the azimuth combines values of the same sample.
+			// It is queued: the previous sample is processed while the bus reads this one.
+			ret = icm20948_get_all_async(icm20948, &xfer);
+			if (ret != ESP_OK) {
+				ESP_LOGE(TAG, "ICM20948 read queue failure: %s", esp_err_to_name(ret));
+				continue;
+			}
 
 /*
 	Need to eventually incorporate this into the icm20948.c file as a 
@@ -117,50 +245,44 @@ icm_read_task(void *args)
 
 
 */ 
-			//ret = icm20948_get_acce(icm20948, &sensorData);
-			ret = icm20948_get_raw_mag(icm20948, &rawSensorData);
-			float Gx = sensorData.acce_x;
-			float Gy = sensorData.acce_y;
-			float Gz = sensorData.acce_z;
-			float Hx = (float) rawSensorData.raw_mag_x*4192/32752;
-			float Hy = (float) rawSensorData.raw_mag_y*4192/32752;
-			float Hz = (float) rawSensorData.raw_mag_z*4192/32752;
-			float dataStorage[10] = {0,0,0,0,0,0,0,0,0,0};
-			float averageAzimuth;
-
-			float magA = sqrt( pow((-1*Gy*Hz + Gz*Hy),2) + pow((Gz*Hx + Gx*Hz),2) + pow((-1*Gx*Hy - Gy*Hx),2));
-			float magBx = sqrt(Gy*Gy + Gz*Gz);
-			float magBy = sqrt(Gx*Gx + Gz*Gz);
-			float magBz = sqrt(Gx*Gx + Gy*Gy);
-
-			float AdotBx = Gx*(Gy*Hy + Gz*Hz) + Hx*(Gy*Gy + Gz*Gz);
-			float AdotBy = Gy*(Gz*Hz - Gx*Hx) - Hy*(Gz*Gz + Gx*Gx);
-			float AdotBz = Gz*(Gy*Hy - Gx*Hx) - Hz*(Gx*Gx + Gy*Gy);
-
-			// These azimuth will change based on how the sensor is orientated
-			float azimuthX = acos(AdotBx /  (magA * magBx))*180/PI;
-			float azimuthY = acos(AdotBy /  (magA * magBy))*180/PI;
-			float azimuthZ = acos(AdotBz /  (magA * magBz))*180/PI;
-
-			if (ret == ESP_OK){
-				//ESP_LOGI(TAG, "mx: %lf my: %lf mz: %lf uT", Hx, Hy, Hz);
-				
-				//ESP_LOGI(TAG, "AzimuthX: %lf AzimuthY: %lf AzimuthZ: %lf", azimuthX, azimuthY, azimuthZ);
-				//ESP_LOGI(TAG, "AzimuthX: %lf degrees", azimuthX);
-				//ESP_LOGI(TAG, "AzimuthY: %lf degrees", azimuthY);
-				//ESP_LOGI(TAG, "AzimuthZ: %lf degrees", azimuthZ);
-				
-				if(count == 500){
-					ESP_LOGI(TAG, "Azimuth: %lf degrees", azimuthY);
-					ESP_LOGI(TAG, "Elevation: %lf degrees\n", elevation);
-					count = 0;
-				}
-				
+			if (have_sample){
+				float Gx = sensorData.acce_x;
+				float Gy = sensorData.acce_y;
+				float Gz = sensorData.acce_z;
+				float Hx = sensorData.mag_x;
+				float Hy = sensorData.mag_y;
+				float Hz = sensorData.mag_z;
+
+				elevation = -1*atan(Gz/sqrt(pow(Gx, 2) + pow(Gy,2)))*180/PI+90;
+
+				float magA = sqrt( pow((-1*Gy*Hz + Gz*Hy),2) + pow((Gz*Hx + Gx*Hz),2) + pow((-1*Gx*Hy - Gy*Hx),2));
+				float magBy = sqrt(Gx*Gx + Gz*Gz);
+				float AdotBy = Gy*(Gz*Hz - Gx*Hx) - Hy*(Gz*Gz + Gx*Gx);
+
+				// This azimuth will change based on how the sensor is orientated
+				azimuthY = acos(AdotBy /  (magA * magBy))*180/PI;
 			}
 
-			count = count + 1;
+			// Time blocked here is not CPU time of this task
+			busy_us += esp_timer_get_time() - wake_time;
+			ret = icm20948_get_all_wait(icm20948, xfer, &sensorData, portMAX_DELAY);
+			have_sample = ret == ESP_OK;
+			samples = samples + 1;
 
-            //vTaskDelay(1 / portTICK_PERIOD_MS);
+			if(samples == STATS_SAMPLES){
+				int64_t window = esp_timer_get_time() - window_start;
+				ESP_LOGI(TAG, "Azimuth: %lf degrees", azimuthY);
+				ESP_LOGI(TAG, "Elevation: %lf degrees", elevation);
+				ESP_LOGI(TAG, "Period: %lld..%lld us, wake up latency <= %lld us, %lu missed, task CPU %.1f%%\n",
+				         (long long)period_min, (long long)period_max, (long long)latency_max, (unsigned long)missed, 100.0 * busy_us / window);
+				samples = 0;
+				missed = 0;
+				period_min = INT64_MAX;
+				period_max = 0;
+				latency_max = 0;
+				busy_us = 0;
+				window_start = esp_timer_get_time();
+			}
         }
 
 	vTaskDelete(NULL);
@@ -0,0 +1,1032 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+
+#include "GeomagnetismHeader.h"
+#include "GeomagGridLib.h"
+#include "GeomagFileLib.h"
+#include "GeomagGeoidLib.h"
+
+/*
+WMM benchmark program.
+
+Times the Geomagnetism Library evaluation paths on a deterministic set of pseudo random
+points and prints the throughput of each. The program expects WMM.COF to be in the
+current directory, or the coefficient file to be given as the third argument. The results
+of the faster paths are not checked here; every program checks the paths it uses:
+wmm_float_audit (MAG_GeomagBatch), wmm_embed -c (MAG_GeomagFixed and the embedded model),
+wmm_file c (MAG_FileStream), wmm_grid -c (the grid engine, the analytic gradient and the
+linear in time paths), wmm_geoid (the geoid store) and wmm_point -c (the allocations of the
+evaluation context and MAG_GeomagTrajectory).
+
+Usage: wmm_bench [all|batch|grid|fixed|file|gradient|geoid|series|raster|elements|trajectory] [points] [coefficient file]
+
+Benchmarks:
+    batch   MAG_Geomag, MAG_Geomag_ctx, MAG_Geomag_ctx with a timed model cache and
+            MAG_GeomagBatch over the same points.
+    grid    MAG_GridEvaluate on a global grid with about the given number of cells: the per
+            cell evaluation on one thread, then the separable evaluation with 1, 2, 4, ...
+            worker threads up to the number of online processors (at least 4).
+    fixed   MAG_GeomagFixed against MAG_Geomag_ctx, for degree 12 models.
+    file    MAG_FileStream against the line by line loop of wmm_file (fgets, sscanf, atof,
+            MAG_Geomag and fprintf per row) on a generated coordinate file with the given
+            number of lines, with 1, 2, 4, ... evaluation threads up to the number of online
+            processors (at least 4).
+    gradient  MAG_GradientAnalytic against the central differences of MAG_Gradient.
+    geoid   MAG_ConvertGeoidToEllipsoidHeight with the flat geoid array against the paged geoid
+            store of GeomagGeoidLib, for locations spread over the globe and for a track of nearby
+            fixes, with several cache sizes. Needs BENCH_GEOID_FILE (written by wmm_geoid) in the
+            current directory, otherwise it is skipped.
+    series  MAG_SiteTimeSeries against MAG_Geomag_ctx with a time adjusted model per date, for
+            BENCH_SERIES_DATES monthly dates at about points / BENCH_SERIES_DATES sites. Then
+            MAG_GridEvaluate with and without LinearTime on a grid with a time axis, for several
+            elements.
+    raster  MAG_GridEvaluate with text, float32 raster and multi-band raster output on a global
+            grid with about the given number of cells.
+    elements  MAG_GridEvaluateElements with BenchMultiElements (declination, inclination, total
+            intensity and grid variation with uncertainties) written to one file each, against a
+            MAG_GridEvaluate run per element.
+    trajectory  MAG_GeomagTrajectory against MAG_TimelyModifyMagneticModel and MAG_Geomag_ctx per fix,
+            on a synthetic 100 Hz vehicle track of the given number of fixes, with and without
+            the reuse of the Legendre functions.
+ */
+
+#define BENCH_DEFAULT_POINTS 200000
+#define BENCH_NUM_DATES 4
+#define BENCH_FILE_LINE 100 /* Line buffer of wmm_file */
+#define BENCH_GEOID_FILE "EGM9615.GST"
+#define BENCH_GEOID_STEP 0.02 /* Largest latitude / longitude change between two fixes of the track (degrees) */
+#define BENCH_SERIES_DATES 60 /* Monthly dates of each site of the series benchmark */
+#define BENCH_RASTER_ELEMENT 3 /* F, the element with the largest values */
+#define BENCH_MULTI_ELEMENTS 4
+#define BENCH_TRAJECTORY_RATE 100.0 /* Fixes per second */
+#define BENCH_TRAJECTORY_SPEED 25.0 /* m/s */
+
+static double bench_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + 1e-9 * (double) ts.tv_nsec;
+}
+
+static double bench_uniform(unsigned long *state, double min, double max)
+/* Small linear congruential generator so the point set is the same on every platform */
+{
+    *state = *state * 6364136223846793005UL + 1442695040888963407UL;
+    return min + (max - min) * (double) ((*state >> 11) & 0xFFFFFFFFFFFFFUL) / (double) 0xFFFFFFFFFFFFFUL;
+}
+
+static int bench_batch(MAGtype_MagneticModel *MagneticModel, MAGtype_Ellipsoid Ellip, int NumPoints)
+{
+    MAGtype_MagneticModel *TimedMagneticModel;
+    MAGtype_TimedModelCache *TimedModels;
+    MAGtype_EvalContext *Context;
+    MAGtype_CoordGeodetic CoordGeodetic;
+    MAGtype_CoordSpherical CoordSpherical;
+    MAGtype_Date UserDate;
+    MAGtype_GeoMagneticElements *Results;
+    double *Latitude, *Longitude, *Height, *DecimalYear, t0, tGeomag, tCtx, tCache, tBatch;
+    unsigned long state = 20250101UL;
+    int i;
+
+    Latitude = (double *) malloc(NumPoints * sizeof (double));
+    Longitude = (double *) malloc(NumPoints * sizeof (double));
+    Height = (double *) malloc(NumPoints * sizeof (double));
+    DecimalYear = (double *) malloc(NumPoints * sizeof (double));
+    Results = (MAGtype_GeoMagneticElements *) malloc(NumPoints * sizeof (MAGtype_GeoMagneticElements));
+    TimedMagneticModel = MAG_AllocateModelMemory((MagneticModel->nMax + 1) * (MagneticModel->nMax + 2) / 2);
+    TimedModels = MAG_AllocateTimedModelCache(BENCH_NUM_DATES, MagneticModel->nMax);
+    Context = MAG_AllocateEvalContext(MagneticModel->nMax);
+    if(!Latitude || !Longitude || !Height || !DecimalYear || !Results || !TimedMagneticModel || !TimedModels || !Context)
+    {
+        printf("Error allocating benchmark memory\n");
+        return FALSE;
+    }
+
+    /* Survey style input: many sites, a handful of dates, dates arriving interleaved */
+    for(i = 0; i < NumPoints; i++)
+    {
+        Latitude[i] = bench_uniform(&state, -89.0, 89.0);
+        Longitude[i] = bench_uniform(&state, -180.0, 180.0);
+        Height[i] = bench_uniform(&state, 0.0, 10.0);
+        DecimalYear[i] = MagneticModel->epoch + 0.5 * (double) (i % BENCH_NUM_DATES);
+    }
+    CoordGeodetic.UseGeoid = 0;
+
+    t0 = bench_seconds();
+    for(i = 0; i < NumPoints; i++)
+    {
+        CoordGeodetic.phi = Latitude[i];
+        CoordGeodetic.lambda = Longitude[i];
+        CoordGeodetic.HeightAboveEllipsoid = Height[i];
+        CoordGeodetic.HeightAboveGeoid = Height[i];
+        UserDate.DecimalYear = DecimalYear[i];
+        MAG_TimelyModifyMagneticModel(UserDate, MagneticModel, TimedMagneticModel);
+        MAG_GeodeticToSpherical(Ellip, CoordGeodetic, &CoordSpherical);
+        MAG_Geomag(Ellip, CoordSpherical, CoordGeodetic, TimedMagneticModel, &Results[i]);
+    }
+    tGeomag = bench_seconds() - t0;
+
+    t0 = bench_seconds();
+    for(i = 0; i < NumPoints; i++)
+    {
+        CoordGeodetic.phi = Latitude[i];
+        CoordGeodetic.lambda = Longitude[i];
+        CoordGeodetic.HeightAboveEllipsoid = Height[i];
+        CoordGeodetic.HeightAboveGeoid = Height[i];
+        UserDate.DecimalYear = DecimalYear[i];
+        MAG_TimelyModifyMagneticModel(UserDate, MagneticModel, TimedMagneticModel);
+        MAG_GeodeticToSpherical(Ellip, CoordGeodetic, &CoordSpherical);
+        MAG_Geomag_ctx(Context, Ellip, CoordSpherical, CoordGeodetic, TimedMagneticModel, &Results[i]);
+    }
+    tCtx = bench_seconds() - t0;
+
+    t0 = bench_seconds();
+    for(i = 0; i < NumPoints; i++)
+    {
+        CoordGeodetic.phi = Latitude[i];
+        CoordGeodetic.lambda = Longitude[i];
+        CoordGeodetic.HeightAboveEllipsoid = Height[i];
+        CoordGeodetic.HeightAboveGeoid = Height[i];
+        UserDate.DecimalYear = DecimalYear[i];
+        MAG_GeodeticToSpherical(Ellip, CoordGeodetic, &CoordSpherical);
+        MAG_Geomag_ctx(Context, Ellip, CoordSpherical, CoordGeodetic, MAG_TimelyModifyMagneticModel_cache(TimedModels, UserDate, MagneticModel), &Results[i]);
+    }
+    tCache = bench_seconds() - t0;
+
+    t0 = bench_seconds();
+    MAG_GeomagBatch(Ellip, MagneticModel, NumPoints, Latitude, Longitude, Height, DecimalYear, Results);
+    tBatch = bench_seconds() - t0;
+
+    printf("batch: %d points, %d dates, nMax %d\n", NumPoints, BENCH_NUM_DATES, MagneticModel->nMax);
+    printf("  %-16s %10.3f s %14.0f points/s\n", "MAG_Geomag", tGeomag, NumPoints / tGeomag);
+    printf("  %-16s %10.3f s %14.0f points/s\n", "MAG_Geomag_ctx", tCtx, NumPoints / tCtx);
+    printf("  %-16s %10.3f s %14.0f points/s  (%lu timed model cache hits, %lu misses)\n", "  + model cache", tCache, NumPoints / tCache,
+            TimedModels->Hits, TimedModels->Misses);
+    printf("  %-16s %10.3f s %14.0f points/s  (%.2fx MAG_Geomag)\n", "MAG_GeomagBatch", tBatch, NumPoints / tBatch, tGeomag / tBatch);
+
+    free(Latitude);
+    free(Longitude);
+    free(Height);
+    free(DecimalYear);
+    free(Results);
+    MAG_FreeMagneticModelMemory(TimedMagneticModel);
+    MAG_FreeTimedModelCache(TimedModels);
+    MAG_FreeEvalContext(Context);
+    return TRUE;
+}
+
+static int bench_grid_run(MAGtype_GridParameters *Parameters, MAGtype_MagneticModel *MagneticModel, MAGtype_Ellipsoid Ellip,
+        MAGtype_Geoid *Geoid, long *Length, double *Seconds, MAGtype_GridStatus *Status)
+/* Evaluates the grid into a temporary file, *Length is the size of the output (text or raster) */
+{
+    FILE *stream;
+    double t0;
+    int Flag;
+
+    stream = tmpfile();
+    if(stream == NULL)
+    {
+        printf("Error opening a temporary file\n");
+        return FALSE;
+    }
+    t0 = bench_seconds();
+    /* Rasters need another stream for the height warnings, which the benchmarks turn off */
+    Flag = MAG_GridEvaluate(Parameters, MagneticModel, Geoid, Ellip, stream, Parameters->OutputFormat == MAG_GRID_TEXT ? stream : stdout, Status);
+    *Seconds = bench_seconds() - t0;
+    *Length = ftell(stream);
+    fclose(stream);
+    if(!Flag)
+        printf("Error evaluating the grid\n");
+    return Flag;
+}
+
+static int bench_grid(MAGtype_MagneticModel *MagneticModel, MAGtype_Ellipsoid Ellip, MAGtype_Geoid *Geoid, int NumPoints)
+{
+    MAGtype_GridParameters Parameters;
+    MAGtype_GridStatus Status;
+    long Length;
+    double t, tReference;
+    int Threads, MaxThreads, Flag = TRUE;
+
+    memset(&Parameters, 0, sizeof (MAGtype_GridParameters));
+    /* Global grid with a spacing that gives about NumPoints cells */
+    Parameters.cord_step_size = sqrt(360.0 * 180.0 / (double) NumPoints);
+    Parameters.minimum.phi = -90.0;
+    Parameters.maximum.phi = 90.0;
+    Parameters.minimum.lambda = -180.0;
+    Parameters.maximum.lambda = 180.0;
+    Parameters.altitude_step_size = 0;
+    Parameters.StartDate.DecimalYear = MagneticModel->epoch;
+    Parameters.EndDate.DecimalYear = MagneticModel->epoch;
+    Parameters.time_step = 0;
+    Parameters.ElementOption = 1;
+    Parameters.UncertaintyOption = 1;
+    Parameters.HeightWarning = NULL;
+    Geoid->UseGeoid = 0;
+    MaxThreads = MAG_GridDefaultThreads();
+    printf("grid: step %.4f degrees, nMax %d, %d online processors\n", Parameters.cord_step_size, MagneticModel->nMax, MaxThreads);
+    if(MaxThreads < 4)
+        MaxThreads = 4; /* Still time the threaded row ordering on small machines */
+
+    /* Reference: per cell evaluation on one thread */
+    Parameters.NumThreads = 1;
+    Parameters.Separable = 0;
+    if(!bench_grid_run(&Parameters, MagneticModel, Ellip, Geoid, &Length, &tReference, &Status))
+        return FALSE;
+    printf("  %-9s %3d threads %10.3f s %14.0f cells/s  (%lu timed model cache hits, %lu misses)\n", "per cell", 1, tReference,
+            Status.NumCells / tReference, Status.TimedModelHits, Status.TimedModelMisses);
+
+    Parameters.Separable = 1;
+    for(Threads = 1; Flag && Threads <= MaxThreads; Threads = (Threads * 2 > MaxThreads && Threads < MaxThreads) ? MaxThreads : Threads * 2)
+    {
+        Parameters.NumThreads = Threads;
+        Flag = bench_grid_run(&Parameters, MagneticModel, Ellip, Geoid, &Length, &t, &Status);
+        if(Flag)
+            printf("  %-9s %3d threads %10.3f s %14.0f cells/s  (%.2fx)\n", "separable", Status.NumThreads, t, Status.NumCells / t,
+                    tReference / t);
+    }
+    return Flag;
+}
+
+static int bench_fixed(MAGtype_MagneticModel *MagneticModel, MAGtype_Ellipsoid Ellip, int NumPoints)
+{
+    MAGtype_MagneticModel *TimedMagneticModel;
+    MAGtype_EvalContext *Context;
+    MAGtype_CoordGeodetic CoordGeodetic;
+    MAGtype_CoordSpherical CoordSpherical;
+    MAGtype_Date UserDate;
+    MAGtype_GeoMagneticElements Results;
+    double *Latitude, *Longitude, *Height, t0, tCtx, tFixed;
+    unsigned long state = 20250101UL;
+    int i;
+
+    if(MagneticModel->nMax != MAG_FIXED_NMAX || MagneticModel->nMaxSecVar != MAG_FIXED_NMAX)
+    {
+        printf("fixed: skipped, the model is not of degree %d\n", MAG_FIXED_NMAX);
+        return TRUE;
+    }
+    Latitude = (double *) malloc(NumPoints * sizeof (double));
+    Longitude = (double *) malloc(NumPoints * sizeof (double));
+    Height = (double *) malloc(NumPoints * sizeof (double));
+    TimedMagneticModel = MAG_AllocateModelMemory((MagneticModel->nMax + 1) * (MagneticModel->nMax + 2) / 2);
+    Context = MAG_AllocateEvalContext(MagneticModel->nMax);
+    if(!Latitude || !Longitude || !Height || !TimedMagneticModel || !Context)
+    {
+        printf("Error allocating benchmark memory\n");
+        return FALSE;
+    }
+    for(i = 0; i < NumPoints; i++)
+    {
+        Latitude[i] = i % 1000 == 0 ? (i % 2000 ? -90.0 : 90.0) : bench_uniform(&state, -90.0, 90.0);
+        Longitude[i] = bench_uniform(&state, -180.0, 180.0);
+        Height[i] = bench_uniform(&state, -1.0, 600.0);
+    }
+    printf("fixed: %d points, nMax %d\n", NumPoints, MAG_FIXED_NMAX);
+
+    CoordGeodetic.UseGeoid = 0;
+    UserDate.DecimalYear = MagneticModel->epoch + 2.5;
+    MAG_TimelyModifyMagneticModel(UserDate, MagneticModel, TimedMagneticModel);
+    t0 = bench_seconds();
+    for(i = 0; i < NumPoints; i++)
+    {
+        CoordGeodetic.phi = Latitude[i];
+        CoordGeodetic.lambda = Longitude[i];
+        CoordGeodetic.HeightAboveEllipsoid = Height[i];
+        MAG_GeodeticToSpherical(Ellip, CoordGeodetic, &CoordSpherical);
+        MAG_Geomag_ctx(Context, Ellip, CoordSpherical, CoordGeodetic, TimedMagneticModel, &Results);
+    }
+    tCtx = bench_seconds() - t0;
+    t0 = bench_seconds();
+    for(i = 0; i < NumPoints; i++)
+    {
+        CoordGeodetic.phi = Latitude[i];
+        CoordGeodetic.lambda = Longitude[i];
+        CoordGeodetic.HeightAboveEllipsoid = Height[i];
+        MAG_GeodeticToSpherical(Ellip, CoordGeodetic, &CoordSpherical);
+        MAG_GeomagFixed(Ellip, CoordSpherical, CoordGeodetic, TimedMagneticModel, &Results);
+    }
+    tFixed = bench_seconds() - t0;
+    printf("  %-16s %10.3f s %14.0f points/s\n", "MAG_Geomag_ctx", tCtx, NumPoints / tCtx);
+    printf("  %-16s %10.3f s %14.0f points/s  (%.2fx MAG_Geomag_ctx)\n", "MAG_GeomagFixed", tFixed, NumPoints / tFixed, tCtx / tFixed);
+
+    free(Latitude);
+    free(Longitude);
+    free(Height);
+    MAG_FreeMagneticModelMemory(TimedMagneticModel);
+    MAG_FreeEvalContext(Context);
+    return TRUE;
+}
+
+static int bench_gradient(MAGtype_MagneticModel *MagneticModel, MAGtype_Ellipsoid Ellip, int NumPoints)
+{
+    MAGtype_MagneticModel *TimedMagneticModel;
+    MAGtype_CoordGeodetic CoordGeodetic;
+    MAGtype_Date UserDate;
+    MAGtype_Gradient Gradient;
+    double *Latitude, *Longitude, *Height, t0, tDifference, tAnalytic;
+    unsigned long state = 20250101UL;
+    int i;
+
+    Latitude = (double *) malloc(NumPoints * sizeof (double));
+    Longitude = (double *) malloc(NumPoints * sizeof (double));
+    Height = (double *) malloc(NumPoints * sizeof (double));
+    TimedMagneticModel = MAG_AllocateModelMemory((MagneticModel->nMax + 1) * (MagneticModel->nMax + 2) / 2);
+    if(!Latitude || !Longitude || !Height || !TimedMagneticModel)
+    {
+        printf("Error allocating benchmark memory\n");
+        return FALSE;
+    }
+    for(i = 0; i < NumPoints; i++)
+    {
+        /* The central differences of MAG_Gradient step 0.01 degrees in latitude, stay clear of the poles */
+        Latitude[i] = i % 1000 == 0 ? (i % 2000 ? -89.5 : 89.5) : bench_uniform(&state, -89.5, 89.5);
+        Longitude[i] = bench_uniform(&state, -180.0, 180.0);
+        Height[i] = bench_uniform(&state, -1.0, 600.0);
+    }
+    printf("gradient: %d points, nMax %d\n", NumPoints, MagneticModel->nMax);
+
+    CoordGeodetic.UseGeoid = 0;
+    UserDate.DecimalYear = MagneticModel->epoch + 2.5;
+    MAG_TimelyModifyMagneticModel(UserDate, MagneticModel, TimedMagneticModel);
+    t0 = bench_seconds();
+    for(i = 0; i < NumPoints; i++)
+    {
+        CoordGeodetic.phi = Latitude[i];
+        CoordGeodetic.lambda = Longitude[i];
+        CoordGeodetic.HeightAboveEllipsoid = Height[i];
+        CoordGeodetic.HeightAboveGeoid = Height[i];
+        MAG_Gradient(Ellip, CoordGeodetic, TimedMagneticModel, &Gradient);
+    }
+    tDifference = bench_seconds() - t0;
+    t0 = bench_seconds();
+    for(i = 0; i < NumPoints; i++)
+    {
+        CoordGeodetic.phi = Latitude[i];
+        CoordGeodetic.lambda = Longitude[i];
+        CoordGeodetic.HeightAboveEllipsoid = Height[i];
+        CoordGeodetic.HeightAboveGeoid = Height[i];
+        MAG_GradientAnalytic(Ellip, CoordGeodetic, TimedMagneticModel, &Gradient);
+    }
+    tAnalytic = bench_seconds() - t0;
+
+    printf("  %-20s %10.3f s %14.0f points/s\n", "MAG_Gradient", tDifference, NumPoints / tDifference);
+    printf("  %-20s %10.3f s %14.0f points/s  (%.2fx MAG_Gradient)\n", "MAG_GradientAnalytic", tAnalytic, NumPoints / tAnalytic,
+            tDifference / tAnalytic);
+
+    free(Latitude);
+    free(Longitude);
+    free(Height);
+    MAG_FreeMagneticModelMemory(TimedMagneticModel);
+    return TRUE;
+}
+
+static int bench_file_generate(FILE *stream, MAGtype_MagneticModel *MagneticModel, int NumLines)
+/* Coordinate file rows with heights in all units and a varying number of decimals (dates stay below the end of the
+   model when rounded to whole years) */
+{
+    static const char Units[] = "KkMmFf";
+    unsigned long state = 20250101UL;
+    double Height;
+    int i, u;
+
+    for(i = 0; i < NumLines; i++)
+    {
+        u = (int) bench_uniform(&state, 0.0, 5.999);
+        Height = bench_uniform(&state, 0.0, 300.0);
+        if(u >= 4)
+            Height *= 3280.0839895;
+        else if(u >= 2)
+            Height *= 1000.0;
+        if(fprintf(stream, "%.*f E %c%.*f %.*f %.*f\n", i % 4, bench_uniform(&state, MagneticModel->epoch, MagneticModel->epoch + 4.4),
+                Units[u], i % 3, Height, 2 + i % 7, bench_uniform(&state, -90.0, 90.0), 2 + i % 5, bench_uniform(&state, -180.0, 360.0)) < 0)
+            return FALSE;
+    }
+    rewind(stream);
+    return TRUE;
+}
+
+static void bench_file_reference(FILE *In, FILE *Out, MAGtype_MagneticModel *MagneticModel, MAGtype_Ellipsoid Ellip, MAGtype_Geoid *Geoid)
+/* The line by line loop of wmm_file for valid rows with heights above the ellipsoid */
+{
+    MAGtype_MagneticModel *TimedMagneticModel;
+    MAGtype_TimedModelCache *TimedModels;
+    MAGtype_CoordSpherical CoordSpherical;
+    MAGtype_CoordGeodetic CoordGeodetic;
+    MAGtype_Date UserDate;
+    MAGtype_GeoMagneticElements Elements, Errors;
+    char line[BENCH_FILE_LINE], args[6][94];
+    double d, i, dmin, imin, alt;
+    int ddeg, ideg, units;
+
+    TimedModels = MAG_AllocateTimedModelCache(1, MagneticModel->nMax);
+    Geoid->UseGeoid = 0;
+    while(fgets(line, BENCH_FILE_LINE, In) != NULL)
+    {
+        sscanf(line, "%93s%93s%93s%93s%93s", args[1], args[2], args[3], args[4], args[5]);
+        CoordGeodetic.lambda = atof(args[5]);
+        CoordGeodetic.phi = atof(args[4]);
+        units = toupper((unsigned char) args[3][0]);
+        alt = atof(args[3] + 1);
+        if(units == 'M')
+            alt *= 0.001;
+        else if(units == 'F')
+            alt /= 3280.0839895;
+        CoordGeodetic.HeightAboveGeoid = alt;
+        UserDate.DecimalYear = atof(args[1]);
+        MAG_ConvertGeoidToEllipsoidHeight(&CoordGeodetic, Geoid);
+        MAG_GeodeticToSpherical(Ellip, CoordGeodetic, &CoordSpherical);
+        TimedMagneticModel = MAG_TimelyModifyMagneticModel_cache(TimedModels, UserDate, MagneticModel);
+        MAG_Geomag(Ellip, CoordSpherical, CoordGeodetic, TimedMagneticModel, &Elements);
+
+        fprintf(Out, "%s %s %s %s %s ", args[1], args[2], args[3], args[4], args[5]);
+        d = Elements.Decl;
+        i = Elements.Incl;
+        ddeg = (int) d;
+        dmin = (d - (double) ddeg)*60;
+        if(ddeg != 0) dmin = fabs(dmin);
+        ideg = (int) i;
+        imin = (i - (double) ideg)*60;
+        if(ideg != 0) imin = fabs(imin);
+        fprintf(Out, " %4dd %2.0fm  %4dd %2.0fm  %8.1f %8.1f %8.1f %8.1f %8.1f", ddeg, dmin, ideg, imin, Elements.H, Elements.X, Elements.Y,
+                Elements.Z, Elements.F);
+        fprintf(Out, " %7.1f   %7.1f     %8.1f %8.1f %8.1f %8.1f %8.1f", 60 * Elements.Decldot, 60 * Elements.Incldot, Elements.Hdot,
+                Elements.Xdot, Elements.Ydot, Elements.Zdot, Elements.Fdot);
+        MAG_WMMErrorCalc(Elements.H, &Errors);
+        fprintf(Out, " %3.0f  %3.0f  %8.1f %8.1f %8.1f %8.1f %8.1f", 60*Errors.Decl, 60*Errors.Incl, Errors.H, Errors.X, Errors.Y, Errors.Z,
+                Errors.F);
+        fprintf(Out, "\n");
+    }
+    MAG_FreeTimedModelCache(TimedModels);
+}
+
+static int bench_file(MAGtype_MagneticModel *MagneticModel, MAGtype_Ellipsoid Ellip, MAGtype_Geoid *Geoid, int NumLines)
+{
+    MAGtype_FileParameters Parameters;
+    MAGtype_FileStatus Status;
+    FILE *In, *Out;
+    double t0, tReference, tStream;
+    int Flag = TRUE, Threads, MaxThreads;
+
+    In = tmpfile();
+    Out = tmpfile();
+    if(In == NULL || Out == NULL || !bench_file_generate(In, MagneticModel, NumLines))
+    {
+        printf("Error writing temporary files\n");
+        return FALSE;
+    }
+    MaxThreads = MAG_FileDefaultThreads();
+    printf("file: %d lines, nMax %d, %d online processors\n", NumLines, MagneticModel->nMax, MaxThreads);
+    if(MaxThreads < 4)
+        MaxThreads = 4; /* Still time the ordered writer on small machines */
+
+    t0 = bench_seconds();
+    bench_file_reference(In, Out, MagneticModel, Ellip, Geoid);
+    fflush(Out);
+    tReference = bench_seconds() - t0;
+    printf("  %-16s %3d threads %10.3f s %14.0f lines/s\n", "fgets/fprintf", 1, tReference, NumLines / tReference);
+
+    memset(&Parameters, 0, sizeof (MAGtype_FileParameters));
+    Parameters.PrintErrors = 1;
+    Parameters.MinYear = MagneticModel->min_year;
+    Parameters.MaxYear = MagneticModel->CoefficientFileEndDate;
+    Parameters.MinHeight = -1;
+    Parameters.MaxHeight = 1900;
+    for(Threads = 1; Flag && Threads <= MaxThreads; Threads = (Threads * 2 > MaxThreads && Threads < MaxThreads) ? MaxThreads : Threads * 2)
+    {
+        Parameters.NumThreads = Threads;
+        rewind(In);
+        rewind(Out);
+        t0 = bench_seconds();
+        Flag = MAG_FileStream(&Parameters, MagneticModel, Geoid, Ellip, In, Out, stdout, &Status);
+        fflush(Out);
+        tStream = bench_seconds() - t0;
+        if(!Flag)
+        {
+            printf("Error processing the coordinate file\n");
+            break;
+        }
+        printf("  %-16s %3d threads %10.3f s %14.0f lines/s  (%.2fx)  reader %.0f%%, workers %.0f%%, writer %.0f%%\n", "MAG_FileStream",
+                Status.NumThreads, tStream, NumLines / tStream, tReference / tStream, 100 * Status.ReaderSeconds / Status.Seconds,
+                100 * Status.WorkerSeconds / (Status.NumThreads * Status.Seconds), 100 * Status.WriterSeconds / Status.Seconds);
+    }
+    fclose(In);
+    fclose(Out);
+    return Flag;
+}
+
+static int bench_geoid_run(const char *Name, MAGtype_Geoid *Geoid, MAGtype_GeoidStore *Store, int NumPoints, const double *Latitude,
+        const double *Longitude, size_t ResidentBytes)
+/* Converts every point and prints the throughput */
+{
+    MAGtype_CoordGeodetic CoordGeodetic;
+    double t0, t;
+    int i, Flag = TRUE;
+
+    memset(&CoordGeodetic, 0, sizeof (MAGtype_CoordGeodetic));
+    t0 = bench_seconds();
+    for(i = 0; i < NumPoints; i++)
+    {
+        CoordGeodetic.phi = Latitude[i];
+        CoordGeodetic.lambda = Longitude[i];
+        CoordGeodetic.HeightAboveGeoid = 0;
+        Flag &= MAG_ConvertGeoidToEllipsoidHeight(&CoordGeodetic, Geoid);
+    }
+    t = bench_seconds() - t0;
+    if(Store != NULL)
+        printf("    %-14s %3d tiles", Name, Store->NumSlots);
+    else
+        printf("    %-24s", Name);
+    printf(" %9.3f s %14.0f lookups/s %9lu resident bytes", t, NumPoints / t, (unsigned long) ResidentBytes);
+    if(Store != NULL)
+        printf("  %lu tiles read", Store->Misses);
+    printf("%s\n", Flag ? "" : "  LOOKUP FAILED");
+    return Flag;
+}
+
+static int bench_geoid(int NumPoints)
+{
+    static const int Slots[] = {1, 4, MAG_GEOID_DEFAULT_SLOTS, 32};
+    MAGtype_GeoidStore Store;
+    MAGtype_GeoidMemory Memory;
+    MAGtype_Ellipsoid Ellip;
+    MAGtype_Geoid FlatGeoid, StoreGeoid;
+    FILE *File;
+    unsigned char *Data = NULL;
+    float *Flat = NULL;
+    double *Latitude, *Longitude;
+    unsigned long state = 20250101UL;
+    long Size;
+    int i, s, Pattern, Flag = TRUE;
+
+    File = fopen(BENCH_GEOID_FILE, "rb");
+    if(File == NULL)
+    {
+        printf("geoid: %s not found (write it with wmm_geoid), geoid benchmark skipped\n", BENCH_GEOID_FILE);
+        return TRUE;
+    }
+    fseek(File, 0, SEEK_END);
+    Size = ftell(File);
+    rewind(File);
+    Data = (unsigned char *) malloc((size_t) Size);
+    Latitude = (double *) malloc(NumPoints * sizeof (double));
+    Longitude = (double *) malloc(NumPoints * sizeof (double));
+    if(!Data || !Latitude || !Longitude || fread(Data, 1, (size_t) Size, File) != (size_t) Size)
+    {
+        printf("Error reading %s\n", BENCH_GEOID_FILE);
+        return FALSE;
+    }
+    Memory.Data = Data;
+    Memory.Size = (size_t) Size;
+    MAG_SetDefaults(&Ellip, &FlatGeoid);
+    /* The flat array path runs on the posts decoded from the store, so EGM9615.h is not needed */
+    if(!MAG_GeoidStoreOpen(&Store, MAG_GeoidReadMemory, &Memory, 1) || Store.NumRows != FlatGeoid.NumbGeoidRows ||
+            Store.NumCols != FlatGeoid.NumbGeoidCols || (Flat = (float *) malloc((size_t) FlatGeoid.NumbGeoidElevs * sizeof (float))) == NULL ||
+            !MAG_GeoidStoreDecode(&Store, Flat))
+    {
+        printf("%s is not a valid EGM96 geoid store\n", BENCH_GEOID_FILE);
+        return FALSE;
+    }
+    MAG_GeoidStoreClose(&Store);
+    FlatGeoid.GeoidHeightBuffer = Flat;
+    FlatGeoid.Geoid_Initialized = 1;
+    FlatGeoid.UseGeoid = 1;
+    StoreGeoid = FlatGeoid;
+    StoreGeoid.GeoidHeightBuffer = NULL;
+    StoreGeoid.GetGeoidPosts = MAG_GeoidStorePosts;
+    printf("geoid: %d lookups, %s is %ld bytes, the flat array %lu bytes\n", NumPoints, BENCH_GEOID_FILE, Size,
+            (unsigned long) (FlatGeoid.NumbGeoidElevs * sizeof (float)));
+
+    for(Pattern = 0; Pattern < 2; Pattern++)
+    {
+        for(i = 0; i < NumPoints; i++)
+            if(Pattern == 0 || i == 0)
+            {
+                Latitude[i] = bench_uniform(&state, -90.0, 90.0);
+                Longitude[i] = bench_uniform(&state, -180.0, 180.0);
+            } else
+            {
+                Latitude[i] = fmax(-90.0, fmin(90.0, Latitude[i - 1] + bench_uniform(&state, -BENCH_GEOID_STEP, BENCH_GEOID_STEP)));
+                Longitude[i] = Longitude[i - 1] + bench_uniform(&state, -BENCH_GEOID_STEP, BENCH_GEOID_STEP);
+                if(Longitude[i] > 180.0)
+                    Longitude[i] -= 360.0;
+                if(Longitude[i] < -180.0)
+                    Longitude[i] += 360.0;
+            }
+        printf("  %s\n", Pattern == 0 ? "locations over the globe" : "track of nearby fixes");
+        Flag &= bench_geoid_run("flat array", &FlatGeoid, NULL, NumPoints, Latitude, Longitude, FlatGeoid.NumbGeoidElevs * sizeof (float));
+        for(s = 0; Flag && s < (int) (sizeof (Slots) / sizeof (Slots[0])); s++)
+        {
+            if(!MAG_GeoidStoreOpen(&Store, MAG_GeoidReadMemory, &Memory, Slots[s]))
+            {
+                Flag = FALSE;
+                break;
+            }
+            StoreGeoid.GeoidData = &Store;
+            Flag &= bench_geoid_run("store, memory", &StoreGeoid, &Store, NumPoints, Latitude, Longitude, MAG_GeoidStoreResidentBytes(&Store));
+            MAG_GeoidStoreClose(&Store);
+        }
+        if(Flag && MAG_GeoidStoreOpen(&Store, MAG_GeoidReadFile, File, MAG_GEOID_DEFAULT_SLOTS))
+        {
+            StoreGeoid.GeoidData = &Store;
+            Flag &= bench_geoid_run("store, file", &StoreGeoid, &Store, NumPoints, Latitude, Longitude, MAG_GeoidStoreResidentBytes(&Store));
+            MAG_GeoidStoreClose(&Store);
+        }
+    }
+
+    fclose(File);
+    free(Data);
+    free(Flat);
+    free(Latitude);
+    free(Longitude);
+    return Flag;
+}
+
+static const int BenchSeriesElements[] = {1, 3, 8, 9, 16}; /* Grid elements timed with and without LinearTime */
+static const int BenchMultiElements[BENCH_MULTI_ELEMENTS] = {1, 2, 3, 8}; /* The four maps of a chart product */
+
+static int bench_series(MAGtype_MagneticModel *MagneticModel, MAGtype_Ellipsoid Ellip, MAGtype_Geoid *Geoid, int NumPoints)
+{
+    MAGtype_MagneticModel **TimedMagneticModels;
+    MAGtype_EvalContext *Context;
+    MAGtype_CoordGeodetic CoordGeodetic;
+    MAGtype_CoordSpherical CoordSpherical;
+    MAGtype_Date UserDate;
+    MAGtype_GeoMagneticElements *Reference, *Results;
+    MAGtype_GridParameters Parameters;
+    MAGtype_GridStatus Status;
+    double DecimalYear[BENCH_SERIES_DATES], t0, tReference = 0, tSeries = 0, t, tGrid;
+    long Length;
+    unsigned long state = 20250101UL;
+    int i, k, NumSites, Flag = TRUE;
+
+    NumSites = NumPoints / BENCH_SERIES_DATES > 0 ? NumPoints / BENCH_SERIES_DATES : 1;
+    TimedMagneticModels = (MAGtype_MagneticModel **) calloc(BENCH_SERIES_DATES, sizeof (MAGtype_MagneticModel *));
+    Reference = (MAGtype_GeoMagneticElements *) malloc(BENCH_SERIES_DATES * sizeof (MAGtype_GeoMagneticElements));
+    Results = (MAGtype_GeoMagneticElements *) malloc(BENCH_SERIES_DATES * sizeof (MAGtype_GeoMagneticElements));
+    Context = MAG_AllocateEvalContext(MagneticModel->nMax);
+    if(!TimedMagneticModels || !Reference || !Results || !Context)
+    {
+        printf("Error allocating benchmark memory\n");
+        return FALSE;
+    }
+    /* Monthly dates over the validity of the model, each time adjusted once so the reference only pays for the summations */
+    for(k = 0; k < BENCH_SERIES_DATES; k++)
+    {
+        DecimalYear[k] = MagneticModel->epoch + (double) k / 12.0;
+        UserDate.DecimalYear = DecimalYear[k];
+        TimedMagneticModels[k] = MAG_AllocateModelMemory((MagneticModel->nMax + 1) * (MagneticModel->nMax + 2) / 2);
+        if(TimedMagneticModels[k] == NULL)
+        {
+            printf("Error allocating benchmark memory\n");
+            return FALSE;
+        }
+        MAG_TimelyModifyMagneticModel(UserDate, MagneticModel, TimedMagneticModels[k]);
+    }
+    printf("series: %d sites, %d dates, nMax %d\n", NumSites, BENCH_SERIES_DATES, MagneticModel->nMax);
+
+    CoordGeodetic.UseGeoid = 0;
+    for(i = 0; i < NumSites; i++)
+    {
+        /* Poles included, where the summations take the special path */
+        CoordGeodetic.phi = i % 500 == 0 ? (i % 1000 ? -90.0 : 90.0) : bench_uniform(&state, -90.0, 90.0);
+        CoordGeodetic.lambda = bench_uniform(&state, -180.0, 180.0);
+        CoordGeodetic.HeightAboveEllipsoid = bench_uniform(&state, -1.0, 600.0);
+        CoordGeodetic.HeightAboveGeoid = CoordGeodetic.HeightAboveEllipsoid;
+
+        t0 = bench_seconds();
+        MAG_GeodeticToSpherical(Ellip, CoordGeodetic, &CoordSpherical);
+        for(k = 0; k < BENCH_SERIES_DATES; k++)
+        {
+            MAG_Geomag_ctx(Context, Ellip, CoordSpherical, CoordGeodetic, TimedMagneticModels[k], &Reference[k]);
+            MAG_CalculateGridVariation(CoordGeodetic, &Reference[k]);
+        }
+        tReference += bench_seconds() - t0;
+        t0 = bench_seconds();
+        MAG_SiteTimeSeries(Ellip, CoordGeodetic, MagneticModel, BENCH_SERIES_DATES, DecimalYear, Results);
+        tSeries += bench_seconds() - t0;
+    }
+    printf("  %-20s %10.3f s %14.0f dates/s\n", "MAG_Geomag_ctx", tReference, NumSites * (double) BENCH_SERIES_DATES / tReference);
+    printf("  %-20s %10.3f s %14.0f dates/s  (%.2fx MAG_Geomag_ctx)\n", "MAG_SiteTimeSeries", tSeries,
+            NumSites * (double) BENCH_SERIES_DATES / tSeries, tReference / tSeries);
+
+    /* Grid with a time axis */
+    memset(&Parameters, 0, sizeof (MAGtype_GridParameters));
+    Parameters.cord_step_size = sqrt(360.0 * 180.0 / (double) NumSites);
+    Parameters.minimum.phi = -90.0;
+    Parameters.maximum.phi = 90.0;
+    Parameters.minimum.lambda = -180.0;
+    Parameters.maximum.lambda = 180.0;
+    Parameters.StartDate.DecimalYear = MagneticModel->epoch;
+    Parameters.EndDate.DecimalYear = MagneticModel->epoch + 4.9;
+    Parameters.time_step = 0.1;
+    Parameters.UncertaintyOption = 1;
+    Parameters.HeightWarning = NULL;
+    Parameters.NumThreads = 1;
+    Parameters.Separable = 1;
+    Geoid->UseGeoid = 0;
+    for(i = 0; Flag && i < (int) (sizeof (BenchSeriesElements) / sizeof (BenchSeriesElements[0])); i++)
+    {
+        Parameters.ElementOption = BenchSeriesElements[i];
+        Parameters.LinearTime = 0;
+        Flag = bench_grid_run(&Parameters, MagneticModel, Ellip, Geoid, &Length, &tGrid, &Status);
+        Parameters.LinearTime = 1;
+        Flag = Flag && bench_grid_run(&Parameters, MagneticModel, Ellip, Geoid, &Length, &t, &Status);
+        if(Flag)
+            printf("  grid element %2d, %ld cells: time adjusted %.3f s, linear in time %.3f s (%.2fx)\n", BenchSeriesElements[i],
+                    Status.NumCells, tGrid, t, tGrid / t);
+    }
+
+    for(k = 0; k < BENCH_SERIES_DATES; k++)
+        MAG_FreeMagneticModelMemory(TimedMagneticModels[k]);
+    free(TimedMagneticModels);
+    free(Reference);
+    free(Results);
+    MAG_FreeEvalContext(Context);
+    return Flag;
+}
+
+static int bench_raster(MAGtype_MagneticModel *MagneticModel, MAGtype_Ellipsoid Ellip, MAGtype_Geoid *Geoid, int NumPoints)
+{
+    MAGtype_GridParameters Parameters;
+    MAGtype_GridStatus Status;
+    double tText, tRaster, tBands;
+    long TextLength, RasterLength, BandsLength, NumCells;
+    int NumBands;
+
+    memset(&Parameters, 0, sizeof (MAGtype_GridParameters));
+    Parameters.cord_step_size = sqrt(360.0 * 180.0 / (double) NumPoints);
+    Parameters.minimum.phi = -90.0;
+    Parameters.maximum.phi = 90.0;
+    Parameters.minimum.lambda = -180.0;
+    Parameters.maximum.lambda = 180.0;
+    Parameters.StartDate.DecimalYear = MagneticModel->epoch + 1.5;
+    Parameters.EndDate.DecimalYear = MagneticModel->epoch + 1.5;
+    Parameters.ElementOption = BENCH_RASTER_ELEMENT;
+    Parameters.UncertaintyOption = 1;
+    Parameters.HeightWarning = NULL;
+    Parameters.NumThreads = 1;
+    Parameters.Separable = 1;
+    Geoid->UseGeoid = 0;
+    printf("raster: step %.4f degrees, nMax %d, element %d with uncertainty\n", Parameters.cord_step_size, MagneticModel->nMax, BENCH_RASTER_ELEMENT);
+
+    Parameters.OutputFormat = MAG_GRID_TEXT;
+    if(!bench_grid_run(&Parameters, MagneticModel, Ellip, Geoid, &TextLength, &tText, &Status))
+        return FALSE;
+    NumCells = Status.NumCells;
+    Parameters.OutputFormat = MAG_GRID_RASTER;
+    if(!bench_grid_run(&Parameters, MagneticModel, Ellip, Geoid, &RasterLength, &tRaster, &Status))
+        return FALSE;
+    Parameters.OutputFormat = MAG_GRID_RASTER_BANDS;
+    if(!bench_grid_run(&Parameters, MagneticModel, Ellip, Geoid, &BandsLength, &tBands, &Status))
+        return FALSE;
+    NumBands = Status.NumBands;
+
+    printf("  %-14s %10.3f s %12.0f cells/s %9.1f MB %8.1f MB/s\n", "text", tText, NumCells / tText, 1e-6 * TextLength,
+            1e-6 * TextLength / tText);
+    printf("  %-14s %10.3f s %12.0f cells/s %9.1f MB %8.1f MB/s  (%.2fx text)\n", "raster", tRaster, NumCells / tRaster,
+            1e-6 * RasterLength, 1e-6 * RasterLength / tRaster, tText / tRaster);
+    printf("  %-14s %10.3f s %12.0f cells/s %9.1f MB %8.1f MB/s  (%d bands, %.2fx 16 text runs)\n", "bands", tBands, NumCells / tBands,
+            1e-6 * BandsLength, 1e-6 * BandsLength / tBands, NumBands, 16 * tText / tBands);
+    return TRUE;
+}
+
+static int bench_elements(MAGtype_MagneticModel *MagneticModel, MAGtype_Ellipsoid Ellip, MAGtype_Geoid *Geoid, int NumPoints)
+{
+    MAGtype_GridParameters Parameters;
+    MAGtype_GridStatus Status;
+    FILE *streams[BENCH_MULTI_ELEMENTS];
+    double t0, t, tSingle = 0, tMulti;
+    long Length, NumCells = 0;
+    int i, Flag = TRUE;
+
+    memset(&Parameters, 0, sizeof (MAGtype_GridParameters));
+    Parameters.cord_step_size = sqrt(360.0 * 180.0 / (double) NumPoints);
+    Parameters.minimum.phi = -90.0;
+    Parameters.maximum.phi = 90.0;
+    Parameters.minimum.lambda = -180.0;
+    Parameters.maximum.lambda = 180.0;
+    Parameters.StartDate.DecimalYear = MagneticModel->epoch + 1.5;
+    Parameters.EndDate.DecimalYear = MagneticModel->epoch + 1.5;
+    Parameters.UncertaintyOption = 1;
+    Parameters.HeightWarning = NULL;
+    Parameters.NumThreads = 1;
+    Parameters.Separable = 1;
+    Parameters.OutputFormat = MAG_GRID_TEXT;
+    Geoid->UseGeoid = 0;
+    printf("elements: step %.4f degrees, nMax %d, %d elements with uncertainty\n", Parameters.cord_step_size, MagneticModel->nMax,
+            BENCH_MULTI_ELEMENTS);
+
+    for(i = 0; i < BENCH_MULTI_ELEMENTS; i++)
+    {
+        Parameters.ElementMask |= MAG_GRID_ELEMENT(BenchMultiElements[i]);
+        streams[i] = tmpfile();
+        if(streams[i] == NULL)
+        {
+            printf("Error opening a temporary file\n");
+            while(i-- > 0)
+                fclose(streams[i]);
+            return FALSE;
+        }
+    }
+    Parameters.UncertaintyMask = Parameters.ElementMask;
+    t0 = bench_seconds();
+    Flag = MAG_GridEvaluateElements(&Parameters, MagneticModel, Geoid, Ellip, streams, stdout, &Status);
+    tMulti = bench_seconds() - t0;
+    for(i = 0; i < BENCH_MULTI_ELEMENTS; i++)
+        fclose(streams[i]);
+    if(!Flag)
+    {
+        printf("  Error evaluating the grid\n");
+        return FALSE;
+    }
+
+    Parameters.ElementMask = Parameters.UncertaintyMask = 0;
+    for(i = 0; Flag && i < BENCH_MULTI_ELEMENTS; i++)
+    {
+        Parameters.ElementOption = BenchMultiElements[i];
+        Flag = bench_grid_run(&Parameters, MagneticModel, Ellip, Geoid, &Length, &t, &Status);
+        NumCells = Status.NumCells;
+        tSingle += t;
+    }
+    if(Flag)
+    {
+        printf("  %-14s %10.3f s %12.0f cells/s\n", "single runs", tSingle, BENCH_MULTI_ELEMENTS * NumCells / tSingle);
+        printf("  %-14s %10.3f s %12.0f cells/s  (%.2fx single runs)\n", "one pass", tMulti, BENCH_MULTI_ELEMENTS * NumCells / tMulti,
+                tSingle / tMulti);
+    }
+    return Flag;
+}
+
+static int bench_trajectory_run(MAGtype_Trajectory *Trajectory, MAGtype_MagneticModel *MagneticModel, MAGtype_Ellipsoid Ellip,
+        int NumPoints, const double *Latitude, const double *Longitude, const double *Height, const double *DecimalYear,
+        MAGtype_GeoMagneticElements *Results, double *Seconds)
+{
+    MAGtype_CoordGeodetic CoordGeodetic;
+    double t0;
+    int i;
+
+    CoordGeodetic.UseGeoid = 0;
+    MAG_ResetTrajectory(Trajectory);
+    Trajectory->Fixes = Trajectory->LegendreUpdates = Trajectory->Reseeds = 0;
+    t0 = bench_seconds();
+    for(i = 0; i < NumPoints; i++)
+    {
+        CoordGeodetic.phi = Latitude[i];
+        CoordGeodetic.lambda = Longitude[i];
+        CoordGeodetic.HeightAboveEllipsoid = Height[i];
+        CoordGeodetic.HeightAboveGeoid = Height[i];
+        if(!MAG_GeomagTrajectory(Trajectory, Ellip, CoordGeodetic, MagneticModel, DecimalYear[i], &Results[i]))
+            return FALSE;
+    }
+    *Seconds = bench_seconds() - t0;
+    return TRUE;
+}
+
+static int bench_trajectory(MAGtype_MagneticModel *MagneticModel, MAGtype_Ellipsoid Ellip, int NumPoints)
+{
+    MAGtype_MagneticModel *TimedMagneticModel;
+    MAGtype_EvalContext *Context;
+    MAGtype_Trajectory *Trajectory;
+    MAGtype_CoordGeodetic CoordGeodetic;
+    MAGtype_CoordSpherical CoordSpherical;
+    MAGtype_Date UserDate;
+    MAGtype_GeoMagneticElements *Results;
+    double *Latitude, *Longitude, *Height, *DecimalYear, Heading, t, t0, tReference, tExact, tDefault;
+    unsigned long ExactUpdates;
+    int i, Flag;
+
+    Latitude = (double *) malloc(NumPoints * sizeof (double));
+    Longitude = (double *) malloc(NumPoints * sizeof (double));
+    Height = (double *) malloc(NumPoints * sizeof (double));
+    DecimalYear = (double *) malloc(NumPoints * sizeof (double));
+    Results = (MAGtype_GeoMagneticElements *) malloc(NumPoints * sizeof (MAGtype_GeoMagneticElements));
+    TimedMagneticModel = MAG_AllocateModelMemory((MagneticModel->nMax + 1) * (MagneticModel->nMax + 2) / 2);
+    Context = MAG_AllocateEvalContext(MagneticModel->nMax);
+    Trajectory = MAG_AllocateTrajectory(MagneticModel->nMax);
+    if(!Latitude || !Longitude || !Height || !DecimalYear || !Results || !TimedMagneticModel || !Context || !Trajectory)
+    {
+        printf("Error allocating benchmark memory\n");
+        return FALSE;
+    }
+
+    /* A vehicle weaving along a road at 100 Hz, with a little height noise */
+    Latitude[0] = 39.7;
+    Longitude[0] = -105.2;
+    for(i = 0; i < NumPoints; i++)
+    {
+        t = i / BENCH_TRAJECTORY_RATE;
+        Heading = DEG2RAD(60.0 + 40.0 * sin(2.0 * M_PI * t / 90.0));
+        if(i > 0)
+        {
+            Latitude[i] = Latitude[i - 1] + RAD2DEG(BENCH_TRAJECTORY_SPEED / BENCH_TRAJECTORY_RATE * cos(Heading) / (1000.0 * Ellip.re));
+            Longitude[i] = Longitude[i - 1] + RAD2DEG(BENCH_TRAJECTORY_SPEED / BENCH_TRAJECTORY_RATE * sin(Heading) /
+                    (1000.0 * Ellip.re * cos(DEG2RAD(Latitude[i]))));
+        }
+        Height[i] = 1.6 + 0.002 * sin(2.0 * M_PI * t / 7.0);
+        DecimalYear[i] = MagneticModel->epoch + 1.5 + t / (365.25 * 86400.0);
+    }
+    printf("trajectory: %d fixes at %.0f Hz, %.0f m/s, %.1f km, nMax %d\n", NumPoints, BENCH_TRAJECTORY_RATE, BENCH_TRAJECTORY_SPEED,
+            NumPoints * BENCH_TRAJECTORY_SPEED / BENCH_TRAJECTORY_RATE / 1000.0, MagneticModel->nMax);
+
+    CoordGeodetic.UseGeoid = 0;
+    t0 = bench_seconds();
+    for(i = 0; i < NumPoints; i++)
+    {
+        CoordGeodetic.phi = Latitude[i];
+        CoordGeodetic.lambda = Longitude[i];
+        CoordGeodetic.HeightAboveEllipsoid = Height[i];
+        CoordGeodetic.HeightAboveGeoid = Height[i];
+        UserDate.DecimalYear = DecimalYear[i];
+        MAG_GeodeticToSpherical(Ellip, CoordGeodetic, &CoordSpherical);
+        MAG_TimelyModifyMagneticModel(UserDate, MagneticModel, TimedMagneticModel);
+        MAG_Geomag_ctx(Context, Ellip, CoordSpherical, CoordGeodetic, TimedMagneticModel, &Results[i]);
+    }
+    tReference = bench_seconds() - t0;
+
+    Trajectory->LatitudeTolerance = 0; /* Legendre functions of every fix */
+    Flag = bench_trajectory_run(Trajectory, MagneticModel, Ellip, NumPoints, Latitude, Longitude, Height, DecimalYear, Results, &tExact);
+    ExactUpdates = Trajectory->LegendreUpdates;
+    Trajectory->LatitudeTolerance = MAG_TRAJECTORY_LATITUDE_TOLERANCE;
+    Flag = Flag && bench_trajectory_run(Trajectory, MagneticModel, Ellip, NumPoints, Latitude, Longitude, Height, DecimalYear, Results, &tDefault);
+    if(Flag)
+    {
+        printf("  %-28s %10.3f s %12.0f fixes/s\n", "TimelyModify + Geomag_ctx", tReference, NumPoints / tReference);
+        printf("  %-28s %10.3f s %12.0f fixes/s  (%.2fx, %lu Legendre updates)\n", "MAG_GeomagTrajectory exact", tExact, NumPoints / tExact,
+                tReference / tExact, ExactUpdates);
+        printf("  %-28s %10.3f s %12.0f fixes/s  (%.2fx, %lu Legendre updates)\n", "MAG_GeomagTrajectory", tDefault, NumPoints / tDefault,
+                tReference / tDefault, Trajectory->LegendreUpdates);
+    } else
+        printf("  Error evaluating the trajectory\n");
+
+    free(Latitude);
+    free(Longitude);
+    free(Height);
+    free(DecimalYear);
+    free(Results);
+    MAG_FreeMagneticModelMemory(TimedMagneticModel);
+    MAG_FreeEvalContext(Context);
+    MAG_FreeTrajectory(Trajectory);
+    return Flag;
+}
+
+int main(int argc, char *argv[])
+{
+    MAGtype_MagneticModel * MagneticModels[1];
+    MAGtype_Ellipsoid Ellip;
+    MAGtype_Geoid Geoid;
+    char filename[] = "WMM.COF";
+    char *model_file = filename;
+    char *benchmark = "all";
+    int NumPoints = BENCH_DEFAULT_POINTS, Flag = TRUE;
+
+    if(argc > 1)
+        benchmark = argv[1];
+    if(argc > 2)
+        NumPoints = atoi(argv[2]);
+    if(argc > 3)
+        model_file = argv[3];
+    if(NumPoints <= 0 || (strcmp(benchmark, "all") && strcmp(benchmark, "batch") && strcmp(benchmark, "grid") &&
+            strcmp(benchmark, "fixed") && strcmp(benchmark, "file") && strcmp(benchmark, "gradient") && strcmp(benchmark, "geoid") &&
+            strcmp(benchmark, "series") && strcmp(benchmark, "raster") && strcmp(benchmark, "elements") &&
+            strcmp(benchmark, "trajectory")))
+    {
+        printf("Usage: wmm_bench [all|batch|grid|fixed|file|gradient|geoid|series|raster|elements|trajectory] [points] [coefficient file]\n");
+        return 1;
+    }
+    if(!MAG_robustReadMagModels(model_file, &MagneticModels, 1))
+    {
+        printf("\n %s not found.\n", model_file);
+        return 1;
+    }
+    MAG_SetDefaults(&Ellip, &Geoid);
+
+    if(!strcmp(benchmark, "all") || !strcmp(benchmark, "batch"))
+        Flag &= bench_batch(MagneticModels[0], Ellip, NumPoints);
+    if(!strcmp(benchmark, "all") || !strcmp(benchmark, "grid"))
+        Flag &= bench_grid(MagneticModels[0], Ellip, &Geoid, NumPoints);
+    if(!strcmp(benchmark, "all") || !strcmp(benchmark, "fixed"))
+        Flag &= bench_fixed(MagneticModels[0], Ellip, NumPoints);
+    if(!strcmp(benchmark, "all") || !strcmp(benchmark, "file"))
+        Flag &= bench_file(MagneticModels[0], Ellip, &Geoid, NumPoints);
+    if(!strcmp(benchmark, "all") || !strcmp(benchmark, "gradient"))
+        Flag &= bench_gradient(MagneticModels[0], Ellip, NumPoints);
+    if(!strcmp(benchmark, "all") || !strcmp(benchmark, "geoid"))
+        Flag &= bench_geoid(NumPoints);
+    if(!strcmp(benchmark, "all") || !strcmp(benchmark, "series"))
+        Flag &= bench_series(MagneticModels[0], Ellip, &Geoid, NumPoints);
+    if(!strcmp(benchmark, "all") || !strcmp(benchmark, "raster"))
+        Flag &= bench_raster(MagneticModels[0], Ellip, &Geoid, NumPoints);
+    if(!strcmp(benchmark, "all") || !strcmp(benchmark, "elements"))
+        Flag &= bench_elements(MagneticModels[0], Ellip, &Geoid, NumPoints);
+    if(!strcmp(benchmark, "all") || !strcmp(benchmark, "trajectory"))
+        Flag &= bench_trajectory(MagneticModels[0], Ellip, NumPoints);
+
+    MAG_FreeMagneticModelMemory(MagneticModels[0]);
+    return Flag ? 0 : 1;
+}
@@ -0,0 +1,131 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "GeomagnetismHeader.h"
+#include "GeomagBinaryLib.h"
+
+/*
+WMM binary coefficient file converter.
+
+Converts a text coefficient file to the binary coefficient format of GeomagBinaryLib.h, which
+MAG_MapBinaryModel (or MAG_OpenBinaryModel on a flash partition) uses in place without parsing.
+After writing, the binary file is mapped back and its coefficients are compared with the parsed
+ones. The time taken by the text reader and by the binary loader is printed.
+
+Usage:
+    wmm_bincof INPUT.COF OUTPUT.BCOF                 WMM.COF style coefficient file
+    wmm_bincof -s INPUT.SHDF OUTPUT.BCOF             First model of an SHDF file
+    wmm_bincof -l INPUT.COF INPUT_SV.COF OUTPUT.BCOF High degree model with a separate secular variation file
+    wmm_bincof -c FILE.BCOF                          Check a binary file and print its header
+ */
+
+static double bincof_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + 1e-9 * (double) ts.tv_nsec;
+}
+
+static void bincof_print(const char *filename, MAGtype_MagneticModel *MagneticModel)
+{
+    printf("%s: %s, epoch %.2f, valid to %.2f, nMax %d, nMaxSecVar %d, %d coefficients per array\n", filename, MagneticModel->ModelName,
+            MagneticModel->epoch, MagneticModel->CoefficientFileEndDate, MagneticModel->nMax, MagneticModel->nMaxSecVar,
+            CALCULATE_NUMTERMS(MagneticModel->nMax) + 1);
+}
+
+static int bincof_check(const char *filename)
+{
+    MAGtype_MagneticModel *MagneticModel;
+    double t0, t;
+
+    t0 = bincof_seconds();
+    MagneticModel = MAG_MapBinaryModel(filename, 1);
+    t = bincof_seconds() - t0;
+    if(MagneticModel == NULL)
+    {
+        printf("%s is not a valid binary coefficient file for this machine\n", filename);
+        return 1;
+    }
+    bincof_print(filename, MagneticModel);
+    printf("  mapped and checksum verified in %.3f ms\n", 1e3 * t);
+    MAG_UnmapBinaryModel(MagneticModel);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    MAGtype_MagneticModel * MagneticModels[1];
+    MAGtype_MagneticModel *MagneticModel = NULL, *Mapped;
+    char *input, *output;
+    double t0, tText, tBinary;
+    size_t n;
+    int Flag;
+
+    if(argc == 3 && !strcmp(argv[1], "-c"))
+        return bincof_check(argv[2]);
+
+    t0 = bincof_seconds();
+    if(argc == 3 && argv[1][0] != '-')
+    {
+        input = argv[1];
+        output = argv[2];
+        if(MAG_robustReadMagModels(input, &MagneticModels, 1))
+            MagneticModel = MagneticModels[0];
+    } else if(argc == 4 && !strcmp(argv[1], "-s"))
+    {
+        input = argv[2];
+        output = argv[3];
+        if(MAG_readMagneticModel_SHDF(input, &MagneticModels, 1) > 0)
+            MagneticModel = MagneticModels[0];
+    } else if(argc == 5 && !strcmp(argv[1], "-l"))
+    {
+        input = argv[2];
+        output = argv[4];
+        if(MAG_robustReadMagneticModel_Large(input, argv[3], &MagneticModels[0]))
+            MagneticModel = MagneticModels[0];
+    } else
+    {
+        printf("Usage: wmm_bincof INPUT.COF OUTPUT.BCOF\n");
+        printf("       wmm_bincof -s INPUT.SHDF OUTPUT.BCOF\n");
+        printf("       wmm_bincof -l INPUT.COF INPUT_SV.COF OUTPUT.BCOF\n");
+        printf("       wmm_bincof -c FILE.BCOF\n");
+        return 1;
+    }
+    tText = bincof_seconds() - t0;
+    if(MagneticModel == NULL)
+    {
+        printf("\n Error reading %s\n", input);
+        return 1;
+    }
+    if(!MAG_WriteBinaryModel(output, MagneticModel))
+    {
+        printf("Error writing %s\n", output);
+        MAG_FreeMagneticModelMemory(MagneticModel);
+        return 1;
+    }
+
+    t0 = bincof_seconds();
+    Mapped = MAG_MapBinaryModel(output, 0);
+    tBinary = bincof_seconds() - t0;
+    n = (CALCULATE_NUMTERMS(MagneticModel->nMax) + 1) * sizeof (double);
+    Flag = Mapped != NULL && Mapped->nMax == MagneticModel->nMax && Mapped->nMaxSecVar == MagneticModel->nMaxSecVar &&
+            Mapped->epoch == MagneticModel->epoch && !strcmp(Mapped->ModelName, MagneticModel->ModelName) &&
+            !memcmp(Mapped->Main_Field_Coeff_G, MagneticModel->Main_Field_Coeff_G, n) &&
+            !memcmp(Mapped->Main_Field_Coeff_H, MagneticModel->Main_Field_Coeff_H, n) &&
+            !memcmp(Mapped->Secular_Var_Coeff_G, MagneticModel->Secular_Var_Coeff_G, n) &&
+            !memcmp(Mapped->Secular_Var_Coeff_H, MagneticModel->Secular_Var_Coeff_H, n);
+    if(Flag)
+    {
+        bincof_print(output, Mapped);
+        printf("  text reader %.3f ms, binary loader %.3f ms\n", 1e3 * tText, 1e3 * tBinary);
+    } else
+        printf("Error: %s does not read back as the model of %s\n", output, input);
+
+    MAG_UnmapBinaryModel(Mapped);
+    MAG_FreeMagneticModelMemory(MagneticModel);
+    return Flag ? 0 : 1;
+}
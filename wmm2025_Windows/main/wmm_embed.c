@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "GeomagnetismHeader.h"
+
+/*
+WMM coefficient header generator.
+
+Reads a WMM.COF style coefficient file and writes a C header with the model as constant
+tables, for builds that embed the model instead of reading a file at startup (define
+MAG_EMBEDDED_WMM2025 when compiling GeomagnetismLibrary.c, see MAG_GetEmbeddedModel).
+Every coefficient is printed with the fewest digits (15 to 17) that read back as the same
+double, so the tables hold exactly the values the text reader produces.
+
+Usage: wmm_embed [coefficient file] [header file]
+    Defaults: WMM.COF and WMMEmbeddedCoefficients.h
+       wmm_embed -c [coefficient file]
+    Checks the constant table path: MAG_GeomagFixed against MAG_Geomag_ctx, bit for bit, on
+    EMBED_CHECK_POINTS pseudo random points (poles included) and on the vectors of
+    EMBED_TEST_VALUES when that file is in the current directory. When built with
+    MAG_EMBEDDED_WMM2025 the embedded model is compared with the coefficient file too.
+    Exits with 1 when a result differs.
+ */
+
+#define EMBED_CHECK_POINTS 200000
+#define EMBED_TEST_VALUES "WMM2025_TEST_VALUES.txt"
+
+static const char *embed_number(double value, char *buffer, size_t size)
+/* Shortest of %.15g, %.16g and %.17g that reads back as exactly the same double */
+{
+    int digits;
+
+    if(value == 0.0 && signbit(value))
+        return "-0.0"; /* A plain -0 would be the integer zero, losing the sign */
+
+    for(digits = 15; digits < 17; digits++)
+    {
+        snprintf(buffer, size, "%.*g", digits, value);
+        if(strtod(buffer, NULL) == value)
+            return buffer;
+    }
+    snprintf(buffer, size, "%.17g", value);
+    return buffer;
+}
+
+static void embed_array(FILE *fp, const char *name, const double *values, int count)
+{
+    char number[40];
+    int i;
+
+    fprintf(fp, "static const double %s[%d] = {", name, count);
+    for(i = 0; i < count; i++)
+        fprintf(fp, "%s%s%s", i ? "," : "", i % 6 ? " " : "\n    ", embed_number(values[i], number, sizeof (number)));
+    fprintf(fp, "\n};\n\n");
+}
+
+static double embed_uniform(unsigned long *state, double min, double max)
+/* Small linear congruential generator so the point set is the same on every platform */
+{
+    *state = *state * 6364136223846793005UL + 1442695040888963407UL;
+    return min + (max - min) * (double) ((*state >> 11) & 0xFFFFFFFFFFFFFUL) / (double) 0xFFFFFFFFFFFFFUL;
+}
+
+static int embed_check_point(MAGtype_MagneticModel *MagneticModel, MAGtype_MagneticModel *TimedMagneticModel, MAGtype_EvalContext *Context,
+        MAGtype_Ellipsoid Ellip, double DecimalYear, double Height, double Latitude, double Longitude, MAGtype_GeoMagneticElements *Fixed)
+/* Evaluates one point with MAG_Geomag_ctx and MAG_GeomagFixed, returns TRUE if the results are identical */
+{
+    MAGtype_CoordGeodetic CoordGeodetic;
+    MAGtype_CoordSpherical CoordSpherical;
+    MAGtype_Date UserDate;
+    MAGtype_GeoMagneticElements Reference;
+
+    CoordGeodetic.phi = Latitude;
+    CoordGeodetic.lambda = Longitude;
+    CoordGeodetic.HeightAboveEllipsoid = Height;
+    CoordGeodetic.HeightAboveGeoid = Height;
+    CoordGeodetic.UseGeoid = 0;
+    UserDate.DecimalYear = DecimalYear;
+    MAG_TimelyModifyMagneticModel(UserDate, MagneticModel, TimedMagneticModel);
+    MAG_GeodeticToSpherical(Ellip, CoordGeodetic, &CoordSpherical);
+    MAG_Geomag_ctx(Context, Ellip, CoordSpherical, CoordGeodetic, TimedMagneticModel, &Reference);
+    if(!MAG_GeomagFixed(Ellip, CoordSpherical, CoordGeodetic, TimedMagneticModel, Fixed))
+        return FALSE;
+    return Reference.Decl == Fixed->Decl && Reference.Incl == Fixed->Incl && Reference.F == Fixed->F && Reference.H == Fixed->H &&
+            Reference.X == Fixed->X && Reference.Y == Fixed->Y && Reference.Z == Fixed->Z &&
+            Reference.Decldot == Fixed->Decldot && Reference.Incldot == Fixed->Incldot && Reference.Fdot == Fixed->Fdot &&
+            Reference.Hdot == Fixed->Hdot && Reference.Xdot == Fixed->Xdot && Reference.Ydot == Fixed->Ydot && Reference.Zdot == Fixed->Zdot;
+}
+
+static int embed_check(const char *model_file)
+/* MAG_GeomagFixed against MAG_Geomag_ctx on pseudo random points and the test vectors, and the embedded model against the file */
+{
+    MAGtype_MagneticModel * MagneticModels[1];
+    MAGtype_MagneticModel *MagneticModel, *TimedMagneticModel;
+    MAGtype_EvalContext *Context;
+    MAGtype_Ellipsoid Ellip;
+    MAGtype_Geoid Geoid;
+    MAGtype_GeoMagneticElements Fixed;
+    char line[512];
+    double v[11], deviation = 0.0;
+    unsigned long state = 20250101UL;
+    int i, count = 0, mismatches = 0, vector_mismatches = 0;
+    FILE *fp;
+
+    if(!MAG_robustReadMagModels((char *) model_file, &MagneticModels, 1))
+    {
+        printf("\n %s not found.\n", model_file);
+        return FALSE;
+    }
+    MagneticModel = MagneticModels[0];
+    if(MagneticModel->nMax != MAG_FIXED_NMAX || MagneticModel->nMaxSecVar != MAG_FIXED_NMAX)
+    {
+        printf("%s is not of degree %d, MAG_GeomagFixed does not apply\n", model_file, MAG_FIXED_NMAX);
+        MAG_FreeMagneticModelMemory(MagneticModel);
+        return FALSE;
+    }
+    TimedMagneticModel = MAG_AllocateModelMemory((MagneticModel->nMax + 1) * (MagneticModel->nMax + 2) / 2);
+    Context = MAG_AllocateEvalContext(MagneticModel->nMax);
+    if(TimedMagneticModel == NULL || Context == NULL)
+    {
+        printf("Error allocating in embed_check\n");
+        return FALSE;
+    }
+    MAG_SetDefaults(&Ellip, &Geoid);
+
+    for(i = 0; i < EMBED_CHECK_POINTS; i++)
+    {
+        v[2] = i % 1000 == 0 ? (i % 2000 ? -90.0 : 90.0) : embed_uniform(&state, -90.0, 90.0);
+        v[3] = embed_uniform(&state, -180.0, 180.0);
+        v[1] = embed_uniform(&state, -1.0, 600.0);
+        if(!embed_check_point(MagneticModel, TimedMagneticModel, Context, Ellip, MagneticModel->epoch + 2.5, v[1], v[2], v[3], &Fixed))
+            mismatches++;
+    }
+    printf("MAG_GeomagFixed: %d of %d points differ from MAG_Geomag_ctx\n", mismatches, EMBED_CHECK_POINTS);
+
+    fp = fopen(EMBED_TEST_VALUES, "r");
+    if(fp == NULL)
+        printf("  %s not found, test vectors skipped\n", EMBED_TEST_VALUES);
+    else
+    {
+        while(fgets(line, sizeof (line), fp) != NULL)
+        {
+            /* Date, height (km), latitude, longitude, X, Y, Z, H, F, I, D */
+            if(line[0] == '#' || sscanf(line, "%lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf", &v[0], &v[1], &v[2], &v[3],
+                    &v[4], &v[5], &v[6], &v[7], &v[8], &v[9], &v[10]) != 11)
+                continue;
+            count++;
+            if(!embed_check_point(MagneticModel, TimedMagneticModel, Context, Ellip, v[0], v[1], v[2], v[3], &Fixed))
+                vector_mismatches++;
+            deviation = fmax(deviation, fabs(Fixed.X - v[4]));
+            deviation = fmax(deviation, fabs(Fixed.Y - v[5]));
+            deviation = fmax(deviation, fabs(Fixed.Z - v[6]));
+            deviation = fmax(deviation, fabs(Fixed.F - v[8]));
+        }
+        fclose(fp);
+        printf("  %d of %d test vectors differ from MAG_Geomag_ctx, largest X/Y/Z/F deviation from the published values %.3f nT\n",
+                vector_mismatches, count, deviation);
+        mismatches += vector_mismatches;
+    }
+
+#ifdef MAG_EMBEDDED_WMM2025
+    {
+        MAGtype_MagneticModel Embedded;
+        size_t n = (CALCULATE_NUMTERMS(MagneticModel->nMax) + 1) * sizeof (double);
+
+        MAG_GetEmbeddedModel(&Embedded);
+        if(Embedded.nMax != MagneticModel->nMax || Embedded.epoch != MagneticModel->epoch ||
+                memcmp(Embedded.Main_Field_Coeff_G, MagneticModel->Main_Field_Coeff_G, n) ||
+                memcmp(Embedded.Main_Field_Coeff_H, MagneticModel->Main_Field_Coeff_H, n) ||
+                memcmp(Embedded.Secular_Var_Coeff_G, MagneticModel->Secular_Var_Coeff_G, n) ||
+                memcmp(Embedded.Secular_Var_Coeff_H, MagneticModel->Secular_Var_Coeff_H, n))
+        {
+            printf("The embedded model %s differs from %s\n", Embedded.ModelName, model_file);
+            mismatches++;
+        } else
+            printf("The embedded model %s matches %s\n", Embedded.ModelName, model_file);
+    }
+#endif
+
+    printf("%s\n", mismatches == 0 ? "PASSED" : "FAILED");
+    MAG_FreeMagneticModelMemory(TimedMagneticModel);
+    MAG_FreeEvalContext(Context);
+    MAG_FreeMagneticModelMemory(MagneticModel);
+    return mismatches == 0;
+}
+
+int main(int argc, char *argv[])
+{
+    MAGtype_MagneticModel * MagneticModels[1];
+    MAGtype_MagneticModel *MagneticModel;
+    char *model_file = "WMM.COF", *header_file = "WMMEmbeddedCoefficients.h";
+    char number[40];
+    int count;
+    FILE *fp;
+
+    if(argc > 1 && !strcmp(argv[1], "-c"))
+        return embed_check(argc > 2 ? argv[2] : model_file) ? 0 : 1;
+    if(argc > 1)
+        model_file = argv[1];
+    if(argc > 2)
+        header_file = argv[2];
+    if(!MAG_robustReadMagModels(model_file, &MagneticModels, 1))
+    {
+        printf("\n %s not found.\n", model_file);
+        return 1;
+    }
+    MagneticModel = MagneticModels[0];
+    count = CALCULATE_NUMTERMS(MagneticModel->nMax) + 1;
+
+    fp = fopen(header_file, "w");
+    if(fp == NULL)
+    {
+        printf("Error opening %s to write\n", header_file);
+        return 1;
+    }
+    fprintf(fp, "/*\n * %s coefficients, generated by wmm_embed from %s. Do not edit.\n", MagneticModel->ModelName, model_file);
+    fprintf(fp, " * Included by GeomagnetismLibrary.c when MAG_EMBEDDED_WMM2025 is defined.\n */\n\n");
+    fprintf(fp, "#ifndef WMMEMBEDDEDCOEFFICIENTS_H\n#define WMMEMBEDDEDCOEFFICIENTS_H\n\n");
+    fprintf(fp, "#define MAG_EMBEDDED_MODEL_NAME \"%s\"\n", MagneticModel->ModelName);
+    fprintf(fp, "#define MAG_EMBEDDED_NMAX %d\n", MagneticModel->nMax);
+    fprintf(fp, "#define MAG_EMBEDDED_NMAXSECVAR %d\n", MagneticModel->nMaxSecVar);
+    fprintf(fp, "#define MAG_EMBEDDED_EPOCH %s\n", embed_number(MagneticModel->epoch, number, sizeof (number)));
+    fprintf(fp, "#define MAG_EMBEDDED_EDITION_DATE %s\n", embed_number(MagneticModel->EditionDate, number, sizeof (number)));
+    fprintf(fp, "#define MAG_EMBEDDED_MIN_YEAR %s\n", embed_number(MagneticModel->min_year, number, sizeof (number)));
+    fprintf(fp, "#define MAG_EMBEDDED_END_DATE %s\n", embed_number(MagneticModel->CoefficientFileEndDate, number, sizeof (number)));
+    fprintf(fp, "#define MAG_EMBEDDED_NUMTERMS %d /* Entries per array, CALCULATE_NUMTERMS(nMax) + 1 */\n\n", count);
+    embed_array(fp, "MAG_EmbeddedMain_Field_Coeff_G", MagneticModel->Main_Field_Coeff_G, count);
+    embed_array(fp, "MAG_EmbeddedMain_Field_Coeff_H", MagneticModel->Main_Field_Coeff_H, count);
+    embed_array(fp, "MAG_EmbeddedSecular_Var_Coeff_G", MagneticModel->Secular_Var_Coeff_G, count);
+    embed_array(fp, "MAG_EmbeddedSecular_Var_Coeff_H", MagneticModel->Secular_Var_Coeff_H, count);
+    fprintf(fp, "#endif /*WMMEMBEDDEDCOEFFICIENTS_H*/\n");
+    if(fclose(fp) != 0)
+    {
+        printf("Error writing %s\n", header_file);
+        return 1;
+    }
+    printf("%s: %s, nMax %d, %d coefficients per array\n", header_file, MagneticModel->ModelName, MagneticModel->nMax, count);
+    MAG_FreeMagneticModelMemory(MagneticModel);
+    return 0;
+}
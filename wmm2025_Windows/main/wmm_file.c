@@ -10,6 +10,10 @@ The program uses the user interface developed for geomag61.c
 Note the option for geocentric height (C) is not supported in this version
 The height entered is considered as height above mean sea level
 
+wmm_file c [lines] writes a coordinate file of FILE_CHECK_LINES (or the given number of) rows,
+converts it with the 'f' loop and with the 's' switch on several thread counts, and exits with 1
+unless every output is the same byte for byte.
+
 Manoj.C.Nair@Noaa.Gov
 November 15, 2009
 
@@ -28,6 +32,7 @@ Updated April, 2023
 #include <math.h>               /* for gcc */
 
 #include "GeomagnetismHeader.h"
+#include "GeomagFileLib.h"
 #include "EGM9615.h"
 #include "version.h"
 
@@ -45,6 +50,8 @@ Updated April, 2023
 
 #define PATH MAXREAD
 
+#define FILE_CHECK_LINES 100000 /* Rows of the generated coordinate file of the 'c' switch */
+
 
 
 
@@ -111,6 +118,7 @@ int main(int argc, char *argv[])
     /*  WMM Variable declaration  */
 
     MAGtype_MagneticModel *TimedMagneticModel, *MagneticModels[1];
+    MAGtype_TimedModelCache *TimedModels;
     MAGtype_Ellipsoid Ellip;
     MAGtype_CoordSpherical CoordSpherical;
     MAGtype_CoordGeodetic CoordGeodetic;
@@ -125,7 +133,7 @@ int main(int argc, char *argv[])
         char filename[] = "WMM.COF";
         char program_name[] = "wmm_file";
     #endif
-    int NumTerms, epochs = 1, epoch = 0, i, nMax = 0, printErrors = 0;
+    int epochs = 1, epoch = 0, i, nMax = 0, printErrors = 0;
     char VersionDate[12];
 
     int print_boz_warning_strong = FALSE;
@@ -148,7 +156,11 @@ int main(int argc, char *argv[])
 
 
     int coords_from_file = 0;
+    int stream = 0;
     int arg_err = 0;
+    MAGtype_FileParameters FileParameters;
+    MAGtype_FileStatus FileStatus;
+    char *stream_threads;
 
     char *begin;
     char *rest;
@@ -179,6 +191,7 @@ int main(int argc, char *argv[])
     void print_result_file(FILE *outf, double d, double i, double h, double x, double y, double z, double f,
             double ddot, double idot, double hdot, double xdot, double ydot, double zdot, double fdot);
     void append_errors_to_result_file(FILE *outf, MAGtype_GeoMagneticElements Errors);
+    int file_check(MAGtype_MagneticModel *MagneticModel, MAGtype_Ellipsoid Ellip, MAGtype_Geoid *Geoid, int NumLines);
 
     int coords_header_fmt_size = 30;
     char* coords_header_fmt = (char*) calloc(coords_header_fmt_size, sizeof(char));
@@ -220,11 +233,10 @@ int main(int argc, char *argv[])
         return 1;
     }
     for(i = 0; i < epochs; i++) if(MagneticModels[i]->nMax > nMax) nMax = MagneticModels[i]->nMax;
-    NumTerms = ((nMax + 1) * (nMax + 2) / 2);
 
-    TimedMagneticModel = MAG_AllocateModelMemory(NumTerms); /* For storing the time modified WMM Model parameters */
+    TimedModels = MAG_AllocateTimedModelCache(epochs, nMax); /* For storing the time modified WMM Model parameters, one per epoch */
 
-    for(i = 0; i < epochs; i++) if(MagneticModels[i] == NULL || TimedMagneticModel == NULL)
+    for(i = 0; i < epochs; i++) if(MagneticModels[i] == NULL || TimedModels == NULL)
         {
             MAG_Error(2);
         }
@@ -243,6 +255,15 @@ int main(int argc, char *argv[])
         if(argv[iarg] != NULL)
             strncpy(args[iarg], argv[iarg], MAXREAD);
 
+    if((argc == 2 || argc == 3) && *(args[1]) == 'c')
+    {
+        /* 'c' switch: the streaming path against the line by line loop on a generated file */
+        i = file_check(MagneticModels[0], Ellip, &Geoid, argc == 3 ? atoi(args[2]) : FILE_CHECK_LINES);
+        MAG_FreeMagneticModelMemory(MagneticModels[0]);
+        MAG_FreeTimedModelCache(TimedModels);
+        exit(i ? 0 : 1);
+    }
+
     printf("\n\n-----------------------------------------------\n");
     printf(" %s File processing program %s", MagneticModels[0]->ModelName, VersionDate);
     printf("\n-----------------------------------------------\n");
@@ -261,6 +282,8 @@ int main(int argc, char *argv[])
             printf("           --- Software Release Date: %s ---\n",  VersionDate);
             printf("USAGE:\n");
             printf("For example: %s f input_file output_file\n", program_name);
+            printf("Streaming:   %s s input_file output_file (same output, for large files)\n", program_name);
+            printf("Check:       %s c [lines] ('s' against 'f' on a generated file)\n", program_name);
             printf("This screen: %s h \n", program_name);
             printf("\n");
             printf("The input file may have any number of entries but they must follow\n");
@@ -284,11 +307,11 @@ int main(int argc, char *argv[])
         } while (NULL == fgets(ans, 20, stdin));
 
         for(i = 0; i < epochs; i++) MAG_FreeMagneticModelMemory(MagneticModels[i]);
-        MAG_FreeMagneticModelMemory(TimedMagneticModel);
+        MAG_FreeTimedModelCache(TimedModels);
         exit(2);
     } /* help */
 
-    if((argc == 4) && (*(args[1]) == 'f'))
+    if((argc == 4) && (*(args[1]) == 'f' || *(args[1]) == 's'))
     {
         printf("\n\n 'f' switch: converting file with multiple locations.\n");
         printf("     The first five output columns repeat the input coordinates.\n");
@@ -296,6 +319,7 @@ int main(int argc, char *argv[])
         printf("     Finally the SV: dD, dI, dH, dX, dY, dZ,  and dF\n");
 
         coords_from_file = 1;
+        stream = *(args[1]) == 's';
         strncpy(coord_fname, args[2], MAXREAD);
         coordfile = fopen(coord_fname, "rt");
         strncpy(out_fname, args[3], MAXREAD);
@@ -328,7 +352,7 @@ int main(int argc, char *argv[])
             printf("\n\nERROR in 'f' switch option: wrong number of arguments2\n");
             exit(2);
         }
-        if((*(args[1]) == 'f') || (*(args[2]) == 'f'))
+        if((*(args[1]) == 'f') || (*(args[2]) == 'f') || (*(args[1]) == 's') || (*(args[2]) == 's'))
         {
                 printf("\n\n 'f' switch: converting file with multiple locations.\n");
                 printf("     The first five output columns repeat the input coordinates.\n");
@@ -336,6 +360,7 @@ int main(int argc, char *argv[])
                 printf("     Finally the SV: dD, dI, dH, dX, dY, dZ,  and dF\n");
 
                 coords_from_file = 1;
+                stream = (*(args[1]) == 's') || (*(args[2]) == 's');
                 strncpy(coord_fname, args[3], MAXREAD);
                 coordfile = fopen(coord_fname, "rt");
                 strncpy(out_fname, args[4], MAXREAD);
@@ -351,8 +376,36 @@ int main(int argc, char *argv[])
 
 
     snprintf(coords_header_fmt, coords_header_fmt_size, "%%%ds%%%ds%%%ds%%%ds%%%ds", MAXREAD, MAXREAD, MAXREAD, MAXREAD, MAXREAD); 
-    
-    while(fgets(line, line_size, coordfile) != NULL && arg_err == 0)
+
+    if(stream)
+    {
+        /* 's' switch: the same rows, read in chunks, evaluated in batches and written in blocks */
+        FileParameters.PrintErrors = printErrors;
+        FileParameters.MinYear = minyr;
+        FileParameters.MaxYear = maxyr;
+        FileParameters.MinHeight = -1;
+        FileParameters.MaxHeight = 1900;
+        for(i = 0; i < 6; i++)
+            FileParameters.InitialArgs[i] = args[i];
+        FileParameters.NumThreads = 0; /* One evaluation thread per online processor */
+        stream_threads = getenv("WMM_FILE_THREADS");
+        if(stream_threads != NULL && atoi(stream_threads) > 0)
+            FileParameters.NumThreads = atoi(stream_threads);
+        if(!MAG_FileStream(&FileParameters, MagneticModels[0], &Geoid, Ellip, coordfile, outfile, stdout, &FileStatus))
+        {
+            printf("\nError processing %s: out of memory or output not written\n\n", coord_fname);
+            exit(1);
+        }
+        if(FileStatus.RangeError)
+            exit(2);
+        iline = (int) FileStatus.NumLines;
+        arg_err = FileStatus.ArgError;
+        print_boz_warning_strong = FileStatus.BozWarningStrong;
+        print_boz_warning_weak = FileStatus.BozWarningWeak;
+        print_alt_warning = FileStatus.AltitudeWarning;
+    }
+
+    while(!stream && fgets(line, line_size, coordfile) != NULL && arg_err == 0)
     {
         if(coords_from_file)
         {
@@ -642,7 +695,7 @@ int main(int argc, char *argv[])
             epoch = epochs - 1;
         if(epoch < 0)
             epoch = 0;
-        MAG_TimelyModifyMagneticModel(UserDate, MagneticModels[epoch], TimedMagneticModel); /* Time adjust the coefficients, Equation 19, WMM Technical report */
+        TimedMagneticModel = MAG_TimelyModifyMagneticModel_cache(TimedModels, UserDate, MagneticModels[epoch]); /* Time adjust the coefficients, Equation 19, WMM Technical report. Rows with the date of an earlier row reuse its coefficients. */
         MAG_Geomag(Ellip, CoordSpherical, CoordGeodetic, TimedMagneticModel, &GeoMagneticElements); /* Computes the geoMagnetic field elements and their time change*/
         MAG_CalculateGridVariation(CoordGeodetic, &GeoMagneticElements);
         
@@ -704,8 +757,16 @@ int main(int argc, char *argv[])
 
 
     if(coords_from_file) printf("\n Processed %1d lines\n\n", iline);
+    if(coords_from_file && !stream) printf(" Time adjusted models: %lu reused, %lu computed\n\n", TimedModels->Hits, TimedModels->Misses);
+    if(stream && FileStatus.Seconds > 0)
+    {
+        printf(" Streamed in %.3f s, %.0f lines/s\n", FileStatus.Seconds, (double) FileStatus.NumLines / FileStatus.Seconds);
+        printf(" Stage utilization: reader %.0f%%, %d evaluation threads %.0f%%, writer %.0f%%\n\n",
+                100.0 * FileStatus.ReaderSeconds / FileStatus.Seconds, FileStatus.NumThreads,
+                100.0 * FileStatus.WorkerSeconds / (FileStatus.NumThreads * FileStatus.Seconds), 100.0 * FileStatus.WriterSeconds / FileStatus.Seconds);
+    }
 
-    if(coords_from_file && !feof(coordfile) && arg_err) {
+    if(coords_from_file && (stream ? !FileStatus.AtEndOfFile : !feof(coordfile)) && arg_err) {
         printf("Terminated prematurely due to argument error in coordinate file\n\n");
         exit(1);    
     }
@@ -729,7 +790,7 @@ int main(int argc, char *argv[])
     for(i = 0; i < epochs; i++) MAG_FreeMagneticModelMemory(MagneticModels[i]);
     for(int i = 0; i < args_row; i++) free(args[i]);
     free(args);
-    MAG_FreeMagneticModelMemory(TimedMagneticModel);
+    MAG_FreeTimedModelCache(TimedModels);
 
     free(coords_header_fmt);
     free(inbuff);
@@ -792,5 +853,164 @@ void append_errors_to_result_file(FILE *outf, MAGtype_GeoMagneticElements Errors
     return;
 } /* append_errors_to_result_file */
 
+static double file_check_uniform(unsigned long *state, double min, double max)
+/* Small linear congruential generator so the coordinate file is the same on every platform */
+{
+    *state = *state * 6364136223846793005UL + 1442695040888963407UL;
+    return min + (max - min) * (double) ((*state >> 11) & 0xFFFFFFFFFFFFFUL) / (double) 0xFFFFFFFFFFFFFUL;
+}
+
+static int file_check_generate(FILE *stream, MAGtype_MagneticModel *MagneticModel, int NumLines)
+/* Coordinate file rows with heights above the ellipsoid in all units and a varying number of decimals (dates stay
+   below the end of the model when rounded to whole years) */
+{
+    static const char Units[] = "KkMmFf";
+    unsigned long state = 20250101UL;
+    double Height;
+    int i, u;
+
+    for(i = 0; i < NumLines; i++)
+    {
+        u = (int) file_check_uniform(&state, 0.0, 5.999);
+        Height = file_check_uniform(&state, 0.0, 300.0);
+        if(u >= 4)
+            Height *= 3280.0839895;
+        else if(u >= 2)
+            Height *= 1000.0;
+        if(fprintf(stream, "%.*f E %c%.*f %.*f %.*f\n", i % 4, file_check_uniform(&state, MagneticModel->epoch, MagneticModel->epoch + 4.4),
+                Units[u], i % 3, Height, 2 + i % 7, file_check_uniform(&state, -90.0, 90.0), 2 + i % 5,
+                file_check_uniform(&state, -180.0, 360.0)) < 0)
+            return FALSE;
+    }
+    rewind(stream);
+    return TRUE;
+}
+
+static void file_check_reference(FILE *In, FILE *Out, MAGtype_MagneticModel *MagneticModel, MAGtype_Ellipsoid Ellip, MAGtype_Geoid *Geoid)
+/* The 'f' loop for valid rows with heights above the ellipsoid, with the model time adjusted for every row */
+{
+    MAGtype_MagneticModel *TimedMagneticModel;
+    MAGtype_CoordSpherical CoordSpherical;
+    MAGtype_CoordGeodetic CoordGeodetic;
+    MAGtype_Date UserDate;
+    MAGtype_GeoMagneticElements GeoMagneticElements, Errors;
+    char line[100], args[6][MAXREAD];
+    int units;
+
+    void print_result_file(FILE *outf, double d, double i, double h, double x, double y, double z, double f,
+            double ddot, double idot, double hdot, double xdot, double ydot, double zdot, double fdot);
+    void append_errors_to_result_file(FILE *outf, MAGtype_GeoMagneticElements Errors);
+
+    TimedMagneticModel = MAG_AllocateModelMemory((MagneticModel->nMax + 1) * (MagneticModel->nMax + 2) / 2);
+    if(TimedMagneticModel == NULL)
+        MAG_Error(2);
+    Geoid->UseGeoid = 0;
+    while(fgets(line, sizeof (line), In) != NULL)
+    {
+        sscanf(line, "%92s%92s%92s%92s%92s", args[1], args[2], args[3], args[4], args[5]);
+        CoordGeodetic.lambda = atof(args[5]);
+        CoordGeodetic.phi = atof(args[4]);
+        units = toupper((unsigned char) args[3][0]);
+        CoordGeodetic.HeightAboveGeoid = atof(args[3] + 1);
+        if(units == 'M')
+            CoordGeodetic.HeightAboveGeoid *= 0.001;
+        else if(units == 'F')
+            CoordGeodetic.HeightAboveGeoid /= 3280.0839895;
+        UserDate.DecimalYear = atof(args[1]);
+        MAG_ConvertGeoidToEllipsoidHeight(&CoordGeodetic, Geoid);
+        MAG_GeodeticToSpherical(Ellip, CoordGeodetic, &CoordSpherical);
+        MAG_TimelyModifyMagneticModel(UserDate, MagneticModel, TimedMagneticModel);
+        MAG_Geomag(Ellip, CoordSpherical, CoordGeodetic, TimedMagneticModel, &GeoMagneticElements);
+
+        fprintf(Out, "%s %s %s %s %s ", args[1], args[2], args[3], args[4], args[5]);
+        print_result_file(Out, GeoMagneticElements.Decl, GeoMagneticElements.Incl, GeoMagneticElements.H, GeoMagneticElements.X,
+                GeoMagneticElements.Y, GeoMagneticElements.Z, GeoMagneticElements.F, 60 * GeoMagneticElements.Decldot,
+                60 * GeoMagneticElements.Incldot, GeoMagneticElements.Hdot, GeoMagneticElements.Xdot, GeoMagneticElements.Ydot,
+                GeoMagneticElements.Zdot, GeoMagneticElements.Fdot);
+#if WMMHR
+        MAG_WMMHRErrorCalc(GeoMagneticElements.H, &Errors);
+#else
+        MAG_WMMErrorCalc(GeoMagneticElements.H, &Errors);
+#endif
+        append_errors_to_result_file(Out, Errors);
+        fprintf(Out, "\n");
+    }
+    MAG_FreeMagneticModelMemory(TimedMagneticModel);
+} /* file_check_reference */
+
+static int file_check_compare(FILE *a, FILE *b)
+/* TRUE if the two streams have the same contents */
+{
+    static char BufferA[1 << 16], BufferB[1 << 16];
+    size_t na, nb;
 
+    rewind(a);
+    rewind(b);
+    do
+    {
+        na = fread(BufferA, 1, sizeof (BufferA), a);
+        nb = fread(BufferB, 1, sizeof (BufferB), b);
+        if(na != nb || memcmp(BufferA, BufferB, na) != 0)
+            return FALSE;
+    } while(na > 0);
+    return TRUE;
+} /* file_check_compare */
+
+int file_check(MAGtype_MagneticModel *MagneticModel, MAGtype_Ellipsoid Ellip, MAGtype_Geoid *Geoid, int NumLines)
+/* Writes a coordinate file of NumLines rows, converts it with the 'f' loop and with MAG_FileStream ('s' switch, with errors)
+   on 1, 2, 4, ... evaluation threads up to the number of online processors (at least 4), and compares the outputs byte
+   for byte. Returns TRUE when all of them are the same. */
+{
+    MAGtype_FileParameters FileParameters;
+    MAGtype_FileStatus FileStatus;
+    FILE *In, *Reference, *Out;
+    int Flag = TRUE, Threads, MaxThreads;
 
+    if(NumLines < 1)
+    {
+        printf("Usage: wmm_file c [lines]\n");
+        return FALSE;
+    }
+    In = tmpfile();
+    Reference = tmpfile();
+    if(In == NULL || Reference == NULL || !file_check_generate(In, MagneticModel, NumLines))
+    {
+        printf("Error writing temporary files\n");
+        return FALSE;
+    }
+    file_check_reference(In, Reference, MagneticModel, Ellip, Geoid);
+    fflush(Reference);
+    MaxThreads = MAG_FileDefaultThreads();
+    if(MaxThreads < 4)
+        MaxThreads = 4; /* Still exercise the ordered writer on small machines */
+    printf("%d generated lines, %s\n", NumLines, MagneticModel->ModelName);
+
+    memset(&FileParameters, 0, sizeof (MAGtype_FileParameters));
+    FileParameters.PrintErrors = 1;
+    FileParameters.MinYear = MagneticModel->min_year;
+    FileParameters.MaxYear = MagneticModel->CoefficientFileEndDate;
+    FileParameters.MinHeight = -1;
+    FileParameters.MaxHeight = 1900;
+    for(Threads = 1; Flag && Threads <= MaxThreads; Threads = (Threads * 2 > MaxThreads && Threads < MaxThreads) ? MaxThreads : Threads * 2)
+    {
+        FileParameters.NumThreads = Threads;
+        rewind(In);
+        Out = tmpfile();
+        if(Out == NULL || !MAG_FileStream(&FileParameters, MagneticModel, Geoid, Ellip, In, Out, stdout, &FileStatus))
+        {
+            printf("Error processing the coordinate file\n");
+            if(Out != NULL)
+                fclose(Out);
+            Flag = FALSE;
+            break;
+        }
+        fflush(Out);
+        Flag = FileStatus.NumLines == NumLines && file_check_compare(Reference, Out);
+        fclose(Out);
+        printf("  's' switch, %d evaluation threads: %s\n", FileStatus.NumThreads, Flag ? "same as the 'f' loop" : "OUTPUT DIFFERS");
+    }
+    printf("%s\n", Flag ? "PASSED" : "FAILED");
+    fclose(In);
+    fclose(Reference);
+    return Flag;
+} /* file_check */
@@ -0,0 +1,303 @@
+#define _POSIX_C_SOURCE 200809L /* clock_gettime */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "GeomagnetismHeader.h"
+#include "GeomagFloatLib.h"
+
+/*
+WMM single precision audit program.
+
+Sweeps a latitude / longitude grid over the whole globe at several heights and dates spanning the
+validity of the model, and compares MAG_GeomagFloat with the double precision path (MAG_GeomagBatch,
+which is bit identical to MAG_Geomag). It reports the worst difference of every element and the
+worst declination, inclination and total intensity difference relative to the uncertainty of
+MAG_WMMErrorCalc at the same point. The program exits with status 1 if a difference exceeds
+AUDIT_LIMIT times that uncertainty. It expects WMM.COF to be in the current directory, or the
+coefficient file to be given as the second argument.
+
+Before the sweep the reference itself is checked: MAG_GeomagBatch, and MAG_Geomag_ctx with the
+timed model cache, must give the same bits as MAG_Geomag on AUDIT_BATCH_POINTS pseudo random points
+whose dates arrive interleaved. The program exits with status 1 if they do not.
+
+Usage: wmm_float_audit [step degrees] [coefficient file]
+ */
+
+#define AUDIT_DEFAULT_STEP 1.0
+#define AUDIT_DATE_STEP 0.25 /* Decimal years between the dates of the sweep */
+#define AUDIT_LIMIT 0.01 /* Largest accepted difference, as a fraction of the MAG_WMMErrorCalc uncertainty */
+#define AUDIT_BATCH_POINTS 100000
+#define AUDIT_BATCH_DATES 4 /* Dates of the reference check, interleaved point by point */
+
+static const double AuditHeights[] = {-1.0, 0.0, 10.0, 100.0, 400.0, 850.0}; /* km above the ellipsoid */
+
+typedef struct {
+    double Worst; /* Largest absolute difference */
+    double Latitude, Longitude, Height, DecimalYear; /* Where it was found */
+} AuditWorst;
+
+static double audit_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + 1e-9 * (double) ts.tv_nsec;
+}
+
+static double audit_decl_difference(double a, double b)
+/* Declination difference wrapped to -180 ... 180 degrees */
+{
+    double d = a - b;
+
+    while(d > 180.0) d -= 360.0;
+    while(d < -180.0) d += 360.0;
+    return d;
+}
+
+static void audit_update(AuditWorst *Worst, double Difference, double Latitude, double Longitude, double Height, double DecimalYear)
+{
+    Difference = fabs(Difference);
+    if(Difference > Worst->Worst || MAG_isNaN(Difference))
+    {
+        Worst->Worst = Difference;
+        Worst->Latitude = Latitude;
+        Worst->Longitude = Longitude;
+        Worst->Height = Height;
+        Worst->DecimalYear = DecimalYear;
+    }
+}
+
+static void audit_print(const char *Name, const char *Unit, AuditWorst *Worst)
+{
+    printf("  %-26s %12.6g %-7s at lat %8.3f lon %8.3f height %6.1f km date %9.4f\n", Name, Worst->Worst, Unit, Worst->Latitude,
+            Worst->Longitude, Worst->Height, Worst->DecimalYear);
+}
+
+static double audit_uniform(unsigned long *state, double min, double max)
+/* Small linear congruential generator so the point set is the same on every platform */
+{
+    *state = *state * 6364136223846793005UL + 1442695040888963407UL;
+    return min + (max - min) * (double) ((*state >> 11) & 0xFFFFFFFFFFFFFUL) / (double) 0xFFFFFFFFFFFFFUL;
+}
+
+static int audit_elements_equal(MAGtype_GeoMagneticElements *a, MAGtype_GeoMagneticElements *b)
+{
+    return a->Decl == b->Decl && a->Incl == b->Incl && a->F == b->F && a->H == b->H &&
+            a->X == b->X && a->Y == b->Y && a->Z == b->Z &&
+            a->Decldot == b->Decldot && a->Incldot == b->Incldot && a->Fdot == b->Fdot && a->Hdot == b->Hdot &&
+            a->Xdot == b->Xdot && a->Ydot == b->Ydot && a->Zdot == b->Zdot;
+}
+
+static int audit_reference(MAGtype_MagneticModel *MagneticModel, MAGtype_Ellipsoid Ellip)
+/* MAG_GeomagBatch and MAG_Geomag_ctx with the timed model cache against MAG_Geomag, returns the number of differing results */
+{
+    MAGtype_MagneticModel *TimedMagneticModel;
+    MAGtype_TimedModelCache *TimedModels;
+    MAGtype_EvalContext *Context;
+    MAGtype_CoordGeodetic CoordGeodetic;
+    MAGtype_CoordSpherical CoordSpherical;
+    MAGtype_Date UserDate;
+    MAGtype_GeoMagneticElements *Reference, *Results, Cached;
+    double *Latitude, *Longitude, *Heights, *Years;
+    unsigned long state = 20250101UL;
+    int i, mismatches = 0;
+
+    Latitude = (double *) malloc(AUDIT_BATCH_POINTS * sizeof (double));
+    Longitude = (double *) malloc(AUDIT_BATCH_POINTS * sizeof (double));
+    Heights = (double *) malloc(AUDIT_BATCH_POINTS * sizeof (double));
+    Years = (double *) malloc(AUDIT_BATCH_POINTS * sizeof (double));
+    Reference = (MAGtype_GeoMagneticElements *) malloc(AUDIT_BATCH_POINTS * sizeof (MAGtype_GeoMagneticElements));
+    Results = (MAGtype_GeoMagneticElements *) malloc(AUDIT_BATCH_POINTS * sizeof (MAGtype_GeoMagneticElements));
+    TimedMagneticModel = MAG_AllocateModelMemory((MagneticModel->nMax + 1) * (MagneticModel->nMax + 2) / 2);
+    TimedModels = MAG_AllocateTimedModelCache(AUDIT_BATCH_DATES, MagneticModel->nMax);
+    Context = MAG_AllocateEvalContext(MagneticModel->nMax);
+    if(!Latitude || !Longitude || !Heights || !Years || !Reference || !Results || !TimedMagneticModel || !TimedModels || !Context)
+    {
+        printf("Error allocating audit memory\n");
+        return AUDIT_BATCH_POINTS;
+    }
+    /* Survey style input: many sites, a handful of dates, dates arriving interleaved */
+    for(i = 0; i < AUDIT_BATCH_POINTS; i++)
+    {
+        Latitude[i] = audit_uniform(&state, -89.0, 89.0);
+        Longitude[i] = audit_uniform(&state, -180.0, 180.0);
+        Heights[i] = audit_uniform(&state, 0.0, 10.0);
+        Years[i] = MagneticModel->epoch + 0.5 * (double) (i % AUDIT_BATCH_DATES);
+    }
+    CoordGeodetic.UseGeoid = 0;
+    for(i = 0; i < AUDIT_BATCH_POINTS; i++)
+    {
+        CoordGeodetic.phi = Latitude[i];
+        CoordGeodetic.lambda = Longitude[i];
+        CoordGeodetic.HeightAboveEllipsoid = Heights[i];
+        CoordGeodetic.HeightAboveGeoid = Heights[i];
+        UserDate.DecimalYear = Years[i];
+        MAG_TimelyModifyMagneticModel(UserDate, MagneticModel, TimedMagneticModel);
+        MAG_GeodeticToSpherical(Ellip, CoordGeodetic, &CoordSpherical);
+        MAG_Geomag(Ellip, CoordSpherical, CoordGeodetic, TimedMagneticModel, &Reference[i]);
+        MAG_Geomag_ctx(Context, Ellip, CoordSpherical, CoordGeodetic, MAG_TimelyModifyMagneticModel_cache(TimedModels, UserDate, MagneticModel), &Cached);
+        if(!audit_elements_equal(&Reference[i], &Cached))
+            mismatches++;
+    }
+    MAG_GeomagBatch(Ellip, MagneticModel, AUDIT_BATCH_POINTS, Latitude, Longitude, Heights, Years, Results);
+    for(i = 0; i < AUDIT_BATCH_POINTS; i++)
+        if(!audit_elements_equal(&Reference[i], &Results[i]))
+            mismatches++;
+    printf("Reference: %d of %d cached and batch results differ from MAG_Geomag (%d interleaved dates)\n", mismatches, 2 * AUDIT_BATCH_POINTS,
+            AUDIT_BATCH_DATES);
+
+    free(Latitude);
+    free(Longitude);
+    free(Heights);
+    free(Years);
+    free(Reference);
+    free(Results);
+    MAG_FreeMagneticModelMemory(TimedMagneticModel);
+    MAG_FreeTimedModelCache(TimedModels);
+    MAG_FreeEvalContext(Context);
+    return mismatches;
+}
+
+int main(int argc, char *argv[])
+{
+    MAGtype_MagneticModel * MagneticModels[1];
+    MAGtype_Ellipsoid Ellip;
+    MAGtype_Geoid Geoid;
+    MAGtype_FloatModel FloatModel;
+    MAGtype_FloatElements FloatElements;
+    MAGtype_GeoMagneticElements *Elements, Errors;
+    AuditWorst Decl, Incl, F, H, X, Y, Z, Decldot, Incldot, Fdot, DeclRatio, InclRatio, FRatio;
+    char filename[] = "WMM.COF";
+    char *model_file = filename;
+    double Step = AUDIT_DEFAULT_STEP, *Latitude, *Longitude, *Heights, *Years, DecimalYear, t0, tDouble = 0, tFloat = 0;
+    int NumLat, NumLon, NumPoints, NumDates, NumHeights, iDate, iHeight, i, j, k;
+    long NumEvaluations = 0;
+
+    if(argc > 1)
+        Step = atof(argv[1]);
+    if(argc > 2)
+        model_file = argv[2];
+    if(Step <= 0 || Step > 90)
+    {
+        printf("Usage: wmm_float_audit [step degrees] [coefficient file]\n");
+        return 1;
+    }
+    if(!MAG_robustReadMagModels(model_file, &MagneticModels, 1))
+    {
+        printf("\n %s not found.\n", model_file);
+        return 1;
+    }
+    MAG_SetDefaults(&Ellip, &Geoid);
+    if(!MAG_FloatModelInit(&FloatModel, MagneticModels[0]->nMax, MagneticModels[0]->nMaxSecVar, MagneticModels[0]->epoch,
+            MagneticModels[0]->Main_Field_Coeff_G, MagneticModels[0]->Main_Field_Coeff_H,
+            MagneticModels[0]->Secular_Var_Coeff_G, MagneticModels[0]->Secular_Var_Coeff_H, Ellip.a, Ellip.epssq, Ellip.re))
+    {
+        printf("\n %s: degree %d, the single precision path supports up to %d\n", model_file, MagneticModels[0]->nMax, MAG_FLOAT_NMAX);
+        return 1;
+    }
+    if(audit_reference(MagneticModels[0], Ellip) != 0)
+    {
+        printf("FAILED: the double precision reference differs from MAG_Geomag\n");
+        return 1;
+    }
+
+    NumLat = (int) floor(180.0 / Step + 1e-9) + 1;
+    NumLon = (int) floor(360.0 / Step + 1e-9) + 1;
+    NumPoints = NumLat * NumLon;
+    NumHeights = (int) (sizeof (AuditHeights) / sizeof (AuditHeights[0]));
+    NumDates = (int) floor((MagneticModels[0]->CoefficientFileEndDate - MagneticModels[0]->min_year) / AUDIT_DATE_STEP) + 1;
+    Latitude = (double *) malloc(NumPoints * sizeof (double));
+    Longitude = (double *) malloc(NumPoints * sizeof (double));
+    Heights = (double *) malloc(NumPoints * sizeof (double));
+    Years = (double *) malloc(NumPoints * sizeof (double));
+    Elements = (MAGtype_GeoMagneticElements *) malloc(NumPoints * sizeof (MAGtype_GeoMagneticElements));
+    if(!Latitude || !Longitude || !Heights || !Years || !Elements)
+    {
+        printf("Error allocating audit memory\n");
+        return 1;
+    }
+    for(i = 0; i < NumLat; i++)
+        for(j = 0; j < NumLon; j++)
+        {
+            Latitude[i * NumLon + j] = i == NumLat - 1 ? 90.0 : -90.0 + i * Step;
+            Longitude[i * NumLon + j] = j == NumLon - 1 ? 180.0 : -180.0 + j * Step;
+        }
+    printf("%s: %d x %d points, %d heights, %d dates from %.4f\n", MagneticModels[0]->ModelName, NumLat, NumLon, NumHeights, NumDates,
+            MagneticModels[0]->min_year);
+
+    memset(&Decl, 0, sizeof (AuditWorst));
+    Incl = F = H = X = Y = Z = Decldot = Incldot = Fdot = DeclRatio = InclRatio = FRatio = Decl;
+    for(iDate = 0; iDate < NumDates; iDate++)
+    {
+        DecimalYear = MagneticModels[0]->min_year + iDate * AUDIT_DATE_STEP;
+        for(iHeight = 0; iHeight < NumHeights; iHeight++)
+        {
+            for(k = 0; k < NumPoints; k++)
+            {
+                Heights[k] = AuditHeights[iHeight];
+                Years[k] = DecimalYear;
+            }
+            t0 = audit_seconds();
+            MAG_GeomagBatch(Ellip, MagneticModels[0], NumPoints, Latitude, Longitude, Heights, Years, Elements);
+            tDouble += audit_seconds() - t0;
+            for(k = 0; k < NumPoints; k++)
+            {
+                t0 = audit_seconds();
+                MAG_GeomagFloat(&FloatModel, (float) DecimalYear, (float) Latitude[k], (float) Longitude[k], (float) Heights[k], &FloatElements);
+                tFloat += audit_seconds() - t0;
+                NumEvaluations++;
+
+#define AUDIT_AT Latitude[k], Longitude[k], Heights[k], DecimalYear
+                audit_update(&Decl, audit_decl_difference(FloatElements.Decl, Elements[k].Decl), AUDIT_AT);
+                audit_update(&Incl, FloatElements.Incl - Elements[k].Incl, AUDIT_AT);
+                audit_update(&F, FloatElements.F - Elements[k].F, AUDIT_AT);
+                audit_update(&H, FloatElements.H - Elements[k].H, AUDIT_AT);
+                audit_update(&X, FloatElements.X - Elements[k].X, AUDIT_AT);
+                audit_update(&Y, FloatElements.Y - Elements[k].Y, AUDIT_AT);
+                audit_update(&Z, FloatElements.Z - Elements[k].Z, AUDIT_AT);
+                audit_update(&Decldot, FloatElements.Decldot - Elements[k].Decldot, AUDIT_AT);
+                audit_update(&Incldot, FloatElements.Incldot - Elements[k].Incldot, AUDIT_AT);
+                audit_update(&Fdot, FloatElements.Fdot - Elements[k].Fdot, AUDIT_AT);
+                MAG_WMMErrorCalc(Elements[k].H, &Errors);
+                audit_update(&DeclRatio, audit_decl_difference(FloatElements.Decl, Elements[k].Decl) / Errors.Decl, AUDIT_AT);
+                audit_update(&InclRatio, (FloatElements.Incl - Elements[k].Incl) / Errors.Incl, AUDIT_AT);
+                audit_update(&FRatio, (FloatElements.F - Elements[k].F) / Errors.F, AUDIT_AT);
+#undef AUDIT_AT
+            }
+        }
+    }
+
+    printf("Largest difference of MAG_GeomagFloat to the double precision path over %ld points:\n", NumEvaluations);
+    audit_print("Decl", "deg", &Decl);
+    audit_print("Incl", "deg", &Incl);
+    audit_print("F", "nT", &F);
+    audit_print("H", "nT", &H);
+    audit_print("X", "nT", &X);
+    audit_print("Y", "nT", &Y);
+    audit_print("Z", "nT", &Z);
+    audit_print("Decldot", "deg/yr", &Decldot);
+    audit_print("Incldot", "deg/yr", &Incldot);
+    audit_print("Fdot", "nT/yr", &Fdot);
+    printf("Relative to the MAG_WMMErrorCalc uncertainty (limit %g):\n", AUDIT_LIMIT);
+    audit_print("Decl / uncertainty", "", &DeclRatio);
+    audit_print("Incl / uncertainty", "", &InclRatio);
+    audit_print("F / uncertainty", "", &FRatio);
+    printf("Host time per point: double %.3f us, float %.3f us\n", 1e6 * tDouble / NumEvaluations, 1e6 * tFloat / NumEvaluations);
+
+    free(Latitude);
+    free(Longitude);
+    free(Heights);
+    free(Years);
+    free(Elements);
+    MAG_FreeMagneticModelMemory(MagneticModels[0]);
+    if(!(DeclRatio.Worst <= AUDIT_LIMIT && InclRatio.Worst <= AUDIT_LIMIT && FRatio.Worst <= AUDIT_LIMIT))
+    {
+        printf("FAILED: the single precision path exceeds %g of the model uncertainty\n", AUDIT_LIMIT);
+        return 1;
+    }
+    printf("PASSED\n");
+    return 0;
+}
@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "GeomagnetismHeader.h"
+#include "GeomagGeoidLib.h"
+#include "EGM9615.h"
+
+/*
+WMM geoid store writer.
+
+Writes the EGM96 geoid grid of EGM9615.h as a compressed, lazily paged geoid store (see
+GeomagGeoidLib.h). The store is then opened through the file reader, every post is compared with
+the source grid, and MAG_ConvertGeoidToEllipsoidHeight is compared between the flat array and the
+store on a set of pseudo random locations. The program exits with status 1 if a post differs by
+more than half a quantization step. Both modes also compare the lookups of the store, through the
+memory reader with several cache sizes and through the file reader, with the lookups of a flat
+array of the decoded posts, for locations over the globe and for a track of nearby fixes; they
+must agree within GEOID_CACHE_TOLERANCE.
+
+Usage:
+    wmm_geoid OUTPUT.GST [tile size]      Write and check a store (tile size in cells, default 64)
+    wmm_geoid -c FILE.GST                 Check a store and print its header
+ */
+
+#define GEOID_CHECK_POINTS 100000
+#define GEOID_FLOAT_SLACK 1e-5 /* Meters, rounding of the float heights of EGM9615.h */
+#define GEOID_CACHE_TOLERANCE 1e-8 /* km, the store and the flat array of its decoded posts */
+#define GEOID_TRACK_STEP 0.02 /* Largest latitude / longitude change between two fixes of the track (degrees) */
+
+static double geoid_uniform(unsigned long *state, double min, double max)
+/* Small linear congruential generator so the locations are the same on every platform */
+{
+    *state = *state * 6364136223846793005UL + 1442695040888963407UL;
+    return min + (max - min) * (double) ((*state >> 11) & 0xFFFFFFFFFFFFFUL) / (double) 0xFFFFFFFFFFFFFUL;
+}
+
+static int geoid_check_lookups(MAGtype_Geoid *FlatGeoid, MAGtype_Geoid *StoreGeoid, const double *Latitude, const double *Longitude,
+        double *Worst)
+/* Converts GEOID_CHECK_POINTS locations with both geoids, keeps the largest difference in *Worst */
+{
+    MAGtype_CoordGeodetic FlatCoord, StoreCoord;
+    int i;
+
+    memset(&FlatCoord, 0, sizeof (MAGtype_CoordGeodetic));
+    for(i = 0; i < GEOID_CHECK_POINTS; i++)
+    {
+        FlatCoord.phi = Latitude[i];
+        FlatCoord.lambda = Longitude[i];
+        FlatCoord.HeightAboveGeoid = 0;
+        StoreCoord = FlatCoord;
+        if(!MAG_ConvertGeoidToEllipsoidHeight(&FlatCoord, FlatGeoid) || !MAG_ConvertGeoidToEllipsoidHeight(&StoreCoord, StoreGeoid))
+            return FALSE;
+        *Worst = fmax(*Worst, fabs(StoreCoord.HeightAboveEllipsoid - FlatCoord.HeightAboveEllipsoid));
+    }
+    return TRUE;
+}
+
+static int geoid_check_cache(FILE *File, long FileSize, float *Heights)
+/* The store through the memory reader with 1 ... 32 cached tiles and through the file reader against the flat array of its
+   decoded posts, for locations over the globe and a track of nearby fixes (which stays in a few tiles) */
+{
+    static const int Slots[] = {1, 4, MAG_GEOID_DEFAULT_SLOTS, 32};
+    MAGtype_GeoidStore Store;
+    MAGtype_GeoidMemory Memory;
+    MAGtype_Ellipsoid Ellip;
+    MAGtype_Geoid FlatGeoid, StoreGeoid;
+    unsigned char *Data;
+    double *Latitude, *Longitude, Worst;
+    unsigned long state = 20250101UL;
+    int i, s, Pattern, Flag = TRUE;
+
+    Data = (unsigned char *) malloc((size_t) FileSize);
+    Latitude = (double *) malloc(GEOID_CHECK_POINTS * sizeof (double));
+    Longitude = (double *) malloc(GEOID_CHECK_POINTS * sizeof (double));
+    rewind(File);
+    if(!Data || !Latitude || !Longitude || fread(Data, 1, (size_t) FileSize, File) != (size_t) FileSize)
+    {
+        printf("Error reading the store into memory\n");
+        free(Data);
+        free(Latitude);
+        free(Longitude);
+        return FALSE;
+    }
+    Memory.Data = Data;
+    Memory.Size = (size_t) FileSize;
+    MAG_SetDefaults(&Ellip, &FlatGeoid);
+    FlatGeoid.GeoidHeightBuffer = Heights;
+    FlatGeoid.Geoid_Initialized = 1;
+    FlatGeoid.UseGeoid = 1;
+    StoreGeoid = FlatGeoid;
+    StoreGeoid.GeoidHeightBuffer = NULL;
+    StoreGeoid.GetGeoidPosts = MAG_GeoidStorePosts;
+
+    for(Pattern = 0; Flag && Pattern < 2; Pattern++)
+    {
+        for(i = 0; i < GEOID_CHECK_POINTS; i++)
+            if(Pattern == 0 || i == 0)
+            {
+                Latitude[i] = geoid_uniform(&state, -90.0, 90.0);
+                Longitude[i] = geoid_uniform(&state, -180.0, 180.0);
+            } else
+            {
+                Latitude[i] = fmax(-90.0, fmin(90.0, Latitude[i - 1] + geoid_uniform(&state, -GEOID_TRACK_STEP, GEOID_TRACK_STEP)));
+                Longitude[i] = Longitude[i - 1] + geoid_uniform(&state, -GEOID_TRACK_STEP, GEOID_TRACK_STEP);
+                if(Longitude[i] > 180.0)
+                    Longitude[i] -= 360.0;
+                if(Longitude[i] < -180.0)
+                    Longitude[i] += 360.0;
+            }
+        printf("  %s\n", Pattern == 0 ? "locations over the globe" : "track of nearby fixes");
+        for(s = 0; Flag && s <= (int) (sizeof (Slots) / sizeof (Slots[0])); s++)
+        {
+            /* The last pass reads the tiles from the file */
+            if(s < (int) (sizeof (Slots) / sizeof (Slots[0])))
+                Flag = MAG_GeoidStoreOpen(&Store, MAG_GeoidReadMemory, &Memory, Slots[s]);
+            else
+                Flag = MAG_GeoidStoreOpen(&Store, MAG_GeoidReadFile, File, MAG_GEOID_DEFAULT_SLOTS);
+            if(!Flag)
+                break;
+            StoreGeoid.GeoidData = &Store;
+            Worst = 0;
+            Flag = geoid_check_lookups(&FlatGeoid, &StoreGeoid, Latitude, Longitude, &Worst) && Worst <= GEOID_CACHE_TOLERANCE;
+            printf("    %-6s reader, %2d cached tiles: %6lu tiles read, largest difference %.1e m%s\n",
+                    s < (int) (sizeof (Slots) / sizeof (Slots[0])) ? "memory" : "file", Store.NumSlots, Store.Misses, 1000 * Worst,
+                    Flag ? "" : "  HEIGHTS DIFFER");
+            MAG_GeoidStoreClose(&Store);
+        }
+    }
+    free(Data);
+    free(Latitude);
+    free(Longitude);
+    return Flag;
+} /*geoid_check_cache*/
+
+static int geoid_check(const char *filename, int Compare)
+/* Opens a store, prints its header and with Compare checks it against GeoidHeightBuffer */
+{
+    MAGtype_GeoidStore Store;
+    MAGtype_Geoid FlatGeoid, StoreGeoid;
+    MAGtype_Ellipsoid Ellip;
+    MAGtype_CoordGeodetic FlatCoord, StoreCoord;
+    FILE *File;
+    float *Heights;
+    double Worst = 0, WorstHeight = 0;
+    unsigned long state = 20250101UL;
+    long FileSize, k;
+    int i, Matches, Flag = TRUE;
+
+    File = fopen(filename, "rb");
+    if(File == NULL)
+    {
+        printf("Error opening %s\n", filename);
+        return FALSE;
+    }
+    fseek(File, 0, SEEK_END);
+    FileSize = ftell(File);
+    if(!MAG_GeoidStoreOpen(&Store, MAG_GeoidReadFile, File, MAG_GEOID_DEFAULT_SLOTS))
+    {
+        printf("%s is not a valid geoid store\n", filename);
+        fclose(File);
+        return FALSE;
+    }
+    printf("%s: %d x %d posts, %d x %d tiles of %d cells, %d counts per meter, largest tile %lu bytes\n", filename, Store.NumRows,
+            Store.NumCols, Store.NumTileRows, Store.NumTileCols, Store.TileSize, Store.CountsPerMeter, Store.MaxTileBytes);
+    printf("  %ld bytes (%.2f bytes per post), %lu resident bytes with %d cached tiles\n", FileSize,
+            (double) FileSize / ((double) Store.NumRows * Store.NumCols), (unsigned long) MAG_GeoidStoreResidentBytes(&Store), Store.NumSlots);
+
+    Heights = (float *) malloc((size_t) Store.NumRows * Store.NumCols * sizeof (float));
+    if(Heights == NULL || !MAG_GeoidStoreDecode(&Store, Heights))
+    {
+        printf("Error decoding %s\n", filename);
+        free(Heights);
+        MAG_GeoidStoreClose(&Store);
+        fclose(File);
+        return FALSE;
+    }
+    if(Compare)
+    {
+        MAG_SetDefaults(&Ellip, &FlatGeoid);
+        if(Store.NumRows != FlatGeoid.NumbGeoidRows || Store.NumCols != FlatGeoid.NumbGeoidCols)
+        {
+            printf("The store does not have the %d x %d posts of EGM9615.h\n", FlatGeoid.NumbGeoidRows, FlatGeoid.NumbGeoidCols);
+            Flag = FALSE;
+        } else
+        {
+            for(k = 0; k < (long) Store.NumRows * Store.NumCols; k++)
+                if(fabs((double) Heights[k] - GeoidHeightBuffer[k]) > Worst)
+                    Worst = fabs((double) Heights[k] - GeoidHeightBuffer[k]);
+            Flag = Worst <= 0.5 / Store.CountsPerMeter + GEOID_FLOAT_SLACK;
+
+            FlatGeoid.GeoidHeightBuffer = GeoidHeightBuffer;
+            FlatGeoid.Geoid_Initialized = 1;
+            FlatGeoid.UseGeoid = 1;
+            StoreGeoid = FlatGeoid;
+            StoreGeoid.GeoidHeightBuffer = NULL;
+            StoreGeoid.GetGeoidPosts = MAG_GeoidStorePosts;
+            StoreGeoid.GeoidData = &Store;
+            for(i = 0; i < GEOID_CHECK_POINTS; i++)
+            {
+                FlatCoord.phi = geoid_uniform(&state, -90.0, 90.0);
+                FlatCoord.lambda = geoid_uniform(&state, -180.0, 360.0);
+                FlatCoord.HeightAboveGeoid = geoid_uniform(&state, -1.0, 10.0);
+                StoreCoord = FlatCoord;
+                if(!MAG_ConvertGeoidToEllipsoidHeight(&FlatCoord, &FlatGeoid) || !MAG_ConvertGeoidToEllipsoidHeight(&StoreCoord, &StoreGeoid))
+                {
+                    Flag = FALSE;
+                    break;
+                }
+                if(fabs(StoreCoord.HeightAboveEllipsoid - FlatCoord.HeightAboveEllipsoid) > WorstHeight)
+                    WorstHeight = fabs(StoreCoord.HeightAboveEllipsoid - FlatCoord.HeightAboveEllipsoid);
+            }
+            Flag = Flag && 1000 * WorstHeight <= 0.5 / Store.CountsPerMeter + GEOID_FLOAT_SLACK;
+            printf("  largest post difference to EGM9615.h %.4f m, largest ellipsoid height difference %.4f m over %d locations\n", Worst,
+                    1000 * WorstHeight, GEOID_CHECK_POINTS);
+            printf("  %lu tiles read for %lu lookups\n", Store.Misses, Store.Hits + Store.Misses);
+        }
+    }
+    /* MAG_ConvertGeoidToEllipsoidHeight takes the dimensions of the grid from the defaults */
+    MAG_SetDefaults(&Ellip, &FlatGeoid);
+    Matches = Store.NumRows == FlatGeoid.NumbGeoidRows && Store.NumCols == FlatGeoid.NumbGeoidCols;
+    MAG_GeoidStoreClose(&Store);
+    if(Matches)
+        Flag &= geoid_check_cache(File, FileSize, Heights);
+    free(Heights);
+    fclose(File);
+    return Flag;
+} /*geoid_check*/
+
+int main(int argc, char *argv[])
+{
+    MAGtype_Ellipsoid Ellip;
+    MAGtype_Geoid Geoid;
+    unsigned char *Buffer;
+    size_t Size, BufferSize;
+    int TileSize = MAG_GEOID_DEFAULT_TILE_SIZE;
+    FILE *File;
+
+    if(argc == 3 && !strcmp(argv[1], "-c"))
+        return geoid_check(argv[2], FALSE) ? 0 : 1;
+    if(argc > 2)
+        TileSize = atoi(argv[2]);
+    if(argc < 2 || argc > 3 || TileSize < 1)
+    {
+        printf("Usage: wmm_geoid OUTPUT.GST [tile size]\n       wmm_geoid -c FILE.GST\n");
+        return 1;
+    }
+
+    MAG_SetDefaults(&Ellip, &Geoid);
+    BufferSize = MAG_GeoidStoreBound(Geoid.NumbGeoidRows, Geoid.NumbGeoidCols, TileSize);
+    Buffer = (unsigned char *) malloc(BufferSize);
+    if(Buffer == NULL)
+    {
+        printf("Error allocating %lu bytes\n", (unsigned long) BufferSize);
+        return 1;
+    }
+    Size = MAG_GeoidStoreEncode(GeoidHeightBuffer, Geoid.NumbGeoidRows, Geoid.NumbGeoidCols, TileSize, Buffer, BufferSize);
+    if(Size == 0)
+    {
+        printf("Error encoding the geoid grid (tile size %d)\n", TileSize);
+        free(Buffer);
+        return 1;
+    }
+    File = fopen(argv[1], "wb");
+    if(File == NULL || fwrite(Buffer, 1, Size, File) != Size || fclose(File) != 0)
+    {
+        printf("Error writing %s\n", argv[1]);
+        free(Buffer);
+        return 1;
+    }
+    free(Buffer);
+    printf("Wrote %s: %lu bytes, the flat array of EGM9615.h is %lu bytes\n", argv[1], (unsigned long) Size,
+            (unsigned long) (Geoid.NumbGeoidElevs * sizeof (float)));
+    return geoid_check(argv[1], TRUE) ? 0 : 1;
+}
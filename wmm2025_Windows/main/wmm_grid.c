@@ -8,6 +8,7 @@
 #include "../src/EGM9615.h"
 #include "version.h"
 #include "GeomagInterativeLib.h"
+#include "../src/GeomagGridLib.h"
 /*#include "GeomagnetismLibrary.c"*/
 
 /*
@@ -20,6 +21,12 @@ the user to enter a location, performs the computations and prints the results t
 standard output. The program expects the files GeomagnetismLibrary.c, GeomagnetismHeader.h,
 EWMM.COF and EGM9615.h to be in the same directory. 
 
+wmm_grid -c [cells] checks the grid engine instead: the separable output against the per cell
+output for several thread counts, the analytic gradient against the central differences, the linear
+in time path against the time adjusted one, the rasters against the printed text and the multi
+element output against single element runs, on global grids of about the given number of cells
+(default GRID_CHECK_CELLS). It exits with 1 when a check fails.
+
 Manoj.C.Nair@Noaa.Gov
 April 21, 2011
 
@@ -42,6 +49,14 @@ int MAG_Grid(MAGtype_CoordGeodetic minimum,
         int UncertaintyOption, 
         int PrintOption, 
         char *OutputFile);
+int grid_check(MAGtype_MagneticModel *MagneticModel, MAGtype_Ellipsoid Ellip, MAGtype_Geoid *Geoid, int NumCells);
+
+#define GRID_CHECK_CELLS 50000
+#define GRID_CHECK_GRADIENT_TOLERANCE 1e-4 /* nT/km, analytic against central difference gradients */
+#define GRID_CHECK_SERIES_DATES 60 /* Monthly dates of each site */
+#define GRID_CHECK_SERIES_TOLERANCE 1e-6 /* nT, deg and their yearly rates, rounding of the regrouped sums */
+#define GRID_CHECK_RASTER_ELEMENT 3 /* F, the element with the largest values */
+#define GRID_CHECK_RASTER_TOLERANCE 0.005 /* Rounding of the printed grid values */
 
 const char* BOZ_WARN_TEXT_STRONG = "Warning: some calculated locations are "
                                    "in the blackout zone "
@@ -60,7 +75,7 @@ const char* BOZ_WARN_TEXT_WEAK = "Caution: some calculated locations approach "
 const char* WMM_MileSpec_INFO = "Warning: The height validity of the geomagnetic components is dependent on the geomagnetic activity level. For more information see \n(https://www.ncei.noaa.gov/products/world-magnetic-model/accuracy-limitations-error-model)\n";
 const char* WMM_MileSpec_WARN = "Warning: WMM will not meet MilSpec at this altitude. For more information see \n(https://www.ncei.noaa.gov/products/world-magnetic-model/accuracy-limitations-error-model)\n";
 
-int main()
+int main(int argc, char *argv[])
 {
     MAGtype_MagneticModel * MagneticModels[1];
     MAGtype_Ellipsoid Ellip;
@@ -91,6 +106,12 @@ int main()
     Geoid.GeoidHeightBuffer = GeoidHeightBuffer;
     Geoid.Geoid_Initialized = 1;
     /* Set EGM96 Geoid parameters END */
+    if(argc > 1 && !strcmp(argv[1], "-c"))
+    {
+        i = grid_check(MagneticModels[0], Ellip, &Geoid, argc > 2 ? atoi(argv[2]) : GRID_CHECK_CELLS);
+        MAG_FreeMagneticModelMemory(MagneticModels[0]);
+        return i ? 0 : 1;
+    }
     #ifdef WMMHR
         printf("\n\n Welcome to the World Magnetic Model High-Resolution(WMMHR) %d C-Program\n",(int) MagneticModels[0]->epoch);
     #else
@@ -178,7 +199,18 @@ INPUT: minimum :Data structure with the following elements (minimum limits of th
 
    OUTPUT: none (prints the output to a file )
 
-   CALLS : MAG_AllocateModelMemory To allocate memory for model coefficients
+   The cells are evaluated by MAG_GridEvaluate. The environment variable WMM_GRID_THREADS sets the
+   number of worker threads, by default one per online processor; the output does not depend on it.
+   WMM_GRID_GRADIENT=analytic computes the gradient elements 17-25 analytically instead of by central
+   differences (they agree to about 1e-5 nT/km). WMM_GRID_TIME=linear sums every location once and derives
+   the years from its main field and secular variation (elements 1-16, same printed values).
+   WMM_GRID_FORMAT=raster writes the output file as float32 values of the element (and its uncertainty),
+   WMM_GRID_FORMAT=bands as float32 values of elements 1-16 (and 8 uncertainties) in one pass; both with a
+   text sidecar OutputFile.hdr describing the axes and bands (MAG_GridRasterHeader).
+   WMM_GRID_ELEMENTS=1,2,3,8 (any elements 1-25) evaluates the grid once and writes each listed element to
+   OutputFile.<element>, in the format of a single element run (MAG_GridEvaluateElements).
+
+   CALLS : MAG_GridEvaluateElements Evaluate and print the grid, one latitude row per task. For each cell it calls
       MAG_TimelyModifyMagneticModel This modifies the Magnetic coefficients to the correct date.
                   MAG_ConvertGeoidToEllipsoidHeight (&CoordGeodetic, &Geoid);   Convert height above msl to height above WGS-84 ellipsoid
                   MAG_GeodeticToSpherical Convert from geodeitic to Spherical Equations: 7-8, WMM Technical report
@@ -190,255 +222,159 @@ INPUT: minimum :Data structure with the following elements (minimum limits of th
 
  */
 {
-    int NumTerms;
-    double a, b, c, d, PrintElement, ErrorElement = 0;
-
-    MAGtype_MagneticModel *TimedMagneticModel;
-    MAGtype_CoordSpherical CoordSpherical;
-    MAGtype_MagneticResults MagneticResultsSph, MagneticResultsGeo, MagneticResultsSphVar, MagneticResultsGeoVar;
-    MAGtype_SphericalHarmonicVariables *SphVariables;
-    MAGtype_GeoMagneticElements GeoMagneticElements, Errors;
-    MAGtype_LegendreFunction *LegendreFunction;
-    MAGtype_Gradient Gradient;
-    int print_boz_warning_weak = FALSE;
-    int print_boz_warning_strong = FALSE;
-    int print_alt_warning = FALSE;
-    double min_wgsalt = -1;
-    double max_wgsalt = 1900;
-    
-    FILE *fileout = NULL;
-
-    if(PrintOption == 1)
+    MAGtype_GridParameters Parameters, Single;
+    MAGtype_GridStatus Status;
+    char *Threads, *Gradient, *Time, *Format, *Elements, *Token, ElementList[128], HeaderFile[80];
+    char FileNames[MAG_GRID_MAX_SINKS][72];
+    const char *Name;
+    int Flag = TRUE, NumOut = 1, e, k, n;
+    FILE *fileout[MAG_GRID_MAX_SINKS], *headerout;
+
+    Format = getenv("WMM_GRID_FORMAT");
+    Parameters.OutputFormat = MAG_GRID_TEXT;
+    if(PrintOption == 1 && Format != NULL && !strcmp(Format, "raster"))
+        Parameters.OutputFormat = MAG_GRID_RASTER; /* float32 values of the element, see MAG_GridRasterHeader */
+    else if(PrintOption == 1 && Format != NULL && !strcmp(Format, "bands"))
+        Parameters.OutputFormat = MAG_GRID_RASTER_BANDS; /* float32 values of elements 1-16 in one pass */
+
+    /* A comma separated list of elements writes each element to OutputFile.<element> from one evaluation */
+    Elements = getenv("WMM_GRID_ELEMENTS");
+    Parameters.ElementMask = 0;
+    if(PrintOption == 1 && Elements != NULL && Parameters.OutputFormat != MAG_GRID_RASTER_BANDS)
     {
-        fileout = fopen(OutputFile, "w");
-        if(!fileout)
+        strncpy(ElementList, Elements, sizeof (ElementList) - 1);
+        ElementList[sizeof (ElementList) - 1] = '\0';
+        for(Token = strtok(ElementList, ", "); Token != NULL; Token = strtok(NULL, ", "))
         {
-            printf("Error opening %s to write", OutputFile);
-            return FALSE;
+            e = atoi(Token);
+            if(e >= 1 && e <= 25)
+                Parameters.ElementMask |= MAG_GRID_ELEMENT(e);
         }
     }
+    Parameters.UncertaintyMask = UncertaintyOption == 1 ? Parameters.ElementMask : 0; /* Elements 9-25 have no uncertainty */
 
-
-
-    if(fabs(cord_step_size) < 1.0e-10) cord_step_size = 99999.0; /*checks to make sure that the step_size is not too small*/
-    if(fabs(altitude_step_size) < 1.0e-10) altitude_step_size = 99999.0;
-    if(fabs(time_step) < 1.0e-10) time_step = 99999.0;
-
-
-    NumTerms = ((MagneticModel->nMax + 1) * (MagneticModel->nMax + 2) / 2);
-    TimedMagneticModel = MAG_AllocateModelMemory(NumTerms);
-    LegendreFunction = MAG_AllocateLegendreFunctionMemory(NumTerms); /* For storing the ALF functions */
-    SphVariables = MAG_AllocateSphVarMemory(MagneticModel->nMax);
-    a = minimum.HeightAboveGeoid; /*sets the loop initialization values*/
-    b = minimum.phi;
-    c = minimum.lambda;
-    d = StartDate.DecimalYear;
-    double alt = minimum.HeightAboveGeoid;
-
-
-    for(minimum.HeightAboveGeoid = a; minimum.HeightAboveGeoid <= maximum.HeightAboveGeoid; minimum.HeightAboveGeoid += altitude_step_size) /* Altitude loop*/
+    if(PrintOption == 1)
     {
-
-        for(minimum.phi = b; minimum.phi <= maximum.phi; minimum.phi += cord_step_size) /*Latitude loop*/
+        NumOut = 0;
+        for(e = 1; e <= 25; e++)
         {
-
-            for(minimum.lambda = c; minimum.lambda <= maximum.lambda; minimum.lambda += cord_step_size) /*Longitude loop*/
+            if(Parameters.ElementMask == 0)
             {
-                alt = minimum.HeightAboveGeoid;
-                if(Geoid->UseGeoid == 1)
-                    MAG_ConvertGeoidToEllipsoidHeight(&minimum, Geoid); /* This converts the height above mean sea level to height above the WGS-84 ellipsoid */
-                else
-                    minimum.HeightAboveEllipsoid = minimum.HeightAboveGeoid;
+                if(e > 1)
+                    break;
+                snprintf(FileNames[NumOut], sizeof (FileNames[NumOut]), "%s", OutputFile);
+            } else if(Parameters.ElementMask & MAG_GRID_ELEMENT(e))
+            {
+                snprintf(FileNames[NumOut], sizeof (FileNames[NumOut]), "%s.", OutputFile);
+                n = (int) strlen(FileNames[NumOut]);
+                for(Name = MAG_GridElementName(e); *Name && n < (int) sizeof (FileNames[NumOut]) - 1; Name++)
+                    if(*Name != '/') /* dX/dphi */
+                        FileNames[NumOut][n++] = *Name;
+                FileNames[NumOut][n] = '\0';
+            } else
+                continue;
+            fileout[NumOut] = fopen(FileNames[NumOut], Parameters.OutputFormat == MAG_GRID_TEXT ? "w" : "wb");
+            if(!fileout[NumOut])
+            {
+                printf("Error opening %s to write", FileNames[NumOut]);
+                for(k = 0; k < NumOut; k++)
+                    fclose(fileout[k]);
+                return FALSE;
+            }
+            setvbuf(fileout[NumOut], NULL, _IOFBF, MAG_GRID_FILE_BUFFER); /* The rows are written in large blocks */
+            NumOut++;
+        }
+        if(Parameters.ElementMask != 0)
+        {
+            printf("\nResults printed in:");
+            for(k = 0; k < NumOut; k++)
+                printf(" %s", FileNames[k]);
+            printf("\n");
+        }
+    } else
+        fileout[0] = stdout;
+
+    Parameters.minimum = minimum;
+    Parameters.maximum = maximum;
+    Parameters.cord_step_size = cord_step_size;
+    Parameters.altitude_step_size = altitude_step_size;
+    Parameters.time_step = time_step;
+    Parameters.StartDate = StartDate;
+    Parameters.EndDate = EndDate;
+    Parameters.ElementOption = ElementOption;
+    Parameters.UncertaintyOption = UncertaintyOption;
+    Parameters.NumThreads = 0; /* One worker per online processor */
+    Threads = getenv("WMM_GRID_THREADS");
+    if(Threads != NULL && atoi(Threads) > 0)
+        Parameters.NumThreads = atoi(Threads);
+    Parameters.Separable = 1; /* Reuse the row and column terms of the regular grid */
+    Gradient = getenv("WMM_GRID_GRADIENT");
+    Parameters.AnalyticGradient = Gradient != NULL && !strcmp(Gradient, "analytic"); /* Otherwise the central differences of MAG_Gradient */
+    Time = getenv("WMM_GRID_TIME");
+    Parameters.LinearTime = Time != NULL && !strcmp(Time, "linear"); /* Otherwise the model is time adjusted for every year */
+    Parameters.MinHeight = -1;
+    Parameters.MaxHeight = 1900;
 #ifndef WMMHR
-                if (minimum.HeightAboveEllipsoid < min_wgsalt || minimum.HeightAboveEllipsoid > max_wgsalt){
-                    printf("\n Unrecognized height: %.2f. \n %s \n", alt, WMM_MileSpec_WARN);
-                    print_alt_warning = 1;
-                }
+    Parameters.HeightWarning = WMM_MileSpec_WARN;
+#else
+    Parameters.HeightWarning = NULL;
 #endif
-                MAG_GeodeticToSpherical(Ellip, minimum, &CoordSpherical);
-                MAG_ComputeSphericalHarmonicVariables(Ellip, CoordSpherical, MagneticModel->nMax, SphVariables); /* Compute Spherical Harmonic variables  */
-                MAG_AssociatedLegendreFunction(CoordSpherical, MagneticModel->nMax, LegendreFunction); /* Compute ALF  Equations 5-6, WMM Technical report*/
-
-                for(StartDate.DecimalYear = d; StartDate.DecimalYear <= EndDate.DecimalYear; StartDate.DecimalYear += time_step) /*Year loop*/
-                {
-
-                    MAG_TimelyModifyMagneticModel(StartDate, MagneticModel, TimedMagneticModel); /*This modifies the Magnetic coefficients to the correct date. */
-                    MAG_Summation(LegendreFunction, TimedMagneticModel, *SphVariables, CoordSpherical, &MagneticResultsSph); /* Accumulate the spherical harmonic coefficients Equations 10:12 , WMM Technical report*/
-                    MAG_SecVarSummation(LegendreFunction, TimedMagneticModel, *SphVariables, CoordSpherical, &MagneticResultsSphVar); /*Sum the Secular Variation Coefficients, Equations 13:15 , WMM Technical report  */
-                    MAG_RotateMagneticVector(CoordSpherical, minimum, MagneticResultsSph, &MagneticResultsGeo); /* Map the computed Magnetic fields to Geodetic coordinates Equation 16 , WMM Technical report */
-                    MAG_RotateMagneticVector(CoordSpherical, minimum, MagneticResultsSphVar, &MagneticResultsGeoVar); /* Map the secular variation field components to Geodetic coordinates, Equation 17 , WMM Technical report*/
-                    MAG_CalculateGeoMagneticElements(&MagneticResultsGeo, &GeoMagneticElements); /* Calculate the Geomagnetic elements, Equation 18 , WMM Technical report */
-                    MAG_CalculateGridVariation(minimum, &GeoMagneticElements);
-                    MAG_CalculateSecularVariationElements(MagneticResultsGeoVar, &GeoMagneticElements); /*Calculate the secular variation of each of the Geomagnetic elements, Equation 19, WMM Technical report*/
-                    #if WMMHR
-                        MAG_WMMHRErrorCalc(GeoMagneticElements.H, &Errors);
-                    #else
-                        MAG_WMMErrorCalc(GeoMagneticElements.H, &Errors);
-                    #endif
-                    if(GeoMagneticElements.H <= 2000.0) {
-                        print_boz_warning_strong = TRUE;
-                    } else if (GeoMagneticElements.H <= 6000.0) {
-                        print_boz_warning_weak = TRUE;
-                    }
-                    
-                    if(ElementOption >= 17)
-                        MAG_Gradient(Ellip, minimum, TimedMagneticModel, &Gradient);
-
-                    switch(ElementOption) {
-                        case 1:
-                            PrintElement = GeoMagneticElements.Decl; /*1. Angle between the magnetic field vector and true north, positive east*/
-                            ErrorElement = Errors.Decl;
-                            break;
-                        case 2:
-                            PrintElement = GeoMagneticElements.Incl; /*2. Angle between the magnetic field vector and the horizontal plane, positive downward*/
-                            ErrorElement = Errors.Incl;                            
-                            break;
-                        case 3:
-                            PrintElement = GeoMagneticElements.F; /*3. Magnetic Field Strength*/
-                            ErrorElement = Errors.F;
-                            break;
-                        case 4:
-                            PrintElement = GeoMagneticElements.H; /*4. Horizontal Magnetic Field Strength*/
-                            ErrorElement = Errors.H;
-                            break;
-                        case 5:
-                            PrintElement = GeoMagneticElements.X; /*5. Northern component of the magnetic field vector*/
-                            ErrorElement = Errors.X;
-                            break;
-                        case 6:
-                            PrintElement = GeoMagneticElements.Y; /*6. Eastern component of the magnetic field vector*/
-                            ErrorElement = Errors.Y;
-                            break;
-                        case 7:
-                            PrintElement = GeoMagneticElements.Z; /*7. Downward component of the magnetic field vector*/
-                            ErrorElement = Errors.Z;
-                            break;
-                        case 8:
-                            PrintElement = GeoMagneticElements.GV; /*8. The Grid Variation*/
-                            ErrorElement = Errors.Decl;
-                            break;
-                        case 9:
-                            PrintElement = GeoMagneticElements.Decldot * 60; /*9. Yearly Rate of change in declination*/
-                            UncertaintyOption = 0;
-                            break;
-                        case 10:
-                            PrintElement = GeoMagneticElements.Incldot * 60; /*10. Yearly Rate of change in inclination*/
-                            UncertaintyOption = 0;
-                            break;
-                        case 11:
-                            PrintElement = GeoMagneticElements.Fdot; /*11. Yearly rate of change in Magnetic field strength*/
-                            UncertaintyOption = 0;
-                            break;
-                        case 12:
-                            PrintElement = GeoMagneticElements.Hdot; /*12. Yearly rate of change in horizontal field strength*/
-                            UncertaintyOption = 0;
-                            break;
-                        case 13:
-                            PrintElement = GeoMagneticElements.Xdot; /*13. Yearly rate of change in the northern component*/
-                            UncertaintyOption = 0;
-                            break;
-                        case 14:
-                            PrintElement = GeoMagneticElements.Ydot; /*14. Yearly rate of change in the eastern component*/
-                            UncertaintyOption = 0;
-                            break;
-                        case 15:
-                            PrintElement = GeoMagneticElements.Zdot; /*15. Yearly rate of change in the downward component*/
-                            UncertaintyOption = 0;
-                            break;
-                        case 16:
-                            PrintElement = GeoMagneticElements.GVdot;
-                            UncertaintyOption = 0;
-                            /*16. Yearly rate of change in grid variation*/;
-                            break;
-                        case 17:
-                            PrintElement = Gradient.GradPhi.X;
-                            UncertaintyOption = 0;
-                            break;
-                        case 18:
-                            PrintElement = Gradient.GradPhi.Y;
-                            UncertaintyOption = 0;
-                            break;
-                        case 19:
-                            PrintElement = Gradient.GradPhi.Z;
-                            UncertaintyOption = 0;
-                            break;
-                        case 20:
-                            PrintElement = Gradient.GradLambda.X;
-                            UncertaintyOption = 0;
-                            break;
-                        case 21:
-                            PrintElement = Gradient.GradLambda.Y;
-                            UncertaintyOption = 0;
-                            break;
-                        case 22:
-                            PrintElement = Gradient.GradLambda.Z;
-                            UncertaintyOption = 0;
-                            break;
-                        case 23:
-                            PrintElement = Gradient.GradZ.X;
-                            UncertaintyOption = 0;
-                            break;
-                        case 24:
-                            PrintElement = Gradient.GradZ.Y;
-                            UncertaintyOption = 0;
-                            break;
-                        case 25:
-                            PrintElement = Gradient.GradZ.Z;
-                            UncertaintyOption = 0;
-                            break;
-                        default:
-                            PrintElement = GeoMagneticElements.Decl; /* 1. Angle between the magnetic field vector and true north, positive east*/
-                            ErrorElement = Errors.Decl;
-                    }
-                    
-                    if(Geoid->UseGeoid == 1)
-                    {
-                        if(PrintOption == 1) fprintf(fileout, "%5.2f %6.2f %8.4f %7.2f %10.2f", minimum.phi, minimum.lambda, minimum.HeightAboveGeoid, StartDate.DecimalYear, PrintElement);
-                        else printf("%5.2f %6.2f %8.4f %7.2f %10.2f", minimum.phi, minimum.lambda, minimum.HeightAboveGeoid, StartDate.DecimalYear, PrintElement);
-                    } else
-                    {
-                        if(PrintOption == 1) fprintf(fileout, "%5.2f %6.2f %8.4f %7.2f %10.2f", minimum.phi, minimum.lambda, minimum.HeightAboveEllipsoid, StartDate.DecimalYear, PrintElement);
-                        else printf("%5.2f %6.2f %8.4f %7.2f %10.2f", minimum.phi, minimum.lambda, minimum.HeightAboveEllipsoid, StartDate.DecimalYear, PrintElement);
-                    }
-                    if(UncertaintyOption == 1) {
-                        if(PrintOption == 1) fprintf(fileout, " %7.2f", ErrorElement);
-                        else printf(" %7.2f", ErrorElement);
-                    }
-                    if(PrintOption == 1) fprintf(fileout, "\n");
-                    else printf("\n"); /* Complete line */
-
-                     /**Below can be used for XYZ Printing format (longitude latitude output_data)
-                     *  fprintf(fileout, "%5.2f %6.2f %10.4f\n", minimum.lambda, minimum.phi, PrintElement); **/
-                        
-                } /* year loop */
-
-            } /*Longitude Loop */
-
-        } /* Latitude Loop */
-
-    } /* Altitude Loop */
-    
-    if(PrintOption == 1){
-        if(print_boz_warning_strong){ 
-            fprintf(fileout, "%s", BOZ_WARN_TEXT_STRONG);
-        } else if (print_boz_warning_weak) {
-            fprintf(fileout, "%s", BOZ_WARN_TEXT_WEAK);
+
+    /* Each raster is described by a text sidecar next to it */
+    for(k = 0, e = 1; Parameters.OutputFormat != MAG_GRID_TEXT && k < NumOut && Flag; k++, e++)
+    {
+        Single = Parameters;
+        if(Parameters.ElementMask != 0)
+        {
+            while(!(Parameters.ElementMask & MAG_GRID_ELEMENT(e)))
+                e++;
+            Single.ElementOption = e;
+            Single.UncertaintyOption = (Parameters.UncertaintyMask & MAG_GRID_ELEMENT(e)) ? 1 : 0;
         }
+        snprintf(HeaderFile, sizeof (HeaderFile), "%.72s.hdr", FileNames[k]);
+        headerout = fopen(HeaderFile, "w");
+        Flag = headerout != NULL && MAG_GridRasterHeader(&Single, MagneticModel, Geoid, headerout);
+        if(headerout != NULL && fclose(headerout) != 0)
+            Flag = FALSE;
+        if(!Flag)
+            printf("Error writing %s\n", HeaderFile);
+    }
+
+    if(Flag)
+    {
+        Flag = MAG_GridEvaluateElements(&Parameters, MagneticModel, Geoid, Ellip, fileout, stdout, &Status);
+        if(!Flag)
+            printf("Error evaluating the grid\n");
+    }
+
+    if(PrintOption == 1 && Parameters.OutputFormat == MAG_GRID_TEXT){
+        for(k = 0; k < NumOut; k++)
+        {
+            if(Status.BozWarningStrong){ 
+                fprintf(fileout[k], "%s", BOZ_WARN_TEXT_STRONG);
+            } else if (Status.BozWarningWeak) {
+                fprintf(fileout[k], "%s", BOZ_WARN_TEXT_WEAK);
+            }
 #ifndef WMMHR
-        if (!print_alt_warning){
-            fprintf(fileout, "%s\n", WMM_MileSpec_INFO);
-        }else{
-            fprintf(fileout, "%s\n", WMM_MileSpec_WARN);
-        }
+            if (!Status.AltitudeWarning){
+                fprintf(fileout[k], "%s\n", WMM_MileSpec_INFO);
+            }else{
+                fprintf(fileout[k], "%s\n", WMM_MileSpec_WARN);
+            }
 #endif
+            fclose(fileout[k]);
+        }
     }else{
-     if(print_boz_warning_strong){ 
+        if(PrintOption == 1)
+            for(k = 0; k < NumOut; k++)
+                fclose(fileout[k]); /* The warnings below go to the screen */
+     if(Status.BozWarningStrong){ 
             printf("%s\n", BOZ_WARN_TEXT_STRONG);
-        } else if (print_boz_warning_weak) {
+        } else if (Status.BozWarningWeak) {
             printf("%s\n", BOZ_WARN_TEXT_WEAK);
         }
 #ifndef WMMHR
-        if (!print_alt_warning){
+        if (!Status.AltitudeWarning){
             printf("%s\n", WMM_MileSpec_INFO);
         }else{
             printf("%s\n", WMM_MileSpec_WARN);
@@ -446,11 +382,400 @@ INPUT: minimum :Data structure with the following elements (minimum limits of th
 #endif
     }
 
+    return Flag;
+} /*MAG_Grid*/
+
+
+static double grid_uniform(unsigned long *state, double min, double max)
+/* Small linear congruential generator so the point set is the same on every platform */
+{
+    *state = *state * 6364136223846793005UL + 1442695040888963407UL;
+    return min + (max - min) * (double) ((*state >> 11) & 0xFFFFFFFFFFFFFUL) / (double) 0xFFFFFFFFFFFFFUL;
+}
+
+static void grid_check_parameters(MAGtype_GridParameters *Parameters, double DecimalYear, int NumCells)
+/* Global grid at one date with a spacing that gives about NumCells cells, one thread, separable */
+{
+    memset(Parameters, 0, sizeof (MAGtype_GridParameters));
+    Parameters->cord_step_size = sqrt(360.0 * 180.0 / (double) NumCells);
+    Parameters->minimum.phi = -90.0;
+    Parameters->maximum.phi = 90.0;
+    Parameters->minimum.lambda = -180.0;
+    Parameters->maximum.lambda = 180.0;
+    Parameters->StartDate.DecimalYear = DecimalYear;
+    Parameters->EndDate.DecimalYear = DecimalYear;
+    Parameters->ElementOption = 1;
+    Parameters->UncertaintyOption = 1;
+    Parameters->HeightWarning = NULL;
+    Parameters->NumThreads = 1;
+    Parameters->Separable = 1;
+    Parameters->OutputFormat = MAG_GRID_TEXT;
+}
+
+static char *grid_check_read(FILE *stream, long *Length)
+/* Reads a temporary output stream back into memory */
+{
+    char *Text;
+
+    *Length = ftell(stream);
+    rewind(stream);
+    Text = (char *) malloc(*Length + 1);
+    if(Text == NULL || fread(Text, 1, *Length, stream) != (size_t) *Length)
+    {
+        free(Text);
+        return NULL;
+    }
+    Text[*Length] = '\0';
+    return Text;
+}
+
+static char *grid_check_run(MAGtype_GridParameters *Parameters, MAGtype_MagneticModel *MagneticModel, MAGtype_Ellipsoid Ellip,
+        MAGtype_Geoid *Geoid, long *Length, MAGtype_GridStatus *Status)
+/* Evaluates the grid into a temporary file and returns its contents (text or raster) */
+{
+    FILE *stream;
+    char *Text;
+    int Flag;
 
+    stream = tmpfile();
+    if(stream == NULL)
+    {
+        printf("Error opening a temporary file\n");
+        return NULL;
+    }
+    /* Rasters need another stream for the height warnings, which the checks turn off */
+    Flag = MAG_GridEvaluate(Parameters, MagneticModel, Geoid, Ellip, stream, Parameters->OutputFormat == MAG_GRID_TEXT ? stream : stdout, Status);
+    Text = grid_check_read(stream, Length);
+    fclose(stream);
+    if(!Flag || Text == NULL)
+    {
+        printf("Error evaluating the grid\n");
+        free(Text);
+        return NULL;
+    }
+    return Text;
+}
+
+static int grid_check_threads(MAGtype_MagneticModel *MagneticModel, MAGtype_Ellipsoid Ellip, MAGtype_Geoid *Geoid, int NumCells)
+/* The separable output with 1, 2, 4, ... threads up to the online processors (at least 4) against the per cell output */
+{
+    MAGtype_GridParameters Parameters;
+    MAGtype_GridStatus Status;
+    char *Reference, *Text;
+    long ReferenceLength, Length;
+    int Threads, MaxThreads, Flag = TRUE;
+
+    grid_check_parameters(&Parameters, MagneticModel->epoch, NumCells);
+    MaxThreads = MAG_GridDefaultThreads();
+    if(MaxThreads < 4)
+        MaxThreads = 4; /* Still exercise the threaded row ordering on small machines */
+    Parameters.Separable = 0;
+    Reference = grid_check_run(&Parameters, MagneticModel, Ellip, Geoid, &ReferenceLength, &Status);
+    if(Reference == NULL)
+        return FALSE;
+    printf("separable grid: %ld cells, step %.4f degrees\n", Status.NumCells, Parameters.cord_step_size);
+
+    Parameters.Separable = 1;
+    for(Threads = 1; Flag && Threads <= MaxThreads; Threads = (Threads * 2 > MaxThreads && Threads < MaxThreads) ? MaxThreads : Threads * 2)
+    {
+        Parameters.NumThreads = Threads;
+        Text = grid_check_run(&Parameters, MagneticModel, Ellip, Geoid, &Length, &Status);
+        Flag = Text != NULL && Length == ReferenceLength && memcmp(Text, Reference, Length) == 0;
+        printf("  %3d threads: %s\n", Threads, Flag ? "same as the per cell output" : "OUTPUT DIFFERS");
+        free(Text);
+    }
+    free(Reference);
+    return Flag;
+}
+
+static double grid_check_gradient_difference(MAGtype_GeoMagneticElements *Analytic, MAGtype_GeoMagneticElements *Difference, double *Worst)
+/* Largest difference of the X, Y and Z gradients, also kept in *Worst */
+{
+    double d = fabs(Analytic->X - Difference->X);
+
+    if(fabs(Analytic->Y - Difference->Y) > d)
+        d = fabs(Analytic->Y - Difference->Y);
+    if(fabs(Analytic->Z - Difference->Z) > d)
+        d = fabs(Analytic->Z - Difference->Z);
+    if(d > *Worst)
+        *Worst = d;
+    return d;
+}
+
+static int grid_check_gradient(MAGtype_MagneticModel *MagneticModel, MAGtype_Ellipsoid Ellip, int NumPoints)
+/* MAG_GradientAnalytic (WMM_GRID_GRADIENT=analytic) against the central differences of MAG_Gradient */
+{
+    MAGtype_MagneticModel *TimedMagneticModel;
+    MAGtype_CoordGeodetic CoordGeodetic;
+    MAGtype_Date UserDate;
+    MAGtype_Gradient Analytic, Difference;
+    double d, Worst[3] = {0, 0, 0};
+    unsigned long state = 20250101UL;
+    int i, mismatches = 0;
+
+    TimedMagneticModel = MAG_AllocateModelMemory((MagneticModel->nMax + 1) * (MagneticModel->nMax + 2) / 2);
+    if(TimedMagneticModel == NULL)
+    {
+        printf("Error allocating in grid_check_gradient\n");
+        return FALSE;
+    }
+    CoordGeodetic.UseGeoid = 0;
+    UserDate.DecimalYear = MagneticModel->epoch + 2.5;
+    MAG_TimelyModifyMagneticModel(UserDate, MagneticModel, TimedMagneticModel);
+    for(i = 0; i < NumPoints; i++)
+    {
+        /* The central differences of MAG_Gradient step 0.01 degrees in latitude, stay clear of the poles */
+        CoordGeodetic.phi = i % 1000 == 0 ? (i % 2000 ? -89.5 : 89.5) : grid_uniform(&state, -89.5, 89.5);
+        CoordGeodetic.lambda = grid_uniform(&state, -180.0, 180.0);
+        CoordGeodetic.HeightAboveEllipsoid = grid_uniform(&state, -1.0, 600.0);
+        CoordGeodetic.HeightAboveGeoid = CoordGeodetic.HeightAboveEllipsoid;
+        MAG_Gradient(Ellip, CoordGeodetic, TimedMagneticModel, &Difference);
+        MAG_GradientAnalytic(Ellip, CoordGeodetic, TimedMagneticModel, &Analytic);
+        /* The truncation error of the central differences is below 1e-5 nT/km for these steps */
+        d = grid_check_gradient_difference(&Analytic.GradPhi, &Difference.GradPhi, &Worst[0]);
+        d = fmax(d, grid_check_gradient_difference(&Analytic.GradLambda, &Difference.GradLambda, &Worst[1]));
+        d = fmax(d, grid_check_gradient_difference(&Analytic.GradZ, &Difference.GradZ, &Worst[2]));
+        if(d > GRID_CHECK_GRADIENT_TOLERANCE)
+            mismatches++;
+    }
+    printf("analytic gradient: %d points, largest difference to the central differences: north %.2e, east %.2e, down %.2e nT/km\n",
+            NumPoints, Worst[0], Worst[1], Worst[2]);
+    printf("  %d points differ by more than %.0e nT/km\n", mismatches, GRID_CHECK_GRADIENT_TOLERANCE);
     MAG_FreeMagneticModelMemory(TimedMagneticModel);
-    MAG_FreeLegendreMemory(LegendreFunction);
-    MAG_FreeSphVarMemory(SphVariables);
+    return mismatches == 0;
+}
 
-    return TRUE;
-} /*MAG_Grid*/
+static void grid_check_update(double Difference, double *Worst)
+{
+    if(fabs(Difference) > *Worst || MAG_isNaN(Difference))
+        *Worst = fabs(Difference);
+}
 
+static int grid_check_time(MAGtype_MagneticModel *MagneticModel, MAGtype_Ellipsoid Ellip, MAGtype_Geoid *Geoid, int NumCells)
+/* MAG_SiteTimeSeries against a time adjusted model per date, then the grid with and without WMM_GRID_TIME=linear */
+{
+    static const int Elements[] = {1, 3, 8, 9, 16};
+    MAGtype_MagneticModel **TimedMagneticModels;
+    MAGtype_EvalContext *Context;
+    MAGtype_CoordGeodetic CoordGeodetic;
+    MAGtype_CoordSpherical CoordSpherical;
+    MAGtype_Date UserDate;
+    MAGtype_GeoMagneticElements Reference, Results[GRID_CHECK_SERIES_DATES];
+    MAGtype_GridParameters Parameters;
+    MAGtype_GridStatus Status;
+    double DecimalYear[GRID_CHECK_SERIES_DATES], WorstField = 0, WorstAngle = 0, WorstRate = 0;
+    char *GridReference, *Text;
+    long ReferenceLength, Length;
+    unsigned long state = 20250101UL;
+    int i, k, NumSites, Flag = TRUE;
+
+    NumSites = NumCells / GRID_CHECK_SERIES_DATES > 0 ? NumCells / GRID_CHECK_SERIES_DATES : 1;
+    TimedMagneticModels = (MAGtype_MagneticModel **) calloc(GRID_CHECK_SERIES_DATES, sizeof (MAGtype_MagneticModel *));
+    Context = MAG_AllocateEvalContext(MagneticModel->nMax);
+    if(!TimedMagneticModels || !Context)
+    {
+        printf("Error allocating in grid_check_time\n");
+        return FALSE;
+    }
+    /* Monthly dates over the validity of the model */
+    for(k = 0; k < GRID_CHECK_SERIES_DATES; k++)
+    {
+        DecimalYear[k] = MagneticModel->epoch + (double) k / 12.0;
+        UserDate.DecimalYear = DecimalYear[k];
+        TimedMagneticModels[k] = MAG_AllocateModelMemory((MagneticModel->nMax + 1) * (MagneticModel->nMax + 2) / 2);
+        if(TimedMagneticModels[k] == NULL)
+        {
+            printf("Error allocating in grid_check_time\n");
+            return FALSE;
+        }
+        MAG_TimelyModifyMagneticModel(UserDate, MagneticModel, TimedMagneticModels[k]);
+    }
+
+    CoordGeodetic.UseGeoid = 0;
+    for(i = 0; i < NumSites; i++)
+    {
+        /* Poles included, where the summations take the special path */
+        CoordGeodetic.phi = i % 500 == 0 ? (i % 1000 ? -90.0 : 90.0) : grid_uniform(&state, -90.0, 90.0);
+        CoordGeodetic.lambda = grid_uniform(&state, -180.0, 180.0);
+        CoordGeodetic.HeightAboveEllipsoid = grid_uniform(&state, -1.0, 600.0);
+        CoordGeodetic.HeightAboveGeoid = CoordGeodetic.HeightAboveEllipsoid;
+        MAG_SiteTimeSeries(Ellip, CoordGeodetic, MagneticModel, GRID_CHECK_SERIES_DATES, DecimalYear, Results);
+        MAG_GeodeticToSpherical(Ellip, CoordGeodetic, &CoordSpherical);
+        for(k = 0; k < GRID_CHECK_SERIES_DATES; k++)
+        {
+            MAG_Geomag_ctx(Context, Ellip, CoordSpherical, CoordGeodetic, TimedMagneticModels[k], &Reference);
+            MAG_CalculateGridVariation(CoordGeodetic, &Reference);
+            grid_check_update(Results[k].X - Reference.X, &WorstField);
+            grid_check_update(Results[k].Y - Reference.Y, &WorstField);
+            grid_check_update(Results[k].Z - Reference.Z, &WorstField);
+            grid_check_update(Results[k].H - Reference.H, &WorstField);
+            grid_check_update(Results[k].F - Reference.F, &WorstField);
+            grid_check_update(Results[k].Decl - Reference.Decl, &WorstAngle);
+            grid_check_update(Results[k].Incl - Reference.Incl, &WorstAngle);
+            grid_check_update(Results[k].GV - Reference.GV, &WorstAngle);
+            grid_check_update(Results[k].Xdot - Reference.Xdot, &WorstRate);
+            grid_check_update(Results[k].Ydot - Reference.Ydot, &WorstRate);
+            grid_check_update(Results[k].Zdot - Reference.Zdot, &WorstRate);
+            grid_check_update(Results[k].Hdot - Reference.Hdot, &WorstRate);
+            grid_check_update(Results[k].Fdot - Reference.Fdot, &WorstRate);
+            grid_check_update(Results[k].Decldot - Reference.Decldot, &WorstRate);
+            grid_check_update(Results[k].Incldot - Reference.Incldot, &WorstRate);
+        }
+    }
+    Flag = WorstField <= GRID_CHECK_SERIES_TOLERANCE && WorstAngle <= GRID_CHECK_SERIES_TOLERANCE && WorstRate <= GRID_CHECK_SERIES_TOLERANCE;
+    printf("linear in time: %d sites, %d dates, largest difference to the time adjusted path: field %.2e nT, angles %.2e deg, rates %.2e (limit %.0e)%s\n",
+            NumSites, GRID_CHECK_SERIES_DATES, WorstField, WorstAngle, WorstRate, GRID_CHECK_SERIES_TOLERANCE, Flag ? "" : "  RESULTS DIFFER");
+
+    /* Grid with a time axis: the printed text of both paths must be the same */
+    grid_check_parameters(&Parameters, MagneticModel->epoch, NumSites);
+    Parameters.EndDate.DecimalYear = MagneticModel->epoch + 4.9;
+    Parameters.time_step = 0.1;
+    for(i = 0; Flag && i < (int) (sizeof (Elements) / sizeof (Elements[0])); i++)
+    {
+        Parameters.ElementOption = Elements[i];
+        Parameters.LinearTime = 0;
+        GridReference = grid_check_run(&Parameters, MagneticModel, Ellip, Geoid, &ReferenceLength, &Status);
+        Parameters.LinearTime = 1;
+        Text = GridReference ? grid_check_run(&Parameters, MagneticModel, Ellip, Geoid, &Length, &Status) : NULL;
+        Flag = Text != NULL && Length == ReferenceLength && memcmp(Text, GridReference, Length) == 0;
+        printf("  grid element %2d, %ld cells: %s\n", Elements[i], Status.NumCells, Flag ? "same printed values" : "OUTPUT DIFFERS");
+        free(GridReference);
+        free(Text);
+    }
+
+    for(k = 0; k < GRID_CHECK_SERIES_DATES; k++)
+        MAG_FreeMagneticModelMemory(TimedMagneticModels[k]);
+    free(TimedMagneticModels);
+    MAG_FreeEvalContext(Context);
+    return Flag;
+}
+
+static int grid_check_raster(MAGtype_MagneticModel *MagneticModel, MAGtype_Ellipsoid Ellip, MAGtype_Geoid *Geoid, int NumCells)
+/* The float32 raster (WMM_GRID_FORMAT=raster) against the printed values, the bands (WMM_GRID_FORMAT=bands) against the raster */
+{
+    MAGtype_GridParameters Parameters;
+    MAGtype_GridStatus Status;
+    char *Text, *Raster, *Bands, *line, *next;
+    float *RasterValues, *BandValues;
+    double Value, Error, d, Worst = 0;
+    long TextLength, RasterLength, BandsLength, Cells, k;
+    int NumBands, mismatches = 0;
+
+    grid_check_parameters(&Parameters, MagneticModel->epoch + 1.5, NumCells);
+    Parameters.ElementOption = GRID_CHECK_RASTER_ELEMENT;
+    Text = grid_check_run(&Parameters, MagneticModel, Ellip, Geoid, &TextLength, &Status);
+    Cells = Status.NumCells;
+    Parameters.OutputFormat = MAG_GRID_RASTER;
+    Raster = grid_check_run(&Parameters, MagneticModel, Ellip, Geoid, &RasterLength, &Status);
+    Parameters.OutputFormat = MAG_GRID_RASTER_BANDS;
+    Bands = grid_check_run(&Parameters, MagneticModel, Ellip, Geoid, &BandsLength, &Status);
+    NumBands = Status.NumBands;
+    if(Text == NULL || Raster == NULL || Bands == NULL || RasterLength != Cells * 2 * (long) sizeof (float) ||
+            BandsLength != Cells * NumBands * (long) sizeof (float))
+    {
+        printf("Error writing the rasters\n");
+        free(Text);
+        free(Raster);
+        free(Bands);
+        return FALSE;
+    }
+
+    /* The raster holds the float of the printed value and uncertainty, the bands the same floats */
+    RasterValues = (float *) Raster;
+    BandValues = (float *) Bands;
+    line = Text;
+    for(k = 0; k < Cells && line != NULL; k++)
+    {
+        next = strchr(line, '\n');
+        if(sscanf(line, "%*f %*f %*f %*f %lf %lf", &Value, &Error) != 2)
+            break;
+        d = fmax(fabs(RasterValues[2 * k] - Value), fabs(RasterValues[2 * k + 1] - Error));
+        if(d > Worst)
+            Worst = d;
+        if(d > GRID_CHECK_RASTER_TOLERANCE + 6e-8 * fabs(Value) ||
+                BandValues[k * NumBands + GRID_CHECK_RASTER_ELEMENT - 1] != RasterValues[2 * k] ||
+                BandValues[k * NumBands + 16 + GRID_CHECK_RASTER_ELEMENT - 1] != RasterValues[2 * k + 1])
+            mismatches++;
+        line = next ? next + 1 : NULL;
+    }
+    if(k != Cells)
+        mismatches++;
+    printf("raster: %ld cells, %d bands, largest difference of the raster to the printed values %.4f, %d cells differ%s\n", Cells, NumBands,
+            Worst, mismatches, mismatches == 0 ? "" : "  RASTER DIFFERS");
+    free(Text);
+    free(Raster);
+    free(Bands);
+    return mismatches == 0;
+}
+
+static int grid_check_elements(MAGtype_MagneticModel *MagneticModel, MAGtype_Ellipsoid Ellip, MAGtype_Geoid *Geoid, int NumCells)
+/* WMM_GRID_ELEMENTS=1,2,3,8 (the four maps of a chart product) against a single element run each */
+{
+    static const int Elements[] = {1, 2, 3, 8};
+    MAGtype_GridParameters Parameters;
+    MAGtype_GridStatus Status;
+    FILE *streams[sizeof (Elements) / sizeof (Elements[0])];
+    char *Single, *Multi;
+    long SingleLength, MultiLength;
+    int i, NumElements = (int) (sizeof (Elements) / sizeof (Elements[0])), Flag = TRUE;
+
+    grid_check_parameters(&Parameters, MagneticModel->epoch + 1.5, NumCells);
+    for(i = 0; i < NumElements; i++)
+    {
+        Parameters.ElementMask |= MAG_GRID_ELEMENT(Elements[i]);
+        streams[i] = tmpfile();
+        if(streams[i] == NULL)
+        {
+            printf("Error opening a temporary file\n");
+            while(i-- > 0)
+                fclose(streams[i]);
+            return FALSE;
+        }
+    }
+    Parameters.UncertaintyMask = Parameters.ElementMask;
+    Flag = MAG_GridEvaluateElements(&Parameters, MagneticModel, Geoid, Ellip, streams, stdout, &Status);
+    if(!Flag)
+        printf("Error evaluating the grid\n");
+    printf("elements: %ld cells, %d elements in one pass\n", Status.NumCells, NumElements);
+
+    Parameters.ElementMask = Parameters.UncertaintyMask = 0;
+    for(i = 0; i < NumElements; i++)
+    {
+        Parameters.ElementOption = Elements[i];
+        Single = grid_check_run(&Parameters, MagneticModel, Ellip, Geoid, &SingleLength, &Status);
+        Multi = Flag ? grid_check_read(streams[i], &MultiLength) : NULL;
+        fclose(streams[i]);
+        if(Single == NULL || Multi == NULL || SingleLength != MultiLength || memcmp(Single, Multi, SingleLength))
+        {
+            printf("  element %d (%s) differs from its single element run\n", Elements[i], MAG_GridElementName(Elements[i]));
+            Flag = FALSE;
+        } else
+            printf("  element %d (%s): same as its single element run\n", Elements[i], MAG_GridElementName(Elements[i]));
+        free(Single);
+        free(Multi);
+    }
+    return Flag;
+}
+
+int grid_check(MAGtype_MagneticModel *MagneticModel, MAGtype_Ellipsoid Ellip, MAGtype_Geoid *Geoid, int NumCells)
+
+/* Checks the paths of the grid engine that MAG_Grid selects against the plain evaluation, on global grids of about
+NumCells cells (and as many points for the gradient). The geoid is not used, so the heights are above the ellipsoid.
+Prints a line per check and returns TRUE when all of them pass. */
+{
+    int Flag = TRUE;
+
+    if(NumCells < 1)
+    {
+        printf("Usage: wmm_grid -c [cells]\n");
+        return FALSE;
+    }
+    Geoid->UseGeoid = 0;
+    Flag &= grid_check_threads(MagneticModel, Ellip, Geoid, NumCells);
+    Flag &= grid_check_gradient(MagneticModel, Ellip, NumCells);
+    Flag &= grid_check_time(MagneticModel, Ellip, Geoid, NumCells);
+    Flag &= grid_check_raster(MagneticModel, Ellip, Geoid, NumCells);
+    Flag &= grid_check_elements(MagneticModel, Ellip, Geoid, NumCells);
+    printf("%s\n", Flag ? "PASSED" : "FAILED");
+    return Flag;
+} /*grid_check*/
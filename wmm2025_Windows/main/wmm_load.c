@@ -0,0 +1,336 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "GeomagnetismHeader.h"
+#include "GeomagServiceLib.h"
+
+/*
+WMM query daemon load generator.
+
+Opens the given number of connections to a running wmm_service and sends requests of pseudo random queries
+on each of them, one request at a time per connection, from one thread per connection. It reports the
+requests and queries per second and the 50th and 99th percentile and largest request latency. With a
+coefficient file, the time to load it (what every start of wmm_point or wmm_file costs before the first
+query) is reported, and the first response of every connection is compared with MAG_Geomag_ctx after the
+run; the program exits with status 1 if a result differs by more than LOAD_TOLERANCE or a request fails.
+POSIX only.
+
+Usage: wmm_load SOCKET [connections] [requests per connection] [queries per request] [coefficient file]
+ */
+
+#define LOAD_MAX_CONNECTIONS 256
+#define LOAD_DEFAULT_CONNECTIONS 4
+#define LOAD_DEFAULT_REQUESTS 2000
+#define LOAD_DEFAULT_QUERIES 16
+#define LOAD_TOLERANCE 1e-9 /* nT and degrees, the daemon evaluates the same functions */
+
+typedef struct {
+    const char *Path;
+    int Index;
+    int NumRequests;
+    int NumQueries;
+    double MinYear, MaxYear; /* Range of the query dates */
+    double *Latency; /* NumRequests request latencies (s) */
+    double *FirstQueries, *FirstResults; /* The first request of the connection and its response */
+    int Failed;
+} LoadClient;
+
+static double load_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + 1e-9 * (double) ts.tv_nsec;
+}
+
+static double load_uniform(unsigned long *state, double min, double max)
+/* Small linear congruential generator so the queries are the same on every platform */
+{
+    *state = *state * 6364136223846793005UL + 1442695040888963407UL;
+    return min + (max - min) * (double) ((*state >> 11) & 0xFFFFFFFFFFFFFUL) / (double) 0xFFFFFFFFFFFFFUL;
+}
+
+static int load_compare(const void *a, const void *b)
+{
+    double da = *(const double *) a, db = *(const double *) b;
+
+    return (da > db) - (da < db);
+}
+
+static int load_read_full(int fd, void *Buffer, size_t Size)
+{
+    unsigned char *p = (unsigned char *) Buffer;
+    ssize_t n;
+
+    while(Size > 0)
+    {
+        n = read(fd, p, Size);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return FALSE;
+        p += n;
+        Size -= (size_t) n;
+    }
+    return TRUE;
+}
+
+static int load_write_full(int fd, const void *Buffer, size_t Size)
+{
+    const unsigned char *p = (const unsigned char *) Buffer;
+    ssize_t n;
+
+    while(Size > 0)
+    {
+        n = write(fd, p, Size);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return FALSE;
+        p += n;
+        Size -= (size_t) n;
+    }
+    return TRUE;
+}
+
+static int load_connect(const char *Path)
+{
+    struct sockaddr_un Address;
+    int fd;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0)
+        return -1;
+    memset(&Address, 0, sizeof (Address));
+    Address.sun_family = AF_UNIX;
+    strncpy(Address.sun_path, Path, sizeof (Address.sun_path) - 1);
+    if(connect(fd, (struct sockaddr *) &Address, sizeof (Address)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void *load_client(void *Arg)
+{
+    LoadClient *Client = (LoadClient *) Arg;
+    MAGtype_ServiceHeader Header;
+    unsigned char *Request, *Response;
+    double *Queries, t0;
+    size_t RequestSize, ResponseSize;
+    unsigned long state = 20250101UL + 7919UL * (unsigned long) Client->Index;
+    int fd, r, i;
+
+    RequestSize = MAG_SERVICE_HEADER_SIZE + (size_t) Client->NumQueries * MAG_SERVICE_QUERY_VALUES * sizeof (double);
+    ResponseSize = MAG_SERVICE_HEADER_SIZE + (size_t) Client->NumQueries * MAG_SERVICE_RESULT_VALUES * sizeof (double);
+    Request = (unsigned char *) malloc(RequestSize);
+    Response = (unsigned char *) malloc(ResponseSize);
+    fd = load_connect(Client->Path);
+    if(Request == NULL || Response == NULL || fd < 0)
+    {
+        printf("Error connecting to %s\n", Client->Path);
+        free(Request);
+        free(Response);
+        Client->Failed = TRUE;
+        return NULL;
+    }
+    Queries = (double *) (Request + MAG_SERVICE_HEADER_SIZE);
+    for(r = 0; r < Client->NumRequests; r++)
+    {
+        for(i = 0; i < Client->NumQueries; i++)
+        {
+            Queries[i * MAG_SERVICE_QUERY_VALUES + 0] = load_uniform(&state, -90.0, 90.0);
+            Queries[i * MAG_SERVICE_QUERY_VALUES + 1] = load_uniform(&state, -180.0, 180.0);
+            Queries[i * MAG_SERVICE_QUERY_VALUES + 2] = load_uniform(&state, -1.0, 10.0);
+            Queries[i * MAG_SERVICE_QUERY_VALUES + 3] = load_uniform(&state, Client->MinYear, Client->MaxYear);
+        }
+        Header.Version = MAG_SERVICE_VERSION;
+        Header.Flags = 0;
+        Header.RequestId = (uint32_t) r;
+        Header.Count = (uint32_t) Client->NumQueries;
+        MAG_ServicePackHeader("WMMQ", &Header, Request);
+
+        t0 = load_seconds();
+        if(!load_write_full(fd, Request, RequestSize) || !load_read_full(fd, Response, MAG_SERVICE_HEADER_SIZE) ||
+                !MAG_ServiceUnpackHeader("WMMR", Response, &Header) || Header.Flags != MAG_SERVICE_OK ||
+                Header.RequestId != (uint32_t) r || Header.Count != (uint32_t) Client->NumQueries ||
+                !load_read_full(fd, Response + MAG_SERVICE_HEADER_SIZE, ResponseSize - MAG_SERVICE_HEADER_SIZE))
+        {
+            printf("Request %d of connection %d failed\n", r, Client->Index);
+            Client->Failed = TRUE;
+            break;
+        }
+        Client->Latency[r] = load_seconds() - t0;
+        if(r == 0)
+        {
+            memcpy(Client->FirstQueries, Queries, RequestSize - MAG_SERVICE_HEADER_SIZE);
+            memcpy(Client->FirstResults, Response + MAG_SERVICE_HEADER_SIZE, ResponseSize - MAG_SERVICE_HEADER_SIZE);
+        }
+    }
+    close(fd);
+    free(Request);
+    free(Response);
+    return NULL;
+}
+
+static int load_check(LoadClient *Client, MAGtype_MagneticModel *MagneticModel, double *Worst)
+/* Compares the first response of a connection with MAG_Geomag_ctx */
+{
+    MAGtype_EvalContext *Context;
+    MAGtype_MagneticModel *TimedMagneticModel;
+    MAGtype_Ellipsoid Ellip;
+    MAGtype_Geoid Geoid;
+    MAGtype_CoordGeodetic CoordGeodetic;
+    MAGtype_CoordSpherical CoordSpherical;
+    MAGtype_GeoMagneticElements Elements;
+    MAGtype_Date UserDate;
+    double Expected[MAG_SERVICE_RESULT_VALUES], *Query, *Result;
+    int i, k;
+
+    Context = MAG_AllocateEvalContext(MagneticModel->nMax);
+    TimedMagneticModel = MAG_AllocateModelMemory((MagneticModel->nMax + 1) * (MagneticModel->nMax + 2) / 2);
+    if(Context == NULL || TimedMagneticModel == NULL)
+        return FALSE;
+    MAG_SetDefaults(&Ellip, &Geoid);
+    CoordGeodetic.UseGeoid = 0;
+    for(i = 0; i < Client->NumQueries; i++)
+    {
+        Query = Client->FirstQueries + i * MAG_SERVICE_QUERY_VALUES;
+        Result = Client->FirstResults + i * MAG_SERVICE_RESULT_VALUES;
+        CoordGeodetic.phi = Query[0];
+        CoordGeodetic.lambda = Query[1];
+        CoordGeodetic.HeightAboveEllipsoid = CoordGeodetic.HeightAboveGeoid = Query[2];
+        UserDate.DecimalYear = Query[3];
+        MAG_GeodeticToSpherical(Ellip, CoordGeodetic, &CoordSpherical);
+        MAG_TimelyModifyMagneticModel(UserDate, MagneticModel, TimedMagneticModel);
+        MAG_Geomag_ctx(Context, Ellip, CoordSpherical, CoordGeodetic, TimedMagneticModel, &Elements);
+        MAG_CalculateGridVariation(CoordGeodetic, &Elements);
+        Expected[0] = Elements.Decl;
+        Expected[1] = Elements.Incl;
+        Expected[2] = Elements.F;
+        Expected[3] = Elements.H;
+        Expected[4] = Elements.X;
+        Expected[5] = Elements.Y;
+        Expected[6] = Elements.Z;
+        Expected[7] = Elements.GV;
+        for(k = 0; k < MAG_SERVICE_RESULT_VALUES; k++)
+            if(!(fabs(Result[k] - Expected[k]) <= *Worst))
+                *Worst = MAG_isNaN(Result[k]) ? HUGE_VAL : fabs(Result[k] - Expected[k]);
+    }
+    MAG_FreeEvalContext(Context);
+    MAG_FreeMagneticModelMemory(TimedMagneticModel);
+    return *Worst <= LOAD_TOLERANCE;
+}
+
+int main(int argc, char *argv[])
+{
+    MAGtype_MagneticModel * MagneticModels[1];
+    LoadClient Clients[LOAD_MAX_CONNECTIONS];
+    pthread_t Threads[LOAD_MAX_CONNECTIONS];
+    double *Latency, t0, tRun, tLoad = 0, Worst = 0;
+    long NumLatency = 0;
+    int NumConnections = LOAD_DEFAULT_CONNECTIONS, NumRequests = LOAD_DEFAULT_REQUESTS, NumQueries = LOAD_DEFAULT_QUERIES;
+    int NumStarted = 0, Flag = TRUE, i, r;
+
+    if(argc > 2)
+        NumConnections = atoi(argv[2]);
+    if(argc > 3)
+        NumRequests = atoi(argv[3]);
+    if(argc > 4)
+        NumQueries = atoi(argv[4]);
+    if(argc < 2 || argc > 6 || NumConnections < 1 || NumConnections > LOAD_MAX_CONNECTIONS || NumRequests < 1 || NumQueries < 1 ||
+            NumQueries > MAG_SERVICE_MAX_QUERIES)
+    {
+        printf("Usage: wmm_load SOCKET [connections] [requests per connection] [queries per request] [coefficient file]\n");
+        return 1;
+    }
+    MagneticModels[0] = NULL;
+    if(argc > 5)
+    {
+        t0 = load_seconds();
+        if(!MAG_robustReadMagModels(argv[5], &MagneticModels, 1))
+        {
+            printf("\n %s not found.\n", argv[5]);
+            return 1;
+        }
+        tLoad = load_seconds() - t0;
+    }
+
+    Latency = (double *) malloc((size_t) NumConnections * NumRequests * sizeof (double));
+    if(Latency == NULL)
+    {
+        printf("Error allocating %d latencies\n", NumConnections * NumRequests);
+        return 1;
+    }
+    t0 = load_seconds();
+    for(i = 0; i < NumConnections; i++)
+    {
+        Clients[i].Path = argv[1];
+        Clients[i].Index = i;
+        Clients[i].NumRequests = NumRequests;
+        Clients[i].NumQueries = NumQueries;
+        Clients[i].MinYear = MagneticModels[0] != NULL ? MagneticModels[0]->epoch : 2025.0;
+        Clients[i].MaxYear = MagneticModels[0] != NULL ? MagneticModels[0]->CoefficientFileEndDate : 2030.0;
+        Clients[i].Latency = Latency + (size_t) i * NumRequests;
+        for(r = 0; r < NumRequests; r++)
+            Clients[i].Latency[r] = -1.0;
+        Clients[i].FirstQueries = (double *) malloc((size_t) NumQueries * MAG_SERVICE_QUERY_VALUES * sizeof (double));
+        Clients[i].FirstResults = (double *) malloc((size_t) NumQueries * MAG_SERVICE_RESULT_VALUES * sizeof (double));
+        Clients[i].Failed = Clients[i].FirstQueries == NULL || Clients[i].FirstResults == NULL;
+        if(Clients[i].Failed || pthread_create(&Threads[i], NULL, load_client, &Clients[i]) != 0)
+        {
+            printf("Error starting connection %d\n", i);
+            free(Clients[i].FirstQueries);
+            free(Clients[i].FirstResults);
+            Flag = FALSE;
+            break;
+        }
+        NumStarted++;
+    }
+    for(i = 0; i < NumStarted; i++)
+        pthread_join(Threads[i], NULL);
+    tRun = load_seconds() - t0;
+
+    for(i = 0; i < NumStarted; i++)
+    {
+        Flag = Flag && !Clients[i].Failed;
+        for(r = 0; r < NumRequests; r++)
+            if(Clients[i].Latency[r] >= 0)
+                Latency[NumLatency++] = Clients[i].Latency[r]; /* Compacted in place, the index never passes the source */
+    }
+    if(NumLatency > 0)
+    {
+        qsort(Latency, NumLatency, sizeof (double), load_compare);
+        printf("%d connections, %ld requests of %d queries in %.3f s\n", NumStarted, NumLatency, NumQueries, tRun);
+        printf("  %.0f requests/s, %.0f queries/s\n", NumLatency / tRun, (double) NumLatency * NumQueries / tRun);
+        printf("  latency p50 %.1f us, p99 %.1f us, max %.1f us\n", 1e6 * Latency[(NumLatency - 1) / 2],
+                1e6 * Latency[(long) ceil(0.99 * NumLatency) - 1], 1e6 * Latency[NumLatency - 1]);
+    }
+    if(MagneticModels[0] != NULL)
+    {
+        printf("  loading %s takes %.1f us per program start, %.1fx the p50 request latency\n", argv[5], 1e6 * tLoad,
+                NumLatency > 0 ? tLoad / Latency[(NumLatency - 1) / 2] : 0.0);
+        for(i = 0; i < NumStarted; i++)
+            if(!Clients[i].Failed)
+                Flag = load_check(&Clients[i], MagneticModels[0], &Worst) && Flag;
+        printf("  largest difference of the first responses to MAG_Geomag_ctx %.2e%s\n", Worst, Flag ? "" : "  FAILED");
+        MAG_FreeMagneticModelMemory(MagneticModels[0]);
+    }
+    for(i = 0; i < NumStarted; i++)
+    {
+        free(Clients[i].FirstQueries);
+        free(Clients[i].FirstResults);
+    }
+    free(Latency);
+    return Flag ? 0 : 1;
+}
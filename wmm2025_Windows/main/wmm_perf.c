@@ -0,0 +1,899 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "GeomagnetismHeader.h"
+#include "GeomagGridLib.h"
+#include "version.h"
+
+/*
+WMM performance suite.
+
+Times the public entry points of the Geomagnetism Library for one or more coefficient files and
+reports the results in the layout of the Google benchmark library, so the JSON output of two builds
+can be compared with its tools (compare.py) or with any script reading that format.
+
+Before a benchmark is timed its results are validated against a test values file (the columns of
+WMM2025_TEST_VALUES.txt). A benchmark that fails validation is not timed; it is reported with
+error_occurred and the program exits with status 1.
+
+Usage: wmm_perf [options] [coefficient file[=test values file]]...
+
+    The coefficient files default to WMM.COF, their test values to WMM2025_TEST_VALUES.txt (looked up
+    in the current directory, then in its parent). A high degree model is given with its own test
+    values, for example wmm_perf WMM.COF WMMHR.COF=WMMHR2025_TEST_VALUES.txt
+
+Options:
+    --benchmark_filter=TEXT        Only run the benchmarks whose name contains TEXT
+    --benchmark_min_time=SECONDS   Minimum timed duration of each benchmark (default 0.5)
+    --benchmark_format=console|json|csv     Format of the standard output (default console)
+    --benchmark_out=FILE           Also write the results to FILE
+    --benchmark_out_format=console|json|csv Format of FILE (default json)
+
+Benchmarks (one item per iteration unless noted, NAME/nMax:N for each model):
+    ModelLoad                      MAG_robustReadMagModels and MAG_FreeMagneticModelMemory. The loaded
+                                   model is validated on the test values.
+    MAG_TimelyModifyMagneticModel  Over dates spread across the model's five years. Validated through
+                                   MAG_Geomag with the time adjusted model of every test date.
+    MAG_Geomag                     MAG_GeodeticToSpherical and MAG_Geomag over points spread over the
+                                   globe and heights up to 600 km. Validated on the test values.
+    MAG_Geomag_ctx                 The same with an evaluation context.
+    MAG_Gradient                   Validated against MAG_GradientAnalytic at the test locations and
+                                   dates within PERF_GRADIENT_TOLERANCE (the test values have no gradients).
+    MAG_PcupLow, MAG_PcupHigh      The Legendre functions of the point latitudes. Each is validated by
+                                   summing the field of the test values from its own functions.
+                                   MAG_PcupLow only runs for nMax <= 16, the degrees it is used for.
+    MAG_GetTransverseMercator      Over points in the UTM latitudes. The test values have no UTM
+                                   coordinates: the published easting of a zone edge at the equator, and
+                                   at the test locations the zone, hemisphere, equator values and the
+                                   symmetry about the central meridian are checked.
+    MAG_GridEvaluate/step:S        The grid engine of wmm_grid (MAG_Grid), one global grid of total
+                                   intensity per iteration at heights 0 and 100 km and dates epoch and
+                                   epoch + 2.5, on one thread. Items are grid cells. The printed values
+                                   of the cells on test locations are validated.
+ */
+
+#define PERF_POINTS 4096 /* Inputs cycled through by the point benchmarks, a power of two */
+#define PERF_TEST_VALUES "WMM2025_TEST_VALUES.txt"
+#define PERF_TEST_COLUMNS 19 /* Date, height, latitude, longitude, X, Y, Z, H, F, I, D, GV and the 7 rates */
+#define PERF_MAX_TEST_VALUES 256
+#define PERF_MAX_MODELS 8
+#define PERF_MAX_RESULTS 256
+#define PERF_DEFAULT_MIN_TIME 0.5 /* Seconds */
+#define PERF_MAX_ITERATIONS 1000000000L
+#define PERF_NT_TOLERANCE 0.05 /* Test values are rounded to 0.1 nT and 0.1 nT/year */
+#define PERF_DEG_TOLERANCE 0.005 /* and to 0.01 degrees and 0.01 degrees/year */
+#define PERF_GRID_TOLERANCE 0.055 /* nT, rounding of the test values and of the printed grid values */
+#define PERF_ROUNDING_SLACK 1e-6 /* Floating point noise on top of the rounding */
+#define PERF_GRADIENT_TOLERANCE 1e-4 /* nT/km, analytic against central difference gradients */
+#define PERF_UTM_TOLERANCE 1e-6 /* Meters */
+#define PERF_UTM_EDGE_EASTING 166021.4431 /* Meters, 3 degrees west of a central meridian at the equator (WGS 84) */
+#define PERF_GRID_ELEMENT 3 /* F */
+#define PERF_MESSAGE 256
+
+enum {
+    PERF_FIELD_GEOMAG, PERF_FIELD_GEOMAG_CTX, PERF_FIELD_PCUPLOW, PERF_FIELD_PCUPHIGH
+};
+
+enum {
+    PERF_CONSOLE, PERF_JSON, PERF_CSV
+};
+
+typedef struct {
+    char *File; /* Coefficient file */
+    char *TestFile;
+    MAGtype_MagneticModel *MagneticModel;
+    MAGtype_MagneticModel *TimedMagneticModel;
+    MAGtype_EvalContext *Context;
+    MAGtype_Ellipsoid Ellip;
+    MAGtype_Geoid Geoid;
+    double TestValues[PERF_MAX_TEST_VALUES][PERF_TEST_COLUMNS];
+    int NumTestValues;
+    double Latitude[PERF_POINTS], Longitude[PERF_POINTS], Height[PERF_POINTS], Year[PERF_POINTS];
+    double UTMLatitude[PERF_POINTS];
+    double *Pcup, *dPcup;
+    FILE *GridStream;
+    MAGtype_GridParameters Grid;
+} PerfModel;
+
+typedef struct {
+    const char *Name;
+    const char *TimeUnit; /* "ns" or "ms" */
+    double Arg; /* Field mode of the validation, or the grid step (degrees) */
+    int (*Validate)(PerfModel *Model, double Arg, double *Items, char *Message);
+    void (*Run)(PerfModel *Model, double Arg, long Iterations);
+} PerfBenchmark;
+
+typedef struct {
+    char Name[128];
+    char Label[128]; /* Coefficient file */
+    const char *TimeUnit;
+    long Iterations;
+    double RealTime, CpuTime; /* Per iteration, in TimeUnit */
+    double ItemsPerSecond;
+    int Error;
+    char Message[PERF_MESSAGE];
+} PerfResult;
+
+static volatile double perf_sink; /* Keeps the timed results alive */
+
+static double perf_clock(clockid_t Clock)
+{
+    struct timespec ts;
+
+    clock_gettime(Clock, &ts);
+    return (double) ts.tv_sec + 1e-9 * (double) ts.tv_nsec;
+}
+
+static double perf_uniform(unsigned long *state, double min, double max)
+/* Small linear congruential generator so the inputs are the same on every platform */
+{
+    *state = *state * 6364136223846793005UL + 1442695040888963407UL;
+    return min + (max - min) * (double) ((*state >> 11) & 0xFFFFFFFFFFFFFUL) / (double) 0xFFFFFFFFFFFFFUL;
+}
+
+static void perf_set_location(double Latitude, double Longitude, double Height, MAGtype_CoordGeodetic *CoordGeodetic)
+{
+    CoordGeodetic->phi = Latitude;
+    CoordGeodetic->lambda = Longitude;
+    CoordGeodetic->HeightAboveEllipsoid = Height;
+    CoordGeodetic->HeightAboveGeoid = Height;
+    CoordGeodetic->UseGeoid = 0;
+}
+
+static double perf_longitude(double Longitude)
+/* Longitude in [-180, 180) as the programs pass it to the library */
+{
+    return Longitude >= 180.0 ? Longitude - 360.0 : Longitude;
+}
+
+static void perf_set_date(PerfModel *Model, double DecimalYear)
+/* Time adjusts the model of the benchmarks */
+{
+    MAGtype_Date UserDate;
+
+    UserDate.DecimalYear = DecimalYear;
+    MAG_TimelyModifyMagneticModel(UserDate, Model->MagneticModel, Model->TimedMagneticModel);
+}
+
+static int perf_read_test_values(PerfModel *Model)
+/* Reads the rows of the test values file, returns FALSE if it has none */
+{
+    char line[512], *Name = Model->TestFile, Parent[512];
+    double *v;
+    FILE *fp;
+
+    fp = fopen(Name, "r");
+    if(fp == NULL && strcmp(Name, PERF_TEST_VALUES) == 0)
+    {
+        snprintf(Parent, sizeof (Parent), "../%s", PERF_TEST_VALUES);
+        fp = fopen(Parent, "r");
+    }
+    if(fp == NULL)
+        return FALSE;
+    Model->NumTestValues = 0;
+    while(fgets(line, sizeof (line), fp) != NULL && Model->NumTestValues < PERF_MAX_TEST_VALUES)
+    {
+        v = Model->TestValues[Model->NumTestValues];
+        if(line[0] == '#' || sscanf(line, "%lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf", &v[0], &v[1],
+                &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8], &v[9], &v[10], &v[11], &v[12], &v[13], &v[14], &v[15], &v[16],
+                &v[17], &v[18]) != PERF_TEST_COLUMNS)
+            continue;
+        Model->NumTestValues++;
+    }
+    fclose(fp);
+    return Model->NumTestValues > 0;
+}
+
+static int perf_compare_value(const char *Element, double Expected, double Value, double Tolerance, int Row, char *Message)
+{
+    if(MAG_isNaN(Expected) || fabs(Value - Expected) <= Tolerance + PERF_ROUNDING_SLACK)
+        return TRUE;
+    snprintf(Message, PERF_MESSAGE, "%s of test value %d is %.4f, expected %.4f", Element, Row + 1, Value, Expected);
+    return FALSE;
+}
+
+static int perf_compare_elements(const double *v, MAGtype_GeoMagneticElements *Elements, int Row, char *Message)
+/* Compares the elements of one point with a row of the test values */
+{
+    return perf_compare_value("X", v[4], Elements->X, PERF_NT_TOLERANCE, Row, Message) &&
+            perf_compare_value("Y", v[5], Elements->Y, PERF_NT_TOLERANCE, Row, Message) &&
+            perf_compare_value("Z", v[6], Elements->Z, PERF_NT_TOLERANCE, Row, Message) &&
+            perf_compare_value("H", v[7], Elements->H, PERF_NT_TOLERANCE, Row, Message) &&
+            perf_compare_value("F", v[8], Elements->F, PERF_NT_TOLERANCE, Row, Message) &&
+            perf_compare_value("Incl", v[9], Elements->Incl, PERF_DEG_TOLERANCE, Row, Message) &&
+            perf_compare_value("Decl", v[10], Elements->Decl, PERF_DEG_TOLERANCE, Row, Message) &&
+            perf_compare_value("GV", v[11], Elements->GV, PERF_DEG_TOLERANCE, Row, Message) &&
+            perf_compare_value("Xdot", v[12], Elements->Xdot, PERF_NT_TOLERANCE, Row, Message) &&
+            perf_compare_value("Ydot", v[13], Elements->Ydot, PERF_NT_TOLERANCE, Row, Message) &&
+            perf_compare_value("Zdot", v[14], Elements->Zdot, PERF_NT_TOLERANCE, Row, Message) &&
+            perf_compare_value("Hdot", v[15], Elements->Hdot, PERF_NT_TOLERANCE, Row, Message) &&
+            perf_compare_value("Fdot", v[16], Elements->Fdot, PERF_NT_TOLERANCE, Row, Message) &&
+            perf_compare_value("Incldot", v[17], Elements->Incldot, PERF_DEG_TOLERANCE, Row, Message) &&
+            perf_compare_value("Decldot", v[18], Elements->Decldot, PERF_DEG_TOLERANCE, Row, Message);
+}
+
+static int perf_field(PerfModel *Model, MAGtype_MagneticModel *MagneticModel, int Mode, const double *v,
+        MAGtype_GeoMagneticElements *Elements)
+/* Evaluates the field of a test value row through MAG_Geomag, MAG_Geomag_ctx or the steps of MAG_Geomag_ctx with
+   the Legendre functions of MAG_PcupLow or MAG_PcupHigh */
+{
+    MAGtype_CoordGeodetic CoordGeodetic;
+    MAGtype_CoordSpherical CoordSpherical;
+    MAGtype_MagneticResults MagneticResultsSph, MagneticResultsGeo, MagneticResultsSphVar, MagneticResultsGeoVar;
+    MAGtype_EvalContext *Context = Model->Context;
+    MAGtype_Date UserDate;
+    double sin_phi;
+    int Flag = TRUE;
+
+    perf_set_location(v[2], perf_longitude(v[3]), v[1], &CoordGeodetic);
+    UserDate.DecimalYear = v[0];
+    MAG_TimelyModifyMagneticModel(UserDate, MagneticModel, Model->TimedMagneticModel);
+    MAG_GeodeticToSpherical(Model->Ellip, CoordGeodetic, &CoordSpherical);
+    if(Mode == PERF_FIELD_GEOMAG)
+        Flag = MAG_Geomag(Model->Ellip, CoordSpherical, CoordGeodetic, Model->TimedMagneticModel, Elements);
+    else if(Mode == PERF_FIELD_GEOMAG_CTX)
+        Flag = MAG_Geomag_ctx(Context, Model->Ellip, CoordSpherical, CoordGeodetic, Model->TimedMagneticModel, Elements);
+    else
+    {
+        sin_phi = sin(DEG2RAD(CoordSpherical.phig));
+        MAG_ComputeSphericalHarmonicVariables(Model->Ellip, CoordSpherical, MagneticModel->nMax, &Context->SphVariables);
+        if(Mode == PERF_FIELD_PCUPLOW)
+            Flag = MAG_PcupLow(Context->LegendreFunction.Pcup, Context->LegendreFunction.dPcup, sin_phi, MagneticModel->nMax);
+        else
+            Flag = MAG_PcupHigh(Context->LegendreFunction.Pcup, Context->LegendreFunction.dPcup, sin_phi, MagneticModel->nMax);
+        MAG_Summation_ctx(Context, Model->TimedMagneticModel, CoordSpherical, &MagneticResultsSph);
+        MAG_SecVarSummation_ctx(Context, Model->TimedMagneticModel, CoordSpherical, &MagneticResultsSphVar);
+        MAG_RotateMagneticVector(CoordSpherical, CoordGeodetic, MagneticResultsSph, &MagneticResultsGeo);
+        MAG_RotateMagneticVector(CoordSpherical, CoordGeodetic, MagneticResultsSphVar, &MagneticResultsGeoVar);
+        MAG_CalculateGeoMagneticElements(&MagneticResultsGeo, Elements);
+        MAG_CalculateSecularVariationElements(MagneticResultsGeoVar, Elements);
+    }
+    MAG_CalculateGridVariation(CoordGeodetic, Elements);
+    return Flag;
+}
+
+static int perf_validate_field_of(PerfModel *Model, MAGtype_MagneticModel *MagneticModel, int Mode, char *Message)
+{
+    MAGtype_GeoMagneticElements Elements;
+    int i;
+
+    for(i = 0; i < Model->NumTestValues; i++)
+    {
+        if(!perf_field(Model, MagneticModel, Mode, Model->TestValues[i], &Elements))
+        {
+            snprintf(Message, PERF_MESSAGE, "evaluation of test value %d failed", i + 1);
+            return FALSE;
+        }
+        if(!perf_compare_elements(Model->TestValues[i], &Elements, i, Message))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static int perf_validate_field(PerfModel *Model, double Arg, double *Items, char *Message)
+{
+    *Items = 1;
+    return perf_validate_field_of(Model, Model->MagneticModel, (int) Arg, Message);
+}
+
+static int perf_validate_load(PerfModel *Model, double Arg, double *Items, char *Message)
+/* Validates a model loaded the way the benchmark loads it */
+{
+    MAGtype_MagneticModel * MagneticModels[1];
+    int Flag;
+
+    (void) Arg;
+    *Items = 1;
+    if(!MAG_robustReadMagModels(Model->File, &MagneticModels, 1))
+    {
+        snprintf(Message, PERF_MESSAGE, "%s could not be read", Model->File);
+        return FALSE;
+    }
+    Flag = MagneticModels[0]->nMax == Model->MagneticModel->nMax &&
+            perf_validate_field_of(Model, MagneticModels[0], PERF_FIELD_GEOMAG, Message);
+    MAG_FreeMagneticModelMemory(MagneticModels[0]);
+    return Flag;
+}
+
+static int perf_validate_gradient(PerfModel *Model, double Arg, double *Items, char *Message)
+{
+    MAGtype_CoordGeodetic CoordGeodetic;
+    MAGtype_Gradient Difference, Analytic;
+    MAGtype_GeoMagneticElements *d[3], *a[3];
+    double *v, Worst;
+    int i, k;
+
+    (void) Arg;
+    *Items = 1;
+    d[0] = &Difference.GradPhi;
+    d[1] = &Difference.GradLambda;
+    d[2] = &Difference.GradZ;
+    a[0] = &Analytic.GradPhi;
+    a[1] = &Analytic.GradLambda;
+    a[2] = &Analytic.GradZ;
+    for(i = 0; i < Model->NumTestValues; i++)
+    {
+        v = Model->TestValues[i];
+        perf_set_date(Model, v[0]);
+        perf_set_location(v[2], perf_longitude(v[3]), v[1], &CoordGeodetic);
+        MAG_Gradient(Model->Ellip, CoordGeodetic, Model->TimedMagneticModel, &Difference);
+        MAG_GradientAnalytic(Model->Ellip, CoordGeodetic, Model->TimedMagneticModel, &Analytic);
+        Worst = 0;
+        for(k = 0; k < 3; k++)
+        {
+            Worst = fmax(Worst, fabs(d[k]->X - a[k]->X));
+            Worst = fmax(Worst, fabs(d[k]->Y - a[k]->Y));
+            Worst = fmax(Worst, fabs(d[k]->Z - a[k]->Z));
+        }
+        if(!(Worst <= PERF_GRADIENT_TOLERANCE))
+        {
+            snprintf(Message, PERF_MESSAGE, "gradient at test value %d differs from MAG_GradientAnalytic by %.2e nT/km", i + 1, Worst);
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static int perf_validate_utm(PerfModel *Model, double Arg, double *Items, char *Message)
+{
+    MAGtype_CoordGeodetic CoordGeodetic;
+    MAGtype_UTMParameters UTM, East, West;
+    double *v, Longitude, CentralMeridian;
+    int i, Checked = 0;
+
+    (void) Arg;
+    *Items = 1;
+    perf_set_location(0.0, 3.0, 0.0, &CoordGeodetic);
+    MAG_GetTransverseMercator(CoordGeodetic, &UTM);
+    if(fabs(UTM.Easting - 500000.0) > PERF_UTM_TOLERANCE || fabs(UTM.Northing) > PERF_UTM_TOLERANCE ||
+            fabs(UTM.PointScale - 0.9996) > 1e-12 || fabs(UTM.ConvergenceOfMeridians) > 1e-12)
+    {
+        snprintf(Message, PERF_MESSAGE, "the central meridian of zone 31 at the equator is at %.6f, %.6f m", UTM.Easting, UTM.Northing);
+        return FALSE;
+    }
+    /* The western edge of a zone at the equator, the smallest easting of the UTM grid */
+    perf_set_location(0.0, 0.0, 0.0, &CoordGeodetic);
+    MAG_GetTransverseMercator(CoordGeodetic, &UTM);
+    if(fabs(UTM.Easting - PERF_UTM_EDGE_EASTING) > 1e-3)
+    {
+        snprintf(Message, PERF_MESSAGE, "the western edge of zone 31 at the equator is at easting %.4f m", UTM.Easting);
+        return FALSE;
+    }
+    for(i = 0; i < Model->NumTestValues; i++)
+    {
+        v = Model->TestValues[i];
+        if(v[2] < -80.0 || v[2] > 84.0)
+            continue;
+        Longitude = perf_longitude(v[3]);
+        perf_set_location(v[2], Longitude, v[1], &CoordGeodetic);
+        MAG_GetTransverseMercator(CoordGeodetic, &UTM);
+        CentralMeridian = perf_longitude(UTM.CentralMeridian);
+        if(fabs(CentralMeridian - (6 * UTM.Zone - 183)) > 1e-12 || fabs(Longitude - CentralMeridian) > 6.0 ||
+                UTM.HemiSphere != (v[2] >= 0 ? 'N' : 'S') || (v[2] == 0 && (fabs(UTM.Northing) > PERF_UTM_TOLERANCE ||
+                fabs(UTM.ConvergenceOfMeridians) > 1e-12)))
+        {
+            snprintf(Message, PERF_MESSAGE, "zone %d%c at test value %d", UTM.Zone, UTM.HemiSphere, i + 1);
+            return FALSE;
+        }
+        /* Points at the same distance east and west of the central meridian mirror each other */
+        perf_set_location(v[2], CentralMeridian + 1.5, v[1], &CoordGeodetic);
+        MAG_GetTransverseMercator(CoordGeodetic, &East);
+        perf_set_location(v[2], CentralMeridian - 1.5, v[1], &CoordGeodetic);
+        MAG_GetTransverseMercator(CoordGeodetic, &West);
+        if(East.Zone != UTM.Zone || West.Zone != UTM.Zone || fabs(East.Easting + West.Easting - 1e6) > PERF_UTM_TOLERANCE ||
+                fabs(East.Northing - West.Northing) > PERF_UTM_TOLERANCE ||
+                fabs(East.ConvergenceOfMeridians + West.ConvergenceOfMeridians) > 1e-12 || fabs(East.PointScale - West.PointScale) > 1e-12)
+        {
+            snprintf(Message, PERF_MESSAGE, "points about the central meridian at test value %d are not symmetric", i + 1);
+            return FALSE;
+        }
+        Checked++;
+    }
+    if(Checked == 0)
+    {
+        snprintf(Message, PERF_MESSAGE, "no test value in the UTM latitudes");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static int perf_validate_pcup(PerfModel *Model, double Arg, double *Items, char *Message)
+{
+    if((int) Arg == PERF_FIELD_PCUPLOW && Model->MagneticModel->nMax > 16)
+    {
+        snprintf(Message, PERF_MESSAGE, "MAG_PcupLow is only used up to degree 16");
+        return FALSE;
+    }
+    return perf_validate_field(Model, Arg, Items, Message);
+}
+
+static void perf_set_grid(PerfModel *Model, double Step)
+/* Global grid of total intensity at heights 0 and 100 km and dates epoch and epoch + 2.5 */
+{
+    MAGtype_GridParameters *Grid = &Model->Grid;
+
+    memset(Grid, 0, sizeof (MAGtype_GridParameters));
+    Grid->minimum.phi = -90.0;
+    Grid->maximum.phi = 90.0;
+    Grid->minimum.lambda = -180.0;
+    Grid->maximum.lambda = 180.0;
+    Grid->cord_step_size = Step;
+    Grid->minimum.HeightAboveGeoid = 0.0;
+    Grid->maximum.HeightAboveGeoid = 100.0;
+    Grid->altitude_step_size = 100.0;
+    Grid->StartDate.DecimalYear = Model->MagneticModel->epoch;
+    Grid->EndDate.DecimalYear = Model->MagneticModel->epoch + 2.5;
+    Grid->time_step = 2.5;
+    Grid->ElementOption = PERF_GRID_ELEMENT;
+    Grid->HeightWarning = NULL;
+    Grid->NumThreads = 1;
+    Grid->Separable = 1;
+    Grid->OutputFormat = MAG_GRID_TEXT;
+    Model->Geoid.UseGeoid = 0;
+}
+
+static int perf_grid_evaluate(PerfModel *Model, MAGtype_GridStatus *Status)
+{
+    rewind(Model->GridStream);
+    return MAG_GridEvaluate(&Model->Grid, Model->MagneticModel, &Model->Geoid, Model->Ellip, Model->GridStream, Model->GridStream, Status);
+}
+
+static int perf_validate_grid(PerfModel *Model, double Arg, double *Items, char *Message)
+/* Evaluates the grid once and compares the printed cells on test locations with the test values */
+{
+    MAGtype_GridStatus Status;
+    char line[256];
+    double Latitude, Longitude, Height, Year, Value, *v;
+    long Length;
+    int i, Matched = 0;
+
+    perf_set_grid(Model, Arg);
+    if(!perf_grid_evaluate(Model, &Status))
+    {
+        snprintf(Message, PERF_MESSAGE, "MAG_GridEvaluate failed");
+        return FALSE;
+    }
+    *Items = (double) Status.NumCells;
+    Length = ftell(Model->GridStream);
+    rewind(Model->GridStream);
+    while(ftell(Model->GridStream) < Length && fgets(line, sizeof (line), Model->GridStream) != NULL)
+    {
+        if(sscanf(line, "%lf %lf %lf %lf %lf", &Latitude, &Longitude, &Height, &Year, &Value) != 5)
+            continue;
+        for(i = 0; i < Model->NumTestValues; i++)
+        {
+            v = Model->TestValues[i];
+            if(fabs(v[0] - Year) < 1e-6 && fabs(v[1] - Height) < 1e-6 && fabs(v[2] - Latitude) < 1e-6 &&
+                    fabs(perf_longitude(v[3]) - Longitude) < 1e-6)
+            {
+                if(!perf_compare_value("Grid F", v[8], Value, PERF_GRID_TOLERANCE, i, Message))
+                    return FALSE;
+                Matched++;
+            }
+        }
+    }
+    if(Matched == 0)
+    {
+        snprintf(Message, PERF_MESSAGE, "no test value on the grid");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void perf_run_load(PerfModel *Model, double Arg, long Iterations)
+{
+    MAGtype_MagneticModel * MagneticModels[1];
+    long i;
+
+    (void) Arg;
+    for(i = 0; i < Iterations; i++)
+    {
+        if(MAG_robustReadMagModels(Model->File, &MagneticModels, 1))
+        {
+            perf_sink += MagneticModels[0]->Main_Field_Coeff_G[1];
+            MAG_FreeMagneticModelMemory(MagneticModels[0]);
+        }
+    }
+}
+
+static void perf_run_timely(PerfModel *Model, double Arg, long Iterations)
+{
+    MAGtype_Date UserDate;
+    long i;
+
+    (void) Arg;
+    for(i = 0; i < Iterations; i++)
+    {
+        UserDate.DecimalYear = Model->Year[i & (PERF_POINTS - 1)];
+        MAG_TimelyModifyMagneticModel(UserDate, Model->MagneticModel, Model->TimedMagneticModel);
+        perf_sink += Model->TimedMagneticModel->Main_Field_Coeff_G[1];
+    }
+}
+
+static void perf_run_geomag(PerfModel *Model, double Arg, long Iterations)
+{
+    MAGtype_CoordGeodetic CoordGeodetic;
+    MAGtype_CoordSpherical CoordSpherical;
+    MAGtype_GeoMagneticElements Elements;
+    long i;
+    int k;
+
+    for(i = 0; i < Iterations; i++)
+    {
+        k = (int) (i & (PERF_POINTS - 1));
+        perf_set_location(Model->Latitude[k], Model->Longitude[k], Model->Height[k], &CoordGeodetic);
+        MAG_GeodeticToSpherical(Model->Ellip, CoordGeodetic, &CoordSpherical);
+        if((int) Arg == PERF_FIELD_GEOMAG_CTX)
+            MAG_Geomag_ctx(Model->Context, Model->Ellip, CoordSpherical, CoordGeodetic, Model->TimedMagneticModel, &Elements);
+        else
+            MAG_Geomag(Model->Ellip, CoordSpherical, CoordGeodetic, Model->TimedMagneticModel, &Elements);
+        perf_sink += Elements.F;
+    }
+}
+
+static void perf_run_gradient(PerfModel *Model, double Arg, long Iterations)
+{
+    MAGtype_CoordGeodetic CoordGeodetic;
+    MAGtype_Gradient Gradient;
+    long i;
+    int k;
+
+    (void) Arg;
+    for(i = 0; i < Iterations; i++)
+    {
+        k = (int) (i & (PERF_POINTS - 1));
+        perf_set_location(Model->Latitude[k], Model->Longitude[k], Model->Height[k], &CoordGeodetic);
+        MAG_Gradient(Model->Ellip, CoordGeodetic, Model->TimedMagneticModel, &Gradient);
+        perf_sink += Gradient.GradPhi.X;
+    }
+}
+
+static void perf_run_pcup(PerfModel *Model, double Arg, long Iterations)
+{
+    double x;
+    long i;
+
+    for(i = 0; i < Iterations; i++)
+    {
+        x = sin(DEG2RAD(Model->Latitude[i & (PERF_POINTS - 1)]));
+        if((int) Arg == PERF_FIELD_PCUPLOW)
+            MAG_PcupLow(Model->Pcup, Model->dPcup, x, Model->MagneticModel->nMax);
+        else
+            MAG_PcupHigh(Model->Pcup, Model->dPcup, x, Model->MagneticModel->nMax);
+        perf_sink += Model->Pcup[1];
+    }
+}
+
+static void perf_run_utm(PerfModel *Model, double Arg, long Iterations)
+{
+    MAGtype_CoordGeodetic CoordGeodetic;
+    MAGtype_UTMParameters UTM;
+    long i;
+    int k;
+
+    (void) Arg;
+    for(i = 0; i < Iterations; i++)
+    {
+        k = (int) (i & (PERF_POINTS - 1));
+        perf_set_location(Model->UTMLatitude[k], Model->Longitude[k], 0.0, &CoordGeodetic);
+        MAG_GetTransverseMercator(CoordGeodetic, &UTM);
+        perf_sink += UTM.Easting;
+    }
+}
+
+static void perf_run_grid(PerfModel *Model, double Arg, long Iterations)
+{
+    MAGtype_GridStatus Status;
+    long i;
+
+    (void) Arg;
+    for(i = 0; i < Iterations; i++)
+    {
+        perf_grid_evaluate(Model, &Status);
+        perf_sink += (double) Status.NumCells;
+    }
+}
+
+static const PerfBenchmark PerfBenchmarks[] = {
+    {"ModelLoad", "ms", 0, perf_validate_load, perf_run_load},
+    {"MAG_TimelyModifyMagneticModel", "ns", PERF_FIELD_GEOMAG, perf_validate_field, perf_run_timely},
+    {"MAG_Geomag", "ns", PERF_FIELD_GEOMAG, perf_validate_field, perf_run_geomag},
+    {"MAG_Geomag_ctx", "ns", PERF_FIELD_GEOMAG_CTX, perf_validate_field, perf_run_geomag},
+    {"MAG_Gradient", "ns", 0, perf_validate_gradient, perf_run_gradient},
+    {"MAG_PcupLow", "ns", PERF_FIELD_PCUPLOW, perf_validate_pcup, perf_run_pcup},
+    {"MAG_PcupHigh", "ns", PERF_FIELD_PCUPHIGH, perf_validate_pcup, perf_run_pcup},
+    {"MAG_GetTransverseMercator", "ns", 0, perf_validate_utm, perf_run_utm},
+    {"MAG_GridEvaluate/step:5", "ms", 5.0, perf_validate_grid, perf_run_grid},
+    {"MAG_GridEvaluate/step:2", "ms", 2.0, perf_validate_grid, perf_run_grid},
+    {"MAG_GridEvaluate/step:1", "ms", 1.0, perf_validate_grid, perf_run_grid}
+};
+
+static int perf_open_model(PerfModel *Model)
+/* Reads the model and its test values and allocates the benchmark inputs */
+{
+    MAGtype_MagneticModel * MagneticModels[1];
+    unsigned long state = 20250101UL;
+    int i, NumTerms;
+
+    if(!MAG_robustReadMagModels(Model->File, &MagneticModels, 1))
+    {
+        printf("%s not found.\n", Model->File);
+        return FALSE;
+    }
+    Model->MagneticModel = MagneticModels[0];
+    if(!perf_read_test_values(Model))
+    {
+        printf("No test values in %s for %s.\n", Model->TestFile, Model->File);
+        return FALSE;
+    }
+    NumTerms = (Model->MagneticModel->nMax + 1) * (Model->MagneticModel->nMax + 2) / 2;
+    Model->TimedMagneticModel = MAG_AllocateModelMemory(NumTerms);
+    Model->Context = MAG_AllocateEvalContext(Model->MagneticModel->nMax);
+    Model->Pcup = (double *) malloc((NumTerms + 1) * sizeof (double));
+    Model->dPcup = (double *) malloc((NumTerms + 1) * sizeof (double));
+    Model->GridStream = tmpfile();
+    if(Model->TimedMagneticModel == NULL || Model->Context == NULL || Model->Pcup == NULL || Model->dPcup == NULL ||
+            Model->GridStream == NULL)
+    {
+        printf("Error allocating benchmark memory\n");
+        return FALSE;
+    }
+    MAG_SetDefaults(&Model->Ellip, &Model->Geoid);
+    for(i = 0; i < PERF_POINTS; i++)
+    {
+        Model->Latitude[i] = perf_uniform(&state, -89.9, 89.9);
+        Model->Longitude[i] = perf_uniform(&state, -180.0, 180.0);
+        Model->Height[i] = perf_uniform(&state, -1.0, 600.0);
+        Model->Year[i] = perf_uniform(&state, Model->MagneticModel->epoch, Model->MagneticModel->epoch + 5.0);
+        Model->UTMLatitude[i] = perf_uniform(&state, -80.0, 84.0);
+    }
+    return TRUE;
+}
+
+static void perf_close_model(PerfModel *Model)
+{
+    if(Model->GridStream != NULL)
+        fclose(Model->GridStream);
+    free(Model->Pcup);
+    free(Model->dPcup);
+    MAG_FreeEvalContext(Model->Context);
+    if(Model->TimedMagneticModel != NULL)
+        MAG_FreeMagneticModelMemory(Model->TimedMagneticModel);
+    if(Model->MagneticModel != NULL)
+        MAG_FreeMagneticModelMemory(Model->MagneticModel);
+}
+
+static void perf_measure(const PerfBenchmark *Benchmark, PerfModel *Model, double MinTime, double Items, PerfResult *Result)
+/* Runs a validated benchmark with a growing number of iterations until one run takes at least MinTime, as the
+   Google benchmark library does, and keeps the per iteration times of the last run. The grid benchmarks
+   run the grid their validation set up. */
+{
+    double Real, Cpu, Multiplier, Scale = strcmp(Benchmark->TimeUnit, "ms") ? 1e9 : 1e3;
+    long Iterations = 1, Next;
+
+    perf_set_date(Model, Model->MagneticModel->epoch + 2.5);
+    for(;;)
+    {
+        Real = perf_clock(CLOCK_MONOTONIC);
+        Cpu = perf_clock(CLOCK_PROCESS_CPUTIME_ID);
+        Benchmark->Run(Model, Benchmark->Arg, Iterations);
+        Cpu = perf_clock(CLOCK_PROCESS_CPUTIME_ID) - Cpu;
+        Real = perf_clock(CLOCK_MONOTONIC) - Real;
+        if(Real >= MinTime || Iterations >= PERF_MAX_ITERATIONS)
+            break;
+        Multiplier = Real / MinTime > 0.1 ? MinTime * 1.4 / fmax(Real, 1e-9) : 10.0;
+        Multiplier = fmax(Multiplier, 1.0);
+        Next = (long) (Iterations * Multiplier);
+        Iterations = Next > Iterations ? Next : Iterations + 1;
+        if(Iterations > PERF_MAX_ITERATIONS)
+            Iterations = PERF_MAX_ITERATIONS;
+    }
+    Result->Iterations = Iterations;
+    Result->RealTime = Real * Scale / Iterations;
+    Result->CpuTime = Cpu * Scale / Iterations;
+    Result->ItemsPerSecond = Cpu > 0 ? Items * Iterations / Cpu : 0;
+}
+
+static void perf_json_string(FILE *Out, const char *Text)
+{
+    fputc('"', Out);
+    for(; *Text; Text++)
+    {
+        if(*Text == '"' || *Text == '\\')
+            fputc('\\', Out);
+        fputc(*Text, Out);
+    }
+    fputc('"', Out);
+}
+
+static void perf_console_header(FILE *Out)
+{
+    fprintf(Out, "%-60s %15s %15s %12s\n", "Benchmark", "Time", "CPU", "Iterations");
+    fprintf(Out, "-------------------------------------------------------------------------------------------------------\n");
+}
+
+static void perf_console_row(FILE *Out, const PerfResult *Result)
+{
+    if(Result->Error)
+        fprintf(Out, "%-60s ERROR OCCURRED: '%s'\n", Result->Name, Result->Message);
+    else
+        fprintf(Out, "%-60s %12.4g %-2s %12.4g %-2s %12ld items_per_second=%.4g/s\n", Result->Name, Result->RealTime, Result->TimeUnit,
+            Result->CpuTime, Result->TimeUnit, Result->Iterations, Result->ItemsPerSecond);
+}
+
+static void perf_write(FILE *Out, int Format, const PerfResult *Results, int NumResults, double MinTime)
+/* Writes the results in the console, JSON or CSV layout of the Google benchmark library */
+{
+    char Date[64];
+    time_t Now = time(NULL);
+    int i;
+
+    if(Format == PERF_CONSOLE)
+    {
+        perf_console_header(Out);
+        for(i = 0; i < NumResults; i++)
+            perf_console_row(Out, &Results[i]);
+    } else if(Format == PERF_CSV)
+    {
+        fprintf(Out, "name,iterations,real_time,cpu_time,time_unit,bytes_per_second,items_per_second,label,error_occurred,error_message\n");
+        for(i = 0; i < NumResults; i++)
+        {
+            if(Results[i].Error)
+                fprintf(Out, "\"%s\",,,,,,,\"%s\",true,\"%s\"\n", Results[i].Name, Results[i].Label, Results[i].Message);
+            else
+                fprintf(Out, "\"%s\",%ld,%.9g,%.9g,%s,,%.9g,\"%s\",,\n", Results[i].Name, Results[i].Iterations, Results[i].RealTime,
+                    Results[i].CpuTime, Results[i].TimeUnit, Results[i].ItemsPerSecond, Results[i].Label);
+        }
+    } else
+    {
+        strftime(Date, sizeof (Date), "%Y-%m-%dT%H:%M:%S", localtime(&Now));
+        fprintf(Out, "{\n  \"context\": {\n    \"date\": \"%s\",\n    \"executable\": \"wmm_perf\",\n", Date);
+        fprintf(Out, "    \"num_cpus\": %ld,\n    \"min_time\": %.6g,\n    \"library_version\": ", sysconf(_SC_NPROCESSORS_ONLN), MinTime);
+        perf_json_string(Out, VERSIONDATE_LARGE);
+        fprintf(Out, "\n  },\n  \"benchmarks\": [");
+        for(i = 0; i < NumResults; i++)
+        {
+            fprintf(Out, "%s\n    {\n      \"name\": ", i ? "," : "");
+            perf_json_string(Out, Results[i].Name);
+            fprintf(Out, ",\n      \"run_name\": ");
+            perf_json_string(Out, Results[i].Name);
+            fprintf(Out, ",\n      \"run_type\": \"iteration\",\n      \"label\": ");
+            perf_json_string(Out, Results[i].Label);
+            if(Results[i].Error)
+            {
+                fprintf(Out, ",\n      \"error_occurred\": true,\n      \"error_message\": ");
+                perf_json_string(Out, Results[i].Message);
+                fprintf(Out, "\n    }");
+                continue;
+            }
+            fprintf(Out, ",\n      \"iterations\": %ld,\n      \"real_time\": %.17g,\n      \"cpu_time\": %.17g,\n      \"time_unit\": \"%s\",\n"
+                    "      \"items_per_second\": %.17g\n    }", Results[i].Iterations, Results[i].RealTime, Results[i].CpuTime, Results[i].TimeUnit,
+                    Results[i].ItemsPerSecond);
+        }
+        fprintf(Out, "\n  ]\n}\n");
+    }
+}
+
+static int perf_format(const char *Name)
+{
+    if(!strcmp(Name, "console"))
+        return PERF_CONSOLE;
+    if(!strcmp(Name, "json"))
+        return PERF_JSON;
+    if(!strcmp(Name, "csv"))
+        return PERF_CSV;
+    return -1;
+}
+
+int main(int argc, char *argv[])
+{
+    static PerfModel Models[PERF_MAX_MODELS];
+    static PerfResult Results[PERF_MAX_RESULTS];
+    const PerfBenchmark *Benchmark;
+    PerfResult *Result;
+    char DefaultFile[] = "WMM.COF", DefaultTestFile[] = PERF_TEST_VALUES, *Filter = "", *OutFile = NULL, *Separator;
+    double MinTime = PERF_DEFAULT_MIN_TIME, Items;
+    int Format = PERF_CONSOLE, OutFormat = PERF_JSON, NumModels = 0, NumResults = 0, i, m, b, Flag = TRUE;
+    FILE *Out;
+
+    for(i = 1; i < argc; i++)
+    {
+        if(!strncmp(argv[i], "--benchmark_filter=", 19))
+            Filter = argv[i] + 19;
+        else if(!strncmp(argv[i], "--benchmark_min_time=", 21))
+            MinTime = atof(argv[i] + 21);
+        else if(!strncmp(argv[i], "--benchmark_format=", 19))
+            Format = perf_format(argv[i] + 19);
+        else if(!strncmp(argv[i], "--benchmark_out=", 16))
+            OutFile = argv[i] + 16;
+        else if(!strncmp(argv[i], "--benchmark_out_format=", 23))
+            OutFormat = perf_format(argv[i] + 23);
+        else if(argv[i][0] != '-' && NumModels < PERF_MAX_MODELS)
+        {
+            Models[NumModels].File = argv[i];
+            Models[NumModels].TestFile = DefaultTestFile;
+            Separator = strchr(argv[i], '=');
+            if(Separator != NULL)
+            {
+                *Separator = '\0';
+                Models[NumModels].TestFile = Separator + 1;
+            }
+            NumModels++;
+        } else
+            Format = -1;
+    }
+    if(Format < 0 || OutFormat < 0 || !(MinTime > 0))
+    {
+        printf("Usage: wmm_perf [--benchmark_filter=TEXT] [--benchmark_min_time=SECONDS] [--benchmark_format=console|json|csv]\n"
+                "                [--benchmark_out=FILE] [--benchmark_out_format=console|json|csv] [coefficient file[=test values file]]...\n");
+        return 1;
+    }
+    if(NumModels == 0)
+    {
+        Models[0].File = DefaultFile;
+        Models[0].TestFile = DefaultTestFile;
+        NumModels = 1;
+    }
+
+    if(Format == PERF_CONSOLE)
+        perf_console_header(stdout);
+    for(m = 0; m < NumModels && Flag; m++)
+    {
+        if(!perf_open_model(&Models[m]))
+        {
+            Flag = FALSE;
+            break;
+        }
+        for(b = 0; b < (int) (sizeof (PerfBenchmarks) / sizeof (PerfBenchmarks[0])) && NumResults < PERF_MAX_RESULTS; b++)
+        {
+            Benchmark = &PerfBenchmarks[b];
+            if(Benchmark->Validate == perf_validate_pcup && (int) Benchmark->Arg == PERF_FIELD_PCUPLOW && Models[m].MagneticModel->nMax > 16)
+                continue;
+            Result = &Results[NumResults];
+            memset(Result, 0, sizeof (PerfResult));
+            if(strchr(Benchmark->Name, '/') != NULL)
+                snprintf(Result->Name, sizeof (Result->Name), "%.*s/nMax:%d%s", (int) (strchr(Benchmark->Name, '/') - Benchmark->Name),
+                    Benchmark->Name, Models[m].MagneticModel->nMax, strchr(Benchmark->Name, '/'));
+            else
+                snprintf(Result->Name, sizeof (Result->Name), "%s/nMax:%d", Benchmark->Name, Models[m].MagneticModel->nMax);
+            if(strstr(Result->Name, Filter) == NULL)
+                continue;
+            snprintf(Result->Label, sizeof (Result->Label), "%s", Models[m].File);
+            Result->TimeUnit = Benchmark->TimeUnit;
+            if(!Benchmark->Validate(&Models[m], Benchmark->Arg, &Items, Result->Message))
+            {
+                Result->Error = TRUE;
+                Flag = FALSE;
+            } else
+                perf_measure(Benchmark, &Models[m], MinTime, Items, Result);
+            NumResults++;
+            if(Format == PERF_CONSOLE)
+            {
+                perf_console_row(stdout, Result);
+                fflush(stdout);
+            }
+        }
+    }
+    for(m = 0; m < NumModels; m++)
+        perf_close_model(&Models[m]);
+
+    if(Format != PERF_CONSOLE)
+        perf_write(stdout, Format, Results, NumResults, MinTime);
+    if(OutFile != NULL)
+    {
+        Out = fopen(OutFile, "w");
+        if(Out == NULL)
+        {
+            printf("Error opening %s\n", OutFile);
+            return 1;
+        }
+        perf_write(Out, OutFormat, Results, NumResults, MinTime);
+        fclose(Out);
+    }
+    return Flag ? 0 : 1;
+}
@@ -29,8 +29,50 @@ April 21, 2011
 liyin.young@noaa.gov
 Updated April, 2023
 
+wmm_point -c [points] [coefficient file] checks the evaluation paths for repeated points instead:
+MAG_Geomag_ctx and MAG_GradY_ctx must not allocate once the context exists (model degree and degree
+POINT_CHECK_HIGH_NMAX, points and poles; counted with the GNU C library only), and MAG_GeomagTrajectory
+on a 100 Hz vehicle track must agree with the time adjusted MAG_Geomag_ctx within
+POINT_CHECK_EXACT_TOLERANCE without and POINT_CHECK_TRAJECTORY_TOLERANCE with the reuse of the
+Legendre functions. It exits with 1 when a check fails.
+
  */
 
+#define POINT_CHECK_POINTS 100000 /* Points of the allocation check, fixes of the track */
+#define POINT_CHECK_HIGH_NMAX 20 /* Above 16, so MAG_AssociatedLegendreFunction_ctx takes MAG_PcupHigh away from the poles */
+#define POINT_CHECK_EXACT_TOLERANCE 1e-6 /* nT, rounding of the regrouped sums */
+#define POINT_CHECK_TRAJECTORY_TOLERANCE 0.1 /* nT, Legendre functions reused within MAG_TRAJECTORY_LATITUDE_TOLERANCE */
+#define POINT_CHECK_RATE 100.0 /* Fixes per second */
+#define POINT_CHECK_SPEED 25.0 /* m/s */
+
+#ifdef __GLIBC__
+/* The GNU C library lets a program replace malloc, calloc and realloc; these count the calls of the whole
+   program (library included) for the 'c' check and hand them to the library's allocator. */
+#define POINT_COUNT_ALLOCATIONS
+extern void *__libc_malloc(size_t Size);
+extern void *__libc_calloc(size_t Count, size_t Size);
+extern void *__libc_realloc(void *Pointer, size_t Size);
+static unsigned long PointAllocations;
+
+void *malloc(size_t Size)
+{
+    PointAllocations++;
+    return __libc_malloc(Size);
+}
+
+void *calloc(size_t Count, size_t Size)
+{
+    PointAllocations++;
+    return __libc_calloc(Count, Size);
+}
+
+void *realloc(void *Pointer, size_t Size)
+{
+    PointAllocations++;
+    return __libc_realloc(Pointer, Size);
+}
+#endif
+
 const char* BOZ_WARN_TEXT_STRONG = "Warning: some calculated locations are "
                                    "in the blackout zone "
                                    "around the magnetic pole\nas defined by "
@@ -52,7 +94,9 @@ char MAG_GeomagIntroduction_WMM(MAGtype_MagneticModel *MagneticModel, char *Vers
 
 void help_info(MAGtype_MagneticModel *MagneticModel, char* short_name);
 
-int main()
+int point_check(char *model_file, int NumPoints);
+
+int main(int argc, char *argv[])
 {
     MAGtype_MagneticModel * MagneticModels[1], *TimedMagneticModel;
     MAGtype_Ellipsoid Ellip;
@@ -74,6 +118,9 @@ int main()
     char VersionDate[12];
     int NumTerms, Flag = 1, nMax = 0;
     int epochs = 1;
+    if(argc > 1 && !strcmp(argv[1], "-c"))
+        return point_check(argc > 3 ? argv[3] : filename, argc > 2 ? atoi(argv[2]) : POINT_CHECK_POINTS) ? 0 : 1;
+
     /* Memory allocation */
 
     strncpy(VersionDate, VERSIONDATE_LARGE + 39, 11);
@@ -270,3 +317,289 @@ void help_info(MAGtype_MagneticModel *MagneticModel, char* short_name){
     printf("\n	Email:  Geomag.Models@noaa.gov \n");
 
 }
+
+static double point_uniform(unsigned long *state, double min, double max)
+/* Small linear congruential generator so the point set is the same on every platform */
+{
+    *state = *state * 6364136223846793005UL + 1442695040888963407UL;
+    return min + (max - min) * (double) ((*state >> 11) & 0xFFFFFFFFFFFFFUL) / (double) 0xFFFFFFFFFFFFFUL;
+}
+
+#ifdef POINT_COUNT_ALLOCATIONS
+static unsigned long point_alloc_run(MAGtype_EvalContext *Context, MAGtype_MagneticModel *TimedMagneticModel, MAGtype_Ellipsoid Ellip,
+        int NumPoints, const double *Latitude, const double *Longitude, int *Failed)
+/* Allocations of MAG_Geomag_ctx and MAG_GradY_ctx over the points; the context is used as given, its tables may not be built yet */
+{
+    MAGtype_CoordGeodetic CoordGeodetic;
+    MAGtype_CoordSpherical CoordSpherical;
+    MAGtype_GeoMagneticElements GeoMagneticElements, GradYElements;
+    unsigned long Before;
+    int i;
+
+    CoordGeodetic.UseGeoid = 0;
+    CoordGeodetic.HeightAboveEllipsoid = CoordGeodetic.HeightAboveGeoid = 0.0;
+    Before = PointAllocations;
+    for(i = 0; i < NumPoints; i++)
+    {
+        CoordGeodetic.phi = Latitude[i];
+        CoordGeodetic.lambda = Longitude[i];
+        MAG_GeodeticToSpherical(Ellip, CoordGeodetic, &CoordSpherical);
+        if(!MAG_Geomag_ctx(Context, Ellip, CoordSpherical, CoordGeodetic, TimedMagneticModel, &GeoMagneticElements) ||
+                !MAG_GradY_ctx(Context, Ellip, CoordSpherical, CoordGeodetic, TimedMagneticModel, GeoMagneticElements, &GradYElements))
+            *Failed = TRUE;
+    }
+    return PointAllocations - Before;
+}
+#endif
+
+static int point_check_alloc(MAGtype_MagneticModel *MagneticModel, MAGtype_Ellipsoid Ellip, int NumPoints)
+/* The evaluation context paths, at the model degree and at POINT_CHECK_HIGH_NMAX, must not allocate */
+{
+#ifdef POINT_COUNT_ALLOCATIONS
+    MAGtype_MagneticModel *Models[2];
+    MAGtype_EvalContext *Context;
+    MAGtype_CoordGeodetic CoordGeodetic;
+    MAGtype_CoordSpherical CoordSpherical;
+    MAGtype_GeoMagneticElements GeoMagneticElements;
+    MAGtype_Date UserDate;
+    double *Latitude, *Longitude, Poles[2] = {90.0, -90.0}, PoleLongitudes[2] = {30.0, -150.0};
+    unsigned long state = 20250101UL, Reference, Points, AtPoles, Total = 0;
+    int i, k, NumTerms, OldTerms, Failed = FALSE;
+
+    Latitude = (double *) malloc(NumPoints * sizeof (double));
+    Longitude = (double *) malloc(NumPoints * sizeof (double));
+    NumTerms = (POINT_CHECK_HIGH_NMAX + 1) * (POINT_CHECK_HIGH_NMAX + 2) / 2;
+    OldTerms = (MagneticModel->nMax + 1) * (MagneticModel->nMax + 2) / 2;
+    Models[0] = MAG_AllocateModelMemory(OldTerms);
+    Models[1] = MAG_AllocateModelMemory(NumTerms);
+    if(!Latitude || !Longitude || !Models[0] || !Models[1] || MagneticModel->nMax > POINT_CHECK_HIGH_NMAX)
+    {
+        printf("Error allocating in point_check_alloc\n");
+        return FALSE;
+    }
+    for(i = 0; i < NumPoints; i++)
+    {
+        Latitude[i] = point_uniform(&state, -89.0, 89.0);
+        Longitude[i] = point_uniform(&state, -180.0, 180.0);
+    }
+    UserDate.DecimalYear = MagneticModel->epoch + 1.5;
+    MAG_TimelyModifyMagneticModel(UserDate, MagneticModel, Models[0]);
+
+    /* The same field up to the model degree, with zero coefficients above it */
+    Models[1]->epoch = Models[0]->epoch;
+    Models[1]->nMax = POINT_CHECK_HIGH_NMAX;
+    Models[1]->nMaxSecVar = Models[0]->nMaxSecVar;
+    Models[1]->SecularVariationUsed = Models[0]->SecularVariationUsed;
+    for(k = 0; k <= NumTerms; k++)
+    {
+        Models[1]->Main_Field_Coeff_G[k] = k <= OldTerms ? Models[0]->Main_Field_Coeff_G[k] : 0.0;
+        Models[1]->Main_Field_Coeff_H[k] = k <= OldTerms ? Models[0]->Main_Field_Coeff_H[k] : 0.0;
+        Models[1]->Secular_Var_Coeff_G[k] = k <= OldTerms ? Models[0]->Secular_Var_Coeff_G[k] : 0.0;
+        Models[1]->Secular_Var_Coeff_H[k] = k <= OldTerms ? Models[0]->Secular_Var_Coeff_H[k] : 0.0;
+    }
+
+    /* MAG_Geomag allocates its work arrays on every call, which shows the counting works */
+    CoordGeodetic.UseGeoid = 0;
+    CoordGeodetic.phi = Latitude[0];
+    CoordGeodetic.lambda = Longitude[0];
+    CoordGeodetic.HeightAboveEllipsoid = CoordGeodetic.HeightAboveGeoid = 0.0;
+    MAG_GeodeticToSpherical(Ellip, CoordGeodetic, &CoordSpherical);
+    Reference = PointAllocations;
+    MAG_Geomag(Ellip, CoordSpherical, CoordGeodetic, Models[0], &GeoMagneticElements);
+    Reference = PointAllocations - Reference;
+
+    printf("Heap allocations, %d points and the poles:\n", NumPoints);
+    printf("  %-34s %8lu  (one point)\n", "MAG_Geomag", Reference);
+    for(i = 0; i < 2; i++)
+    {
+        /* A fresh context per model, so the lazily built recursion tables are counted too */
+        Context = MAG_AllocateEvalContext(Models[i]->nMax);
+        if(Context == NULL)
+            return FALSE;
+        Points = point_alloc_run(Context, Models[i], Ellip, NumPoints, Latitude, Longitude, &Failed);
+        AtPoles = point_alloc_run(Context, Models[i], Ellip, 2, Poles, PoleLongitudes, &Failed);
+        printf("  MAG_Geomag_ctx + MAG_GradY_ctx, nMax %-3d %5lu  (points)\n", Models[i]->nMax, Points);
+        printf("  MAG_Geomag_ctx + MAG_GradY_ctx, nMax %-3d %5lu  (poles)\n", Models[i]->nMax, AtPoles);
+        Total += Points + AtPoles;
+        MAG_FreeEvalContext(Context);
+    }
+    printf("  %lu allocations in the context evaluations%s\n", Total, Failed ? ", evaluation failed" : "");
+
+    free(Latitude);
+    free(Longitude);
+    MAG_FreeMagneticModelMemory(Models[0]);
+    MAG_FreeMagneticModelMemory(Models[1]);
+    return Total == 0 && Reference > 0 && !Failed;
+#else
+    (void) MagneticModel;
+    (void) Ellip;
+    (void) NumPoints;
+    printf("Heap allocations: not counted, replacing malloc needs the GNU C library\n");
+    return TRUE;
+#endif
+}
+
+static double point_trajectory_difference(MAGtype_GeoMagneticElements *a, MAGtype_GeoMagneticElements *b, double *WorstDecl)
+/* Largest difference of the field components and their rates (nT, nT/yr), the declination difference is kept apart */
+{
+    double d = fabs(a->X - b->X);
+
+    d = fmax(d, fabs(a->Y - b->Y));
+    d = fmax(d, fabs(a->Z - b->Z));
+    d = fmax(d, fabs(a->F - b->F));
+    d = fmax(d, fabs(a->Xdot - b->Xdot));
+    d = fmax(d, fabs(a->Ydot - b->Ydot));
+    d = fmax(d, fabs(a->Zdot - b->Zdot));
+    if(fabs(a->Decl - b->Decl) > *WorstDecl)
+        *WorstDecl = fabs(a->Decl - b->Decl);
+    return d;
+}
+
+static int point_trajectory_run(MAGtype_Trajectory *Trajectory, MAGtype_MagneticModel *MagneticModel, MAGtype_Ellipsoid Ellip,
+        int NumPoints, const double *Latitude, const double *Longitude, const double *Height, const double *DecimalYear,
+        MAGtype_GeoMagneticElements *Reference, double *Worst, double *WorstDecl)
+/* Evaluates the track from a reset trajectory and keeps the largest differences to Reference */
+{
+    MAGtype_CoordGeodetic CoordGeodetic;
+    MAGtype_GeoMagneticElements Results;
+    int i;
+
+    CoordGeodetic.UseGeoid = 0;
+    MAG_ResetTrajectory(Trajectory);
+    Trajectory->Fixes = Trajectory->LegendreUpdates = Trajectory->Reseeds = 0;
+    for(i = 0; i < NumPoints; i++)
+    {
+        CoordGeodetic.phi = Latitude[i];
+        CoordGeodetic.lambda = Longitude[i];
+        CoordGeodetic.HeightAboveEllipsoid = Height[i];
+        CoordGeodetic.HeightAboveGeoid = Height[i];
+        if(!MAG_GeomagTrajectory(Trajectory, Ellip, CoordGeodetic, MagneticModel, DecimalYear[i], &Results))
+            return FALSE;
+        *Worst = fmax(*Worst, point_trajectory_difference(&Results, &Reference[i], WorstDecl));
+    }
+    return TRUE;
+}
+
+static int point_check_trajectory(MAGtype_MagneticModel *MagneticModel, MAGtype_Ellipsoid Ellip, int NumPoints)
+/* MAG_GeomagTrajectory against MAG_TimelyModifyMagneticModel and MAG_Geomag_ctx per fix, on a 100 Hz vehicle track */
+{
+    MAGtype_MagneticModel *TimedMagneticModel;
+    MAGtype_EvalContext *Context;
+    MAGtype_Trajectory *Trajectory;
+    MAGtype_CoordGeodetic CoordGeodetic;
+    MAGtype_CoordSpherical CoordSpherical;
+    MAGtype_Date UserDate;
+    MAGtype_GeoMagneticElements *Reference;
+    double *Latitude, *Longitude, *Height, *DecimalYear, Heading, t, Drift;
+    double WorstExact = 0, WorstDefault = 0, WorstDeclExact = 0, WorstDeclDefault = 0, Unused = 0;
+    unsigned long ExactUpdates, Reseeds;
+    int i, Flag;
+
+    Latitude = (double *) malloc(NumPoints * sizeof (double));
+    Longitude = (double *) malloc(NumPoints * sizeof (double));
+    Height = (double *) malloc(NumPoints * sizeof (double));
+    DecimalYear = (double *) malloc(NumPoints * sizeof (double));
+    Reference = (MAGtype_GeoMagneticElements *) malloc(NumPoints * sizeof (MAGtype_GeoMagneticElements));
+    TimedMagneticModel = MAG_AllocateModelMemory((MagneticModel->nMax + 1) * (MagneticModel->nMax + 2) / 2);
+    Context = MAG_AllocateEvalContext(MagneticModel->nMax);
+    Trajectory = MAG_AllocateTrajectory(MagneticModel->nMax);
+    if(!Latitude || !Longitude || !Height || !DecimalYear || !Reference || !TimedMagneticModel || !Context || !Trajectory)
+    {
+        printf("Error allocating in point_check_trajectory\n");
+        return FALSE;
+    }
+
+    /* A vehicle weaving along a road, with a little height noise */
+    Latitude[0] = 39.7;
+    Longitude[0] = -105.2;
+    for(i = 0; i < NumPoints; i++)
+    {
+        t = i / POINT_CHECK_RATE;
+        Heading = DEG2RAD(60.0 + 40.0 * sin(2.0 * M_PI * t / 90.0));
+        if(i > 0)
+        {
+            Latitude[i] = Latitude[i - 1] + RAD2DEG(POINT_CHECK_SPEED / POINT_CHECK_RATE * cos(Heading) / (1000.0 * Ellip.re));
+            Longitude[i] = Longitude[i - 1] + RAD2DEG(POINT_CHECK_SPEED / POINT_CHECK_RATE * sin(Heading) /
+                    (1000.0 * Ellip.re * cos(DEG2RAD(Latitude[i]))));
+        }
+        Height[i] = 1.6 + 0.002 * sin(2.0 * M_PI * t / 7.0);
+        DecimalYear[i] = MagneticModel->epoch + 1.5 + t / (365.25 * 86400.0);
+    }
+    CoordGeodetic.UseGeoid = 0;
+    for(i = 0; i < NumPoints; i++)
+    {
+        CoordGeodetic.phi = Latitude[i];
+        CoordGeodetic.lambda = Longitude[i];
+        CoordGeodetic.HeightAboveEllipsoid = Height[i];
+        CoordGeodetic.HeightAboveGeoid = Height[i];
+        UserDate.DecimalYear = DecimalYear[i];
+        MAG_GeodeticToSpherical(Ellip, CoordGeodetic, &CoordSpherical);
+        MAG_TimelyModifyMagneticModel(UserDate, MagneticModel, TimedMagneticModel);
+        MAG_Geomag_ctx(Context, Ellip, CoordSpherical, CoordGeodetic, TimedMagneticModel, &Reference[i]);
+    }
+    printf("Trajectory: %d fixes at %.0f Hz, %.0f m/s, %.1f km\n", NumPoints, POINT_CHECK_RATE, POINT_CHECK_SPEED,
+            NumPoints * POINT_CHECK_SPEED / POINT_CHECK_RATE / 1000.0);
+
+    Trajectory->LatitudeTolerance = 0; /* Legendre functions of every fix */
+    Flag = point_trajectory_run(Trajectory, MagneticModel, Ellip, NumPoints, Latitude, Longitude, Height, DecimalYear, Reference,
+            &WorstExact, &WorstDeclExact);
+    ExactUpdates = Trajectory->LegendreUpdates;
+    Reseeds = Trajectory->Reseeds;
+    Trajectory->LatitudeTolerance = MAG_TRAJECTORY_LATITUDE_TOLERANCE;
+    Flag = Flag && point_trajectory_run(Trajectory, MagneticModel, Ellip, NumPoints, Latitude, Longitude, Height, DecimalYear, Reference,
+            &WorstDefault, &WorstDeclDefault);
+    printf("  exact:   largest difference %.2e nT, declination %.2e deg, %lu Legendre updates, %lu longitude reseeds\n", WorstExact,
+            WorstDeclExact, ExactUpdates, Reseeds);
+    printf("  default: largest difference %.2e nT, declination %.2e deg, %lu Legendre updates (tolerance %g deg)\n", WorstDefault,
+            WorstDeclDefault, Trajectory->LegendreUpdates, MAG_TRAJECTORY_LATITUDE_TOLERANCE);
+
+    /* Without reseeding the angle additions accumulate rounding over the whole track; reported, not checked */
+    Trajectory->ReseedInterval = NumPoints;
+    Unused = 0;
+    Flag = Flag && point_trajectory_run(Trajectory, MagneticModel, Ellip, NumPoints, Latitude, Longitude, Height, DecimalYear, Reference,
+            &Unused, &Unused);
+    Drift = fmax(fabs(Trajectory->cos_lambda - cos(DEG2RAD(Longitude[NumPoints - 1]))),
+            fabs(Trajectory->sin_lambda - sin(DEG2RAD(Longitude[NumPoints - 1]))));
+    printf("  longitude sine and cosine drift after %d steps without reseeding: %.2e\n", NumPoints - 1, Drift);
+    if(!Flag)
+        printf("  Error evaluating the trajectory\n");
+    Flag = Flag && WorstExact <= POINT_CHECK_EXACT_TOLERANCE && WorstDefault <= POINT_CHECK_TRAJECTORY_TOLERANCE;
+
+    free(Latitude);
+    free(Longitude);
+    free(Height);
+    free(DecimalYear);
+    free(Reference);
+    MAG_FreeMagneticModelMemory(TimedMagneticModel);
+    MAG_FreeEvalContext(Context);
+    MAG_FreeTrajectory(Trajectory);
+    return Flag;
+}
+
+int point_check(char *model_file, int NumPoints)
+
+/* Checks the allocations of the evaluation context and MAG_GeomagTrajectory on NumPoints points or fixes.
+Prints a line per check and returns TRUE when all of them pass. */
+{
+    MAGtype_MagneticModel * MagneticModels[1];
+    MAGtype_Ellipsoid Ellip;
+    MAGtype_Geoid Geoid;
+    int Flag = TRUE;
+
+    if(NumPoints < 2)
+    {
+        printf("Usage: wmm_point -c [points] [coefficient file]\n");
+        return FALSE;
+    }
+    if(!MAG_robustReadMagModels(model_file, &MagneticModels, 1))
+    {
+        printf("\n %s not found.\n", model_file);
+        return FALSE;
+    }
+    MAG_SetDefaults(&Ellip, &Geoid);
+    Flag &= point_check_alloc(MagneticModels[0], Ellip, NumPoints);
+    Flag &= point_check_trajectory(MagneticModels[0], Ellip, NumPoints);
+    printf("%s\n", Flag ? "PASSED" : "FAILED");
+    MAG_FreeMagneticModelMemory(MagneticModels[0]);
+    return Flag;
+} /*point_check*/
@@ -0,0 +1,429 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "GeomagnetismHeader.h"
+#include "GeomagServiceLib.h"
+#include "EGM9615.h"
+
+/*
+WMM query daemon.
+
+Loads the coefficient file and the EGM96 geoid once and answers batches of queries from local clients over a
+Unix domain socket, with the protocol of GeomagServiceLib.h. The main thread accepts the connections and
+waits for requests on all of them with poll; a connection with a pending request is handed to a pool of
+worker threads, each with its own evaluation context and time adjusted model cache, which read the request,
+evaluate it and write the response. A connection is served by one worker at a time, so the requests of one
+connection are answered in order, and the requests of different connections in parallel. An existing file
+at the socket path is removed. The daemon runs until SIGINT or SIGTERM and then prints its counters.
+POSIX only.
+
+Usage: wmm_service SOCKET [threads] [coefficient file]
+ */
+
+#define SERVICE_MAX_THREADS 256
+#define SERVICE_MAX_CONNECTIONS 1024
+#define SERVICE_BACKLOG 64
+
+enum {
+    SERVICE_FREE, /* Slot without a connection */
+    SERVICE_IDLE, /* Waiting for the next request, polled by the main thread */
+    SERVICE_BUSY /* Queued for or served by a worker */
+};
+
+typedef struct {
+    int fd;
+    int State;
+} ServiceConnection;
+
+typedef struct {
+    MAGtype_MagneticModel *MagneticModel;
+    MAGtype_Ellipsoid Ellip;
+    MAGtype_Geoid Geoid;
+    pthread_mutex_t Lock;
+    pthread_cond_t Ready; /* Signalled when a connection is queued or the service stops */
+    ServiceConnection Connections[SERVICE_MAX_CONNECTIONS];
+    int Queue[SERVICE_MAX_CONNECTIONS]; /* Ring of the connections with a pending request */
+    int QueueHead, QueueCount;
+    int Stop;
+    int WakeRead, WakeWrite; /* Pipe, a byte is written when a connection returns to the main thread */
+    unsigned long NumConnections, NumRequests, NumQueries, NumErrors;
+} ServiceShared;
+
+typedef struct {
+    ServiceShared *Shared;
+    MAGtype_EvalContext *Context;
+    MAGtype_TimedModelCache *Cache;
+    double *Queries; /* MAG_SERVICE_MAX_QUERIES queries */
+    unsigned char *Response; /* Header and MAG_SERVICE_MAX_QUERIES results */
+} ServiceWorker;
+
+static volatile sig_atomic_t ServiceStop = 0;
+static int ServiceWakeFd = -1;
+
+static void service_signal(int Signal)
+{
+    char c = 's';
+
+    (void) Signal;
+    ServiceStop = 1;
+    if(ServiceWakeFd >= 0 && write(ServiceWakeFd, &c, 1) < 0)
+        ServiceStop = 1; /* The pipe is full, poll wakes up anyway */
+}
+
+static int service_read_full(int fd, void *Buffer, size_t Size)
+/* Reads Size bytes, FALSE at the end of the stream or on an error */
+{
+    unsigned char *p = (unsigned char *) Buffer;
+    ssize_t n;
+
+    while(Size > 0)
+    {
+        n = read(fd, p, Size);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return FALSE;
+        p += n;
+        Size -= (size_t) n;
+    }
+    return TRUE;
+}
+
+static int service_write_full(int fd, const void *Buffer, size_t Size)
+{
+    const unsigned char *p = (const unsigned char *) Buffer;
+    ssize_t n;
+
+    while(Size > 0)
+    {
+        n = write(fd, p, Size);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return FALSE;
+        p += n;
+        Size -= (size_t) n;
+    }
+    return TRUE;
+}
+
+static int service_reply(int fd, unsigned char *Response, const MAGtype_ServiceHeader *Request, int Status, uint32_t Count)
+{
+    MAGtype_ServiceHeader Header;
+
+    Header.Version = MAG_SERVICE_VERSION;
+    Header.Flags = (uint16_t) Status;
+    Header.RequestId = Request->RequestId;
+    Header.Count = Status == MAG_SERVICE_OK ? Count : 0;
+    MAG_ServicePackHeader("WMMR", &Header, Response);
+    return service_write_full(fd, Response, MAG_SERVICE_HEADER_SIZE + (size_t) Header.Count * MAG_SERVICE_RESULT_VALUES * sizeof (double));
+}
+
+static int service_request(ServiceWorker *Worker, int fd)
+/* Serves one request of the connection. Returns FALSE when the connection is to be closed. */
+{
+    ServiceShared *Shared = Worker->Shared;
+    MAGtype_ServiceHeader Request;
+    unsigned char Header[MAG_SERVICE_HEADER_SIZE];
+    int Flag;
+
+    if(!service_read_full(fd, Header, sizeof (Header)))
+        return FALSE; /* Closed by the client */
+    memset(&Request, 0, sizeof (Request));
+    if(!MAG_ServiceUnpackHeader("WMMQ", Header, &Request) || (Request.Flags & ~MAG_SERVICE_HEIGHT_MSL) != 0)
+    {
+        service_reply(fd, Worker->Response, &Request, MAG_SERVICE_BAD_REQUEST, 0);
+        return FALSE; /* The rest of the stream can not be parsed */
+    }
+    if(Request.Count > MAG_SERVICE_MAX_QUERIES)
+    {
+        service_reply(fd, Worker->Response, &Request, MAG_SERVICE_TOO_LARGE, 0);
+        return FALSE;
+    }
+    if(!service_read_full(fd, Worker->Queries, (size_t) Request.Count * MAG_SERVICE_QUERY_VALUES * sizeof (double)))
+        return FALSE;
+    Flag = MAG_ServiceEvaluate(Worker->Context, Worker->Cache, Shared->Ellip, &Shared->Geoid, Shared->MagneticModel, Request.Flags,
+            (int) Request.Count, Worker->Queries, (double *) (Worker->Response + MAG_SERVICE_HEADER_SIZE));
+
+    pthread_mutex_lock(&Shared->Lock);
+    Shared->NumRequests++;
+    Shared->NumQueries += Request.Count;
+    if(!Flag)
+        Shared->NumErrors++;
+    pthread_mutex_unlock(&Shared->Lock);
+    return service_reply(fd, Worker->Response, &Request, Flag ? MAG_SERVICE_OK : MAG_SERVICE_FAILED, Request.Count);
+}
+
+static void *service_worker(void *Arg)
+{
+    ServiceWorker *Worker = (ServiceWorker *) Arg;
+    ServiceShared *Shared = Worker->Shared;
+    ServiceConnection *Connection;
+    char c = 'w';
+    int Index, Open;
+
+    for(;;)
+    {
+        pthread_mutex_lock(&Shared->Lock);
+        while(Shared->QueueCount == 0 && !Shared->Stop)
+            pthread_cond_wait(&Shared->Ready, &Shared->Lock);
+        if(Shared->Stop)
+        {
+            pthread_mutex_unlock(&Shared->Lock);
+            break;
+        }
+        Index = Shared->Queue[Shared->QueueHead];
+        Shared->QueueHead = (Shared->QueueHead + 1) % SERVICE_MAX_CONNECTIONS;
+        Shared->QueueCount--;
+        pthread_mutex_unlock(&Shared->Lock);
+
+        Connection = &Shared->Connections[Index];
+        Open = service_request(Worker, Connection->fd);
+
+        pthread_mutex_lock(&Shared->Lock);
+        if(!Open)
+        {
+            close(Connection->fd);
+            Connection->fd = -1;
+            Connection->State = SERVICE_FREE;
+        } else
+            Connection->State = SERVICE_IDLE;
+        pthread_mutex_unlock(&Shared->Lock);
+        if(write(Shared->WakeWrite, &c, 1) < 0)
+            c = 'w'; /* The pipe is full, so the main thread is woken up anyway */
+    }
+    return NULL;
+}
+
+static int service_listen(const char *Path)
+{
+    struct sockaddr_un Address;
+    struct stat Status;
+    int fd;
+
+    if(strlen(Path) >= sizeof (Address.sun_path))
+    {
+        printf("Socket path %s is too long\n", Path);
+        return -1;
+    }
+    if(stat(Path, &Status) == 0 && S_ISSOCK(Status.st_mode))
+        unlink(Path); /* Left over by an earlier run */
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+    memset(&Address, 0, sizeof (Address));
+    Address.sun_family = AF_UNIX;
+    strcpy(Address.sun_path, Path);
+    if(bind(fd, (struct sockaddr *) &Address, sizeof (Address)) != 0 || listen(fd, SERVICE_BACKLOG) != 0)
+    {
+        perror(Path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void service_run(ServiceShared *Shared, int ListenFd)
+/* Accepts the connections and queues those with a pending request, until ServiceStop */
+{
+    static struct pollfd Polled[SERVICE_MAX_CONNECTIONS + 2];
+    static int PolledIndex[SERVICE_MAX_CONNECTIONS + 2];
+    char Drain[64];
+    int NumPolled, i, fd;
+
+    while(!ServiceStop)
+    {
+        Polled[0].fd = ListenFd;
+        Polled[0].events = POLLIN;
+        Polled[1].fd = Shared->WakeRead;
+        Polled[1].events = POLLIN;
+        NumPolled = 2;
+        pthread_mutex_lock(&Shared->Lock);
+        for(i = 0; i < SERVICE_MAX_CONNECTIONS; i++)
+            if(Shared->Connections[i].State == SERVICE_IDLE)
+            {
+                Polled[NumPolled].fd = Shared->Connections[i].fd;
+                Polled[NumPolled].events = POLLIN;
+                PolledIndex[NumPolled++] = i;
+            }
+        pthread_mutex_unlock(&Shared->Lock);
+
+        if(poll(Polled, NumPolled, -1) < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
+        if(Polled[1].revents & POLLIN)
+            while(read(Shared->WakeRead, Drain, sizeof (Drain)) > 0)
+                ;
+        pthread_mutex_lock(&Shared->Lock);
+        for(i = 2; i < NumPolled; i++)
+            if(Polled[i].revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                /* The worker reads the request, or finds the end of the stream and closes the connection */
+                Shared->Connections[PolledIndex[i]].State = SERVICE_BUSY;
+                Shared->Queue[(Shared->QueueHead + Shared->QueueCount) % SERVICE_MAX_CONNECTIONS] = PolledIndex[i];
+                Shared->QueueCount++;
+                pthread_cond_signal(&Shared->Ready);
+            }
+        pthread_mutex_unlock(&Shared->Lock);
+
+        if(Polled[0].revents & POLLIN)
+        {
+            fd = accept(ListenFd, NULL, NULL);
+            if(fd < 0)
+                continue;
+            pthread_mutex_lock(&Shared->Lock);
+            for(i = 0; i < SERVICE_MAX_CONNECTIONS && Shared->Connections[i].State != SERVICE_FREE; i++)
+                ;
+            if(i < SERVICE_MAX_CONNECTIONS)
+            {
+                Shared->Connections[i].fd = fd;
+                Shared->Connections[i].State = SERVICE_IDLE;
+                Shared->NumConnections++;
+            }
+            pthread_mutex_unlock(&Shared->Lock);
+            if(i == SERVICE_MAX_CONNECTIONS)
+                close(fd); /* Too many clients */
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    MAGtype_MagneticModel * MagneticModels[1];
+    static ServiceShared Shared;
+    ServiceWorker Workers[SERVICE_MAX_THREADS];
+    pthread_t Threads[SERVICE_MAX_THREADS];
+    struct sigaction Action;
+    char filename[] = "WMM.COF";
+    char *model_file = filename;
+    int NumThreads = 0, NumStarted = 0, ListenFd, WakePipe[2], i;
+
+    if(argc > 2)
+        NumThreads = atoi(argv[2]);
+    if(argc > 3)
+        model_file = argv[3];
+    if(argc < 2 || argc > 4 || NumThreads < 0)
+    {
+        printf("Usage: wmm_service SOCKET [threads] [coefficient file]\n");
+        return 1;
+    }
+#ifdef _SC_NPROCESSORS_ONLN
+    if(NumThreads == 0)
+        NumThreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if(NumThreads < 1)
+        NumThreads = 1;
+    if(NumThreads > SERVICE_MAX_THREADS)
+        NumThreads = SERVICE_MAX_THREADS;
+
+    if(!MAG_robustReadMagModels(model_file, &MagneticModels, 1))
+    {
+        printf("\n %s not found.\n", model_file);
+        return 1;
+    }
+    Shared.MagneticModel = MagneticModels[0];
+    MAG_SetDefaults(&Shared.Ellip, &Shared.Geoid);
+    Shared.Geoid.GeoidHeightBuffer = GeoidHeightBuffer;
+    Shared.Geoid.Geoid_Initialized = 1;
+    for(i = 0; i < SERVICE_MAX_CONNECTIONS; i++)
+    {
+        Shared.Connections[i].fd = -1;
+        Shared.Connections[i].State = SERVICE_FREE;
+    }
+    if(pipe(WakePipe) != 0 || fcntl(WakePipe[0], F_SETFL, O_NONBLOCK) != 0 || fcntl(WakePipe[1], F_SETFL, O_NONBLOCK) != 0)
+    {
+        perror("pipe");
+        return 1;
+    }
+    Shared.WakeRead = WakePipe[0];
+    Shared.WakeWrite = WakePipe[1];
+    ServiceWakeFd = WakePipe[1];
+    pthread_mutex_init(&Shared.Lock, NULL);
+    pthread_cond_init(&Shared.Ready, NULL);
+
+    ListenFd = service_listen(argv[1]);
+    if(ListenFd < 0)
+        return 1;
+    memset(&Action, 0, sizeof (Action));
+    Action.sa_handler = service_signal;
+    sigaction(SIGINT, &Action, NULL);
+    sigaction(SIGTERM, &Action, NULL);
+    Action.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &Action, NULL); /* A client closing early is seen as a failed write */
+
+    for(i = 0; i < NumThreads; i++)
+    {
+        Workers[i].Shared = &Shared;
+        Workers[i].Context = MAG_AllocateEvalContext(MagneticModels[0]->nMax);
+        Workers[i].Cache = MAG_AllocateTimedModelCache(4, MagneticModels[0]->nMax);
+        Workers[i].Queries = (double *) malloc((size_t) MAG_SERVICE_MAX_QUERIES * MAG_SERVICE_QUERY_VALUES * sizeof (double));
+        Workers[i].Response = (unsigned char *) malloc(MAG_SERVICE_HEADER_SIZE +
+                (size_t) MAG_SERVICE_MAX_QUERIES * MAG_SERVICE_RESULT_VALUES * sizeof (double));
+        if(Workers[i].Context == NULL || Workers[i].Cache == NULL || Workers[i].Queries == NULL || Workers[i].Response == NULL ||
+                pthread_create(&Threads[i], NULL, service_worker, &Workers[i]) != 0)
+        {
+            printf("Error starting worker %d\n", i);
+            MAG_FreeEvalContext(Workers[i].Context);
+            MAG_FreeTimedModelCache(Workers[i].Cache);
+            free(Workers[i].Queries);
+            free(Workers[i].Response);
+            ServiceStop = 1;
+            break;
+        }
+        NumStarted++;
+    }
+    if(!ServiceStop)
+    {
+        printf("%s: %s (nMax %d) on %s with %d workers\n", argv[0], MagneticModels[0]->ModelName, MagneticModels[0]->nMax, argv[1],
+                NumStarted);
+        fflush(stdout);
+    }
+    service_run(&Shared, ListenFd);
+
+    pthread_mutex_lock(&Shared.Lock);
+    Shared.Stop = TRUE;
+    pthread_cond_broadcast(&Shared.Ready);
+    for(i = 0; i < SERVICE_MAX_CONNECTIONS; i++)
+        if(Shared.Connections[i].State == SERVICE_BUSY)
+            shutdown(Shared.Connections[i].fd, SHUT_RDWR); /* Wakes a worker waiting for the rest of a request */
+    pthread_mutex_unlock(&Shared.Lock);
+    for(i = 0; i < NumStarted; i++)
+    {
+        pthread_join(Threads[i], NULL);
+        MAG_FreeEvalContext(Workers[i].Context);
+        MAG_FreeTimedModelCache(Workers[i].Cache);
+        free(Workers[i].Queries);
+        free(Workers[i].Response);
+    }
+    for(i = 0; i < SERVICE_MAX_CONNECTIONS; i++)
+        if(Shared.Connections[i].State != SERVICE_FREE)
+            close(Shared.Connections[i].fd);
+    close(ListenFd);
+    unlink(argv[1]);
+    close(WakePipe[0]);
+    close(WakePipe[1]);
+    pthread_mutex_destroy(&Shared.Lock);
+    pthread_cond_destroy(&Shared.Ready);
+    printf("%lu connections, %lu requests, %lu queries, %lu failed requests\n", Shared.NumConnections, Shared.NumRequests,
+            Shared.NumQueries, Shared.NumErrors);
+    MAG_FreeMagneticModelMemory(MagneticModels[0]);
+    return 0;
+}
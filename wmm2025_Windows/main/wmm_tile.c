@@ -0,0 +1,427 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "GeomagnetismHeader.h"
+#include "GeomagGridLib.h"
+#include "GeomagTileLib.h"
+
+/*
+WMM lookup tile program.
+
+Generates the declination / inclination lookup tiles used on the antenna pointer, checks them
+against the full model and looks up single points. The nodes are evaluated by the grid
+engine (MAG_GridEvaluateElements, separable, as float32 rasters) at one date and one height
+above the WGS-84 ellipsoid. Every tile records a bilinear and a bicubic error estimate: the
+largest error on a sub-grid of TILE_PROBE_DIVISIONS probes per cell side, nodes included,
+times TILE_ESTIMATE_MARGIN. It is sampled, not a proven bound. A tile whose probed declination
+error passes TILE_POLE_ERROR covers a magnetic pole and gets a declination estimate of 180
+degrees, the largest wrapped difference. The program expects WMM.COF to be in the current
+directory, or the coefficient file to be given as the last argument.
+
+Usage:
+    wmm_tile g TILE LATMIN LATMAX LONMIN LONMAX STEP DATE [HEIGHT_KM] [COF]
+        Generate a tile with the given window (degrees), node spacing (degrees),
+        decimal year and height (km above the ellipsoid, default 0).
+    wmm_tile v TILE [POINTS] [COF]
+        Report the maximum and RMS error of both interpolation modes against MAG_Geomag
+        over random points in the tile (default 100000 points). Exits with 1 when an error
+        exceeds the estimate stored in the tile.
+    wmm_tile l TILE LAT LON
+        Print the interpolated declination and inclination of one location.
+ */
+
+#define TILE_DEFAULT_POINTS 100000
+#define TILE_PROBE_DIVISIONS 4 /* Probes per cell side when the error estimate is computed */
+#define TILE_ESTIMATE_MARGIN 1.25 /* Factor on the largest probed error */
+#define TILE_POLE_ERROR 10.0 /* Probed declination error (degrees) taken to mean the tile covers a magnetic pole */
+
+static double tile_uniform(unsigned long *state, double min, double max)
+/* Small linear congruential generator so the point set is the same on every platform */
+{
+    *state = *state * 6364136223846793005UL + 1442695040888963407UL;
+    return min + (max - min) * (double) ((*state >> 11) & 0xFFFFFFFFFFFFFUL) / (double) 0xFFFFFFFFFFFFFUL;
+}
+
+static double tile_decl_difference(double a, double b)
+/* Declination difference wrapped to -180 ... 180 degrees */
+{
+    double d = a - b;
+
+    while(d > 180.0) d -= 360.0;
+    while(d < -180.0) d += 360.0;
+    return d;
+}
+
+static int tile_evaluate(MAGtype_MagneticModel *MagneticModel, MAGtype_Ellipsoid Ellip, int NumPoints, const double *Latitude,
+        const double *Longitude, double Height, double DecimalYear, MAGtype_GeoMagneticElements *Elements)
+/* MAG_GeomagBatch at a single height and date */
+{
+    double *Heights, *Years;
+    int i, Flag;
+
+    Heights = (double *) malloc(NumPoints * sizeof (double));
+    Years = (double *) malloc(NumPoints * sizeof (double));
+    if(Heights == NULL || Years == NULL)
+    {
+        free(Heights);
+        free(Years);
+        return FALSE;
+    }
+    for(i = 0; i < NumPoints; i++)
+    {
+        Heights[i] = Height;
+        Years[i] = DecimalYear;
+    }
+    Flag = MAG_GeomagBatch(Ellip, MagneticModel, NumPoints, Latitude, Longitude, Heights, Years, Elements);
+    free(Heights);
+    free(Years);
+    return Flag;
+}
+
+static unsigned char *tile_read(const char *filename, size_t *Size)
+{
+    FILE *fp;
+    unsigned char *Buffer;
+    long n;
+
+    fp = fopen(filename, "rb");
+    if(fp == NULL)
+        return NULL;
+    fseek(fp, 0, SEEK_END);
+    n = ftell(fp);
+    rewind(fp);
+    Buffer = (unsigned char *) malloc(n > 0 ? n : 1);
+    if(Buffer == NULL || n < 0 || fread(Buffer, 1, n, fp) != (size_t) n)
+    {
+        free(Buffer);
+        fclose(fp);
+        return NULL;
+    }
+    fclose(fp);
+    *Size = (size_t) n;
+    return Buffer;
+}
+
+static int tile_read_model(const char *filename, MAGtype_MagneticModel **MagneticModel)
+{
+    MAGtype_MagneticModel * MagneticModels[1];
+
+    if(!MAG_robustReadMagModels((char *) filename, &MagneticModels, 1))
+    {
+        printf("\n %s not found.\n", filename);
+        return FALSE;
+    }
+    *MagneticModel = MagneticModels[0];
+    return TRUE;
+}
+
+static int tile_grid(MAGtype_MagneticModel *MagneticModel, MAGtype_Ellipsoid Ellip, MAGtype_Tile *Tile, int Divisions, FILE **Out)
+/* Declination and inclination of the tile window at Divisions points per node spacing, as float32 rasters
+ * of MAG_GridEvaluateElements in two temporary files (latitude rows from LatMin, longitude fastest) */
+{
+    MAGtype_GridParameters Parameters;
+    MAGtype_GridStatus Status;
+    MAGtype_Geoid Geoid;
+    double Step;
+    int Flag;
+
+    memset(&Parameters, 0, sizeof (MAGtype_GridParameters));
+    memset(&Geoid, 0, sizeof (MAGtype_Geoid));
+    Step = (double) Tile->LatStep / Divisions;
+    /* Half a step past the last point, so the accumulated axis of MAG_Grid has exactly the tile's points */
+    Parameters.minimum.phi = Tile->LatMin;
+    Parameters.maximum.phi = Tile->LatMin + (double) Tile->LatStep * (Tile->NumLat - 1) + 0.5 * Step;
+    Parameters.minimum.lambda = Tile->LonMin;
+    Parameters.maximum.lambda = Tile->LonMin + (double) Tile->LonStep * (Tile->NumLon - 1) + 0.5 * Step;
+    Parameters.minimum.HeightAboveGeoid = Parameters.maximum.HeightAboveGeoid = Tile->Height; /* Geoid.UseGeoid is 0: above the ellipsoid */
+    Parameters.cord_step_size = Step;
+    Parameters.StartDate.DecimalYear = Parameters.EndDate.DecimalYear = Tile->DecimalYear;
+    Parameters.ElementOption = 1;
+    Parameters.ElementMask = MAG_GRID_ELEMENT(1) | MAG_GRID_ELEMENT(2); /* Decl, Incl */
+    Parameters.Separable = 1;
+    Parameters.OutputFormat = MAG_GRID_RASTER;
+
+    Out[0] = tmpfile();
+    Out[1] = tmpfile();
+    if(Out[0] == NULL || Out[1] == NULL)
+        return FALSE;
+    Flag = MAG_GridEvaluateElements(&Parameters, MagneticModel, &Geoid, Ellip, Out, stdout, &Status);
+    Flag &= Status.NumCells == (long) ((Divisions * (Tile->NumLat - 1) + 1) * (Divisions * (Tile->NumLon - 1) + 1));
+    rewind(Out[0]);
+    rewind(Out[1]);
+    return Flag;
+}
+
+static int tile_generate(int argc, char *argv[])
+{
+    MAGtype_MagneticModel *MagneticModel;
+    MAGtype_Ellipsoid Ellip;
+    MAGtype_Geoid Geoid;
+    MAGtype_Tile Tile;
+    unsigned char *Buffer;
+    float *RowDecl, *RowIncl;
+    double LatMax, LonMax, *Decl, *Incl, Latitude, Longitude, d, dDecl, dIncl, SampledDecl[2], SampledIncl[2];
+    const char *model_file = "WMM.COF";
+    size_t Size;
+    int i, k, Mode, NumNodes, NumRows, NumColumns, Flag;
+    FILE *fp, *Out[2];
+
+    if(argc < 9)
+        return -1;
+    memset(&Tile, 0, sizeof (MAGtype_Tile));
+    Tile.LatMin = (float) atof(argv[3]);
+    LatMax = atof(argv[4]);
+    Tile.LonMin = (float) atof(argv[5]);
+    LonMax = atof(argv[6]);
+    Tile.LatStep = Tile.LonStep = (float) atof(argv[7]);
+    Tile.DecimalYear = (float) atof(argv[8]);
+    if(argc > 9)
+        Tile.Height = (float) atof(argv[9]);
+    if(argc > 10)
+        model_file = argv[10];
+    if(!(Tile.LatStep > 0) || LatMax < Tile.LatMin || LonMax < Tile.LonMin || Tile.LatMin < -90.0 || LatMax > 90.0 || LonMax - Tile.LonMin > 360.0)
+    {
+        printf("Invalid tile window or step\n");
+        return 1;
+    }
+    Tile.NumLat = (int) floor((LatMax - Tile.LatMin) / Tile.LatStep + 1.0e-9) + 1;
+    Tile.NumLon = (int) floor((LonMax - Tile.LonMin) / Tile.LonStep + 1.0e-9) + 1;
+    if(Tile.NumLat > MAG_TILE_MAX_NODES || Tile.NumLon > MAG_TILE_MAX_NODES)
+    {
+        printf("The tile has more than %d rows or columns\n", MAG_TILE_MAX_NODES);
+        return 1;
+    }
+    if(!tile_read_model(model_file, &MagneticModel))
+        return 1;
+    MAG_SetDefaults(&Ellip, &Geoid);
+
+    /* The nodes, then the probes on a sub-grid of TILE_PROBE_DIVISIONS points per node spacing, one
+     * probe row at a time */
+    NumNodes = Tile.NumLat * Tile.NumLon;
+    NumRows = TILE_PROBE_DIVISIONS * (Tile.NumLat - 1) + 1;
+    NumColumns = TILE_PROBE_DIVISIONS * (Tile.NumLon - 1) + 1;
+    Decl = (double *) malloc(NumNodes * sizeof (double));
+    Incl = (double *) malloc(NumNodes * sizeof (double));
+    RowDecl = (float *) malloc((NumColumns > NumNodes ? NumColumns : NumNodes) * sizeof (float));
+    RowIncl = (float *) malloc((NumColumns > NumNodes ? NumColumns : NumNodes) * sizeof (float));
+    Buffer = (unsigned char *) malloc(MAG_TileSize(Tile.NumLat, Tile.NumLon));
+    if(!Decl || !Incl || !RowDecl || !RowIncl || !Buffer)
+    {
+        printf("Error allocating tile memory\n");
+        return 1;
+    }
+    if(!tile_grid(MagneticModel, Ellip, &Tile, 1, Out) || fread(RowDecl, sizeof (float), NumNodes, Out[0]) != (size_t) NumNodes ||
+            fread(RowIncl, sizeof (float), NumNodes, Out[1]) != (size_t) NumNodes)
+    {
+        printf("Error evaluating the tile\n");
+        return 1;
+    }
+    fclose(Out[0]);
+    fclose(Out[1]);
+    for(k = 0; k < NumNodes; k++)
+    {
+        Decl[k] = RowDecl[k];
+        Incl[k] = RowIncl[k];
+    }
+    MAG_TileEncode(&Tile, Decl, Incl, Buffer);
+
+    /* Error estimate: largest difference on the sub-grid, which includes the nodes and so the quantization
+     * error, times TILE_ESTIMATE_MARGIN for the peaks that fall between the probes */
+    if(!tile_grid(MagneticModel, Ellip, &Tile, TILE_PROBE_DIVISIONS, Out))
+    {
+        printf("Error evaluating the tile\n");
+        return 1;
+    }
+    for(Mode = MAG_TILE_BILINEAR; Mode <= MAG_TILE_BICUBIC; Mode++)
+        SampledDecl[Mode] = SampledIncl[Mode] = 0;
+    for(i = 0; i < NumRows; i++)
+    {
+        if(fread(RowDecl, sizeof (float), NumColumns, Out[0]) != (size_t) NumColumns ||
+                fread(RowIncl, sizeof (float), NumColumns, Out[1]) != (size_t) NumColumns)
+        {
+            printf("Error evaluating the tile\n");
+            return 1;
+        }
+        Latitude = Tile.LatMin + (double) Tile.LatStep * i / TILE_PROBE_DIVISIONS;
+        for(Mode = MAG_TILE_BILINEAR; Mode <= MAG_TILE_BICUBIC; Mode++)
+            for(k = 0; k < NumColumns; k++)
+            {
+                Longitude = Tile.LonMin + (double) Tile.LonStep * k / TILE_PROBE_DIVISIONS;
+                MAG_TileLookup(&Tile, Latitude, Longitude, Mode, &dDecl, &dIncl);
+                d = fabs(tile_decl_difference(dDecl, RowDecl[k]));
+                if(d > SampledDecl[Mode])
+                    SampledDecl[Mode] = d;
+                d = fabs(dIncl - RowIncl[k]);
+                if(d > SampledIncl[Mode])
+                    SampledIncl[Mode] = d;
+            }
+    }
+    fclose(Out[0]);
+    fclose(Out[1]);
+    for(Mode = MAG_TILE_BILINEAR; Mode <= MAG_TILE_BICUBIC; Mode++)
+    {
+        /* Declination is not continuous at a magnetic pole, only the largest wrapped difference bounds it there */
+        Tile.DeclError[Mode] = (float) (SampledDecl[Mode] > TILE_POLE_ERROR ? 180.0 : SampledDecl[Mode] * TILE_ESTIMATE_MARGIN);
+        Tile.InclError[Mode] = (float) (SampledIncl[Mode] * TILE_ESTIMATE_MARGIN);
+    }
+    MAG_TileEncode(&Tile, Decl, Incl, Buffer);
+
+    Size = MAG_TileSize(Tile.NumLat, Tile.NumLon);
+    Flag = FALSE;
+    fp = fopen(argv[2], "wb");
+    if(fp != NULL)
+    {
+        Flag = fwrite(Buffer, 1, Size, fp) == Size;
+        Flag &= fclose(fp) == 0;
+    }
+    if(!Flag)
+        printf("Error writing %s\n", argv[2]);
+    else
+    {
+        printf("%s: %d x %d nodes, %lu bytes, %.2f, %.3f km\n", argv[2], Tile.NumLat, Tile.NumLon, (unsigned long) Size, Tile.DecimalYear, Tile.Height);
+        printf("  error estimate  bilinear  Decl %.4f  Incl %.4f deg\n", Tile.DeclError[MAG_TILE_BILINEAR], Tile.InclError[MAG_TILE_BILINEAR]);
+        printf("                  bicubic   Decl %.4f  Incl %.4f deg\n", Tile.DeclError[MAG_TILE_BICUBIC], Tile.InclError[MAG_TILE_BICUBIC]);
+    }
+
+    free(Decl);
+    free(Incl);
+    free(RowDecl);
+    free(RowIncl);
+    free(Buffer);
+    MAG_FreeMagneticModelMemory(MagneticModel);
+    return Flag ? 0 : 1;
+}
+
+static int tile_verify(int argc, char *argv[])
+{
+    MAGtype_MagneticModel *MagneticModel;
+    MAGtype_Ellipsoid Ellip;
+    MAGtype_Geoid Geoid;
+    MAGtype_GeoMagneticElements *Elements;
+    MAGtype_Tile Tile;
+    unsigned char *Buffer;
+    double *Latitude, *Longitude, Decl, Incl, d, MaxDecl, MaxIncl, SumDecl, SumIncl;
+    const char *model_file = "WMM.COF";
+    unsigned long state = 20250101UL;
+    size_t Size;
+    int i, Mode, NumPoints = TILE_DEFAULT_POINTS, Flag = 0;
+
+    if(argc < 3)
+        return -1;
+    if(argc > 3)
+        NumPoints = atoi(argv[3]);
+    if(argc > 4)
+        model_file = argv[4];
+    if(NumPoints <= 0)
+        return -1;
+    Buffer = tile_read(argv[2], &Size);
+    if(Buffer == NULL || !MAG_TileOpen(Buffer, Size, &Tile))
+    {
+        printf("%s is not a valid tile\n", argv[2]);
+        return 1;
+    }
+    if(!tile_read_model(model_file, &MagneticModel))
+        return 1;
+    MAG_SetDefaults(&Ellip, &Geoid);
+
+    Latitude = (double *) malloc(NumPoints * sizeof (double));
+    Longitude = (double *) malloc(NumPoints * sizeof (double));
+    Elements = (MAGtype_GeoMagneticElements *) malloc(NumPoints * sizeof (MAGtype_GeoMagneticElements));
+    if(!Latitude || !Longitude || !Elements)
+    {
+        printf("Error allocating memory\n");
+        return 1;
+    }
+    for(i = 0; i < NumPoints; i++)
+    {
+        Latitude[i] = tile_uniform(&state, Tile.LatMin, Tile.LatMin + (double) Tile.LatStep * (Tile.NumLat - 1));
+        Longitude[i] = tile_uniform(&state, Tile.LonMin, Tile.LonMin + (double) Tile.LonStep * (Tile.NumLon - 1));
+    }
+    if(!tile_evaluate(MagneticModel, Ellip, NumPoints, Latitude, Longitude, Tile.Height, Tile.DecimalYear, Elements))
+    {
+        printf("Error evaluating the model\n");
+        return 1;
+    }
+
+    printf("%s: %d x %d nodes, %.2f, %.3f km, %d random points\n", argv[2], Tile.NumLat, Tile.NumLon, Tile.DecimalYear, Tile.Height, NumPoints);
+    printf("  %-9s %12s %12s %12s %12s %12s %12s\n", "mode", "Decl max", "Decl rms", "Decl est", "Incl max", "Incl rms", "Incl est");
+    for(Mode = MAG_TILE_BILINEAR; Mode <= MAG_TILE_BICUBIC; Mode++)
+    {
+        MaxDecl = MaxIncl = SumDecl = SumIncl = 0;
+        for(i = 0; i < NumPoints; i++)
+        {
+            MAG_TileLookup(&Tile, Latitude[i], Longitude[i], Mode, &Decl, &Incl);
+            d = fabs(tile_decl_difference(Decl, Elements[i].Decl));
+            SumDecl += d * d;
+            if(d > MaxDecl) MaxDecl = d;
+            d = fabs(Incl - Elements[i].Incl);
+            SumIncl += d * d;
+            if(d > MaxIncl) MaxIncl = d;
+        }
+        printf("  %-9s %12.5f %12.5f %12.5f %12.5f %12.5f %12.5f\n", Mode == MAG_TILE_BILINEAR ? "bilinear" : "bicubic",
+                MaxDecl, sqrt(SumDecl / NumPoints), Tile.DeclError[Mode], MaxIncl, sqrt(SumIncl / NumPoints), Tile.InclError[Mode]);
+        if(MaxDecl > Tile.DeclError[Mode] || MaxIncl > Tile.InclError[Mode])
+            Flag = 1;
+    }
+    if(Flag)
+        printf("The error exceeds the estimate of the tile\n");
+
+    free(Latitude);
+    free(Longitude);
+    free(Elements);
+    free(Buffer);
+    MAG_FreeMagneticModelMemory(MagneticModel);
+    return Flag;
+}
+
+static int tile_lookup(int argc, char *argv[])
+{
+    MAGtype_Tile Tile;
+    unsigned char *Buffer;
+    double Decl, Incl;
+    size_t Size;
+    int Mode;
+
+    if(argc < 5)
+        return -1;
+    Buffer = tile_read(argv[2], &Size);
+    if(Buffer == NULL || !MAG_TileOpen(Buffer, Size, &Tile))
+    {
+        printf("%s is not a valid tile\n", argv[2]);
+        return 1;
+    }
+    for(Mode = MAG_TILE_BILINEAR; Mode <= MAG_TILE_BICUBIC; Mode++)
+    {
+        if(!MAG_TileLookup(&Tile, atof(argv[3]), atof(argv[4]), Mode, &Decl, &Incl))
+        {
+            printf("The location is outside the tile\n");
+            free(Buffer);
+            return 1;
+        }
+        printf("%-9s Decl %9.4f  Incl %9.4f deg\n", Mode == MAG_TILE_BILINEAR ? "bilinear" : "bicubic", Decl, Incl);
+    }
+    free(Buffer);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int Flag = -1;
+
+    if(argc > 1 && !strcmp(argv[1], "g"))
+        Flag = tile_generate(argc, argv);
+    else if(argc > 1 && !strcmp(argv[1], "v"))
+        Flag = tile_verify(argc, argv);
+    else if(argc > 1 && !strcmp(argv[1], "l"))
+        Flag = tile_lookup(argc, argv);
+    if(Flag < 0)
+    {
+        printf("Usage: wmm_tile g TILE LATMIN LATMAX LONMIN LONMAX STEP DATE [HEIGHT_KM] [COF]\n");
+        printf("       wmm_tile v TILE [POINTS] [COF]\n");
+        printf("       wmm_tile l TILE LAT LON\n");
+        return 1;
+    }
+    return Flag;
+}
@@ -0,0 +1,268 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#if !defined(_WIN32) && !defined(MAG_NO_MMAP)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define MAG_BINARY_USE_MMAP
+#endif
+#include "GeomagnetismHeader.h"
+#include "GeomagBinaryLib.h"
+
+/*
+ * Binary coefficient files, see GeomagBinaryLib.h for the layout.
+ *
+ * MAG_MapBinaryModel maps the file read only with mmap. Without mmap (Windows, or MAG_NO_MMAP defined)
+ * the file is read into one allocated buffer instead, which is still free of any parsing.
+ */
+
+#define MAG_BINARY_BYTE_ORDER_MARK 0x01020304u
+
+typedef struct {
+    MAGtype_MagneticModel Model; /* Must stay first, MAG_UnmapBinaryModel casts back to the handle */
+    void *Base;
+    size_t Size;
+    int Mapped; /* Base was mapped with mmap, otherwise allocated */
+} MAGtype_BinaryModelHandle;
+
+#define MAG_BINARY_CHECKSUM_SEED 2166136261u
+
+static uint32_t MAG_BinaryChecksum(uint32_t h, const unsigned char *p, size_t n)
+/* 32 bit FNV-1a, continued from h (MAG_BINARY_CHECKSUM_SEED for a new checksum) */
+{
+    while(n--)
+    {
+        h ^= *p++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+int MAG_WriteBinaryModel(const char *filename, MAGtype_MagneticModel *MagneticModel)
+
+/* Writes a model, as read by any of the coefficient file readers, as a binary coefficient file.
+
+INPUT: filename  Output file
+       MagneticModel  The model (not time adjusted)
+OUTPUT: Returns FALSE if the file could not be written
+CALLS : none
+ */
+{
+    unsigned char Header[MAG_BINARY_MODEL_HEADER_SIZE];
+    const double *Arrays[4];
+    uint32_t u32, DataChecksum;
+    uint64_t DataSize;
+    int32_t i32, ArrayLength;
+    size_t k;
+    FILE *fp;
+    int Flag = TRUE;
+
+    ArrayLength = CALCULATE_NUMTERMS(MagneticModel->nMax) + 1;
+    DataSize = (uint64_t) 4 * ArrayLength * sizeof (double);
+    Arrays[0] = MagneticModel->Main_Field_Coeff_G;
+    Arrays[1] = MagneticModel->Main_Field_Coeff_H;
+    Arrays[2] = MagneticModel->Secular_Var_Coeff_G;
+    Arrays[3] = MagneticModel->Secular_Var_Coeff_H;
+
+    /* The data checksum runs over the four arrays as they will lie in the file */
+    DataChecksum = MAG_BINARY_CHECKSUM_SEED;
+    for(k = 0; k < 4; k++)
+        DataChecksum = MAG_BinaryChecksum(DataChecksum, (const unsigned char *) Arrays[k], ArrayLength * sizeof (double));
+
+    memset(Header, 0, sizeof (Header));
+    memcpy(Header, "WMMBCOF", 8);
+    u32 = MAG_BINARY_MODEL_VERSION;
+    memcpy(Header + 8, &u32, 4);
+    u32 = MAG_BINARY_MODEL_HEADER_SIZE;
+    memcpy(Header + 12, &u32, 4);
+    u32 = MAG_BINARY_BYTE_ORDER_MARK;
+    memcpy(Header + 16, &u32, 4);
+    i32 = MagneticModel->nMax;
+    memcpy(Header + 20, &i32, 4);
+    i32 = MagneticModel->nMaxSecVar;
+    memcpy(Header + 24, &i32, 4);
+    memcpy(Header + 28, &ArrayLength, 4);
+    memcpy(Header + 32, &MagneticModel->EditionDate, 8);
+    memcpy(Header + 40, &MagneticModel->epoch, 8);
+    memcpy(Header + 48, &MagneticModel->min_year, 8);
+    memcpy(Header + 56, &MagneticModel->CoefficientFileEndDate, 8);
+    MAG_strlcpy_equivalent((char *) Header + 64, MagneticModel->ModelName, 32);
+    i32 = MagneticModel->SecularVariationUsed;
+    memcpy(Header + 96, &i32, 4);
+    memcpy(Header + 104, &DataSize, 8);
+    memcpy(Header + 112, &DataChecksum, 4);
+    u32 = MAG_BinaryChecksum(MAG_BINARY_CHECKSUM_SEED, Header, 116);
+    memcpy(Header + 116, &u32, 4);
+
+    fp = fopen(filename, "wb");
+    if(fp == NULL)
+        return FALSE;
+    if(fwrite(Header, 1, sizeof (Header), fp) != sizeof (Header))
+        Flag = FALSE;
+    for(k = 0; k < 4 && Flag; k++)
+        if(fwrite(Arrays[k], sizeof (double), ArrayLength, fp) != (size_t) ArrayLength)
+            Flag = FALSE;
+    if(fclose(fp) != 0)
+        Flag = FALSE;
+    return Flag;
+} /*MAG_WriteBinaryModel*/
+
+int MAG_OpenBinaryModel(const void *Buffer, size_t Size, int VerifyData, MAGtype_MagneticModel *MagneticModel)
+
+/* Fills a model from a binary coefficient file image. The coefficient arrays point into Buffer,
+which must stay valid and unchanged while the model is used, and must be aligned for doubles.
+
+INPUT: Buffer  File image
+       Size    Number of bytes available
+       VerifyData  1 - Also check the checksum of the coefficient arrays (reads every byte once)
+OUTPUT: MagneticModel  Header fields and array pointers. Do not free it with MAG_FreeMagneticModelMemory.
+        Returns FALSE if the image is not a valid binary coefficient file for this machine
+CALLS : none
+ */
+{
+    const unsigned char *p = (const unsigned char *) Buffer;
+    const double *Data;
+    uint32_t u32;
+    uint64_t DataSize;
+    int32_t i32, ArrayLength;
+
+    if(Size < MAG_BINARY_MODEL_HEADER_SIZE || memcmp(p, "WMMBCOF", 8) != 0)
+        return FALSE;
+    memcpy(&u32, p + 16, 4);
+    if(u32 != MAG_BINARY_BYTE_ORDER_MARK)
+        return FALSE;
+    memcpy(&u32, p + 8, 4);
+    if(u32 != MAG_BINARY_MODEL_VERSION)
+        return FALSE;
+    memcpy(&u32, p + 12, 4);
+    if(u32 != MAG_BINARY_MODEL_HEADER_SIZE)
+        return FALSE;
+    memcpy(&u32, p + 116, 4);
+    if(u32 != MAG_BinaryChecksum(MAG_BINARY_CHECKSUM_SEED, p, 116))
+        return FALSE;
+    memcpy(&i32, p + 20, 4);
+    memcpy(&ArrayLength, p + 28, 4);
+    memcpy(&DataSize, p + 104, 8);
+    if(i32 < 0 || ArrayLength != CALCULATE_NUMTERMS(i32) + 1 || DataSize != (uint64_t) 4 * ArrayLength * sizeof (double) ||
+            Size - MAG_BINARY_MODEL_HEADER_SIZE < DataSize || ((uintptr_t) p % sizeof (double)) != 0)
+        return FALSE;
+    if(VerifyData)
+    {
+        memcpy(&u32, p + 112, 4);
+        if(u32 != MAG_BinaryChecksum(MAG_BINARY_CHECKSUM_SEED, p + MAG_BINARY_MODEL_HEADER_SIZE, (size_t) DataSize))
+            return FALSE;
+    }
+
+    memset(MagneticModel, 0, sizeof (MAGtype_MagneticModel));
+    MagneticModel->nMax = i32;
+    memcpy(&i32, p + 24, 4);
+    MagneticModel->nMaxSecVar = i32;
+    memcpy(&MagneticModel->EditionDate, p + 32, 8);
+    memcpy(&MagneticModel->epoch, p + 40, 8);
+    memcpy(&MagneticModel->min_year, p + 48, 8);
+    memcpy(&MagneticModel->CoefficientFileEndDate, p + 56, 8);
+    memcpy(MagneticModel->ModelName, p + 64, 32);
+    MagneticModel->ModelName[31] = '\0';
+    memcpy(&i32, p + 96, 4);
+    MagneticModel->SecularVariationUsed = i32;
+    Data = (const double *) (p + MAG_BINARY_MODEL_HEADER_SIZE);
+    MagneticModel->Main_Field_Coeff_G = (double *) Data;
+    MagneticModel->Main_Field_Coeff_H = (double *) (Data + ArrayLength);
+    MagneticModel->Secular_Var_Coeff_G = (double *) (Data + 2 * ArrayLength);
+    MagneticModel->Secular_Var_Coeff_H = (double *) (Data + 3 * ArrayLength);
+    return TRUE;
+} /*MAG_OpenBinaryModel*/
+
+MAGtype_MagneticModel *MAG_MapBinaryModel(const char *filename, int VerifyData)
+
+/* Maps a binary coefficient file and returns the model that uses it in place.
+
+INPUT: filename  Binary coefficient file
+       VerifyData  1 - Also check the checksum of the coefficient arrays
+OUTPUT: Returns the model, to be released with MAG_UnmapBinaryModel, or NULL on error
+CALLS : MAG_OpenBinaryModel
+ */
+{
+    MAGtype_BinaryModelHandle *Handle;
+
+    Handle = (MAGtype_BinaryModelHandle *) calloc(1, sizeof (MAGtype_BinaryModelHandle));
+    if(Handle == NULL)
+        return NULL;
+#ifdef MAG_BINARY_USE_MMAP
+    {
+        struct stat st;
+        int fd = open(filename, O_RDONLY);
+
+        if(fd < 0)
+        {
+            free(Handle);
+            return NULL;
+        }
+        if(fstat(fd, &st) != 0 || st.st_size < MAG_BINARY_MODEL_HEADER_SIZE)
+        {
+            close(fd);
+            free(Handle);
+            return NULL;
+        }
+        Handle->Size = (size_t) st.st_size;
+        Handle->Base = mmap(NULL, Handle->Size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(Handle->Base == MAP_FAILED)
+        {
+            free(Handle);
+            return NULL;
+        }
+        Handle->Mapped = TRUE;
+    }
+#else
+    {
+        FILE *fp = fopen(filename, "rb");
+        long n;
+
+        if(fp == NULL)
+        {
+            free(Handle);
+            return NULL;
+        }
+        fseek(fp, 0, SEEK_END);
+        n = ftell(fp);
+        rewind(fp);
+        Handle->Base = n > 0 ? malloc((size_t) n) : NULL;
+        if(Handle->Base == NULL || fread(Handle->Base, 1, (size_t) n, fp) != (size_t) n)
+        {
+            fclose(fp);
+            free(Handle->Base);
+            free(Handle);
+            return NULL;
+        }
+        fclose(fp);
+        Handle->Size = (size_t) n;
+    }
+#endif
+    if(!MAG_OpenBinaryModel(Handle->Base, Handle->Size, VerifyData, &Handle->Model))
+    {
+        MAG_UnmapBinaryModel(&Handle->Model);
+        return NULL;
+    }
+    return &Handle->Model;
+} /*MAG_MapBinaryModel*/
+
+void MAG_UnmapBinaryModel(MAGtype_MagneticModel *MagneticModel)
+/* Releases a model returned by MAG_MapBinaryModel */
+{
+    MAGtype_BinaryModelHandle *Handle = (MAGtype_BinaryModelHandle *) MagneticModel;
+
+    if(Handle == NULL)
+        return;
+#ifdef MAG_BINARY_USE_MMAP
+    if(Handle->Mapped)
+        munmap(Handle->Base, Handle->Size);
+#else
+    free(Handle->Base);
+#endif
+    free(Handle);
+} /*MAG_UnmapBinaryModel*/
@@ -0,0 +1,46 @@
+/*
+ * Binary coefficient files.
+ *
+ * A binary coefficient file holds one MAGtype_MagneticModel with its coefficient arrays stored as
+ * native doubles, so a loaded model points straight into the file image: no parsing, no copies and
+ * no allocation of coefficient memory. The image can be a memory mapped file (MAG_MapBinaryModel)
+ * or any buffer such as a flash partition (MAG_OpenBinaryModel). The coefficients of such a model
+ * are read only; use the model as the source of MAG_TimelyModifyMagneticModel as usual.
+ *
+ * File layout, in the byte order of the machine that wrote it (checked by ByteOrderMark):
+ *
+ *   offset  type       field
+ *        0  char[8]    "WMMBCOF" and a zero byte
+ *        8  uint32     Version (MAG_BINARY_MODEL_VERSION)
+ *       12  uint32     HeaderSize (MAG_BINARY_MODEL_HEADER_SIZE)
+ *       16  uint32     ByteOrderMark (0x01020304)
+ *       20  int32      nMax, nMaxSecVar
+ *       28  int32      ArrayLength (entries per coefficient array, CALCULATE_NUMTERMS(nMax) + 1)
+ *       32  float64    EditionDate, epoch, min_year, CoefficientFileEndDate
+ *       64  char[32]   ModelName
+ *       96  int32      SecularVariationUsed
+ *      100  uint32     Reserved (zero)
+ *      104  uint64     DataSize (4 * ArrayLength * 8 bytes)
+ *      112  uint32     DataChecksum (32 bit FNV-1a of the coefficient arrays)
+ *      116  uint32     HeaderChecksum (32 bit FNV-1a of bytes 0 to 115)
+ *      120  uint8[8]   Reserved (zero)
+ *      128  float64    Main_Field_Coeff_G, Main_Field_Coeff_H, Secular_Var_Coeff_G, Secular_Var_Coeff_H
+ */
+
+#ifndef GEOMAGBINARYLIB_H
+#define GEOMAGBINARYLIB_H
+
+#include <stddef.h>
+
+#define MAG_BINARY_MODEL_VERSION 1
+#define MAG_BINARY_MODEL_HEADER_SIZE 128
+
+int MAG_WriteBinaryModel(const char *filename, MAGtype_MagneticModel *MagneticModel);
+
+int MAG_OpenBinaryModel(const void *Buffer, size_t Size, int VerifyData, MAGtype_MagneticModel *MagneticModel);
+
+MAGtype_MagneticModel *MAG_MapBinaryModel(const char *filename, int VerifyData);
+
+void MAG_UnmapBinaryModel(MAGtype_MagneticModel *MagneticModel);
+
+#endif /*GEOMAGBINARYLIB_H*/
@@ -0,0 +1,1013 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <time.h>
+#ifndef MAG_NO_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#include "GeomagnetismHeader.h"
+#include "GeomagFileLib.h"
+
+/*
+ * Streaming coordinate file processor.
+ *
+ * The line by line loop of wmm_file reads each record with fgets into a 100 byte buffer, splits it
+ * with sscanf("%93s%93s%93s%93s%93s") into args[1..5], which keep their previous contents when a record
+ * has fewer entries, interprets the entries with atof and strchr and prints each line with fprintf.
+ * MAG_FileStream reproduces each of these steps exactly:
+ *
+ *  - Records are cut from the chunk buffer as fgets would cut them: up to and including a newline, or
+ *    MAG_FILE_RECORD bytes, or up to the end of the file.
+ *  - Entries are cut as sscanf would cut them, MAG_FILE_TOKEN characters at most, into the persistent
+ *    args[1..5] of the reader.
+ *  - Numbers are converted with MAG_FileAtof, which is exact where it does not defer to atof.
+ *  - Values are printed with MAG_FileFixed, which gives the bytes of %W.1f / %W.0f and defers to
+ *    snprintf for non finite, very large and near tie values.
+ *
+ * The control variables of the loop are reset after every row that is printed, and the loop stops at the
+ * first row that is not, so the outcome of a record only depends on args[1..5] and on whether it is the
+ * first record (which sees the initial values of the control variables instead of the reset ones). The
+ * reader therefore only cuts the records and their entries, in order, and stores the "%s %s %s %s %s "
+ * prefix of each record in a batch of MAG_FILE_BATCH records. Everything else is done per batch: the
+ * entries are interpreted and checked, the heights converted, the rows evaluated with MAG_GeomagBatch
+ * (bit identical to MAG_TimelyModifyMagneticModel and MAG_Geomag per row) and the lines formatted into
+ * one text buffer, which is written with a single fwrite. A batch that holds an invalid record keeps the
+ * messages of that record; the writer prints them after the rows before it and stops the stream.
+ *
+ * With more than one thread, the steps form a pipeline over a ring of batch slots: a reader thread fills
+ * the slots, the worker threads evaluate whole slots (each call of MAG_GeomagBatch with its own time
+ * adjusted model) and the calling thread writes them in input order and frees them for the reader.
+ */
+
+#define MAG_FILE_RECORD 99 /* Bytes per record, fgets into the 100 byte line buffer of wmm_file */
+#define MAG_FILE_TOKEN 93 /* Characters per entry, MAXREAD in wmm_file */
+#define MAG_FILE_ECHO (5 * (MAG_FILE_TOKEN + 1)) /* Longest "%s %s %s %s %s " prefix of an output line */
+#define MAG_FILE_LINE_MAX 8192 /* Room reserved per output line, enough for 21 values printed by snprintf */
+#define MAG_FILE_MESSAGES 2048 /* Room for the messages of an invalid record */
+#define MAG_FILE_WINDOW 2 /* Batches in flight per worker thread */
+
+typedef struct {
+    FILE *In;
+    char *Buffer; /* MAG_FILE_CHUNK_SIZE + MAG_FILE_RECORD bytes */
+    size_t Start; /* First unread byte */
+    size_t End; /* End of the bytes read */
+    int Eof; /* fread returned nothing */
+    char Args[6][MAG_FILE_TOKEN + 1]; /* args[1..5] of wmm_file, kept from record to record */
+    long NumLines; /* Records read */
+} MAGtype_FileReader;
+
+typedef struct {
+    int igdgc, decyears, units, decdeg, range;
+    double sdate, latitude, longitude, alt;
+} MAGtype_FileRowState;
+
+typedef struct {
+    int NumRows; /* Records in the batch */
+    long FirstLine; /* Line number of the first record */
+    int AtEnd; /* The last record ran into the end of the file */
+    char *Echo; /* The "%s %s %s %s %s " prefix of each record */
+    size_t EchoSize;
+    size_t *EchoEnd; /* End of the prefix of each record in Echo */
+    double *Latitude, *Longitude, *HeightAboveEllipsoid, *DecimalYear;
+    MAGtype_GeoMagneticElements *Elements;
+    int NumValid; /* Records before the first invalid one */
+    int ArgError; /* Record NumValid has an invalid entry */
+    int RangeError; /* Record NumValid has a date range */
+    char Messages[MAG_FILE_MESSAGES]; /* Messages of record NumValid */
+    char *Text; /* Formatted lines of the valid records */
+    size_t TextLength;
+    size_t TextSize;
+    int BozWarningStrong, BozWarningWeak, AltitudeWarning;
+    int Done; /* Evaluated and formatted, waiting to be written */
+} MAGtype_FileBatch;
+
+typedef struct {
+    MAGtype_FileParameters *Parameters;
+    MAGtype_MagneticModel *MagneticModel;
+    MAGtype_Geoid *Geoid;
+    MAGtype_Ellipsoid Ellip;
+    FILE *Out;
+    FILE *MessageOut;
+    MAGtype_FileStatus *Status;
+    MAGtype_FileReader Reader; /* Used by the reader only */
+    MAGtype_FileBatch *Slots;
+    int NumSlots;
+    long NextFill; /* Next batch to fill; batches before it are ready for the workers */
+    long NextEvaluate; /* Next batch to hand out to a worker */
+    long NextWrite; /* Next batch to write */
+    int ReaderDone; /* The reader filled its last batch */
+    int Stopped; /* The writer reached an invalid record */
+    int Failed;
+#ifndef MAG_NO_THREADS
+    pthread_mutex_t Lock;
+    pthread_cond_t Filled; /* Signalled when the reader fills a batch or finishes */
+    pthread_cond_t Evaluated; /* Signalled when a worker finishes a batch or the reader finishes */
+    pthread_cond_t SlotFree; /* Signalled when the writer releases a slot */
+#endif
+} MAGtype_FileShared;
+
+static const double MAG_FilePow10[23] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static double MAG_FileAtof(const char *s)
+/* atof for plain decimals ([+-]digits[.digits]) of up to 2^53 in mantissa and 22 fraction digits. Both the
+   mantissa and the power of ten are exact doubles then, and so is the correctly rounded quotient, as with
+   strtod. Anything else (exponents, hex, inf, nan, trailing text, long mantissas) goes to atof. */
+{
+    const char *p = s;
+    unsigned long long m = 0;
+    int negative = 0, digits = 0, scale = 0, fraction = 0;
+    double v;
+
+    if(*p == '+' || *p == '-')
+        negative = *p++ == '-';
+    for(;; p++)
+    {
+        if(*p >= '0' && *p <= '9')
+        {
+            if(m >= (1ULL << 53) / 10)
+                return atof(s);
+            m = m * 10 + (unsigned) (*p - '0');
+            digits++;
+            scale += fraction;
+        } else if(*p == '.' && !fraction)
+            fraction = 1;
+        else
+            break;
+    }
+    if(*p != '\0' || digits == 0 || scale > 22)
+        return atof(s);
+    v = (double) m;
+    if(scale)
+        v /= MAG_FilePow10[scale];
+    return negative ? -v : v;
+} /*MAG_FileAtof*/
+
+static char *MAG_FileFixed(char *p, double x, int width, int decimals)
+/* Appends x as printf("%*.*f", width, decimals) would, for decimals 0 or 1. Below 1e8 the rounding error
+   of x * 10 is under 2.5e-7, so the rounding direction is certain unless the fraction is within 1e-6 of
+   one half; those values, and the large and non finite ones, are printed with snprintf. */
+{
+    char digits[24];
+    double a, t, f;
+    unsigned long long q;
+    int n = 0;
+
+    a = fabs(x);
+    if(!(a < 1e8))
+        return p + snprintf(p, MAG_FILE_LINE_MAX / 24, "%*.*f", width, decimals, x);
+    t = decimals ? a * 10.0 : a;
+    f = t - floor(t);
+    if(fabs(f - 0.5) < 1e-6)
+        return p + snprintf(p, MAG_FILE_LINE_MAX / 24, "%*.*f", width, decimals, x);
+    q = (unsigned long long) floor(t) + (f > 0.5);
+    if(decimals)
+    {
+        digits[n++] = (char) ('0' + q % 10);
+        q /= 10;
+        digits[n++] = '.';
+    }
+    do
+    {
+        digits[n++] = (char) ('0' + q % 10);
+        q /= 10;
+    } while(q);
+    if(signbit(x))
+        digits[n++] = '-';
+    while(width-- > n)
+        *p++ = ' ';
+    while(n)
+        *p++ = digits[--n];
+    return p;
+} /*MAG_FileFixed*/
+
+static char *MAG_FileInt(char *p, int v, int width)
+/* Appends v as printf("%*d", width, v) */
+{
+    char digits[16];
+    unsigned int u = v < 0 ? 0u - (unsigned int) v : (unsigned int) v;
+    int n = 0;
+
+    do
+    {
+        digits[n++] = (char) ('0' + u % 10);
+        u /= 10;
+    } while(u);
+    if(v < 0)
+        digits[n++] = '-';
+    while(width-- > n)
+        *p++ = ' ';
+    while(n)
+        *p++ = digits[--n];
+    return p;
+} /*MAG_FileInt*/
+
+static char *MAG_FileText(char *p, const char *s)
+{
+    while(*s)
+        *p++ = *s++;
+    return p;
+} /*MAG_FileText*/
+
+static char *MAG_FileFormatLine(char *p, MAGtype_GeoMagneticElements *Elements, int PrintErrors)
+/* The print_result_file and append_errors_to_result_file columns of wmm_file and the newline */
+{
+    MAGtype_GeoMagneticElements Errors;
+    double d = Elements->Decl, i = Elements->Incl, dmin, imin;
+    int ddeg, ideg;
+
+    ddeg = (int) d;
+    dmin = (d - (double) ddeg)*60;
+    if(ddeg != 0) dmin = fabs(dmin);
+    ideg = (int) i;
+    imin = (i - (double) ideg)*60;
+    if(ideg != 0) imin = fabs(imin);
+
+    if(MAG_isNaN(d))
+    {
+        p = MAG_FileText(p, " NaN        ");
+        p = MAG_FileInt(p, ideg, 4);
+        p = MAG_FileText(p, "d ");
+        p = MAG_FileFixed(p, imin, 2, 0);
+        p = MAG_FileText(p, "m  ");
+        p = MAG_FileFixed(p, Elements->H, 8, 1);
+        if(MAG_isNaN(Elements->X))
+            p = MAG_FileText(p, "      NaN      NaN");
+        else
+        {
+            *p++ = ' ';
+            p = MAG_FileFixed(p, Elements->X, 8, 1);
+            *p++ = ' ';
+            p = MAG_FileFixed(p, Elements->Y, 8, 1);
+        }
+    } else
+    {
+        *p++ = ' ';
+        p = MAG_FileInt(p, ddeg, 4);
+        p = MAG_FileText(p, "d ");
+        p = MAG_FileFixed(p, dmin, 2, 0);
+        p = MAG_FileText(p, "m  ");
+        p = MAG_FileInt(p, ideg, 4);
+        p = MAG_FileText(p, "d ");
+        p = MAG_FileFixed(p, imin, 2, 0);
+        p = MAG_FileText(p, "m  ");
+        p = MAG_FileFixed(p, Elements->H, 8, 1);
+        *p++ = ' ';
+        p = MAG_FileFixed(p, Elements->X, 8, 1);
+        *p++ = ' ';
+        p = MAG_FileFixed(p, Elements->Y, 8, 1);
+    }
+    *p++ = ' ';
+    p = MAG_FileFixed(p, Elements->Z, 8, 1);
+    *p++ = ' ';
+    p = MAG_FileFixed(p, Elements->F, 8, 1);
+
+    if(MAG_isNaN(60 * Elements->Decldot))
+    {
+        p = MAG_FileText(p, "      NaN  ");
+        p = MAG_FileFixed(p, 60 * Elements->Incldot, 7, 1);
+        p = MAG_FileText(p, "     ");
+        p = MAG_FileFixed(p, Elements->Hdot, 8, 1);
+        if(MAG_isNaN(Elements->Xdot))
+            p = MAG_FileText(p, "      NaN      NaN");
+        else
+        {
+            *p++ = ' ';
+            p = MAG_FileFixed(p, Elements->Xdot, 8, 1);
+            *p++ = ' ';
+            p = MAG_FileFixed(p, Elements->Ydot, 8, 1);
+        }
+    } else
+    {
+        *p++ = ' ';
+        p = MAG_FileFixed(p, 60 * Elements->Decldot, 7, 1);
+        p = MAG_FileText(p, "   ");
+        p = MAG_FileFixed(p, 60 * Elements->Incldot, 7, 1);
+        p = MAG_FileText(p, "     ");
+        p = MAG_FileFixed(p, Elements->Hdot, 8, 1);
+        *p++ = ' ';
+        p = MAG_FileFixed(p, Elements->Xdot, 8, 1);
+        *p++ = ' ';
+        p = MAG_FileFixed(p, Elements->Ydot, 8, 1);
+    }
+    *p++ = ' ';
+    p = MAG_FileFixed(p, Elements->Zdot, 8, 1);
+    *p++ = ' ';
+    p = MAG_FileFixed(p, Elements->Fdot, 8, 1);
+
+    if(PrintErrors)
+    {
+#ifdef WMMHR
+        MAG_WMMHRErrorCalc(Elements->H, &Errors);
+#else
+        MAG_WMMErrorCalc(Elements->H, &Errors);
+#endif
+        if(MAG_isNaN(Errors.Decl))
+        {
+            p = MAG_FileText(p, " NaN         ");
+            p = MAG_FileFixed(p, 60*Errors.Incl, 3, 0);
+            p = MAG_FileText(p, "  ");
+            p = MAG_FileFixed(p, Errors.H, 8, 1);
+            if(MAG_isNaN(Errors.X))
+                p = MAG_FileText(p, "      NaN      NaN");
+            else
+            {
+                *p++ = ' ';
+                p = MAG_FileFixed(p, Errors.X, 8, 1);
+                *p++ = ' ';
+                p = MAG_FileFixed(p, Errors.Y, 8, 1);
+            }
+        } else
+        {
+            *p++ = ' ';
+            p = MAG_FileFixed(p, 60*Errors.Decl, 3, 0);
+            p = MAG_FileText(p, "  ");
+            p = MAG_FileFixed(p, 60*Errors.Incl, 3, 0);
+            p = MAG_FileText(p, "  ");
+            p = MAG_FileFixed(p, Errors.H, 8, 1);
+            *p++ = ' ';
+            p = MAG_FileFixed(p, Errors.X, 8, 1);
+            *p++ = ' ';
+            p = MAG_FileFixed(p, Errors.Y, 8, 1);
+        }
+        *p++ = ' ';
+        p = MAG_FileFixed(p, Errors.Z, 8, 1);
+        *p++ = ' ';
+        p = MAG_FileFixed(p, Errors.F, 8, 1);
+    }
+    *p++ = '\n';
+    return p;
+} /*MAG_FileFormatLine*/
+
+static int MAG_FileNextRecord(MAGtype_FileReader *Reader, const char **Record, size_t *Length, int *AtEnd)
+/* Cuts the next record as fgets(line, MAG_FILE_RECORD + 1, In) would. Returns FALSE at the end of the file. */
+{
+    const char *Newline;
+    size_t n, got;
+
+    for(;;)
+    {
+        n = Reader->End - Reader->Start;
+        Newline = (const char *) memchr(Reader->Buffer + Reader->Start, '\n', n < MAG_FILE_RECORD ? n : MAG_FILE_RECORD);
+        if(Newline != NULL || n >= MAG_FILE_RECORD || (Reader->Eof && n > 0))
+        {
+            *Record = Reader->Buffer + Reader->Start;
+            *Length = Newline != NULL ? (size_t) (Newline - *Record) + 1 : (n < MAG_FILE_RECORD ? n : MAG_FILE_RECORD);
+            *AtEnd = Newline == NULL && n < MAG_FILE_RECORD;
+            Reader->Start += *Length;
+            return TRUE;
+        }
+        if(Reader->Eof)
+            return FALSE;
+        memmove(Reader->Buffer, Reader->Buffer + Reader->Start, n);
+        Reader->Start = 0;
+        Reader->End = n;
+        got = fread(Reader->Buffer + n, 1, MAG_FILE_CHUNK_SIZE, Reader->In);
+        if(got == 0)
+            Reader->Eof = TRUE;
+        Reader->End += got;
+    }
+} /*MAG_FileNextRecord*/
+
+static void MAG_FileSplitRecord(MAGtype_FileReader *Reader, const char *Record, size_t Length)
+/* sscanf(Record, "%93s%93s%93s%93s%93s", args[1], ..., args[5]): entries missing from the record keep their value */
+{
+    const char *End = Record + Length;
+    int k, n;
+
+    for(k = 1; k <= 5; k++)
+    {
+        while(Record < End && *Record != '\0' && isspace((unsigned char) *Record))
+            Record++;
+        if(Record == End || *Record == '\0')
+            return;
+        for(n = 0; n < MAG_FILE_TOKEN && Record < End && *Record != '\0' && !isspace((unsigned char) *Record); n++)
+            Reader->Args[k][n] = *Record++;
+        Reader->Args[k][n] = '\0';
+    }
+} /*MAG_FileSplitRecord*/
+
+static void MAG_FileMessage(char *Messages, const char *Format, ...)
+/* Appends a message of an invalid record */
+{
+    size_t Length = strlen(Messages);
+    va_list Arguments;
+
+    va_start(Arguments, Format);
+    vsnprintf(Messages + Length, MAG_FILE_MESSAGES - Length, Format, Arguments);
+    va_end(Arguments);
+} /*MAG_FileMessage*/
+
+static int MAG_FileParseRow(char *Args[6], int First, MAGtype_FileParameters *Parameters, long iline, char *Messages,
+        MAGtype_CoordGeodetic *CoordGeodetic, double *DecimalYear)
+/* Interprets args[1..5] as the switch of wmm_file does, starting from the initial values of the control
+   variables for the first record and from their reset values otherwise, and applies its checks.
+   Returns 1 for a row to evaluate, 0 for an invalid entry and -1 for a date range, with the messages of
+   wmm_file in Messages. */
+{
+    MAGtype_FileRowState State;
+    char *Args5 = Args[5], *Args4 = Args[4], *Args3 = Args[3], *Args2 = Args[2], *Args1 = Args[1];
+    char Start[MAG_FILE_TOKEN + 1], Stop[MAG_FILE_TOKEN + 1], *Dash;
+    int c, arg_err = 0;
+
+    if(First)
+    {
+        /* The initial values of the control variables of wmm_file */
+        State.decyears = 3;
+        State.units = 4;
+        State.decdeg = 3;
+        State.range = -1;
+        State.igdgc = 3;
+        State.alt = -999999;
+    } else
+    {
+        /* The reset at the end of each row of wmm_file */
+        State.igdgc = State.decyears = State.units = State.decdeg = -1;
+        State.range = -1;
+        State.alt = -9999999;
+    }
+    State.sdate = -1;
+    State.latitude = 200;
+    State.longitude = 200;
+
+    if(strchr(Args5, ','))
+        State.decdeg = 2; /* Degrees, minutes, seconds: the longitude is left as it was */
+    else
+    {
+        State.decdeg = 1;
+        State.longitude = MAG_FileAtof(Args5);
+    }
+    if(strchr(Args4, ','))
+        State.decdeg = 2;
+    else
+    {
+        State.decdeg = 1;
+        State.latitude = MAG_FileAtof(Args4);
+    }
+    c = toupper((unsigned char) Args3[0]);
+    if(c == 'K') State.units = 1;
+    else if(c == 'M') State.units = 2;
+    else if(c == 'F') State.units = 3;
+    if(strlen(Args3) > 1)
+        State.alt = MAG_FileAtof(Args3 + 1);
+    c = toupper((unsigned char) Args2[0]);
+    if(c == 'M') State.igdgc = 1;
+    else if(c == 'E') State.igdgc = 2;
+    if((Dash = strchr(Args1, '-')))
+    {
+        /* A date range: the start date is still read, as a range starting at 0 is an unrecognized date instead */
+        State.range = 2;
+        memcpy(Start, Args1, (size_t) (Dash - Args1));
+        Start[Dash - Args1] = '\0';
+        strcpy(Stop, Dash + 1);
+        if((Dash = strchr(Stop, '-')))
+            *Dash = '\0';
+        if(strchr(Stop, ','))
+        {
+            State.decyears = 2;
+            if(!strchr(Start, ','))
+                State.sdate = MAG_FileAtof(Start);
+        } else
+        {
+            State.decyears = 1;
+            State.sdate = MAG_FileAtof(Start);
+        }
+    } else
+    {
+        State.range = 1;
+        if(strchr(Args1, ','))
+            State.decyears = 2; /* Not decimal years: the date is left as it was */
+        else
+        {
+            State.decyears = 1;
+            State.sdate = MAG_FileAtof(Args1);
+        }
+    }
+    if(State.sdate == 0)
+    {
+        State.decyears = -1;
+        State.range = -1;
+    }
+    if(State.range == 2)
+    {
+        MAG_FileMessage(Messages, "Error in line %1ld, date = %s: date ranges not allowed for file option\n\n", iline, Args1);
+        return -1;
+    }
+
+    if(!arg_err && (State.decyears != 1 && State.decyears != 2))
+    {
+        MAG_FileMessage(Messages, "\nError: unrecognized date %s in coordinate file line %1ld\n\n", Args1, iline);
+        arg_err = 1;
+    }
+    if(!arg_err && State.range != 1)
+    {
+        MAG_FileMessage(Messages, "\nError: unrecognized date %s in coordinate file line %1ld\n\n", Args1, iline);
+        arg_err = 1;
+    }
+    if(!arg_err && (State.sdate < Parameters->MinYear || State.sdate >= Parameters->MaxYear))
+    {
+        MAG_FileMessage(Messages, "\nError:  date out of range in coordinate file line %1ld\n\n", iline);
+        MAG_FileMessage(Messages, "\nExpected range = %6.1f - %6.1f, entered %6.6f\n", Parameters->MinYear, Parameters->MaxYear, State.sdate);
+        arg_err = 1;
+    }
+    if(!arg_err && (State.igdgc != 1 && State.igdgc != 2))
+    {
+        MAG_FileMessage(Messages, "\nError: Unrecognized height reference %s in coordinate file line %1ld\n\n", Args1, iline);
+        arg_err = 1;
+    }
+    if(!arg_err && State.decdeg != 1)
+    {
+        MAG_FileMessage(Messages, "\nError: unrecognized lat %s or lon %s in coordinate file line %1ld\n\n", Args4, Args5, iline);
+        arg_err = 1;
+    }
+    if(!arg_err && (State.longitude < LON_BOUND_MIN || State.longitude > LON_BOUND_MAX))
+    {
+        MAG_FileMessage(Messages, "\nError:  longitude out of range in coordinate file line %1ld\n\n", iline);
+        MAG_FileMessage(Messages, "\nExpected range = %6.1lf - %6.1lf, entered %6.6lf\n", (double) LON_BOUND_MIN, (double) LON_BOUND_MAX, State.longitude);
+        arg_err = 1;
+    }
+    if(!arg_err && (State.latitude < LAT_BOUND_MIN || State.latitude > LAT_BOUND_MAX))
+    {
+        MAG_FileMessage(Messages, "\nError:  latitude out of range in coordinate file line %1ld\n\n", iline);
+        MAG_FileMessage(Messages, "\nExpected range = %6.1lf - %6.1lf, entered %6.6lf\n", (double) LAT_BOUND_MIN, (double) LAT_BOUND_MAX, State.latitude);
+        arg_err = 1;
+    }
+    if(arg_err)
+        return 0;
+
+    if(State.units == 2)
+        State.alt *= 0.001;
+    else if(State.units == 3)
+        State.alt /= 3280.0839895;
+    CoordGeodetic->lambda = State.longitude;
+    CoordGeodetic->phi = State.latitude;
+    CoordGeodetic->HeightAboveGeoid = State.alt;
+    CoordGeodetic->UseGeoid = State.igdgc == 1; /* 1: height above MSL, 0: height above WGS-84 Ellipsoid */
+    *DecimalYear = State.sdate;
+    return 1;
+} /*MAG_FileParseRow*/
+
+static double MAG_FileSeconds(void)
+{
+#ifndef MAG_NO_THREADS
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + 1e-9 * (double) ts.tv_nsec;
+#else
+    return (double) clock() / CLOCKS_PER_SEC;
+#endif
+} /*MAG_FileSeconds*/
+
+static void MAG_FileFreeBatch(MAGtype_FileBatch *Batch)
+{
+    free(Batch->Echo);
+    free(Batch->EchoEnd);
+    free(Batch->Latitude);
+    free(Batch->Longitude);
+    free(Batch->HeightAboveEllipsoid);
+    free(Batch->DecimalYear);
+    free(Batch->Elements);
+    free(Batch->Text);
+} /*MAG_FileFreeBatch*/
+
+static int MAG_FileAllocateBatch(MAGtype_FileBatch *Batch)
+{
+    memset(Batch, 0, sizeof (MAGtype_FileBatch));
+    Batch->EchoSize = (size_t) MAG_FILE_BATCH * 64 + MAG_FILE_ECHO;
+    Batch->Echo = (char *) malloc(Batch->EchoSize);
+    Batch->EchoEnd = (size_t *) malloc(MAG_FILE_BATCH * sizeof (size_t));
+    Batch->Latitude = (double *) malloc(MAG_FILE_BATCH * sizeof (double));
+    Batch->Longitude = (double *) malloc(MAG_FILE_BATCH * sizeof (double));
+    Batch->HeightAboveEllipsoid = (double *) malloc(MAG_FILE_BATCH * sizeof (double));
+    Batch->DecimalYear = (double *) malloc(MAG_FILE_BATCH * sizeof (double));
+    Batch->Elements = (MAGtype_GeoMagneticElements *) malloc(MAG_FILE_BATCH * sizeof (MAGtype_GeoMagneticElements));
+    Batch->TextSize = (size_t) MAG_FILE_BATCH * 256 + MAG_FILE_LINE_MAX;
+    Batch->Text = (char *) malloc(Batch->TextSize);
+    if(!Batch->Echo || !Batch->EchoEnd || !Batch->Latitude || !Batch->Longitude || !Batch->HeightAboveEllipsoid || !Batch->DecimalYear ||
+            !Batch->Elements || !Batch->Text)
+    {
+        MAG_FileFreeBatch(Batch);
+        return FALSE;
+    }
+    return TRUE;
+} /*MAG_FileAllocateBatch*/
+
+static int MAG_FileAddRecord(MAGtype_FileBatch *Batch, MAGtype_FileReader *Reader)
+/* Appends the "%s %s %s %s %s " prefix of a record. Returns FALSE if the prefix buffer cannot grow. */
+{
+    size_t Start = Batch->NumRows ? Batch->EchoEnd[Batch->NumRows - 1] : 0;
+    char *p, *NewEcho;
+    int k;
+
+    if(Batch->EchoSize - Start < MAG_FILE_ECHO)
+    {
+        NewEcho = (char *) realloc(Batch->Echo, Batch->EchoSize * 2);
+        if(NewEcho == NULL)
+            return FALSE;
+        Batch->Echo = NewEcho;
+        Batch->EchoSize *= 2;
+    }
+    p = Batch->Echo + Start;
+    for(k = 1; k <= 5; k++)
+    {
+        p = MAG_FileText(p, Reader->Args[k]);
+        *p++ = ' ';
+    }
+    Batch->EchoEnd[Batch->NumRows++] = (size_t) (p - Batch->Echo);
+    return TRUE;
+} /*MAG_FileAddRecord*/
+
+static int MAG_FileFillBatch(MAGtype_FileShared *Shared, MAGtype_FileBatch *Batch, int *More)
+/* Cuts records and their entries until the batch is full (*More set) or the input ends.
+   Returns FALSE if memory could not be allocated. */
+{
+    MAGtype_FileReader *Reader = &Shared->Reader;
+    const char *Record;
+    size_t Length;
+
+    Batch->NumRows = 0;
+    Batch->FirstLine = Reader->NumLines + 1;
+    Batch->AtEnd = FALSE;
+    *More = FALSE;
+    while(MAG_FileNextRecord(Reader, &Record, &Length, &Batch->AtEnd))
+    {
+        Reader->NumLines++;
+        MAG_FileSplitRecord(Reader, Record, Length);
+        if(!MAG_FileAddRecord(Batch, Reader))
+            return FALSE;
+        if(Batch->NumRows == MAG_FILE_BATCH)
+        {
+            *More = TRUE;
+            return TRUE;
+        }
+    }
+    return TRUE;
+} /*MAG_FileFillBatch*/
+
+static int MAG_FileEvaluateBatch(MAGtype_FileShared *Shared, MAGtype_FileBatch *Batch)
+/* Interprets the records of a batch up to the first invalid one, converts the heights, evaluates the rows
+   and formats their lines into Batch->Text */
+{
+    MAGtype_Geoid Geoid = *Shared->Geoid;
+    MAGtype_CoordGeodetic CoordGeodetic;
+    char Entries[MAG_FILE_ECHO + 1], *Args[6], *p, *NewText;
+    size_t NewSize, EchoStart, EchoLength;
+    int i, k, Row;
+
+    memset(&CoordGeodetic, 0, sizeof (MAGtype_CoordGeodetic));
+    Batch->NumValid = Batch->NumRows;
+    Batch->ArgError = Batch->RangeError = 0;
+    Batch->Messages[0] = '\0';
+    Batch->BozWarningStrong = Batch->BozWarningWeak = Batch->AltitudeWarning = 0;
+    Args[0] = NULL;
+    for(i = 0; i < Batch->NumRows; i++)
+    {
+        /* Split the prefix back into the five entries, which never contain white space */
+        EchoStart = i ? Batch->EchoEnd[i - 1] : 0;
+        EchoLength = Batch->EchoEnd[i] - EchoStart;
+        memcpy(Entries, Batch->Echo + EchoStart, EchoLength);
+        for(k = 1, p = Entries; k <= 5; k++)
+        {
+            Args[k] = p;
+            while(*p != ' ')
+                p++;
+            *p++ = '\0';
+        }
+        Row = MAG_FileParseRow(Args, Batch->FirstLine + i == 1, Shared->Parameters, Batch->FirstLine + i, Batch->Messages, &CoordGeodetic,
+                &Batch->DecimalYear[i]);
+        if(Row <= 0)
+        {
+            Batch->NumValid = i;
+            Batch->ArgError = Row == 0;
+            Batch->RangeError = Row < 0;
+            break;
+        }
+        if(CoordGeodetic.HeightAboveGeoid < Shared->Parameters->MinHeight || CoordGeodetic.HeightAboveGeoid > Shared->Parameters->MaxHeight)
+            Batch->AltitudeWarning = TRUE;
+        Geoid.UseGeoid = CoordGeodetic.UseGeoid;
+        MAG_ConvertGeoidToEllipsoidHeight(&CoordGeodetic, &Geoid);
+        Batch->Latitude[i] = CoordGeodetic.phi;
+        Batch->Longitude[i] = CoordGeodetic.lambda;
+        Batch->HeightAboveEllipsoid[i] = CoordGeodetic.HeightAboveEllipsoid;
+    }
+
+    if(!MAG_GeomagBatch(Shared->Ellip, Shared->MagneticModel, Batch->NumValid, Batch->Latitude, Batch->Longitude, Batch->HeightAboveEllipsoid,
+            Batch->DecimalYear, Batch->Elements))
+        return FALSE;
+    Batch->TextLength = 0;
+    for(i = 0; i < Batch->NumValid; i++)
+    {
+        if(Batch->Elements[i].H <= 2000.0)
+            Batch->BozWarningStrong = TRUE;
+        else if(Batch->Elements[i].H <= 6000.0)
+            Batch->BozWarningWeak = TRUE;
+        if(Batch->TextSize - Batch->TextLength < MAG_FILE_ECHO + MAG_FILE_LINE_MAX)
+        {
+            NewSize = Batch->TextSize * 2;
+            NewText = (char *) realloc(Batch->Text, NewSize);
+            if(NewText == NULL)
+                return FALSE;
+            Batch->Text = NewText;
+            Batch->TextSize = NewSize;
+        }
+        EchoStart = i ? Batch->EchoEnd[i - 1] : 0;
+        memcpy(Batch->Text + Batch->TextLength, Batch->Echo + EchoStart, Batch->EchoEnd[i] - EchoStart);
+        p = MAG_FileFormatLine(Batch->Text + Batch->TextLength + (Batch->EchoEnd[i] - EchoStart), &Batch->Elements[i],
+                Shared->Parameters->PrintErrors);
+        Batch->TextLength = (size_t) (p - Batch->Text);
+    }
+    return TRUE;
+} /*MAG_FileEvaluateBatch*/
+
+static int MAG_FileWriteBatch(MAGtype_FileShared *Shared, MAGtype_FileBatch *Batch)
+/* Writes the lines of a batch. At an invalid record, prints its messages and sets Shared->Stopped. */
+{
+    MAGtype_FileStatus *Status = Shared->Status;
+    int Flag;
+
+    Flag = fwrite(Batch->Text, 1, Batch->TextLength, Shared->Out) == Batch->TextLength;
+    Status->BozWarningStrong |= Batch->BozWarningStrong;
+    Status->BozWarningWeak |= Batch->BozWarningWeak;
+    Status->AltitudeWarning |= Batch->AltitudeWarning;
+    if(Batch->NumValid < Batch->NumRows)
+    {
+        fputs(Batch->Messages, Shared->MessageOut);
+        Status->NumLines = Batch->FirstLine + Batch->NumValid;
+        Status->ArgError = Batch->ArgError;
+        Status->RangeError = Batch->RangeError;
+        Status->AtEndOfFile = Batch->NumValid == Batch->NumRows - 1 && Batch->AtEnd;
+        Shared->Stopped = TRUE;
+    }
+    return Flag;
+} /*MAG_FileWriteBatch*/
+
+#ifndef MAG_NO_THREADS
+static void MAG_FileStop(MAGtype_FileShared *Shared, int Failed)
+/* Stops all stages. Called with the lock held. */
+{
+    Shared->Stopped = TRUE;
+    if(Failed)
+        Shared->Failed = TRUE;
+    pthread_cond_broadcast(&Shared->Filled);
+    pthread_cond_broadcast(&Shared->Evaluated);
+    pthread_cond_broadcast(&Shared->SlotFree);
+} /*MAG_FileStop*/
+
+static void *MAG_FileReaderThread(void *Argument)
+/* Fills the free slots in order until the input ends */
+{
+    MAGtype_FileShared *Shared = (MAGtype_FileShared *) Argument;
+    MAGtype_FileBatch *Batch;
+    double t0;
+    int More = TRUE, Flag;
+
+    while(More)
+    {
+        pthread_mutex_lock(&Shared->Lock);
+        while(!Shared->Stopped && Shared->NextFill >= Shared->NextWrite + Shared->NumSlots)
+            pthread_cond_wait(&Shared->SlotFree, &Shared->Lock);
+        if(Shared->Stopped)
+        {
+            pthread_mutex_unlock(&Shared->Lock);
+            break;
+        }
+        Batch = &Shared->Slots[Shared->NextFill % Shared->NumSlots];
+        pthread_mutex_unlock(&Shared->Lock);
+
+        t0 = MAG_FileSeconds();
+        Flag = MAG_FileFillBatch(Shared, Batch, &More);
+        Shared->Status->ReaderSeconds += MAG_FileSeconds() - t0;
+
+        pthread_mutex_lock(&Shared->Lock);
+        if(!Flag)
+            MAG_FileStop(Shared, TRUE);
+        else
+        {
+            if(Batch->NumRows > 0)
+            {
+                Batch->Done = 0;
+                Shared->NextFill++;
+            }
+            if(!More)
+                Shared->ReaderDone = TRUE;
+            pthread_cond_broadcast(&Shared->Filled);
+            if(!More)
+                pthread_cond_broadcast(&Shared->Evaluated);
+        }
+        pthread_mutex_unlock(&Shared->Lock);
+        More = More && Flag;
+    }
+    return NULL;
+} /*MAG_FileReaderThread*/
+
+static void *MAG_FileWorkerThread(void *Argument)
+/* Takes the filled slots in order, evaluates and formats them and marks them done */
+{
+    MAGtype_FileShared *Shared = (MAGtype_FileShared *) Argument;
+    MAGtype_FileBatch *Batch;
+    double t0, t;
+    int Flag;
+
+    pthread_mutex_lock(&Shared->Lock);
+    for(;;)
+    {
+        while(!Shared->Stopped && Shared->NextEvaluate >= Shared->NextFill && !Shared->ReaderDone)
+            pthread_cond_wait(&Shared->Filled, &Shared->Lock);
+        if(Shared->Stopped || Shared->NextEvaluate >= Shared->NextFill)
+            break;
+        Batch = &Shared->Slots[Shared->NextEvaluate++ % Shared->NumSlots];
+        pthread_mutex_unlock(&Shared->Lock);
+
+        t0 = MAG_FileSeconds();
+        Flag = MAG_FileEvaluateBatch(Shared, Batch);
+        t = MAG_FileSeconds() - t0;
+
+        pthread_mutex_lock(&Shared->Lock);
+        Shared->Status->WorkerSeconds += t;
+        Batch->Done = 1;
+        if(!Flag)
+            MAG_FileStop(Shared, TRUE);
+        pthread_cond_broadcast(&Shared->Evaluated);
+    }
+    pthread_mutex_unlock(&Shared->Lock);
+    return NULL;
+} /*MAG_FileWorkerThread*/
+#endif
+
+int MAG_FileDefaultThreads(void)
+/* Number of online processors, or 1 if it cannot be determined or threads are not available */
+{
+#if !defined(MAG_NO_THREADS) && defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if(n > MAG_FILE_MAX_THREADS)
+        return MAG_FILE_MAX_THREADS;
+    return n > 0 ? (int) n : 1;
+#else
+    return 1;
+#endif
+} /*MAG_FileDefaultThreads*/
+
+int MAG_FileStream(MAGtype_FileParameters *Parameters, MAGtype_MagneticModel *MagneticModel, MAGtype_Geoid *Geoid, MAGtype_Ellipsoid Ellip,
+        FILE *In, FILE *Out, FILE *MessageOut, MAGtype_FileStatus *Status)
+
+/* Processes a coordinate file as the 'f' option of wmm_file does and writes the same output lines (the
+caller writes the header line). With more than one thread, a reader thread cuts the records into batches,
+the worker threads evaluate and format the batches and the calling thread writes them in input order. At
+most MAG_FILE_WINDOW batches per worker are in flight, so the memory used does not depend on the file size.
+
+INPUT: Parameters  Date and height limits, uncertainty option, initial entries and thread count
+       MagneticModel  The model as read from the coefficient file (not time adjusted)
+       Geoid  Geoid used for heights above mean sea level (UseGeoid is set per row)
+       Ellip
+       In  Coordinate file
+       MessageOut  Stream for the messages of an invalid record
+OUTPUT: Out  One line per accepted row
+        Status  Line count, stop reason, warnings and the time spent in each stage
+        Returns FALSE if memory could not be allocated or the output could not be written
+CALLS : MAG_ConvertGeoidToEllipsoidHeight, MAG_GeomagBatch, MAG_WMMErrorCalc (MAG_WMMHRErrorCalc)
+ */
+{
+    MAGtype_FileShared Shared;
+    double Start, t0;
+    int i, k, NumThreads, More, Flag = TRUE;
+#ifndef MAG_NO_THREADS
+    pthread_t Reader, Threads[MAG_FILE_MAX_THREADS];
+    int NumStarted = 0, ReaderStarted = FALSE;
+#endif
+
+    Start = MAG_FileSeconds();
+    memset(Status, 0, sizeof (MAGtype_FileStatus));
+    memset(&Shared, 0, sizeof (MAGtype_FileShared));
+    Shared.Parameters = Parameters;
+    Shared.MagneticModel = MagneticModel;
+    Shared.Geoid = Geoid;
+    Shared.Ellip = Ellip;
+    Shared.Out = Out;
+    Shared.MessageOut = MessageOut;
+    Shared.Status = Status;
+
+    NumThreads = Parameters->NumThreads > 0 ? Parameters->NumThreads : MAG_FileDefaultThreads();
+    if(NumThreads > MAG_FILE_MAX_THREADS)
+        NumThreads = MAG_FILE_MAX_THREADS;
+#ifdef MAG_NO_THREADS
+    NumThreads = 1;
+#endif
+    Status->NumThreads = NumThreads;
+
+    Shared.Reader.In = In;
+    Shared.Reader.Buffer = (char *) malloc(MAG_FILE_CHUNK_SIZE + MAG_FILE_RECORD);
+    for(k = 1; k <= 5; k++)
+        if(Parameters->InitialArgs[k] != NULL)
+            strncpy(Shared.Reader.Args[k], Parameters->InitialArgs[k], MAG_FILE_TOKEN);
+    Shared.NumSlots = NumThreads == 1 ? 1 : NumThreads * MAG_FILE_WINDOW + 2;
+    Shared.Slots = (MAGtype_FileBatch *) calloc(Shared.NumSlots, sizeof (MAGtype_FileBatch));
+    if(Shared.Reader.Buffer == NULL || Shared.Slots == NULL)
+    {
+        Flag = FALSE;
+        goto cleanup;
+    }
+    for(i = 0; i < Shared.NumSlots; i++)
+        if(!MAG_FileAllocateBatch(&Shared.Slots[i]))
+        {
+            while(--i >= 0)
+                MAG_FileFreeBatch(&Shared.Slots[i]);
+            free(Shared.Slots);
+            Shared.Slots = NULL;
+            Flag = FALSE;
+            goto cleanup;
+        }
+
+    if(NumThreads == 1)
+    {
+        /* Serial path: read, evaluate and write each batch in turn */
+        do
+        {
+            t0 = MAG_FileSeconds();
+            Flag = MAG_FileFillBatch(&Shared, &Shared.Slots[0], &More);
+            Status->ReaderSeconds += MAG_FileSeconds() - t0;
+            if(!Flag || Shared.Slots[0].NumRows == 0)
+                break;
+            t0 = MAG_FileSeconds();
+            Flag = MAG_FileEvaluateBatch(&Shared, &Shared.Slots[0]);
+            Status->WorkerSeconds += MAG_FileSeconds() - t0;
+            t0 = MAG_FileSeconds();
+            Flag = Flag && MAG_FileWriteBatch(&Shared, &Shared.Slots[0]);
+            Status->WriterSeconds += MAG_FileSeconds() - t0;
+        } while(Flag && More && !Shared.Stopped);
+    }
+#ifndef MAG_NO_THREADS
+    else
+    {
+        MAGtype_FileBatch *Batch;
+
+        pthread_mutex_init(&Shared.Lock, NULL);
+        pthread_cond_init(&Shared.Filled, NULL);
+        pthread_cond_init(&Shared.Evaluated, NULL);
+        pthread_cond_init(&Shared.SlotFree, NULL);
+        ReaderStarted = pthread_create(&Reader, NULL, MAG_FileReaderThread, &Shared) == 0;
+        for(NumStarted = 0; ReaderStarted && NumStarted < NumThreads; NumStarted++)
+            if(pthread_create(&Threads[NumStarted], NULL, MAG_FileWorkerThread, &Shared) != 0)
+                break;
+
+        /* The calling thread is the writer: it waits for the batches in order */
+        pthread_mutex_lock(&Shared.Lock);
+        if(NumStarted == 0)
+            MAG_FileStop(&Shared, TRUE);
+        for(;;)
+        {
+            while(!Shared.Stopped && !(Shared.NextWrite < Shared.NextFill && Shared.Slots[Shared.NextWrite % Shared.NumSlots].Done) &&
+                    !(Shared.ReaderDone && Shared.NextWrite >= Shared.NextFill))
+                pthread_cond_wait(&Shared.Evaluated, &Shared.Lock);
+            if(Shared.Stopped || Shared.NextWrite >= Shared.NextFill)
+                break;
+            Batch = &Shared.Slots[Shared.NextWrite % Shared.NumSlots];
+            pthread_mutex_unlock(&Shared.Lock);
+            t0 = MAG_FileSeconds();
+            Flag = MAG_FileWriteBatch(&Shared, Batch);
+            Status->WriterSeconds += MAG_FileSeconds() - t0;
+            pthread_mutex_lock(&Shared.Lock);
+            if(!Flag || Shared.Stopped)
+                MAG_FileStop(&Shared, !Flag);
+            Batch->Done = 0;
+            Shared.NextWrite++;
+            pthread_cond_broadcast(&Shared.SlotFree);
+        }
+        pthread_mutex_unlock(&Shared.Lock);
+
+        if(ReaderStarted)
+            pthread_join(Reader, NULL);
+        for(i = 0; i < NumStarted; i++)
+            pthread_join(Threads[i], NULL);
+        pthread_mutex_destroy(&Shared.Lock);
+        pthread_cond_destroy(&Shared.Filled);
+        pthread_cond_destroy(&Shared.Evaluated);
+        pthread_cond_destroy(&Shared.SlotFree);
+        Flag = !Shared.Failed;
+    }
+#endif
+
+    if(Flag && !Shared.Stopped)
+    {
+        Status->NumLines = Shared.Reader.NumLines;
+        Status->AtEndOfFile = TRUE;
+    }
+
+cleanup:
+    if(Shared.Slots)
+    {
+        for(i = 0; i < Shared.NumSlots; i++)
+            MAG_FileFreeBatch(&Shared.Slots[i]);
+        free(Shared.Slots);
+    }
+    free(Shared.Reader.Buffer);
+    Status->Seconds = MAG_FileSeconds() - Start;
+    return Flag;
+} /*MAG_FileStream*/
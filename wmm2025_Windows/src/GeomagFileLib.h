@@ -0,0 +1,58 @@
+/*
+ * Streaming coordinate file processor used by the wmm_file program.
+ *
+ * MAG_FileStream reads a coordinate file in large chunks, parses the records with a hand written
+ * scanner instead of sscanf and atof, evaluates the rows in batches with MAG_GeomagBatch and formats
+ * the output lines into a large buffer with a fixed point formatter. The bytes written are the same
+ * as those of the line by line loop of wmm_file, including its handling of short, blank and invalid
+ * records. With more than one thread the file is processed by a reader thread, a pool of evaluation
+ * threads and the calling thread as the writer, connected by a bounded ring of batches.
+ * Define MAG_NO_THREADS to build without POSIX threads (the file is then processed serially).
+ */
+
+#ifndef GEOMAGFILELIB_H
+#define GEOMAGFILELIB_H
+
+#include <stdio.h>
+
+#define MAG_FILE_CHUNK_SIZE (1 << 20) /* Bytes read from the coordinate file at a time */
+#define MAG_FILE_BATCH 4096 /* Rows evaluated, formatted and written together */
+#define MAG_FILE_MAX_THREADS 256 /* Upper limit of MAGtype_FileParameters.NumThreads */
+
+typedef struct {
+    int PrintErrors; /* 1 - Append the uncertainties to every line */
+    double MinYear; /* Dates outside [MinYear, MaxYear) are rejected */
+    double MaxYear;
+    double MinHeight; /* Heights above the geoid outside [MinHeight, MaxHeight] set AltitudeWarning */
+    double MaxHeight;
+    const char *InitialArgs[6]; /* Entries 1 to 5 before the first record, NULL for empty (wmm_file starts with its command line) */
+    int NumThreads; /* Number of evaluation threads, 0 to use one per online processor, 1 for the serial loop */
+} MAGtype_FileParameters;
+
+typedef struct {
+    long NumLines; /* Records read, including a rejected one */
+    int ArgError; /* Processing stopped at a record with an invalid entry */
+    int RangeError; /* Processing stopped at a record with a date range (wmm_file exits with status 2) */
+    int AtEndOfFile; /* The last record read ran into the end of the file, as feof after fgets */
+    int BozWarningStrong; /* Some locations have H <= 2000 nT */
+    int BozWarningWeak; /* Some locations have 2000 < H <= 6000 nT */
+    int AltitudeWarning; /* Some heights were outside [MinHeight, MaxHeight] */
+    int NumThreads; /* Number of evaluation threads used */
+    double Seconds; /* Elapsed time */
+    double ReaderSeconds; /* Time spent reading and parsing records */
+    double WorkerSeconds; /* Time spent evaluating and formatting rows, summed over the evaluation threads */
+    double WriterSeconds; /* Time spent writing */
+} MAGtype_FileStatus;
+
+int MAG_FileStream(MAGtype_FileParameters *Parameters,
+        MAGtype_MagneticModel *MagneticModel,
+        MAGtype_Geoid *Geoid,
+        MAGtype_Ellipsoid Ellip,
+        FILE *In,
+        FILE *Out,
+        FILE *MessageOut,
+        MAGtype_FileStatus *Status);
+
+int MAG_FileDefaultThreads(void);
+
+#endif /*GEOMAGFILELIB_H*/
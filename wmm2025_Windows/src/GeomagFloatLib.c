@@ -0,0 +1,239 @@
+#include <string.h>
+#include <math.h>
+#include "GeomagFloatLib.h"
+
+/*
+ * Single precision point evaluation, see GeomagFloatLib.h.
+ *
+ * Each step follows the double precision function named in its comment, with the same recursions and
+ * the same order of the terms. Every constant carries the f suffix, so that no expression is promoted
+ * to double.
+ */
+
+#define MAG_FLOAT_DEG2RAD 0.0174532925199432958f
+#define MAG_FLOAT_RAD2DEG 57.2957795130823209f
+
+int MAG_FloatModelInit(MAGtype_FloatModel *Model, int nMax, int nMaxSecVar, double epoch,
+        const double *Main_Field_Coeff_G, const double *Main_Field_Coeff_H,
+        const double *Secular_Var_Coeff_G, const double *Secular_Var_Coeff_H,
+        double a, double epssq, double re)
+
+/* Converts a model to single precision. The coefficient arrays are indexed as in MAGtype_MagneticModel,
+a model read with MAG_robustReadMagModels or MAG_GetEmbeddedModel can be passed as it is. The
+normalization factors and recursion constants are computed in double before they are rounded.
+
+INPUT: nMax, nMaxSecVar  Degrees of the main field and of the secular variation
+       epoch  Base time of the model (decimal years)
+       Main_Field_Coeff_G, Main_Field_Coeff_H, Secular_Var_Coeff_G, Secular_Var_Coeff_H
+       a, epssq, re  Ellipsoid (MAGtype_Ellipsoid)
+OUTPUT: Model
+        Returns FALSE if nMax is not in 1..MAG_FLOAT_NMAX or nMaxSecVar exceeds nMax
+ */
+{
+    double Norm[MAG_FLOAT_NUMTERMS];
+    int n, m, index, SecVarTerms;
+
+    if(nMax < 1 || nMax > MAG_FLOAT_NMAX || nMaxSecVar < 0 || nMaxSecVar > nMax)
+        return FALSE;
+    memset(Model, 0, sizeof (MAGtype_FloatModel));
+    Model->nMax = nMax;
+    Model->nMaxSecVar = nMaxSecVar;
+    Model->epoch = (float) epoch;
+    Model->a = (float) a;
+    Model->epssq = (float) epssq;
+    Model->re = (float) re;
+    SecVarTerms = nMaxSecVar * (nMaxSecVar + 1) / 2 + nMaxSecVar;
+    for(index = 1; index <= nMax * (nMax + 1) / 2 + nMax; index++)
+    {
+        Model->Main_Field_Coeff_G[index] = (float) Main_Field_Coeff_G[index];
+        Model->Main_Field_Coeff_H[index] = (float) Main_Field_Coeff_H[index];
+        if(index <= SecVarTerms)
+        {
+            Model->Secular_Var_Coeff_G[index] = (float) Secular_Var_Coeff_G[index];
+            Model->Secular_Var_Coeff_H[index] = (float) Secular_Var_Coeff_H[index];
+        }
+    }
+
+    /* The schmidtQuasiNorm of MAG_PcupLow */
+    Norm[0] = 1.0;
+    Model->schmidtQuasiNorm[0] = 1.0f;
+    for(n = 1; n <= nMax; n++)
+    {
+        index = (n * (n + 1) / 2);
+        Norm[index] = Norm[(n - 1) * n / 2] * (double) (2 * n - 1) / (double) n;
+        Model->schmidtQuasiNorm[index] = (float) Norm[index];
+        for(m = 1; m <= n; m++)
+        {
+            index = (n * (n + 1) / 2 + m);
+            Norm[index] = Norm[index - 1] * sqrt((double) ((n - m + 1) * (m == 1 ? 2 : 1)) / (double) (n + m));
+            Model->schmidtQuasiNorm[index] = (float) Norm[index];
+        }
+        for(m = 0; m < n && n > 1; m++)
+            Model->RecursionK[n * (n + 1) / 2 + m] = (float) ((double) (((n - 1) * (n - 1)) - (m * m)) / (double) ((2 * n - 1) * (2 * n - 3)));
+    }
+    return TRUE;
+} /*MAG_FloatModelInit*/
+
+int MAG_GeomagFloat(const MAGtype_FloatModel *Model, float DecimalYear, float Latitude, float Longitude, float HeightAboveEllipsoid,
+        MAGtype_FloatElements *Elements)
+
+/* Evaluates the model at one point in single precision: MAG_TimelyModifyMagneticModel, MAG_GeodeticToSpherical
+and MAG_Geomag in one function. All scratch memory is on the stack.
+
+INPUT: Model  Converted with MAG_FloatModelInit
+       DecimalYear
+       Latitude  Geodetic latitude (deg)
+       Longitude  (deg)
+       HeightAboveEllipsoid  Height above the WGS-84 ellipsoid (km)
+OUTPUT: Elements
+        Returns FALSE if the model was not initialized
+ */
+{
+    float Pcup[MAG_FLOAT_NUMTERMS], dPcup[MAG_FLOAT_NUMTERMS], PcupS[MAG_FLOAT_NMAX + 1];
+    float RelativeRadiusPower[MAG_FLOAT_NMAX + 1], cos_mlambda[MAG_FLOAT_NMAX + 1], sin_mlambda[MAG_FLOAT_NMAX + 1];
+    float dt, CosLat, SinLat, rc, xp, zp, r, x, z, ratio, cos_psi, sin_psi;
+    float G, H, SvG, SvH, Bx, By, Bz, SvBx, SvBy, SvBz;
+    int n, m, index, index1, index2, nMax = Model->nMax;
+
+    if(nMax < 1 || nMax > MAG_FLOAT_NMAX)
+        return FALSE;
+    dt = DecimalYear - Model->epoch;
+
+    /* MAG_GeodeticToSpherical. The sine and cosine of the geocentric latitude are kept instead of the angle. */
+    if(Latitude >= 90.0f || Latitude <= -90.0f)
+    {
+        CosLat = 0.0f; /* cosf of the rounded pi/2 is not zero */
+        SinLat = Latitude > 0.0f ? 1.0f : -1.0f;
+    } else
+    {
+        CosLat = cosf(Latitude * MAG_FLOAT_DEG2RAD);
+        SinLat = sinf(Latitude * MAG_FLOAT_DEG2RAD);
+    }
+    rc = Model->a / sqrtf(1.0f - Model->epssq * SinLat * SinLat);
+    xp = (rc + HeightAboveEllipsoid) * CosLat;
+    zp = (rc * (1.0f - Model->epssq) + HeightAboveEllipsoid) * SinLat;
+    r = sqrtf(xp * xp + zp * zp);
+    x = zp / r; /* sin(phig) */
+    z = xp / r; /* cos(phig) */
+
+    /* MAG_ComputeSphericalHarmonicVariables */
+    ratio = Model->re / r;
+    RelativeRadiusPower[0] = ratio * ratio;
+    for(n = 1; n <= nMax; n++)
+        RelativeRadiusPower[n] = RelativeRadiusPower[n - 1] * ratio;
+    cos_mlambda[0] = 1.0f;
+    sin_mlambda[0] = 0.0f;
+    cos_mlambda[1] = cosf(Longitude * MAG_FLOAT_DEG2RAD);
+    sin_mlambda[1] = sinf(Longitude * MAG_FLOAT_DEG2RAD);
+    for(m = 2; m <= nMax; m++)
+    {
+        cos_mlambda[m] = cos_mlambda[m - 1] * cos_mlambda[1] - sin_mlambda[m - 1] * sin_mlambda[1];
+        sin_mlambda[m] = cos_mlambda[m - 1] * sin_mlambda[1] + sin_mlambda[m - 1] * cos_mlambda[1];
+    }
+
+    /* MAG_PcupLow: the Gauss-normalized functions, then the Schmidt quasi-normalization with the sign of
+       the derivative changed to the latitude */
+    Pcup[0] = 1.0f;
+    dPcup[0] = 0.0f;
+    for(n = 1; n <= nMax; n++)
+    {
+        for(m = 0; m <= n; m++)
+        {
+            index = (n * (n + 1) / 2 + m);
+            if(n == m)
+            {
+                index1 = (n - 1) * n / 2 + m - 1;
+                Pcup[index] = z * Pcup[index1];
+                dPcup[index] = z * dPcup[index1] + x * Pcup[index1];
+            } else if(n == 1 && m == 0)
+            {
+                Pcup[index] = x * Pcup[0];
+                dPcup[index] = x * dPcup[0] - z * Pcup[0];
+            } else
+            {
+                index1 = (n - 2) * (n - 1) / 2 + m;
+                index2 = (n - 1) * n / 2 + m;
+                if(m > n - 2)
+                {
+                    Pcup[index] = x * Pcup[index2];
+                    dPcup[index] = x * dPcup[index2] - z * Pcup[index2];
+                } else
+                {
+                    Pcup[index] = x * Pcup[index2] - Model->RecursionK[index] * Pcup[index1];
+                    dPcup[index] = x * dPcup[index2] - z * Pcup[index2] - Model->RecursionK[index] * dPcup[index1];
+                }
+            }
+        }
+    }
+    for(index = 1; index <= nMax * (nMax + 1) / 2 + nMax; index++)
+    {
+        Pcup[index] = Pcup[index] * Model->schmidtQuasiNorm[index];
+        dPcup[index] = -dPcup[index] * Model->schmidtQuasiNorm[index];
+    }
+
+    /* MAG_TimelyModifyMagneticModel, MAG_Summation and MAG_SecVarSummation in one pass */
+    Bx = By = Bz = 0.0f;
+    SvBx = SvBy = SvBz = 0.0f;
+    for(n = 1; n <= nMax; n++)
+    {
+        for(m = 0; m <= n; m++)
+        {
+            index = (n * (n + 1) / 2 + m);
+            SvG = Model->Secular_Var_Coeff_G[index];
+            SvH = Model->Secular_Var_Coeff_H[index];
+            G = Model->Main_Field_Coeff_G[index] + dt * SvG;
+            H = Model->Main_Field_Coeff_H[index] + dt * SvH;
+            Bz -= RelativeRadiusPower[n] * (G * cos_mlambda[m] + H * sin_mlambda[m]) * (float) (n + 1) * Pcup[index];
+            By += RelativeRadiusPower[n] * (G * sin_mlambda[m] - H * cos_mlambda[m]) * (float) (m) * Pcup[index];
+            Bx -= RelativeRadiusPower[n] * (G * cos_mlambda[m] + H * sin_mlambda[m]) * dPcup[index];
+            SvBz -= RelativeRadiusPower[n] * (SvG * cos_mlambda[m] + SvH * sin_mlambda[m]) * (float) (n + 1) * Pcup[index];
+            SvBy += RelativeRadiusPower[n] * (SvG * sin_mlambda[m] - SvH * cos_mlambda[m]) * (float) (m) * Pcup[index];
+            SvBx -= RelativeRadiusPower[n] * (SvG * cos_mlambda[m] + SvH * sin_mlambda[m]) * dPcup[index];
+        }
+    }
+    if(z > 1.0e-10f)
+    {
+        By = By / z;
+        SvBy = SvBy / z;
+    } else
+    {
+        /* MAG_SummationSpecial and MAG_SecVarSummationSpecial: By at the geographic poles */
+        By = SvBy = 0.0f;
+        PcupS[0] = 1.0f;
+        for(n = 1; n <= nMax; n++)
+        {
+            index = (n * (n + 1) / 2 + 1);
+            if(n == 1)
+                PcupS[n] = PcupS[n - 1];
+            else
+                PcupS[n] = x * PcupS[n - 1] - Model->RecursionK[index] * PcupS[n - 2];
+            SvG = Model->Secular_Var_Coeff_G[index];
+            SvH = Model->Secular_Var_Coeff_H[index];
+            G = Model->Main_Field_Coeff_G[index] + dt * SvG;
+            H = Model->Main_Field_Coeff_H[index] + dt * SvH;
+            By += RelativeRadiusPower[n] * (G * sin_mlambda[1] - H * cos_mlambda[1]) * PcupS[n] * Model->schmidtQuasiNorm[index];
+            SvBy += RelativeRadiusPower[n] * (SvG * sin_mlambda[1] - SvH * cos_mlambda[1]) * PcupS[n] * Model->schmidtQuasiNorm[index];
+        }
+    }
+
+    /* MAG_RotateMagneticVector, with sin and cos of Psi = phig - phi from the angle difference formulas */
+    sin_psi = x * CosLat - z * SinLat;
+    cos_psi = z * CosLat + x * SinLat;
+    Elements->X = Bx * cos_psi - Bz * sin_psi;
+    Elements->Y = By;
+    Elements->Z = Bx * sin_psi + Bz * cos_psi;
+    Elements->Xdot = SvBx * cos_psi - SvBz * sin_psi;
+    Elements->Ydot = SvBy;
+    Elements->Zdot = SvBx * sin_psi + SvBz * cos_psi;
+
+    /* MAG_CalculateGeoMagneticElements and MAG_CalculateSecularVariationElements */
+    Elements->H = sqrtf(Elements->X * Elements->X + Elements->Y * Elements->Y);
+    Elements->F = sqrtf(Elements->H * Elements->H + Elements->Z * Elements->Z);
+    Elements->Decl = MAG_FLOAT_RAD2DEG * atan2f(Elements->Y, Elements->X);
+    Elements->Incl = MAG_FLOAT_RAD2DEG * atan2f(Elements->Z, Elements->H);
+    Elements->Hdot = (Elements->X * Elements->Xdot + Elements->Y * Elements->Ydot) / Elements->H;
+    Elements->Fdot = (Elements->X * Elements->Xdot + Elements->Y * Elements->Ydot + Elements->Z * Elements->Zdot) / Elements->F;
+    Elements->Decldot = MAG_FLOAT_RAD2DEG * (Elements->X * Elements->Ydot - Elements->Y * Elements->Xdot) / (Elements->H * Elements->H);
+    Elements->Incldot = MAG_FLOAT_RAD2DEG * (Elements->H * Elements->Zdot - Elements->Z * Elements->Hdot) / (Elements->F * Elements->F);
+    return TRUE;
+} /*MAG_GeomagFloat*/
@@ -0,0 +1,73 @@
+/*
+ * Single precision point evaluation.
+ *
+ * MAG_GeomagFloat evaluates a model of degree MAG_FLOAT_NMAX (12, the WMM) or less at one point with
+ * float arithmetic only: float variables, float constants and the float functions of the C library
+ * (sinf, cosf, sqrtf, atan2f). It is meant for targets whose FPU handles single precision only, where
+ * every double operation of MAG_Geomag is emulated in software. The time adjustment, the geodetic to
+ * spherical conversion, the Legendre functions, the summations and the rotation to geodetic components
+ * all run in single precision. The geocentric latitude is never computed as an angle: its sine and
+ * cosine come straight from the spherical coordinates. Like GeomagTileLib, this file and
+ * GeomagFloatLib.c only depend on the C library.
+ *
+ * The model is converted once with MAG_FloatModelInit, which also stores the Schmidt normalization factors
+ * and the recursion constants of the Legendre functions, so no division or square root of these is left
+ * per point. The wmm_float_audit program compares the results with the double precision path over the
+ * globe and the date range of a model.
+ */
+
+#ifndef GEOMAGFLOATLIB_H
+#define GEOMAGFLOATLIB_H
+
+#ifndef TRUE
+#define TRUE            ((int)1)
+#endif
+
+#ifndef FALSE
+#define FALSE           ((int)0)
+#endif
+
+#define MAG_FLOAT_NMAX 12 /* Largest degree evaluated by MAG_GeomagFloat */
+#define MAG_FLOAT_NUMTERMS ((MAG_FLOAT_NMAX + 1) * (MAG_FLOAT_NMAX + 2) / 2)
+
+typedef struct {
+    int nMax;
+    int nMaxSecVar;
+    float epoch; /* Base time of the model (decimal years) */
+    float Main_Field_Coeff_G[MAG_FLOAT_NUMTERMS]; /* Same index as MAGtype_MagneticModel: n(n+1)/2 + m */
+    float Main_Field_Coeff_H[MAG_FLOAT_NUMTERMS];
+    float Secular_Var_Coeff_G[MAG_FLOAT_NUMTERMS]; /* Zero above nMaxSecVar */
+    float Secular_Var_Coeff_H[MAG_FLOAT_NUMTERMS];
+    float schmidtQuasiNorm[MAG_FLOAT_NUMTERMS]; /* Gauss to Schmidt quasi-normalization, as in MAG_PcupLow */
+    float RecursionK[MAG_FLOAT_NUMTERMS]; /* ((n-1)^2 - m^2) / ((2n-1)(2n-3)), the k of the MAG_PcupLow recursion */
+    float a; /* Semi-major axis of the ellipsoid (km) */
+    float epssq; /* First eccentricity squared */
+    float re; /* Mean radius of the ellipsoid, reference radius of the model (km) */
+} MAGtype_FloatModel;
+
+typedef struct {
+    float Decl; /* Angle between the magnetic field vector and true north, positive east (deg) */
+    float Incl; /* Angle between the magnetic field vector and the horizontal plane, positive down (deg) */
+    float F; /* Magnetic field strength (nT) */
+    float H; /* Horizontal magnetic field strength (nT) */
+    float X; /* Northern component (nT) */
+    float Y; /* Eastern component (nT) */
+    float Z; /* Downward component (nT) */
+    float Decldot; /* Yearly rates of change of the elements above */
+    float Incldot;
+    float Fdot;
+    float Hdot;
+    float Xdot;
+    float Ydot;
+    float Zdot;
+} MAGtype_FloatElements;
+
+int MAG_FloatModelInit(MAGtype_FloatModel *Model, int nMax, int nMaxSecVar, double epoch,
+        const double *Main_Field_Coeff_G, const double *Main_Field_Coeff_H,
+        const double *Secular_Var_Coeff_G, const double *Secular_Var_Coeff_H,
+        double a, double epssq, double re);
+
+int MAG_GeomagFloat(const MAGtype_FloatModel *Model, float DecimalYear, float Latitude, float Longitude, float HeightAboveEllipsoid,
+        MAGtype_FloatElements *Elements);
+
+#endif /*GEOMAGFLOATLIB_H*/
@@ -0,0 +1,422 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "GeomagGeoidLib.h"
+
+/*
+ * Compressed, lazily paged EGM96 geoid store, see GeomagGeoidLib.h for the file layout.
+ *
+ * The header, index and tiles are read byte by byte, so a store can be used on hosts of either byte
+ * order. A store and its cache are not thread safe: give every thread its own MAGtype_GeoidStore
+ * (they may share the read function and the underlying file or partition if it can be read
+ * concurrently).
+ */
+
+static void MAG_GeoidPutU16(unsigned char *p, unsigned int v)
+{
+    p[0] = (unsigned char) (v & 0xFF);
+    p[1] = (unsigned char) ((v >> 8) & 0xFF);
+}
+
+static void MAG_GeoidPutU32(unsigned char *p, uint32_t v)
+{
+    p[0] = (unsigned char) (v & 0xFF);
+    p[1] = (unsigned char) ((v >> 8) & 0xFF);
+    p[2] = (unsigned char) ((v >> 16) & 0xFF);
+    p[3] = (unsigned char) ((v >> 24) & 0xFF);
+}
+
+static unsigned int MAG_GeoidGetU16(const unsigned char *p)
+{
+    return (unsigned int) p[0] | ((unsigned int) p[1] << 8);
+}
+
+static uint32_t MAG_GeoidGetU32(const unsigned char *p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint32_t MAG_GeoidChecksum(const unsigned char *p, size_t n)
+/* 32 bit FNV-1a */
+{
+    uint32_t h = 2166136261u;
+
+    while(n--)
+    {
+        h ^= *p++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int MAG_GeoidNumTiles(int NumPosts, int TileSize)
+/* Tiles along one axis, neighbouring tiles share their edge posts */
+{
+    return (NumPosts - 2) / TileSize + 1;
+}
+
+static int MAG_GeoidTileExtent(int NumPosts, int TileSize, int t)
+/* Posts of tile t along one axis */
+{
+    int Last = (t + 1) * TileSize;
+
+    if(Last > NumPosts - 1)
+        Last = NumPosts - 1;
+    return Last - t * TileSize + 1;
+}
+
+static long MAG_GeoidPredict(const int16_t *Row, const int16_t *RowAbove, int j)
+/* Prediction of post j of a tile row from the posts already decoded */
+{
+    if(j == 0)
+        return RowAbove != NULL ? (long) RowAbove[0] : 0;
+    if(j == 1)
+        return (long) Row[0];
+    return 2 * (long) Row[j - 1] - (long) Row[j - 2];
+}
+
+size_t MAG_GeoidStoreBound(int NumRows, int NumCols, int TileSize)
+/* Largest possible size in bytes of a store, the buffer size for MAG_GeoidStoreEncode */
+{
+    size_t NumTiles;
+
+    if(NumRows < 2 || NumCols < 2 || TileSize < 1)
+        return 0;
+    NumTiles = (size_t) MAG_GeoidNumTiles(NumRows, TileSize) * (size_t) MAG_GeoidNumTiles(NumCols, TileSize);
+    /* A zigzag residual is below 2^19, three varint bytes */
+    return MAG_GEOID_HEADER_SIZE + NumTiles * (MAG_GEOID_INDEX_ENTRY_SIZE + 3 * (size_t) (TileSize + 1) * (TileSize + 1));
+} /*MAG_GeoidStoreBound*/
+
+size_t MAG_GeoidStoreEncode(const float *Heights, int NumRows, int NumCols, int TileSize, unsigned char *Buffer, size_t BufferSize)
+
+/* Quantizes a geoid height grid to centimetres and writes the compressed store to Buffer.
+
+INPUT: Heights  NumRows * NumCols geoid heights in meters, row major, the first row at 90 N and the
+                first column at 0 E (GeoidHeightBuffer of EGM9615.h)
+       NumRows, NumCols  Grid size in posts (721, 1441 for EGM96 at 15 minutes)
+       TileSize  Cells per tile edge (MAG_GEOID_DEFAULT_TILE_SIZE)
+       BufferSize  At least MAG_GeoidStoreBound(NumRows, NumCols, TileSize)
+OUTPUT: Buffer  The store
+        Returns the size of the store in bytes, 0 if the dimensions are out of range, the buffer is too
+        small or a height does not fit in 16 bits
+ */
+{
+    unsigned char *p, *TileStart;
+    int16_t *Posts;
+    int NumTileRows, NumTileCols, tr, tc, i, j, Height, Width, NumTiles;
+    size_t MaxTileBytes = 0;
+    long q, Residual;
+    uint32_t u;
+
+    if(NumRows < 2 || NumCols < 2 || TileSize < 1 || NumRows > 65535 || NumCols > 65535 || TileSize > 65535)
+        return 0;
+    if(BufferSize < MAG_GeoidStoreBound(NumRows, NumCols, TileSize))
+        return 0;
+    NumTileRows = MAG_GeoidNumTiles(NumRows, TileSize);
+    NumTileCols = MAG_GeoidNumTiles(NumCols, TileSize);
+    NumTiles = NumTileRows * NumTileCols;
+    Posts = (int16_t *) malloc((size_t) (TileSize + 1) * (TileSize + 1) * sizeof (int16_t));
+    if(Posts == NULL)
+        return 0;
+
+    p = Buffer + MAG_GEOID_HEADER_SIZE + (size_t) NumTiles * MAG_GEOID_INDEX_ENTRY_SIZE;
+    for(tr = 0; tr < NumTileRows; tr++)
+        for(tc = 0; tc < NumTileCols; tc++)
+        {
+            unsigned char *Entry = Buffer + MAG_GEOID_HEADER_SIZE + (size_t) (tr * NumTileCols + tc) * MAG_GEOID_INDEX_ENTRY_SIZE;
+
+            Height = MAG_GeoidTileExtent(NumRows, TileSize, tr);
+            Width = MAG_GeoidTileExtent(NumCols, TileSize, tc);
+            TileStart = p;
+            for(i = 0; i < Height; i++)
+            {
+                int16_t *Row = Posts + i * Width;
+
+                for(j = 0; j < Width; j++)
+                {
+                    q = lround((double) Heights[(size_t) (tr * TileSize + i) * NumCols + tc * TileSize + j] * MAG_GEOID_COUNTS_PER_METER);
+                    if(q < -32768 || q > 32767)
+                    {
+                        free(Posts);
+                        return 0;
+                    }
+                    Row[j] = (int16_t) q;
+                    Residual = q - MAG_GeoidPredict(Row, i > 0 ? Row - Width : NULL, j);
+                    u = Residual >= 0 ? (uint32_t) (2 * Residual) : (uint32_t) (-2 * Residual - 1);
+                    while(u >= 0x80)
+                    {
+                        *p++ = (unsigned char) (u | 0x80);
+                        u >>= 7;
+                    }
+                    *p++ = (unsigned char) u;
+                }
+            }
+            MAG_GeoidPutU32(Entry, (uint32_t) (TileStart - Buffer));
+            MAG_GeoidPutU32(Entry + 4, (uint32_t) (p - TileStart));
+            MAG_GeoidPutU32(Entry + 8, MAG_GeoidChecksum(TileStart, (size_t) (p - TileStart)));
+            if((size_t) (p - TileStart) > MaxTileBytes)
+                MaxTileBytes = (size_t) (p - TileStart);
+        }
+    free(Posts);
+
+    memcpy(Buffer, "WMMG", 4);
+    MAG_GeoidPutU16(Buffer + 4, MAG_GEOID_VERSION);
+    MAG_GeoidPutU16(Buffer + 6, MAG_GEOID_HEADER_SIZE);
+    MAG_GeoidPutU16(Buffer + 8, (unsigned int) NumRows);
+    MAG_GeoidPutU16(Buffer + 10, (unsigned int) NumCols);
+    MAG_GeoidPutU16(Buffer + 12, (unsigned int) TileSize);
+    MAG_GeoidPutU16(Buffer + 14, MAG_GEOID_COUNTS_PER_METER);
+    MAG_GeoidPutU32(Buffer + 16, (uint32_t) MaxTileBytes);
+    MAG_GeoidPutU32(Buffer + 20, MAG_GeoidChecksum(Buffer + MAG_GEOID_HEADER_SIZE, (size_t) NumTiles * MAG_GEOID_INDEX_ENTRY_SIZE));
+    MAG_GeoidPutU32(Buffer + 24, 0);
+    MAG_GeoidPutU32(Buffer + 28, 0);
+    return (size_t) (p - Buffer);
+} /*MAG_GeoidStoreEncode*/
+
+int MAG_GeoidStoreOpen(MAGtype_GeoidStore *Store, MAGtype_GeoidRead Read, void *ReadData, int NumSlots)
+
+/* Reads the header and the tile index of a store and allocates its tile cache. No tile is read yet.
+
+INPUT: Read, ReadData  Read function of the store (MAG_GeoidReadFile with a FILE *, MAG_GeoidReadMemory
+                       with a MAGtype_GeoidMemory *, or a function reading a flash partition)
+       NumSlots  Number of decoded tiles kept (MAG_GEOID_DEFAULT_SLOTS), at least 1
+OUTPUT: Store  Ready for MAG_GeoidStorePosts; free it with MAG_GeoidStoreClose
+        Returns FALSE if the store cannot be read, the magic, version or index checksum do not match,
+        or memory cannot be allocated
+ */
+{
+    unsigned char Header[MAG_GEOID_HEADER_SIZE], *IndexBytes;
+    size_t NumTiles, k;
+    int i;
+
+    memset(Store, 0, sizeof (MAGtype_GeoidStore));
+    if(NumSlots < 1 || !Read(ReadData, 0, Header, MAG_GEOID_HEADER_SIZE) || memcmp(Header, "WMMG", 4) != 0)
+        return FALSE;
+    if(MAG_GeoidGetU16(Header + 4) != MAG_GEOID_VERSION || MAG_GeoidGetU16(Header + 6) != MAG_GEOID_HEADER_SIZE)
+        return FALSE;
+    Store->NumRows = (int) MAG_GeoidGetU16(Header + 8);
+    Store->NumCols = (int) MAG_GeoidGetU16(Header + 10);
+    Store->TileSize = (int) MAG_GeoidGetU16(Header + 12);
+    Store->CountsPerMeter = (int) MAG_GeoidGetU16(Header + 14);
+    Store->MaxTileBytes = (unsigned long) MAG_GeoidGetU32(Header + 16);
+    if(Store->NumRows < 2 || Store->NumCols < 2 || Store->TileSize < 1 || Store->CountsPerMeter < 1 || Store->MaxTileBytes < 1)
+        return FALSE;
+    Store->NumTileRows = MAG_GeoidNumTiles(Store->NumRows, Store->TileSize);
+    Store->NumTileCols = MAG_GeoidNumTiles(Store->NumCols, Store->TileSize);
+    Store->Read = Read;
+    Store->ReadData = ReadData;
+    NumTiles = (size_t) Store->NumTileRows * Store->NumTileCols;
+
+    IndexBytes = (unsigned char *) malloc(NumTiles * MAG_GEOID_INDEX_ENTRY_SIZE);
+    Store->Index = (uint32_t *) malloc(3 * NumTiles * sizeof (uint32_t));
+    Store->ReadBuffer = (unsigned char *) malloc(Store->MaxTileBytes);
+    Store->Slots = (MAGtype_GeoidSlot *) calloc((size_t) NumSlots, sizeof (MAGtype_GeoidSlot));
+    if(IndexBytes == NULL || Store->Index == NULL || Store->ReadBuffer == NULL || Store->Slots == NULL)
+    {
+        free(IndexBytes);
+        MAG_GeoidStoreClose(Store);
+        return FALSE;
+    }
+    Store->NumSlots = NumSlots;
+    for(i = 0; i < NumSlots; i++)
+    {
+        Store->Slots[i].Tile = -1;
+        Store->Slots[i].Posts = (int16_t *) malloc((size_t) (Store->TileSize + 1) * (Store->TileSize + 1) * sizeof (int16_t));
+        if(Store->Slots[i].Posts == NULL)
+        {
+            free(IndexBytes);
+            MAG_GeoidStoreClose(Store);
+            return FALSE;
+        }
+    }
+    if(!Read(ReadData, MAG_GEOID_HEADER_SIZE, IndexBytes, NumTiles * MAG_GEOID_INDEX_ENTRY_SIZE) ||
+            MAG_GeoidChecksum(IndexBytes, NumTiles * MAG_GEOID_INDEX_ENTRY_SIZE) != MAG_GeoidGetU32(Header + 20))
+    {
+        free(IndexBytes);
+        MAG_GeoidStoreClose(Store);
+        return FALSE;
+    }
+    for(k = 0; k < 3 * NumTiles; k++)
+        Store->Index[k] = MAG_GeoidGetU32(IndexBytes + 4 * k);
+    free(IndexBytes);
+    return TRUE;
+} /*MAG_GeoidStoreOpen*/
+
+void MAG_GeoidStoreClose(MAGtype_GeoidStore *Store)
+/* Frees the memory of a store opened with MAG_GeoidStoreOpen. The read function is not called. */
+{
+    int i;
+
+    if(Store->Slots != NULL)
+        for(i = 0; i < Store->NumSlots; i++)
+            free(Store->Slots[i].Posts);
+    free(Store->Slots);
+    free(Store->ReadBuffer);
+    free(Store->Index);
+    Store->Slots = NULL;
+    Store->ReadBuffer = NULL;
+    Store->Index = NULL;
+    Store->NumSlots = 0;
+} /*MAG_GeoidStoreClose*/
+
+static int MAG_GeoidStoreDecodeTile(MAGtype_GeoidStore *Store, int Tile, int16_t *Posts)
+/* Reads, checks and decodes a tile into Posts, (TileSize + 1) posts per row */
+{
+    const unsigned char *p, *End;
+    uint32_t Offset = Store->Index[3 * Tile], Size = Store->Index[3 * Tile + 1], u;
+    int16_t *Row;
+    long q;
+    int Height, Width, Stride = Store->TileSize + 1, i, j, Shift;
+
+    if(Size > Store->MaxTileBytes || !Store->Read(Store->ReadData, (unsigned long) Offset, Store->ReadBuffer, (size_t) Size))
+        return FALSE;
+    if(MAG_GeoidChecksum(Store->ReadBuffer, (size_t) Size) != Store->Index[3 * Tile + 2])
+        return FALSE;
+    Height = MAG_GeoidTileExtent(Store->NumRows, Store->TileSize, Tile / Store->NumTileCols);
+    Width = MAG_GeoidTileExtent(Store->NumCols, Store->TileSize, Tile % Store->NumTileCols);
+    p = Store->ReadBuffer;
+    End = p + Size;
+    for(i = 0; i < Height; i++)
+    {
+        Row = Posts + i * Stride;
+        for(j = 0; j < Width; j++)
+        {
+            u = 0;
+            Shift = 0;
+            do
+            {
+                if(p == End || Shift > 21)
+                    return FALSE;
+                u |= (uint32_t) (*p & 0x7F) << Shift;
+                Shift += 7;
+            } while(*p++ & 0x80);
+            q = MAG_GeoidPredict(Row, i > 0 ? Row - Stride : NULL, j) + ((u & 1) ? -(long) (u >> 1) - 1 : (long) (u >> 1));
+            if(q < -32768 || q > 32767)
+                return FALSE;
+            Row[j] = (int16_t) q;
+        }
+    }
+    return TRUE;
+} /*MAG_GeoidStoreDecodeTile*/
+
+static const int16_t *MAG_GeoidStoreTile(MAGtype_GeoidStore *Store, int Tile)
+/* Decoded posts of a tile, from the cache or read into the least recently used slot. NULL on a read error. */
+{
+    MAGtype_GeoidSlot *Slot, *Oldest;
+    int i;
+
+    Store->Clock++;
+    Oldest = &Store->Slots[0];
+    for(i = 0; i < Store->NumSlots; i++)
+    {
+        Slot = &Store->Slots[i];
+        if(Slot->Tile == Tile)
+        {
+            Slot->LastUse = Store->Clock;
+            Store->Hits++;
+            return Slot->Posts;
+        }
+        if(Slot->LastUse < Oldest->LastUse)
+            Oldest = Slot;
+    }
+    Store->Misses++;
+    if(!MAG_GeoidStoreDecodeTile(Store, Tile, Oldest->Posts))
+    {
+        Oldest->Tile = -1;
+        Oldest->LastUse = 0;
+        return NULL;
+    }
+    Oldest->Tile = Tile;
+    Oldest->LastUse = Store->Clock;
+    return Oldest->Posts;
+} /*MAG_GeoidStoreTile*/
+
+int MAG_GeoidStorePosts(void *Store, int Row, int Col, double *Posts)
+
+/* The geoid heights at the four corners of a grid cell, the GetGeoidPosts hook of MAGtype_Geoid.
+
+INPUT: Store  MAGtype_GeoidStore opened with MAG_GeoidStoreOpen
+       Row, Col  Northwest post of the cell, 0 <= Row < NumRows - 1 and 0 <= Col < NumCols - 1
+OUTPUT: Posts  Northwest, northeast, southwest and southeast geoid heights (meters)
+        Returns FALSE if the cell is outside the grid or its tile cannot be read
+ */
+{
+    MAGtype_GeoidStore *GeoidStore = (MAGtype_GeoidStore *) Store;
+    const int16_t *p;
+    int tr, tc, Stride = GeoidStore->TileSize + 1;
+    double Scale = 1.0 / GeoidStore->CountsPerMeter;
+
+    if(Row < 0 || Col < 0 || Row >= GeoidStore->NumRows - 1 || Col >= GeoidStore->NumCols - 1)
+        return FALSE;
+    tr = Row / GeoidStore->TileSize;
+    tc = Col / GeoidStore->TileSize;
+    p = MAG_GeoidStoreTile(GeoidStore, tr * GeoidStore->NumTileCols + tc);
+    if(p == NULL)
+        return FALSE;
+    p += (Row - tr * GeoidStore->TileSize) * Stride + (Col - tc * GeoidStore->TileSize);
+    Posts[0] = p[0] * Scale;
+    Posts[1] = p[1] * Scale;
+    Posts[2] = p[Stride] * Scale;
+    Posts[3] = p[Stride + 1] * Scale;
+    return TRUE;
+} /*MAG_GeoidStorePosts*/
+
+int MAG_GeoidStoreDecode(MAGtype_GeoidStore *Store, float *Heights)
+
+/* Decodes the whole store into a flat grid, for checks against the source grid and for comparisons
+   with the flat array path of MAG_GetGeoidHeight.
+
+INPUT: Store
+OUTPUT: Heights  NumRows * NumCols geoid heights (meters), laid out as GeoidHeightBuffer
+        Returns FALSE if a tile cannot be read
+ */
+{
+    const int16_t *Posts;
+    int tr, tc, i, j, Height, Width;
+    double Scale = 1.0 / Store->CountsPerMeter;
+
+    for(tr = 0; tr < Store->NumTileRows; tr++)
+        for(tc = 0; tc < Store->NumTileCols; tc++)
+        {
+            Posts = MAG_GeoidStoreTile(Store, tr * Store->NumTileCols + tc);
+            if(Posts == NULL)
+                return FALSE;
+            Height = MAG_GeoidTileExtent(Store->NumRows, Store->TileSize, tr);
+            Width = MAG_GeoidTileExtent(Store->NumCols, Store->TileSize, tc);
+            for(i = 0; i < Height; i++)
+                for(j = 0; j < Width; j++)
+                    Heights[(size_t) (tr * Store->TileSize + i) * Store->NumCols + tc * Store->TileSize + j] =
+                        (float) (Posts[i * (Store->TileSize + 1) + j] * Scale);
+        }
+    return TRUE;
+} /*MAG_GeoidStoreDecode*/
+
+size_t MAG_GeoidStoreResidentBytes(const MAGtype_GeoidStore *Store)
+/* Heap and structure bytes held by an open store: index, read buffer and tile cache */
+{
+    return sizeof (MAGtype_GeoidStore) + 3 * sizeof (uint32_t) * (size_t) Store->NumTileRows * Store->NumTileCols +
+            Store->MaxTileBytes + (size_t) Store->NumSlots * (sizeof (MAGtype_GeoidSlot) +
+            (size_t) (Store->TileSize + 1) * (Store->TileSize + 1) * sizeof (int16_t));
+} /*MAG_GeoidStoreResidentBytes*/
+
+int MAG_GeoidReadFile(void *ReadData, unsigned long Offset, void *Buffer, size_t Size)
+/* MAGtype_GeoidRead for a store file, ReadData is the FILE * (opened in binary mode) */
+{
+    FILE *File = (FILE *) ReadData;
+
+    if(fseek(File, (long) Offset, SEEK_SET) != 0)
+        return FALSE;
+    return fread(Buffer, 1, Size, File) == Size;
+} /*MAG_GeoidReadFile*/
+
+int MAG_GeoidReadMemory(void *ReadData, unsigned long Offset, void *Buffer, size_t Size)
+/* MAGtype_GeoidRead for a store held in memory, ReadData is a MAGtype_GeoidMemory * */
+{
+    MAGtype_GeoidMemory *Memory = (MAGtype_GeoidMemory *) ReadData;
+
+    if(Offset > Memory->Size || Size > Memory->Size - Offset)
+        return FALSE;
+    memcpy(Buffer, Memory->Data + Offset, Size);
+    return TRUE;
+} /*MAG_GeoidReadMemory*/
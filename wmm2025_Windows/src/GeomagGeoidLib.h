@@ -0,0 +1,106 @@
+/*
+ * Compressed, lazily paged EGM96 geoid store.
+ *
+ * The geoid heights of the EGM96 grid (GeoidHeightBuffer of EGM9615.h, 721 x 1441 float posts, about
+ * 4 MB) are quantized to int16 centimetres and cut into square tiles of TileSize cells. Neighbouring
+ * tiles share their edge posts, so the four posts of any grid cell lie in one tile. Every tile row is
+ * compressed on its own: each post is predicted from the two posts to its left (the first post of a row
+ * from the first post of the row above) and the residual is stored as a zigzag varint. The store is read
+ * lazily through a caller supplied read function (a file, a flash partition or a memory buffer) into a
+ * small LRU cache of decoded tiles, so only the tile index and NumSlots tiles are resident.
+ *
+ * MAG_GeoidStorePosts matches the GetGeoidPosts hook of MAGtype_Geoid: with GeoidHeightBuffer NULL,
+ * MAG_GetGeoidHeight and MAG_ConvertGeoidToEllipsoidHeight read the posts from the store instead of the
+ * flat array. Like GeomagTileLib, this file and GeomagGeoidLib.c only depend on the C library.
+ *
+ * File layout, all fields little endian:
+ *
+ *   offset  type       field
+ *        0  char[4]    "WMMG"
+ *        4  uint16     Version (MAG_GEOID_VERSION)
+ *        6  uint16     HeaderSize (MAG_GEOID_HEADER_SIZE)
+ *        8  uint16     NumRows, NumCols (posts, the first row is 90 N and the first column 0 E)
+ *       12  uint16     TileSize (cells per tile edge)
+ *       14  uint16     CountsPerMeter
+ *       16  uint32     MaxTileBytes (largest compressed tile)
+ *       20  uint32     IndexChecksum (32 bit FNV-1a of the tile index)
+ *       24  uint32     Reserved (0)
+ *       28  uint32     Reserved (0)
+ *       32  uint32     Tile index, for every tile (tile row major): Offset from the start of the file,
+ *                      compressed Size, Checksum (32 bit FNV-1a of the compressed bytes)
+ *        .  bytes      Compressed tiles
+ */
+
+#ifndef GEOMAGGEOIDLIB_H
+#define GEOMAGGEOIDLIB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef TRUE
+#define TRUE            ((int)1)
+#endif
+
+#ifndef FALSE
+#define FALSE           ((int)0)
+#endif
+
+#define MAG_GEOID_VERSION 1
+#define MAG_GEOID_HEADER_SIZE 32
+#define MAG_GEOID_INDEX_ENTRY_SIZE 12
+#define MAG_GEOID_DEFAULT_TILE_SIZE 64 /* Cells per tile edge, 8450 resident bytes per decoded tile */
+#define MAG_GEOID_DEFAULT_SLOTS 8 /* Decoded tiles kept in the LRU cache */
+#define MAG_GEOID_COUNTS_PER_METER 100 /* Centimetre quantization */
+
+/* Reads Size bytes at Offset from the start of the store into Buffer, returns FALSE on failure */
+typedef int (*MAGtype_GeoidRead)(void *ReadData, unsigned long Offset, void *Buffer, size_t Size);
+
+typedef struct {
+    const unsigned char *Data; /* Store bytes, e.g. a memory mapped flash partition */
+    size_t Size;
+} MAGtype_GeoidMemory;
+
+typedef struct {
+    int Tile; /* Index of the decoded tile, -1 if the slot is empty */
+    unsigned long LastUse;
+    int16_t *Posts; /* (TileSize + 1) * (TileSize + 1) posts, row major */
+} MAGtype_GeoidSlot;
+
+typedef struct {
+    int NumRows; /* Posts in latitude */
+    int NumCols; /* Posts in longitude */
+    int TileSize;
+    int NumTileRows;
+    int NumTileCols;
+    int CountsPerMeter;
+    unsigned long MaxTileBytes;
+    MAGtype_GeoidRead Read;
+    void *ReadData;
+    uint32_t *Index; /* 3 entries per tile, as in the file */
+    unsigned char *ReadBuffer; /* MaxTileBytes */
+    int NumSlots;
+    MAGtype_GeoidSlot *Slots;
+    unsigned long Clock;
+    unsigned long Hits; /* Lookups served by a decoded tile */
+    unsigned long Misses; /* Tiles read and decoded */
+} MAGtype_GeoidStore;
+
+size_t MAG_GeoidStoreBound(int NumRows, int NumCols, int TileSize);
+
+size_t MAG_GeoidStoreEncode(const float *Heights, int NumRows, int NumCols, int TileSize, unsigned char *Buffer, size_t BufferSize);
+
+int MAG_GeoidStoreOpen(MAGtype_GeoidStore *Store, MAGtype_GeoidRead Read, void *ReadData, int NumSlots);
+
+void MAG_GeoidStoreClose(MAGtype_GeoidStore *Store);
+
+int MAG_GeoidStorePosts(void *Store, int Row, int Col, double *Posts);
+
+int MAG_GeoidStoreDecode(MAGtype_GeoidStore *Store, float *Heights);
+
+size_t MAG_GeoidStoreResidentBytes(const MAGtype_GeoidStore *Store);
+
+int MAG_GeoidReadFile(void *ReadData, unsigned long Offset, void *Buffer, size_t Size);
+
+int MAG_GeoidReadMemory(void *ReadData, unsigned long Offset, void *Buffer, size_t Size);
+
+#endif /*GEOMAGGEOIDLIB_H*/
@@ -0,0 +1,922 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#ifndef MAG_NO_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#include "GeomagnetismHeader.h"
+#include "GeomagGridLib.h"
+
+/*
+ * Grid evaluation engine.
+ *
+ * MAG_GridEvaluate computes the same cells as the four nested loops of MAG_Grid (altitude, latitude,
+ * longitude, year) and prints the same lines. The loop values are generated once, with the same
+ * floating point accumulation as the serial loops, and every (altitude, latitude) pair forms a row.
+ * Rows are handed out to the worker threads in order. Each worker formats its row into a private
+ * text buffer and the calling thread writes the buffers in row order, so the output does not depend
+ * on the number of threads. At most MAG_GRID_WINDOW rows per thread are in flight at any time.
+ *
+ * With Parameters->Separable set, the engine uses the separability of the spherical harmonic terms on
+ * a regular grid: cos(m*lambda) and sin(m*lambda) are tabulated once per longitude column and the cells
+ * sum straight from these tables, and when the ellipsoid height of a row is constant (no geoid correction)
+ * the spherical coordinates, (a/r)^(n+2) and the Legendre functions are computed once per row. Each worker keeps its time adjusted models in a
+ * MAGtype_TimedModelCache with one entry per year (up to MAG_GRID_TIMED_MODELS), so a model is only
+ * adjusted when a year is first seen, not once per cell. Every value is produced by the same expressions as
+ * the per cell path, so the output is identical.
+ *
+ * With Parameters->LinearTime set, the summations of a cell run once on the coefficients at the model
+ * epoch and once on the secular variation coefficients (see MAG_SiteBasis_ctx), and every year of the
+ * cell is their linear combination (MAG_SiteElements). The cost of a cell then hardly depends on the
+ * number of years. The field values differ from the time adjusted path by rounding only (around
+ * 1e-10 nT), far below the printed precision. The gradient elements (17-25) keep the time adjusted path.
+ *
+ * With a raster OutputFormat the workers append the float32 values of their cells to the row buffer
+ * instead of formatting text, and the writer writes each row with one fwrite, so a row of a global grid
+ * is a single write of some tens of kilobytes. Height warnings then always go to MessageOut.
+ */
+
+#define MAG_GRID_WINDOW 4 /* Rows in flight per worker thread */
+#define MAG_GRID_TIMED_MODELS 16 /* Time adjusted models kept per worker thread */
+
+typedef struct {
+    char *Text;
+    size_t Length;
+    size_t Size;
+} MAGtype_GridText;
+
+typedef struct {
+    int Element; /* Element option, 1-25 as in MAG_GetUserGrid */
+    int UncertaintyOption; /* Effective option: the rate and gradient elements have no uncertainty */
+    int NumBands; /* Raster output: values per cell, 0 for text output */
+    int BandElements[MAG_GRID_MAX_BANDS]; /* Raster output: element option of each band */
+    int BandUncertainties[MAG_GRID_MAX_BANDS]; /* Raster output: 1 if the band holds the uncertainty of its element */
+    FILE *DataOut;
+} MAGtype_GridSink;
+
+typedef struct {
+    int Row; /* Row held by this slot, -1 if free */
+    int Done; /* Row has been computed */
+    MAGtype_GridText Data[MAG_GRID_MAX_SINKS]; /* Lines (raster values) for the DataOut of each sink */
+    MAGtype_GridText Messages; /* Lines for MessageOut, unused when both streams are the same */
+    int BozWarningStrong;
+    int BozWarningWeak;
+    int AltitudeWarning;
+    long NumCells;
+} MAGtype_GridSlot;
+
+typedef struct {
+    MAGtype_GridParameters *Parameters;
+    MAGtype_MagneticModel *MagneticModel;
+    MAGtype_Geoid *Geoid;
+    MAGtype_Ellipsoid Ellip;
+    double *Altitudes, *Latitudes, *Longitudes, *Years;
+    int NumAltitudes, NumLatitudes, NumLongitudes, NumYears;
+    int NumRows;
+    int NumSinks;
+    MAGtype_GridSink Sinks[MAG_GRID_MAX_SINKS]; /* One per element written, in element order */
+    int GradientOption; /* A gradient element (17-25) is written */
+    int SharedStream; /* The DataOut of the first sink and MessageOut are the same stream */
+    double *cos_mlambda, *sin_mlambda; /* Separable mode: (nMax + 1) entries per longitude column */
+    MAGtype_GridSlot *Slots;
+    int NumSlots;
+    int NextRow; /* Next row to hand out */
+    int NextWrite; /* Next row to write */
+    int Failed;
+#ifndef MAG_NO_THREADS
+    pthread_mutex_t Lock;
+    pthread_cond_t RowDone; /* Signalled when a worker finishes a row */
+    pthread_cond_t SlotFree; /* Signalled when the writer releases a slot */
+#endif
+} MAGtype_GridShared;
+
+typedef struct {
+    MAGtype_GridShared *Shared;
+    MAGtype_EvalContext *Context;
+    MAGtype_TimedModelCache *TimedModels;
+} MAGtype_GridWorker;
+
+static int MAG_GridTextPrintf(MAGtype_GridText *Buffer, const char *Format, ...)
+/* Appends formatted text to a growable buffer */
+{
+    va_list args;
+    int n;
+    size_t NewSize;
+    char *NewText;
+
+    for(;;)
+    {
+        va_start(args, Format);
+        n = vsnprintf(Buffer->Text ? Buffer->Text + Buffer->Length : NULL, Buffer->Text ? Buffer->Size - Buffer->Length : 0, Format, args);
+        va_end(args);
+        if(n < 0)
+            return FALSE;
+        if(Buffer->Text && Buffer->Length + (size_t) n < Buffer->Size)
+        {
+            Buffer->Length += (size_t) n;
+            return TRUE;
+        }
+        NewSize = Buffer->Size ? Buffer->Size * 2 : 4096;
+        while(NewSize < Buffer->Length + (size_t) n + 1)
+            NewSize *= 2;
+        NewText = (char *) realloc(Buffer->Text, NewSize);
+        if(NewText == NULL)
+            return FALSE;
+        Buffer->Text = NewText;
+        Buffer->Size = NewSize;
+    }
+} /*MAG_GridTextPrintf*/
+
+static int MAG_GridTextAppend(MAGtype_GridText *Buffer, const void *Data, size_t Size)
+/* Appends raw bytes to a growable buffer */
+{
+    size_t NewSize;
+    char *NewText;
+
+    if(Buffer->Length + Size > Buffer->Size)
+    {
+        NewSize = Buffer->Size ? Buffer->Size * 2 : 4096;
+        while(NewSize < Buffer->Length + Size)
+            NewSize *= 2;
+        NewText = (char *) realloc(Buffer->Text, NewSize);
+        if(NewText == NULL)
+            return FALSE;
+        Buffer->Text = NewText;
+        Buffer->Size = NewSize;
+    }
+    memcpy(Buffer->Text + Buffer->Length, Data, Size);
+    Buffer->Length += Size;
+    return TRUE;
+} /*MAG_GridTextAppend*/
+
+static double MAG_GridStep(double Step)
+/* The step of a MAG_Grid loop: steps that are too small skip the axis */
+{
+    return fabs(Step) < 1.0e-10 ? 99999.0 : Step;
+} /*MAG_GridStep*/
+
+static double *MAG_GridAxis(double Start, double Stop, double Step, int *Count)
+/* Returns the values taken by for(x = Start; x <= Stop; x += Step), computed with the same accumulation */
+{
+    double x, *Values;
+    int n = 0;
+
+    for(x = Start; x <= Stop; x += Step)
+        n++;
+    Values = (double *) malloc((n > 0 ? n : 1) * sizeof (double));
+    if(Values == NULL)
+        return NULL;
+    n = 0;
+    for(x = Start; x <= Stop; x += Step)
+        Values[n++] = x;
+    *Count = n;
+    return Values;
+} /*MAG_GridAxis*/
+
+static int MAG_GridSelectElement(int ElementOption, MAGtype_GeoMagneticElements *GeoMagneticElements, MAGtype_GeoMagneticElements *Errors,
+        MAGtype_Gradient *Gradient, double *PrintElement, double *ErrorElement)
+/* The element selection of MAG_Grid. Returns FALSE for the elements that have no uncertainty. */
+{
+    switch(ElementOption) {
+        case 1:
+            *PrintElement = GeoMagneticElements->Decl; /*1. Angle between the magnetic field vector and true north, positive east*/
+            *ErrorElement = Errors->Decl;
+            return TRUE;
+        case 2:
+            *PrintElement = GeoMagneticElements->Incl; /*2. Angle between the magnetic field vector and the horizontal plane, positive downward*/
+            *ErrorElement = Errors->Incl;
+            return TRUE;
+        case 3:
+            *PrintElement = GeoMagneticElements->F; /*3. Magnetic Field Strength*/
+            *ErrorElement = Errors->F;
+            return TRUE;
+        case 4:
+            *PrintElement = GeoMagneticElements->H; /*4. Horizontal Magnetic Field Strength*/
+            *ErrorElement = Errors->H;
+            return TRUE;
+        case 5:
+            *PrintElement = GeoMagneticElements->X; /*5. Northern component of the magnetic field vector*/
+            *ErrorElement = Errors->X;
+            return TRUE;
+        case 6:
+            *PrintElement = GeoMagneticElements->Y; /*6. Eastern component of the magnetic field vector*/
+            *ErrorElement = Errors->Y;
+            return TRUE;
+        case 7:
+            *PrintElement = GeoMagneticElements->Z; /*7. Downward component of the magnetic field vector*/
+            *ErrorElement = Errors->Z;
+            return TRUE;
+        case 8:
+            *PrintElement = GeoMagneticElements->GV; /*8. The Grid Variation*/
+            *ErrorElement = Errors->Decl;
+            return TRUE;
+        case 9:
+            *PrintElement = GeoMagneticElements->Decldot * 60; /*9. Yearly Rate of change in declination*/
+            return FALSE;
+        case 10:
+            *PrintElement = GeoMagneticElements->Incldot * 60; /*10. Yearly Rate of change in inclination*/
+            return FALSE;
+        case 11:
+            *PrintElement = GeoMagneticElements->Fdot; /*11. Yearly rate of change in Magnetic field strength*/
+            return FALSE;
+        case 12:
+            *PrintElement = GeoMagneticElements->Hdot; /*12. Yearly rate of change in horizontal field strength*/
+            return FALSE;
+        case 13:
+            *PrintElement = GeoMagneticElements->Xdot; /*13. Yearly rate of change in the northern component*/
+            return FALSE;
+        case 14:
+            *PrintElement = GeoMagneticElements->Ydot; /*14. Yearly rate of change in the eastern component*/
+            return FALSE;
+        case 15:
+            *PrintElement = GeoMagneticElements->Zdot; /*15. Yearly rate of change in the downward component*/
+            return FALSE;
+        case 16:
+            *PrintElement = GeoMagneticElements->GVdot; /*16. Yearly rate of change in grid variation*/
+            return FALSE;
+        case 17:
+            *PrintElement = Gradient->GradPhi.X;
+            return FALSE;
+        case 18:
+            *PrintElement = Gradient->GradPhi.Y;
+            return FALSE;
+        case 19:
+            *PrintElement = Gradient->GradPhi.Z;
+            return FALSE;
+        case 20:
+            *PrintElement = Gradient->GradLambda.X;
+            return FALSE;
+        case 21:
+            *PrintElement = Gradient->GradLambda.Y;
+            return FALSE;
+        case 22:
+            *PrintElement = Gradient->GradLambda.Z;
+            return FALSE;
+        case 23:
+            *PrintElement = Gradient->GradZ.X;
+            return FALSE;
+        case 24:
+            *PrintElement = Gradient->GradZ.Y;
+            return FALSE;
+        case 25:
+            *PrintElement = Gradient->GradZ.Z;
+            return FALSE;
+        default:
+            *PrintElement = GeoMagneticElements->Decl; /* 1. Angle between the magnetic field vector and true north, positive east*/
+            *ErrorElement = Errors->Decl;
+            return TRUE;
+    }
+} /*MAG_GridSelectElement*/
+
+static void MAG_GridRadiusPower(MAGtype_Ellipsoid Ellip, MAGtype_CoordSpherical CoordSpherical, int nMax, MAGtype_SphericalHarmonicVariables *SphVariables)
+/* The (a/r)^(n+2) part of MAG_ComputeSphericalHarmonicVariables */
+{
+    int n;
+
+    SphVariables->RelativeRadiusPower[0] = (Ellip.re / CoordSpherical.r) * (Ellip.re / CoordSpherical.r);
+    for(n = 1; n <= nMax; n++)
+    {
+        SphVariables->RelativeRadiusPower[n] = SphVariables->RelativeRadiusPower[n - 1] * (Ellip.re / CoordSpherical.r);
+    }
+} /*MAG_GridRadiusPower*/
+
+static int MAG_GridLongitudeTables(MAGtype_GridShared *Shared)
+/* Tabulates cos(m*lambda) and sin(m*lambda) for every longitude column with MAG_ComputeSphericalHarmonicVariables */
+{
+    MAGtype_SphericalHarmonicVariables *SphVariables;
+    MAGtype_CoordSpherical CoordSpherical;
+    int iLon, nMax = Shared->MagneticModel->nMax;
+
+    Shared->cos_mlambda = (double *) malloc(Shared->NumLongitudes * (nMax + 1) * sizeof (double));
+    Shared->sin_mlambda = (double *) malloc(Shared->NumLongitudes * (nMax + 1) * sizeof (double));
+    SphVariables = MAG_AllocateSphVarMemory(nMax);
+    if(Shared->cos_mlambda == NULL || Shared->sin_mlambda == NULL || SphVariables == NULL)
+    {
+        if(SphVariables)
+            MAG_FreeSphVarMemory(SphVariables);
+        return FALSE;
+    }
+    CoordSpherical.phig = 0;
+    CoordSpherical.r = Shared->Ellip.re;
+    for(iLon = 0; iLon < Shared->NumLongitudes; iLon++)
+    {
+        CoordSpherical.lambda = Shared->Longitudes[iLon];
+        MAG_ComputeSphericalHarmonicVariables(Shared->Ellip, CoordSpherical, nMax, SphVariables);
+        memcpy(Shared->cos_mlambda + iLon * (nMax + 1), SphVariables->cos_mlambda, (nMax + 1) * sizeof (double));
+        memcpy(Shared->sin_mlambda + iLon * (nMax + 1), SphVariables->sin_mlambda, (nMax + 1) * sizeof (double));
+    }
+    MAG_FreeSphVarMemory(SphVariables);
+    return TRUE;
+} /*MAG_GridLongitudeTables*/
+
+static int MAG_GridComputeRow(MAGtype_GridWorker *Worker, int Row, MAGtype_GridSlot *Slot)
+/* Computes and formats all of the cells (longitudes and years) of one row into Slot */
+{
+    MAGtype_GridShared *Shared = Worker->Shared;
+    MAGtype_GridParameters *Parameters = Shared->Parameters;
+    MAGtype_CoordGeodetic CoordGeodetic;
+    MAGtype_CoordSpherical CoordSpherical;
+    MAGtype_MagneticResults MagneticResultsSph, MagneticResultsGeo, MagneticResultsSphVar, MagneticResultsGeoVar;
+    MAGtype_MagneticModel *TimedMagneticModel = NULL;
+    MAGtype_GeoMagneticElements GeoMagneticElements, Errors;
+    MAGtype_SiteBasis Basis;
+    MAGtype_Gradient Gradient;
+    MAGtype_Date UserDate;
+    MAGtype_GridText *Messages;
+    double PrintElement, ErrorElement = 0;
+    double *cos_mlambda, *sin_mlambda;
+    MAGtype_GridSink *Sink;
+    float Values[MAG_GRID_MAX_BANDS];
+    int iLon, iYear, k, s, nMax, RowConstant, LinearTime, Flag = TRUE;
+
+    Messages = Shared->SharedStream ? &Slot->Data[0] : &Slot->Messages;
+    nMax = Shared->MagneticModel->nMax;
+    /* The context's own longitude arrays, put back at the end of the row */
+    cos_mlambda = Worker->Context->SphVariables.cos_mlambda;
+    sin_mlambda = Worker->Context->SphVariables.sin_mlambda;
+    CoordGeodetic = Parameters->minimum;
+    CoordGeodetic.HeightAboveGeoid = Shared->Altitudes[Row / Shared->NumLatitudes];
+    CoordGeodetic.phi = Shared->Latitudes[Row % Shared->NumLatitudes];
+    UserDate = Parameters->StartDate;
+    /* The gradient elements need the time adjusted model of every year */
+    LinearTime = Parameters->LinearTime && !Shared->GradientOption;
+    /* Without the geoid correction the ellipsoid height, and so everything but the longitude, is constant along the row */
+    RowConstant = Parameters->Separable && Shared->Geoid->UseGeoid != 1 && Shared->NumLongitudes > 0;
+    if(RowConstant)
+    {
+        CoordGeodetic.lambda = Shared->Longitudes[0];
+        CoordGeodetic.HeightAboveEllipsoid = CoordGeodetic.HeightAboveGeoid;
+        MAG_GeodeticToSpherical(Shared->Ellip, CoordGeodetic, &CoordSpherical);
+        MAG_GridRadiusPower(Shared->Ellip, CoordSpherical, nMax, &Worker->Context->SphVariables);
+        MAG_AssociatedLegendreFunction_ctx(Worker->Context, CoordSpherical, nMax);
+    }
+
+    for(iLon = 0; iLon < Shared->NumLongitudes; iLon++)
+    {
+        CoordGeodetic.lambda = Shared->Longitudes[iLon];
+        if(Shared->Geoid->UseGeoid == 1)
+            MAG_ConvertGeoidToEllipsoidHeight(&CoordGeodetic, Shared->Geoid); /* This converts the height above mean sea level to height above the WGS-84 ellipsoid */
+        else
+            CoordGeodetic.HeightAboveEllipsoid = CoordGeodetic.HeightAboveGeoid;
+        if(Parameters->HeightWarning &&
+                (CoordGeodetic.HeightAboveEllipsoid < Parameters->MinHeight || CoordGeodetic.HeightAboveEllipsoid > Parameters->MaxHeight))
+        {
+            Flag &= MAG_GridTextPrintf(Messages, "\n Unrecognized height: %.2f. \n %s \n", CoordGeodetic.HeightAboveGeoid, Parameters->HeightWarning);
+            Slot->AltitudeWarning = TRUE;
+        }
+        if(RowConstant)
+        {
+            CoordSpherical.lambda = CoordGeodetic.lambda;
+        } else
+        {
+            MAG_GeodeticToSpherical(Shared->Ellip, CoordGeodetic, &CoordSpherical);
+            if(Parameters->Separable)
+                MAG_GridRadiusPower(Shared->Ellip, CoordSpherical, nMax, &Worker->Context->SphVariables);
+            else
+                MAG_ComputeSphericalHarmonicVariables(Shared->Ellip, CoordSpherical, nMax, &Worker->Context->SphVariables); /* Compute Spherical Harmonic variables  */
+            MAG_AssociatedLegendreFunction_ctx(Worker->Context, CoordSpherical, nMax); /* Compute ALF  Equations 5-6, WMM Technical report*/
+        }
+        if(Parameters->Separable)
+        {
+            /* The summations only read these, so they can sum straight from the column tables */
+            Worker->Context->SphVariables.cos_mlambda = Shared->cos_mlambda + iLon * (nMax + 1);
+            Worker->Context->SphVariables.sin_mlambda = Shared->sin_mlambda + iLon * (nMax + 1);
+        }
+
+        if(LinearTime)
+        {
+            /* The main field and secular variation of the untimed model, see MAG_SiteBasis_ctx */
+            MAG_Summation_ctx(Worker->Context, Shared->MagneticModel, CoordSpherical, &MagneticResultsSph);
+            MAG_SecVarSummation_ctx(Worker->Context, Shared->MagneticModel, CoordSpherical, &MagneticResultsSphVar);
+            MAG_RotateMagneticVector(CoordSpherical, CoordGeodetic, MagneticResultsSph, &Basis.MainField);
+            MAG_RotateMagneticVector(CoordSpherical, CoordGeodetic, MagneticResultsSphVar, &Basis.SecularVariation);
+            Basis.epoch = Shared->MagneticModel->epoch;
+            Basis.CoordGeodetic = CoordGeodetic;
+        }
+
+        for(iYear = 0; iYear < Shared->NumYears; iYear++)
+        {
+            UserDate.DecimalYear = Shared->Years[iYear];
+            if(LinearTime)
+                MAG_SiteElements(&Basis, UserDate.DecimalYear, &GeoMagneticElements);
+            else
+            {
+                TimedMagneticModel = MAG_TimelyModifyMagneticModel_cache(Worker->TimedModels, UserDate, Shared->MagneticModel); /*This modifies the Magnetic coefficients to the correct date. */
+                MAG_Summation_ctx(Worker->Context, TimedMagneticModel, CoordSpherical, &MagneticResultsSph); /* Accumulate the spherical harmonic coefficients Equations 10:12 , WMM Technical report*/
+                MAG_SecVarSummation_ctx(Worker->Context, TimedMagneticModel, CoordSpherical, &MagneticResultsSphVar); /*Sum the Secular Variation Coefficients, Equations 13:15 , WMM Technical report  */
+                MAG_RotateMagneticVector(CoordSpherical, CoordGeodetic, MagneticResultsSph, &MagneticResultsGeo); /* Map the computed Magnetic fields to Geodetic coordinates Equation 16 , WMM Technical report */
+                MAG_RotateMagneticVector(CoordSpherical, CoordGeodetic, MagneticResultsSphVar, &MagneticResultsGeoVar); /* Map the secular variation field components to Geodetic coordinates, Equation 17 , WMM Technical report*/
+                MAG_CalculateGeoMagneticElements(&MagneticResultsGeo, &GeoMagneticElements); /* Calculate the Geomagnetic elements, Equation 18 , WMM Technical report */
+                MAG_CalculateGridVariation(CoordGeodetic, &GeoMagneticElements);
+                MAG_CalculateSecularVariationElements(MagneticResultsGeoVar, &GeoMagneticElements); /*Calculate the secular variation of each of the Geomagnetic elements, Equation 19, WMM Technical report*/
+            }
+#ifdef WMMHR
+            MAG_WMMHRErrorCalc(GeoMagneticElements.H, &Errors);
+#else
+            MAG_WMMErrorCalc(GeoMagneticElements.H, &Errors);
+#endif
+            if(GeoMagneticElements.H <= 2000.0) {
+                Slot->BozWarningStrong = TRUE;
+            } else if (GeoMagneticElements.H <= 6000.0) {
+                Slot->BozWarningWeak = TRUE;
+            }
+
+            if(Shared->GradientOption)
+            {
+                /* The context still holds the Legendre functions and spherical harmonic variables of this cell */
+                if(!Parameters->AnalyticGradient ||
+                        !MAG_GradientSummation_ctx(Worker->Context, Shared->Ellip, CoordSpherical, CoordGeodetic, TimedMagneticModel, GeoMagneticElements, &Gradient))
+                    MAG_Gradient(Shared->Ellip, CoordGeodetic, TimedMagneticModel, &Gradient);
+            }
+
+            for(s = 0; s < Shared->NumSinks; s++)
+            {
+                Sink = &Shared->Sinks[s];
+                if(Sink->NumBands > 0)
+                {
+                    for(k = 0; k < Sink->NumBands; k++)
+                    {
+                        MAG_GridSelectElement(Sink->BandElements[k], &GeoMagneticElements, &Errors, &Gradient, &PrintElement, &ErrorElement);
+                        Values[k] = (float) (Sink->BandUncertainties[k] ? ErrorElement : PrintElement);
+                    }
+                    Flag &= MAG_GridTextAppend(&Slot->Data[s], Values, Sink->NumBands * sizeof (float));
+                } else
+                {
+                    MAG_GridSelectElement(Sink->Element, &GeoMagneticElements, &Errors, &Gradient, &PrintElement, &ErrorElement);
+
+                    Flag &= MAG_GridTextPrintf(&Slot->Data[s], "%5.2f %6.2f %8.4f %7.2f %10.2f", CoordGeodetic.phi, CoordGeodetic.lambda,
+                            Shared->Geoid->UseGeoid == 1 ? CoordGeodetic.HeightAboveGeoid : CoordGeodetic.HeightAboveEllipsoid,
+                            UserDate.DecimalYear, PrintElement);
+                    if(Sink->UncertaintyOption == 1)
+                        Flag &= MAG_GridTextPrintf(&Slot->Data[s], " %7.2f", ErrorElement);
+                    Flag &= MAG_GridTextPrintf(&Slot->Data[s], "\n"); /* Complete line */
+                }
+            }
+            Slot->NumCells++;
+        } /* year loop */
+    } /*Longitude Loop */
+    Worker->Context->SphVariables.cos_mlambda = cos_mlambda;
+    Worker->Context->SphVariables.sin_mlambda = sin_mlambda;
+    return Flag;
+} /*MAG_GridComputeRow*/
+
+static int MAG_GridWriteSlot(MAGtype_GridSlot *Slot, MAGtype_GridShared *Shared, FILE *MessageOut, MAGtype_GridStatus *Status)
+/* Writes a computed row to the sinks, merges its warning flags into Status and resets the slot */
+{
+    int s, Flag = TRUE;
+
+    if(Slot->Messages.Length > 0 && fwrite(Slot->Messages.Text, 1, Slot->Messages.Length, MessageOut) != Slot->Messages.Length)
+        Flag = FALSE;
+    for(s = 0; s < Shared->NumSinks; s++)
+    {
+        if(Slot->Data[s].Length > 0 && fwrite(Slot->Data[s].Text, 1, Slot->Data[s].Length, Shared->Sinks[s].DataOut) != Slot->Data[s].Length)
+            Flag = FALSE;
+        Slot->Data[s].Length = 0;
+    }
+    Status->BozWarningStrong |= Slot->BozWarningStrong;
+    Status->BozWarningWeak |= Slot->BozWarningWeak;
+    Status->AltitudeWarning |= Slot->AltitudeWarning;
+    Status->NumCells += Slot->NumCells;
+    Slot->Messages.Length = 0;
+    Slot->BozWarningStrong = Slot->BozWarningWeak = Slot->AltitudeWarning = 0;
+    Slot->NumCells = 0;
+    Slot->Done = 0;
+    Slot->Row = -1;
+    return Flag;
+} /*MAG_GridWriteSlot*/
+
+static MAGtype_GridWorker *MAG_GridAllocateWorker(MAGtype_GridShared *Shared)
+{
+    MAGtype_GridWorker *Worker;
+    int nMax = Shared->MagneticModel->nMax;
+
+    Worker = (MAGtype_GridWorker *) calloc(1, sizeof (MAGtype_GridWorker));
+    if(Worker == NULL)
+        return NULL;
+    Worker->Shared = Shared;
+    Worker->Context = MAG_AllocateEvalContext(nMax);
+    Worker->TimedModels = MAG_AllocateTimedModelCache(Shared->NumYears < MAG_GRID_TIMED_MODELS ? Shared->NumYears : MAG_GRID_TIMED_MODELS, nMax);
+    if(Worker->Context == NULL || Worker->TimedModels == NULL)
+    {
+        MAG_FreeEvalContext(Worker->Context);
+        MAG_FreeTimedModelCache(Worker->TimedModels);
+        free(Worker);
+        return NULL;
+    }
+    return Worker;
+} /*MAG_GridAllocateWorker*/
+
+static void MAG_GridFreeWorker(MAGtype_GridWorker *Worker)
+{
+    if(Worker == NULL)
+        return;
+    MAG_FreeEvalContext(Worker->Context);
+    MAG_FreeTimedModelCache(Worker->TimedModels);
+    free(Worker);
+} /*MAG_GridFreeWorker*/
+
+#ifndef MAG_NO_THREADS
+static void *MAG_GridWorkerThread(void *Argument)
+/* Takes rows in order while there is a free slot in the output window, computes them and marks them done */
+{
+    MAGtype_GridWorker *Worker = (MAGtype_GridWorker *) Argument;
+    MAGtype_GridShared *Shared = Worker->Shared;
+    MAGtype_GridSlot *Slot;
+    int Row, Flag;
+
+    pthread_mutex_lock(&Shared->Lock);
+    for(;;)
+    {
+        while(!Shared->Failed && Shared->NextRow < Shared->NumRows && Shared->NextRow >= Shared->NextWrite + Shared->NumSlots)
+            pthread_cond_wait(&Shared->SlotFree, &Shared->Lock);
+        if(Shared->Failed || Shared->NextRow >= Shared->NumRows)
+            break;
+        Row = Shared->NextRow++;
+        Slot = &Shared->Slots[Row % Shared->NumSlots];
+        Slot->Row = Row;
+        pthread_mutex_unlock(&Shared->Lock);
+
+        Flag = MAG_GridComputeRow(Worker, Row, Slot);
+
+        pthread_mutex_lock(&Shared->Lock);
+        Slot->Done = 1;
+        if(!Flag)
+            Shared->Failed = TRUE;
+        pthread_cond_broadcast(&Shared->RowDone);
+    }
+    pthread_mutex_unlock(&Shared->Lock);
+    return NULL;
+} /*MAG_GridWorkerThread*/
+#endif
+
+int MAG_GridDefaultThreads(void)
+/* Number of online processors, or 1 if it cannot be determined or threads are not available */
+{
+#if !defined(MAG_NO_THREADS) && defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if(n > MAG_GRID_MAX_THREADS)
+        return MAG_GRID_MAX_THREADS;
+    return n > 0 ? (int) n : 1;
+#else
+    return 1;
+#endif
+} /*MAG_GridDefaultThreads*/
+
+static int MAG_GridSinks(MAGtype_GridParameters *Parameters, FILE **DataOut, MAGtype_GridShared *Shared)
+/* Sets up one sink per element written: ElementOption alone, or every element of ElementMask in increasing order */
+{
+    MAGtype_GridParameters Single = *Parameters;
+    MAGtype_GridSink *Sink;
+    int e, s;
+
+    Shared->NumSinks = 0;
+    if(Parameters->ElementMask >> MAG_GRID_MAX_SINKS)
+        return FALSE;
+    if(Parameters->ElementMask != 0 && Parameters->OutputFormat == MAG_GRID_RASTER_BANDS)
+        return FALSE; /* The bands already hold every element */
+    for(e = 1; e <= MAG_GRID_MAX_SINKS; e++)
+    {
+        if(Parameters->ElementMask == 0)
+        {
+            if(e > 1)
+                break;
+            Single.ElementOption = Parameters->ElementOption;
+        } else if(Parameters->ElementMask & (1UL << (e - 1)))
+        {
+            Single.ElementOption = e;
+            Single.UncertaintyOption = (Parameters->UncertaintyMask & (1UL << (e - 1))) ? 1 : 0;
+        } else
+            continue;
+        Sink = &Shared->Sinks[Shared->NumSinks];
+        Sink->Element = Single.ElementOption;
+        Sink->UncertaintyOption = (Sink->Element >= 9 && Sink->Element <= 25) ? 0 : Single.UncertaintyOption;
+        Sink->NumBands = MAG_GridRasterBands(&Single, Sink->BandElements, Sink->BandUncertainties);
+        Sink->DataOut = DataOut[Shared->NumSinks];
+        Shared->NumSinks++;
+    }
+    for(s = 0; s < Shared->NumSinks; s++)
+        if(Shared->Sinks[s].Element >= 17 && Shared->Sinks[s].Element <= 25 && Parameters->OutputFormat != MAG_GRID_RASTER_BANDS)
+            Shared->GradientOption = TRUE;
+    return TRUE;
+} /*MAG_GridSinks*/
+
+int MAG_GridEvaluate(MAGtype_GridParameters *Parameters, MAGtype_MagneticModel *MagneticModel, MAGtype_Geoid *Geoid, MAGtype_Ellipsoid Ellip,
+        FILE *DataOut, FILE *MessageOut, MAGtype_GridStatus *Status)
+
+/* Evaluates the grid described by Parameters and prints one line per cell to DataOut, in the order of the
+serial MAG_Grid loops (altitude, latitude, longitude, year). Per cell height warnings go to MessageOut.
+With a raster Parameters->OutputFormat the cells are written to DataOut as float32 values instead (see
+MAG_GridRasterHeader), and MessageOut must be another stream. Parameters->ElementMask must be 0 or
+select a single element; see MAG_GridEvaluateElements for several elements.
+
+INPUT: Parameters  Grid limits, steps, element and uncertainty option, thread count and height check
+           MagneticModel   The model as read from the coefficient file (not time adjusted)
+           Geoid
+           Ellip
+           DataOut     Stream for the grid lines
+           MessageOut  Stream for the height warnings (may be the same as DataOut for text output)
+OUTPUT: Status  Warning flags, number of lines (cells), bands and threads used
+        Returns FALSE if memory could not be allocated, the output could not be written or a raster
+        was requested with DataOut the same as MessageOut
+
+CALLS : MAG_GridEvaluateElements
+ */
+{
+    if(Parameters->ElementMask & (Parameters->ElementMask - 1))
+        return FALSE;
+    return MAG_GridEvaluateElements(Parameters, MagneticModel, Geoid, Ellip, &DataOut, MessageOut, Status);
+} /*MAG_GridEvaluate*/
+
+int MAG_GridEvaluateElements(MAGtype_GridParameters *Parameters, MAGtype_MagneticModel *MagneticModel, MAGtype_Geoid *Geoid, MAGtype_Ellipsoid Ellip,
+        FILE **DataOut, FILE *MessageOut, MAGtype_GridStatus *Status)
+
+/* Evaluates the grid described by Parameters once and writes every element of Parameters->ElementMask to its
+own stream: the lines (or raster values) of element e are exactly those MAG_GridEvaluate writes with
+ElementOption e, with the uncertainty when bit e - 1 of Parameters->UncertaintyMask is set. With an ElementMask
+of 0 this is MAG_GridEvaluate with DataOut[0]. Producing several maps this way costs one evaluation of the
+grid plus the formatting of each element.
+
+INPUT: Parameters  Grid limits, steps, elements and uncertainties, output format, thread count and height check
+           MagneticModel   The model as read from the coefficient file (not time adjusted)
+           Geoid
+           Ellip
+           DataOut     One stream per element of ElementMask, in increasing element order
+           MessageOut  Stream for the height warnings (may be the same as DataOut[0] for text output)
+OUTPUT: Status  Warning flags, number of cells, bands (summed over the streams) and threads used
+        Returns FALSE if memory could not be allocated, the output could not be written, ElementMask has
+        bits above element 25 or is combined with MAG_GRID_RASTER_BANDS, or a raster was requested with
+        DataOut[0] the same as MessageOut
+
+CALLS : MAG_AllocateEvalContext, MAG_ComputeSphericalHarmonicVariables (longitude tables), MAG_TimelyModifyMagneticModel_cache, MAG_ConvertGeoidToEllipsoidHeight, MAG_GeodeticToSpherical,
+        MAG_ComputeSphericalHarmonicVariables, MAG_AssociatedLegendreFunction_ctx, MAG_Summation_ctx, MAG_SecVarSummation_ctx,
+        MAG_RotateMagneticVector, MAG_CalculateGeoMagneticElements, MAG_CalculateGridVariation,
+        MAG_CalculateSecularVariationElements, MAG_WMMErrorCalc, MAG_Gradient (MAG_GradientSummation_ctx)
+ */
+{
+    MAGtype_GridShared Shared;
+    MAGtype_GridWorker *Workers[MAG_GRID_MAX_THREADS];
+    double cord_step_size, altitude_step_size, time_step;
+    int i, s, NumThreads, Flag = TRUE;
+#ifndef MAG_NO_THREADS
+    pthread_t Threads[MAG_GRID_MAX_THREADS];
+    int NumStarted = 0;
+#endif
+
+    memset(Status, 0, sizeof (MAGtype_GridStatus));
+    memset(&Shared, 0, sizeof (MAGtype_GridShared));
+    Shared.Parameters = Parameters;
+    Shared.MagneticModel = MagneticModel;
+    Shared.Geoid = Geoid;
+    Shared.Ellip = Ellip;
+    if(!MAG_GridSinks(Parameters, DataOut, &Shared))
+        return FALSE;
+    Shared.SharedStream = (DataOut[0] == MessageOut);
+    for(s = 0; s < Shared.NumSinks; s++)
+    {
+        Status->NumBands += Shared.Sinks[s].NumBands;
+        if(Shared.Sinks[s].NumBands > 0 && Shared.Sinks[s].DataOut == MessageOut)
+            return FALSE; /* Height warnings would end up inside the raster */
+    }
+
+    cord_step_size = MAG_GridStep(Parameters->cord_step_size); /*checks to make sure that the step_size is not too small*/
+    altitude_step_size = MAG_GridStep(Parameters->altitude_step_size);
+    time_step = MAG_GridStep(Parameters->time_step);
+
+    Shared.Altitudes = MAG_GridAxis(Parameters->minimum.HeightAboveGeoid, Parameters->maximum.HeightAboveGeoid, altitude_step_size, &Shared.NumAltitudes);
+    Shared.Latitudes = MAG_GridAxis(Parameters->minimum.phi, Parameters->maximum.phi, cord_step_size, &Shared.NumLatitudes);
+    Shared.Longitudes = MAG_GridAxis(Parameters->minimum.lambda, Parameters->maximum.lambda, cord_step_size, &Shared.NumLongitudes);
+    Shared.Years = MAG_GridAxis(Parameters->StartDate.DecimalYear, Parameters->EndDate.DecimalYear, time_step, &Shared.NumYears);
+    if(!Shared.Altitudes || !Shared.Latitudes || !Shared.Longitudes || !Shared.Years)
+    {
+        Flag = FALSE;
+        goto cleanup;
+    }
+    Shared.NumRows = Shared.NumAltitudes * Shared.NumLatitudes;
+    if(Parameters->Separable && !MAG_GridLongitudeTables(&Shared))
+    {
+        Flag = FALSE;
+        goto cleanup;
+    }
+
+    NumThreads = Parameters->NumThreads > 0 ? Parameters->NumThreads : MAG_GridDefaultThreads();
+    if(NumThreads > MAG_GRID_MAX_THREADS)
+        NumThreads = MAG_GRID_MAX_THREADS;
+    if(NumThreads > Shared.NumRows)
+        NumThreads = Shared.NumRows > 0 ? Shared.NumRows : 1;
+#ifdef MAG_NO_THREADS
+    NumThreads = 1;
+#endif
+    Status->NumThreads = NumThreads;
+
+    Shared.NumSlots = NumThreads * MAG_GRID_WINDOW;
+    Shared.Slots = (MAGtype_GridSlot *) calloc(Shared.NumSlots, sizeof (MAGtype_GridSlot));
+    if(Shared.Slots == NULL)
+    {
+        Flag = FALSE;
+        goto cleanup;
+    }
+    for(i = 0; i < Shared.NumSlots; i++)
+        Shared.Slots[i].Row = -1;
+    for(i = 0; i < NumThreads; i++)
+    {
+        Workers[i] = MAG_GridAllocateWorker(&Shared);
+        if(Workers[i] == NULL)
+        {
+            while(--i >= 0)
+                MAG_GridFreeWorker(Workers[i]);
+            Flag = FALSE;
+            goto cleanup;
+        }
+    }
+
+    if(NumThreads == 1)
+    {
+        /* Serial path: compute and write each row in turn */
+        for(i = 0; i < Shared.NumRows && Flag; i++)
+        {
+            Flag = MAG_GridComputeRow(Workers[0], i, &Shared.Slots[0]);
+            Flag &= MAG_GridWriteSlot(&Shared.Slots[0], &Shared, MessageOut, Status);
+        }
+    }
+#ifndef MAG_NO_THREADS
+    else
+    {
+        MAGtype_GridSlot *Slot;
+
+        pthread_mutex_init(&Shared.Lock, NULL);
+        pthread_cond_init(&Shared.RowDone, NULL);
+        pthread_cond_init(&Shared.SlotFree, NULL);
+        for(NumStarted = 0; NumStarted < NumThreads; NumStarted++)
+            if(pthread_create(&Threads[NumStarted], NULL, MAG_GridWorkerThread, Workers[NumStarted]) != 0)
+                break;
+
+        /* The calling thread is the writer: it waits for the rows in order */
+        pthread_mutex_lock(&Shared.Lock);
+        if(NumStarted == 0)
+            Shared.Failed = TRUE;
+        while(!Shared.Failed && Shared.NextWrite < Shared.NumRows)
+        {
+            Slot = &Shared.Slots[Shared.NextWrite % Shared.NumSlots];
+            while(!Shared.Failed && !(Slot->Row == Shared.NextWrite && Slot->Done))
+                pthread_cond_wait(&Shared.RowDone, &Shared.Lock);
+            if(Shared.Failed)
+                break;
+            pthread_mutex_unlock(&Shared.Lock);
+            Flag = MAG_GridWriteSlot(Slot, &Shared, MessageOut, Status);
+            pthread_mutex_lock(&Shared.Lock);
+            if(!Flag)
+                Shared.Failed = TRUE;
+            Shared.NextWrite++;
+            pthread_cond_broadcast(&Shared.SlotFree);
+        }
+        if(Shared.Failed)
+            pthread_cond_broadcast(&Shared.SlotFree);
+        pthread_mutex_unlock(&Shared.Lock);
+
+        for(i = 0; i < NumStarted; i++)
+            pthread_join(Threads[i], NULL);
+        pthread_mutex_destroy(&Shared.Lock);
+        pthread_cond_destroy(&Shared.RowDone);
+        pthread_cond_destroy(&Shared.SlotFree);
+        Flag = !Shared.Failed;
+    }
+#endif
+
+    for(i = 0; i < NumThreads; i++)
+    {
+        Status->TimedModelHits += Workers[i]->TimedModels->Hits;
+        Status->TimedModelMisses += Workers[i]->TimedModels->Misses;
+        MAG_GridFreeWorker(Workers[i]);
+    }
+
+cleanup:
+    if(Shared.Slots)
+    {
+        for(i = 0; i < Shared.NumSlots; i++)
+        {
+            for(s = 0; s < MAG_GRID_MAX_SINKS; s++)
+                free(Shared.Slots[i].Data[s].Text);
+            free(Shared.Slots[i].Messages.Text);
+        }
+        free(Shared.Slots);
+    }
+    free(Shared.Altitudes);
+    free(Shared.Latitudes);
+    free(Shared.Longitudes);
+    free(Shared.Years);
+    free(Shared.cos_mlambda);
+    free(Shared.sin_mlambda);
+    return Flag;
+} /*MAG_GridEvaluateElements*/
+
+static const char *MAG_GridElementNames[26] = {"Decl", "Decl", "Incl", "F", "H", "X", "Y", "Z", "GV", "Decldot", "Incldot", "Fdot",
+    "Hdot", "Xdot", "Ydot", "Zdot", "GVdot", "dX/dphi", "dY/dphi", "dZ/dphi", "dX/dlambda", "dY/dlambda", "dZ/dlambda",
+    "dX/dz", "dY/dz", "dZ/dz"};
+
+static const char *MAG_GridElementUnits[26] = {"deg", "deg", "deg", "nT", "nT", "nT", "nT", "nT", "deg", "min/yr", "min/yr", "nT/yr",
+    "nT/yr", "nT/yr", "nT/yr", "nT/yr", "deg/yr", "nT/km", "nT/km", "nT/km", "nT/km", "nT/km", "nT/km", "nT/km", "nT/km", "nT/km"};
+
+const char *MAG_GridElementName(int Element)
+/* Short name of an element option (1-25), as used in the raster headers */
+{
+    return MAG_GridElementNames[(Element >= 1 && Element <= 25) ? Element : 0];
+} /*MAG_GridElementName*/
+
+int MAG_GridRasterBands(MAGtype_GridParameters *Parameters, int *Elements, int *Uncertainties)
+/* Lists the bands of the raster output of Parameters, in the order they are written. Elements receives the
+element option (1-25, as in MAG_GetUserGrid) of each band and Uncertainties whether the band holds the
+uncertainty of that element instead of its value. Both need MAG_GRID_MAX_BANDS entries.
+Returns the number of bands, 0 for text output. */
+{
+    int e, NumBands = 0;
+
+    if(Parameters->OutputFormat == MAG_GRID_RASTER)
+    {
+        e = (Parameters->ElementOption >= 1 && Parameters->ElementOption <= 25) ? Parameters->ElementOption : 1;
+        Elements[NumBands] = e;
+        Uncertainties[NumBands++] = 0;
+        if(e <= 8 && Parameters->UncertaintyOption == 1)
+        {
+            Elements[NumBands] = e;
+            Uncertainties[NumBands++] = 1;
+        }
+    } else if(Parameters->OutputFormat == MAG_GRID_RASTER_BANDS)
+    {
+        for(e = 1; e <= 16; e++)
+        {
+            Elements[NumBands] = e;
+            Uncertainties[NumBands++] = 0;
+        }
+        for(e = 1; e <= 8 && Parameters->UncertaintyOption == 1; e++)
+        {
+            Elements[NumBands] = e;
+            Uncertainties[NumBands++] = 1;
+        }
+    }
+    return NumBands;
+} /*MAG_GridRasterBands*/
+
+int MAG_GridRasterHeader(MAGtype_GridParameters *Parameters, MAGtype_MagneticModel *MagneticModel, MAGtype_Geoid *Geoid, FILE *HeaderOut)
+
+/* Writes the text sidecar of a raster written by MAG_GridEvaluate: one "key = value" line per item. Each
+axis line gives the number of values, the first value and the step; the values of an axis are accumulated
+as in the loops of MAG_Grid (first, first + step, ...). Then one line per band with its element and unit.
+
+INPUT: Parameters  The parameters given to MAG_GridEvaluate
+           MagneticModel
+           Geoid        Tells whether the altitudes are above mean sea level or the ellipsoid
+           HeaderOut
+OUTPUT: Returns FALSE for text output, or if the axes could not be allocated or the header could not be written
+
+CALLS : MAG_GridRasterBands
+ */
+{
+    static const unsigned short ByteOrder = 1;
+    const char *AxisNames[4] = {"altitude", "latitude", "longitude", "year"};
+    const char *AxisUnits[4] = {"km", "deg", "deg", "decimal years"};
+    double First[4], Step[4], *Values;
+    int Elements[MAG_GRID_MAX_BANDS], Uncertainties[MAG_GRID_MAX_BANDS], Count[4], i, NumBands;
+
+    NumBands = MAG_GridRasterBands(Parameters, Elements, Uncertainties);
+    if(NumBands == 0)
+        return FALSE;
+    First[0] = Parameters->minimum.HeightAboveGeoid;
+    Step[0] = MAG_GridStep(Parameters->altitude_step_size);
+    First[1] = Parameters->minimum.phi;
+    Step[1] = MAG_GridStep(Parameters->cord_step_size);
+    First[2] = Parameters->minimum.lambda;
+    Step[2] = Step[1];
+    First[3] = Parameters->StartDate.DecimalYear;
+    Step[3] = MAG_GridStep(Parameters->time_step);
+    for(i = 0; i < 4; i++)
+    {
+        Values = MAG_GridAxis(First[i], i == 0 ? Parameters->maximum.HeightAboveGeoid : i == 1 ? Parameters->maximum.phi :
+                i == 2 ? Parameters->maximum.lambda : Parameters->EndDate.DecimalYear, Step[i], &Count[i]);
+        if(Values == NULL)
+            return FALSE;
+        free(Values);
+        if(Count[i] <= 1)
+            Step[i] = 0;
+    }
+
+    fprintf(HeaderOut, "WMM grid raster\n");
+    fprintf(HeaderOut, "version = %d\n", MAG_GRID_RASTER_VERSION);
+    fprintf(HeaderOut, "model = %s %.1f\n", MagneticModel->ModelName, MagneticModel->epoch);
+    fprintf(HeaderOut, "data type = float32\n");
+    fprintf(HeaderOut, "byte order = %s\n", *(const unsigned char *) &ByteOrder ? "little endian" : "big endian");
+    fprintf(HeaderOut, "interleave = bip\n");
+    fprintf(HeaderOut, "dimensions = altitude latitude longitude year band (last varies fastest)\n");
+    for(i = 0; i < 4; i++)
+        fprintf(HeaderOut, "%s = %d %.10g %.10g %s%s\n", AxisNames[i], Count[i], First[i], Step[i], AxisUnits[i],
+                i > 0 ? "" : Geoid->UseGeoid == 1 ? " above mean sea level" : " above the WGS-84 ellipsoid");
+    fprintf(HeaderOut, "cells = %.0f\n", (double) Count[0] * Count[1] * Count[2] * Count[3]);
+    fprintf(HeaderOut, "bands = %d\n", NumBands);
+    for(i = 0; i < NumBands; i++)
+        fprintf(HeaderOut, "band %d = %d %s%s %s\n", i + 1, Elements[i], MAG_GridElementNames[Elements[i]],
+                Uncertainties[i] ? " uncertainty" : "", MAG_GridElementUnits[Elements[i]]);
+    return !ferror(HeaderOut);
+} /*MAG_GridRasterHeader*/
@@ -0,0 +1,95 @@
+/*
+ * Grid evaluation engine used by the wmm_grid program.
+ *
+ * The engine evaluates the altitude / latitude / longitude / time grid of MAG_Grid. Latitude rows
+ * are distributed over a pool of worker threads, each with its own evaluation context and time
+ * adjusted model, and the rows are written in the same order as the serial loops.
+ * Define MAG_NO_THREADS to build the engine without POSIX threads (rows are then evaluated serially).
+ *
+ * Besides the text lines of MAG_Grid, the engine writes raw float32 rasters (OutputFormat): the selected
+ * element, or every element of MAGtype_GeoMagneticElements as bands in one pass. The cells are in the
+ * order of the text lines (altitude, latitude, longitude, year, the last varying fastest) with the bands
+ * of a cell next to each other (band interleaved by pixel), in the byte order of the host. The axes,
+ * bands and byte order are described by a text sidecar written with MAG_GridRasterHeader.
+ *
+ * MAG_GridEvaluateElements evaluates the grid once for several elements (ElementMask) and streams each
+ * element to its own output, in the format of a single element run.
+ */
+
+#ifndef GEOMAGGRIDLIB_H
+#define GEOMAGGRIDLIB_H
+
+#include <stdio.h>
+
+#define MAG_GRID_MAX_THREADS 256 /* Upper limit of MAGtype_GridParameters.NumThreads */
+
+#define MAG_GRID_TEXT 0 /* One line per cell, as MAG_Grid */
+#define MAG_GRID_RASTER 1 /* float32 raster of the selected element, and its uncertainty */
+#define MAG_GRID_RASTER_BANDS 2 /* float32 raster of elements 1-16, and the uncertainties of elements 1-8 */
+#define MAG_GRID_RASTER_VERSION 1 /* Version of the MAG_GridRasterHeader sidecar */
+#define MAG_GRID_MAX_BANDS 24
+#define MAG_GRID_MAX_SINKS 25 /* Elements 1-25, one output stream each */
+#define MAG_GRID_ELEMENT(e) (1UL << ((e) - 1)) /* Bit of element e (1-25) in ElementMask and UncertaintyMask */
+#define MAG_GRID_FILE_BUFFER (1 << 20) /* Suggested stdio buffer of a grid output file, see setvbuf */
+
+typedef struct {
+    MAGtype_CoordGeodetic minimum; /* Minimum limits of the grid, HeightAboveGeoid holds the start altitude */
+    MAGtype_CoordGeodetic maximum; /* Maximum limits of the grid */
+    double cord_step_size; /* Spatial step size (decimal degrees) */
+    double altitude_step_size; /* Altitude step size (km) */
+    double time_step; /* Time step size (decimal years) */
+    MAGtype_Date StartDate;
+    MAGtype_Date EndDate;
+    int ElementOption; /* Geomagnetic element to print, 1-25 as in MAG_GetUserGrid */
+    int UncertaintyOption; /* 1 - Append uncertainties. Otherwise do not append uncertainties */
+    unsigned long ElementMask; /* MAG_GridEvaluateElements: MAG_GRID_ELEMENT(e) of every element to write, 0 to use ElementOption */
+    unsigned long UncertaintyMask; /* With ElementMask: MAG_GRID_ELEMENT(e) of the elements written with their uncertainty (1-8) */
+    int NumThreads; /* Number of worker threads, 0 to use one per online processor */
+    int Separable; /* 1 - Reuse the longitude terms per column and, without geoid, the Legendre functions per row */
+    int AnalyticGradient; /* 1 - Elements 17-25 from MAG_GradientSummation_ctx instead of the central differences of MAG_Gradient */
+    int LinearTime; /* 1 - Sum each cell once and derive every year from its main field and secular variation (elements 1-16) */
+    int OutputFormat; /* MAG_GRID_TEXT, MAG_GRID_RASTER or MAG_GRID_RASTER_BANDS */
+    double MinHeight; /* Ellipsoid heights outside [MinHeight, MaxHeight] are reported with HeightWarning */
+    double MaxHeight;
+    const char *HeightWarning; /* NULL to skip the height check */
+} MAGtype_GridParameters;
+
+typedef struct {
+    int BozWarningStrong; /* Some locations have H <= 2000 nT */
+    int BozWarningWeak; /* Some locations have 2000 < H <= 6000 nT */
+    int AltitudeWarning; /* Some locations were outside [MinHeight, MaxHeight] */
+    long NumCells; /* Number of lines (raster cells) written */
+    int NumBands; /* Values per raster cell summed over the outputs, 0 for text output */
+    int NumThreads; /* Number of worker threads used */
+    unsigned long TimedModelHits; /* Cells that reused a time adjusted model, summed over the workers */
+    unsigned long TimedModelMisses; /* Cells that time adjusted the model */
+} MAGtype_GridStatus;
+
+int MAG_GridEvaluate(MAGtype_GridParameters *Parameters,
+        MAGtype_MagneticModel *MagneticModel,
+        MAGtype_Geoid *Geoid,
+        MAGtype_Ellipsoid Ellip,
+        FILE *DataOut,
+        FILE *MessageOut,
+        MAGtype_GridStatus *Status);
+
+int MAG_GridEvaluateElements(MAGtype_GridParameters *Parameters,
+        MAGtype_MagneticModel *MagneticModel,
+        MAGtype_Geoid *Geoid,
+        MAGtype_Ellipsoid Ellip,
+        FILE **DataOut,
+        FILE *MessageOut,
+        MAGtype_GridStatus *Status);
+
+int MAG_GridDefaultThreads(void);
+
+const char *MAG_GridElementName(int Element);
+
+int MAG_GridRasterBands(MAGtype_GridParameters *Parameters, int *Elements, int *Uncertainties);
+
+int MAG_GridRasterHeader(MAGtype_GridParameters *Parameters,
+        MAGtype_MagneticModel *MagneticModel,
+        MAGtype_Geoid *Geoid,
+        FILE *HeaderOut);
+
+#endif /*GEOMAGGRIDLIB_H*/
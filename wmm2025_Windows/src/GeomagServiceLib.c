@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include "GeomagnetismHeader.h"
+#include "GeomagServiceLib.h"
+
+/*
+ * Request / response protocol of the wmm_service query daemon, see GeomagServiceLib.h for the layout.
+ */
+
+void MAG_ServicePackHeader(const char *Magic, const MAGtype_ServiceHeader *Header, unsigned char *Buffer)
+/* Writes the MAG_SERVICE_HEADER_SIZE bytes of a request ("WMMQ") or response ("WMMR") header */
+{
+    memcpy(Buffer, Magic, 4);
+    memcpy(Buffer + 4, &Header->Version, 2);
+    memcpy(Buffer + 6, &Header->Flags, 2);
+    memcpy(Buffer + 8, &Header->RequestId, 4);
+    memcpy(Buffer + 12, &Header->Count, 4);
+} /*MAG_ServicePackHeader*/
+
+int MAG_ServiceUnpackHeader(const char *Magic, const unsigned char *Buffer, MAGtype_ServiceHeader *Header)
+/* Reads a header written by MAG_ServicePackHeader. Returns FALSE if the magic or the version differ. */
+{
+    if(memcmp(Buffer, Magic, 4) != 0)
+        return FALSE;
+    memcpy(&Header->Version, Buffer + 4, 2);
+    memcpy(&Header->Flags, Buffer + 6, 2);
+    memcpy(&Header->RequestId, Buffer + 8, 4);
+    memcpy(&Header->Count, Buffer + 12, 4);
+    return Header->Version == MAG_SERVICE_VERSION;
+} /*MAG_ServiceUnpackHeader*/
+
+int MAG_ServiceEvaluate(MAGtype_EvalContext *Context, MAGtype_TimedModelCache *Cache, MAGtype_Ellipsoid Ellip, MAGtype_Geoid *Geoid,
+        MAGtype_MagneticModel *MagneticModel, int Flags, int Count, const double *Queries, double *Results)
+/*
+Evaluates the queries of one request into the values of its response. The model is time adjusted through the
+cache, so a batch of queries of one date, or of a few dates, adjusts it once per date. Context and Cache belong
+to the calling thread; MagneticModel and Geoid are only read and may be shared by all of the workers.
+
+INPUT: Context   Allocated for at least MagneticModel->nMax
+              Cache     Allocated for at least MagneticModel->nMax
+              Ellip
+              Geoid     With the EGM96 heights, used with MAG_SERVICE_HEIGHT_MSL (UseGeoid is ignored)
+              MagneticModel   The model as read from the coefficient file (not time adjusted)
+              Flags     Of the request
+              Count
+              Queries   Count * MAG_SERVICE_QUERY_VALUES values, see GeomagServiceLib.h
+
+OUTPUT : Results   Count * MAG_SERVICE_RESULT_VALUES values, NaN for invalid queries
+              Returns FALSE if MSL heights were asked for without an initialized geoid, or a model does not fit
+              the context
+
+CALLS:  	MAG_ConvertGeoidToEllipsoidHeight, MAG_GeodeticToSpherical, MAG_TimelyModifyMagneticModel_cache,
+                     MAG_Geomag_ctx, MAG_CalculateGridVariation
+ */
+{
+    MAGtype_CoordGeodetic CoordGeodetic;
+    MAGtype_CoordSpherical CoordSpherical;
+    MAGtype_MagneticModel *TimedMagneticModel;
+    MAGtype_GeoMagneticElements GeoMagneticElements;
+    MAGtype_Geoid MslGeoid;
+    MAGtype_Date UserDate;
+    const double *Query;
+    double *Result;
+    int i, k;
+
+    if((Flags & MAG_SERVICE_HEIGHT_MSL) && (Geoid == NULL || !Geoid->Geoid_Initialized))
+        return FALSE;
+    if(Geoid != NULL)
+    {
+        MslGeoid = *Geoid;
+        MslGeoid.UseGeoid = 1;
+    }
+    CoordGeodetic.UseGeoid = (Flags & MAG_SERVICE_HEIGHT_MSL) ? 1 : 0;
+    for(i = 0; i < Count; i++)
+    {
+        Query = Queries + (size_t) i * MAG_SERVICE_QUERY_VALUES;
+        Result = Results + (size_t) i * MAG_SERVICE_RESULT_VALUES;
+        if(MAG_isNaN(Query[0]) || MAG_isNaN(Query[1]) || MAG_isNaN(Query[2]) || MAG_isNaN(Query[3]) || fabs(Query[0]) > 90.0 ||
+                Query[1] < -180.0 || Query[1] > 360.0)
+        {
+            for(k = 0; k < MAG_SERVICE_RESULT_VALUES; k++)
+                Result[k] = NAN;
+            continue;
+        }
+        CoordGeodetic.phi = Query[0];
+        CoordGeodetic.lambda = Query[1];
+        if(CoordGeodetic.UseGeoid)
+        {
+            CoordGeodetic.HeightAboveGeoid = Query[2];
+            if(!MAG_ConvertGeoidToEllipsoidHeight(&CoordGeodetic, &MslGeoid))
+                return FALSE;
+        } else
+            CoordGeodetic.HeightAboveEllipsoid = CoordGeodetic.HeightAboveGeoid = Query[2];
+        UserDate.DecimalYear = Query[3];
+        MAG_GeodeticToSpherical(Ellip, CoordGeodetic, &CoordSpherical);
+        TimedMagneticModel = MAG_TimelyModifyMagneticModel_cache(Cache, UserDate, MagneticModel);
+        if(TimedMagneticModel == NULL || !MAG_Geomag_ctx(Context, Ellip, CoordSpherical, CoordGeodetic, TimedMagneticModel, &GeoMagneticElements))
+            return FALSE;
+        MAG_CalculateGridVariation(CoordGeodetic, &GeoMagneticElements);
+        Result[0] = GeoMagneticElements.Decl;
+        Result[1] = GeoMagneticElements.Incl;
+        Result[2] = GeoMagneticElements.F;
+        Result[3] = GeoMagneticElements.H;
+        Result[4] = GeoMagneticElements.X;
+        Result[5] = GeoMagneticElements.Y;
+        Result[6] = GeoMagneticElements.Z;
+        Result[7] = GeoMagneticElements.GV;
+    }
+    return TRUE;
+} /*MAG_ServiceEvaluate*/
@@ -0,0 +1,71 @@
+/*
+ * Request / response protocol of the wmm_service query daemon.
+ *
+ * The daemon loads the model once and answers batches of queries over a Unix domain socket
+ * (see main/wmm_service.c, main/wmm_load.c is a load generator). A client sends a request and reads
+ * its response before sending the next one on the same connection; it may keep the connection open
+ * for any number of requests. Both ends are on the same machine, so all fields are in the byte order
+ * of the host.
+ *
+ * Request:
+ *
+ *   offset  type       field
+ *        0  char[4]    "WMMQ"
+ *        4  uint16     Version (MAG_SERVICE_VERSION)
+ *        6  uint16     Flags (MAG_SERVICE_HEIGHT_MSL)
+ *        8  uint32     RequestId, returned in the response
+ *       12  uint32     Count, number of queries (at most MAG_SERVICE_MAX_QUERIES)
+ *       16  float64    Count queries of MAG_SERVICE_QUERY_VALUES values: latitude (deg), longitude (deg),
+ *                      height (km above the ellipsoid, or above mean sea level with MAG_SERVICE_HEIGHT_MSL)
+ *                      and date (decimal years)
+ *
+ * Response:
+ *
+ *   offset  type       field
+ *        0  char[4]    "WMMR"
+ *        4  uint16     Version (MAG_SERVICE_VERSION)
+ *        6  uint16     Status (MAG_SERVICE_OK, ...), no results follow unless MAG_SERVICE_OK
+ *        8  uint32     RequestId of the request
+ *       12  uint32     Count, number of results
+ *       16  float64    Count results of MAG_SERVICE_RESULT_VALUES values: Decl, Incl (deg), F, H, X, Y, Z (nT)
+ *                      and GV (deg). A query with a latitude outside [-90, 90], a longitude outside [-180, 360]
+ *                      or a value that is not a number gives NaN results.
+ *
+ * This file and GeomagServiceLib.c only depend on the C library and the Geomagnetism library; the socket
+ * handling is in the programs.
+ */
+
+#ifndef GEOMAGSERVICELIB_H
+#define GEOMAGSERVICELIB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MAG_SERVICE_VERSION 1
+#define MAG_SERVICE_HEADER_SIZE 16
+#define MAG_SERVICE_MAX_QUERIES 65536 /* Largest Count of a request, 2 MB of queries */
+#define MAG_SERVICE_QUERY_VALUES 4
+#define MAG_SERVICE_RESULT_VALUES 8
+
+#define MAG_SERVICE_HEIGHT_MSL 0x0001 /* The heights are above mean sea level (EGM96) */
+
+#define MAG_SERVICE_OK 0
+#define MAG_SERVICE_BAD_REQUEST 1 /* Unknown magic, version or flags */
+#define MAG_SERVICE_TOO_LARGE 2 /* Count above MAG_SERVICE_MAX_QUERIES */
+#define MAG_SERVICE_FAILED 3 /* The evaluation failed */
+
+typedef struct {
+    uint16_t Version;
+    uint16_t Flags; /* Request flags, or the status of a response */
+    uint32_t RequestId;
+    uint32_t Count;
+} MAGtype_ServiceHeader;
+
+void MAG_ServicePackHeader(const char *Magic, const MAGtype_ServiceHeader *Header, unsigned char *Buffer);
+
+int MAG_ServiceUnpackHeader(const char *Magic, const unsigned char *Buffer, MAGtype_ServiceHeader *Header);
+
+int MAG_ServiceEvaluate(MAGtype_EvalContext *Context, MAGtype_TimedModelCache *Cache, MAGtype_Ellipsoid Ellip, MAGtype_Geoid *Geoid,
+        MAGtype_MagneticModel *MagneticModel, int Flags, int Count, const double *Queries, double *Results);
+
+#endif /*GEOMAGSERVICELIB_H*/
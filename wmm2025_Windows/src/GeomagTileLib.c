@@ -0,0 +1,320 @@
+#include <string.h>
+#include <math.h>
+#include "GeomagTileLib.h"
+
+/*
+ * Declination / inclination lookup tiles, see GeomagTileLib.h for the file layout.
+ *
+ * The samples are read byte by byte, so a tile can be used in place from any buffer (a file read
+ * into memory, a constant array or a flash partition) on hosts of either byte order.
+ */
+
+static void MAG_TilePutU16(unsigned char *p, unsigned int v)
+{
+    p[0] = (unsigned char) (v & 0xFF);
+    p[1] = (unsigned char) ((v >> 8) & 0xFF);
+}
+
+static void MAG_TilePutU32(unsigned char *p, uint32_t v)
+{
+    p[0] = (unsigned char) (v & 0xFF);
+    p[1] = (unsigned char) ((v >> 8) & 0xFF);
+    p[2] = (unsigned char) ((v >> 16) & 0xFF);
+    p[3] = (unsigned char) ((v >> 24) & 0xFF);
+}
+
+static void MAG_TilePutFloat(unsigned char *p, float f)
+{
+    uint32_t v;
+
+    memcpy(&v, &f, sizeof (v));
+    MAG_TilePutU32(p, v);
+}
+
+static unsigned int MAG_TileGetU16(const unsigned char *p)
+{
+    return (unsigned int) p[0] | ((unsigned int) p[1] << 8);
+}
+
+static uint32_t MAG_TileGetU32(const unsigned char *p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static float MAG_TileGetFloat(const unsigned char *p)
+{
+    uint32_t v = MAG_TileGetU32(p);
+    float f;
+
+    memcpy(&f, &v, sizeof (f));
+    return f;
+}
+
+static uint32_t MAG_TileChecksum(const unsigned char *p, size_t n)
+/* 32 bit FNV-1a */
+{
+    uint32_t h = 2166136261u;
+
+    while(n--)
+    {
+        h ^= *p++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static double MAG_TileSample(const MAGtype_Tile *Tile, int Band, int i, int j)
+/* Sample (i, j) of band 0 (declination) or 1 (inclination) in degrees, indices clamped to the tile */
+{
+    const unsigned char *p;
+    int v;
+
+    if(i < 0) i = 0;
+    if(i >= Tile->NumLat) i = Tile->NumLat - 1;
+    if(j < 0) j = 0;
+    if(j >= Tile->NumLon) j = Tile->NumLon - 1;
+    p = Tile->Samples + 2 * ((size_t) Band * Tile->NumLat * Tile->NumLon + (size_t) i * Tile->NumLon + j);
+    v = (int) MAG_TileGetU16(p);
+    if(v >= 32768)
+        v -= 65536;
+    return (double) v * (Band == 0 ? Tile->DeclScale : Tile->InclScale);
+}
+
+static double MAG_TileUnwrap(double Value, double Reference)
+/* Moves a declination by a multiple of 360 degrees to within 180 degrees of Reference */
+{
+    while(Value - Reference > 180.0)
+        Value -= 360.0;
+    while(Value - Reference < -180.0)
+        Value += 360.0;
+    return Value;
+}
+
+static void MAG_TileCubicWeights(double t, double *w)
+/* Catmull-Rom weights of the samples at -1, 0, 1 and 2 for 0 <= t <= 1 */
+{
+    double t2 = t * t, t3 = t2 * t;
+
+    w[0] = 0.5 * (-t3 + 2.0 * t2 - t);
+    w[1] = 0.5 * (3.0 * t3 - 5.0 * t2 + 2.0);
+    w[2] = 0.5 * (-3.0 * t3 + 4.0 * t2 + t);
+    w[3] = 0.5 * (t3 - t2);
+}
+
+static double MAG_TileInterpolate(const MAGtype_Tile *Tile, int Band, int i, int j, double u, double v, int Mode)
+/* Interpolates a band in the cell (i, j) at the fractional position (u, v). Declination is unwrapped around the cell corner. */
+{
+    double Reference, Value, Row, wi[4], wj[4], s[4][4];
+    int k, l;
+
+    Reference = MAG_TileSample(Tile, Band, i, j);
+    if(Mode == MAG_TILE_BICUBIC)
+    {
+        /* 4 x 4 neighbourhood. Beyond the edges of the tile the samples are extrapolated linearly. */
+        for(k = 0; k < 4; k++)
+            for(l = 0; l < 4; l++)
+            {
+                s[k][l] = MAG_TileSample(Tile, Band, i + k - 1, j + l - 1);
+                if(Band == 0)
+                    s[k][l] = MAG_TileUnwrap(s[k][l], Reference);
+            }
+        for(l = 0; l < 4 && Tile->NumLat > 1; l++)
+        {
+            if(i - 1 < 0)
+                s[0][l] = 2.0 * s[1][l] - s[2][l];
+            if(i + 2 >= Tile->NumLat)
+                s[3][l] = 2.0 * s[2][l] - s[1][l];
+        }
+        for(k = 0; k < 4 && Tile->NumLon > 1; k++)
+        {
+            if(j - 1 < 0)
+                s[k][0] = 2.0 * s[k][1] - s[k][2];
+            if(j + 2 >= Tile->NumLon)
+                s[k][3] = 2.0 * s[k][2] - s[k][1];
+        }
+        MAG_TileCubicWeights(u, wi);
+        MAG_TileCubicWeights(v, wj);
+        Value = 0;
+        for(k = 0; k < 4; k++)
+        {
+            Row = 0;
+            for(l = 0; l < 4; l++)
+                Row += wj[l] * s[k][l];
+            Value += wi[k] * Row;
+        }
+    } else
+    {
+        double s00, s01, s10, s11;
+
+        s00 = Reference;
+        s01 = MAG_TileSample(Tile, Band, i, j + 1);
+        s10 = MAG_TileSample(Tile, Band, i + 1, j);
+        s11 = MAG_TileSample(Tile, Band, i + 1, j + 1);
+        if(Band == 0)
+        {
+            s01 = MAG_TileUnwrap(s01, Reference);
+            s10 = MAG_TileUnwrap(s10, Reference);
+            s11 = MAG_TileUnwrap(s11, Reference);
+        }
+        Value = (1.0 - u) * ((1.0 - v) * s00 + v * s01) + u * ((1.0 - v) * s10 + v * s11);
+    }
+    if(Band == 0)
+        Value = MAG_TileUnwrap(Value, 0.0);
+    return Value;
+} /*MAG_TileInterpolate*/
+
+size_t MAG_TileSize(int NumLat, int NumLon)
+/* Size in bytes of a tile with NumLat rows and NumLon columns */
+{
+    return MAG_TILE_HEADER_SIZE + 2 * 2 * (size_t) NumLat * (size_t) NumLon;
+} /*MAG_TileSize*/
+
+int MAG_TileEncode(MAGtype_Tile *Tile, const double *Decl, const double *Incl, unsigned char *Buffer)
+
+/* Quantizes the declination and inclination of every node and writes the tile to Buffer.
+
+INPUT: Tile  NumLat, NumLon, window, date, height and error estimates. DeclScale and InclScale are chosen here
+            from the largest magnitude of each band.
+       Decl, Incl  NumLat * NumLon values in degrees, latitude major
+OUTPUT: Buffer  MAG_TileSize(NumLat, NumLon) bytes
+        Tile  Scales, checksum and Samples (pointing into Buffer) are set
+        Returns FALSE if the dimensions are out of range
+ */
+{
+    unsigned char *Samples = Buffer + MAG_TILE_HEADER_SIZE;
+    double Largest;
+    long q;
+    size_t k, NumNodes;
+    int Band;
+
+    if(Tile->NumLat < 1 || Tile->NumLon < 1 || Tile->NumLat > MAG_TILE_MAX_NODES || Tile->NumLon > MAG_TILE_MAX_NODES)
+        return FALSE;
+    NumNodes = (size_t) Tile->NumLat * Tile->NumLon;
+    for(Band = 0; Band < 2; Band++)
+    {
+        const double *Values = Band == 0 ? Decl : Incl;
+        float Scale;
+
+        Largest = 0;
+        for(k = 0; k < NumNodes; k++)
+            if(fabs(Values[k]) > Largest)
+                Largest = fabs(Values[k]);
+        Scale = Largest > 0 ? (float) (Largest / 32767.0) : 1.0f;
+        /* Rounding the scale to float may make it slightly small, keep every count within int16 */
+        while(Largest / Scale > 32767.0)
+            Scale = nextafterf(Scale, 2.0f * Scale);
+        for(k = 0; k < NumNodes; k++)
+        {
+            q = lround(Values[k] / Scale);
+            MAG_TilePutU16(Samples + 2 * (Band * NumNodes + k), (unsigned int) (q & 0xFFFF));
+        }
+        if(Band == 0)
+            Tile->DeclScale = Scale;
+        else
+            Tile->InclScale = Scale;
+    }
+    Tile->Checksum = MAG_TileChecksum(Samples, 4 * NumNodes);
+    Tile->Samples = Samples;
+
+    memcpy(Buffer, "WMMT", 4);
+    MAG_TilePutU16(Buffer + 4, MAG_TILE_VERSION);
+    MAG_TilePutU16(Buffer + 6, MAG_TILE_HEADER_SIZE);
+    MAG_TilePutU16(Buffer + 8, (unsigned int) Tile->NumLat);
+    MAG_TilePutU16(Buffer + 10, (unsigned int) Tile->NumLon);
+    MAG_TilePutFloat(Buffer + 12, Tile->LatMin);
+    MAG_TilePutFloat(Buffer + 16, Tile->LonMin);
+    MAG_TilePutFloat(Buffer + 20, Tile->LatStep);
+    MAG_TilePutFloat(Buffer + 24, Tile->LonStep);
+    MAG_TilePutFloat(Buffer + 28, Tile->DecimalYear);
+    MAG_TilePutFloat(Buffer + 32, Tile->Height);
+    MAG_TilePutFloat(Buffer + 36, Tile->DeclScale);
+    MAG_TilePutFloat(Buffer + 40, Tile->InclScale);
+    MAG_TilePutFloat(Buffer + 44, Tile->DeclError[MAG_TILE_BILINEAR]);
+    MAG_TilePutFloat(Buffer + 48, Tile->DeclError[MAG_TILE_BICUBIC]);
+    MAG_TilePutFloat(Buffer + 52, Tile->InclError[MAG_TILE_BILINEAR]);
+    MAG_TilePutFloat(Buffer + 56, Tile->InclError[MAG_TILE_BICUBIC]);
+    MAG_TilePutU32(Buffer + 60, Tile->Checksum);
+    return TRUE;
+} /*MAG_TileEncode*/
+
+int MAG_TileOpen(const void *Buffer, size_t Size, MAGtype_Tile *Tile)
+
+/* Checks a tile held in memory and reads its header. The samples are used in place.
+
+INPUT: Buffer  Tile bytes
+       Size    Number of bytes available
+OUTPUT: Tile  Header fields, Samples points into Buffer
+        Returns FALSE if the magic, version, size or checksum do not match
+ */
+{
+    const unsigned char *p = (const unsigned char *) Buffer;
+
+    if(Size < MAG_TILE_HEADER_SIZE || memcmp(p, "WMMT", 4) != 0)
+        return FALSE;
+    if(MAG_TileGetU16(p + 4) != MAG_TILE_VERSION || MAG_TileGetU16(p + 6) != MAG_TILE_HEADER_SIZE)
+        return FALSE;
+    Tile->NumLat = (int) MAG_TileGetU16(p + 8);
+    Tile->NumLon = (int) MAG_TileGetU16(p + 10);
+    if(Tile->NumLat < 1 || Tile->NumLon < 1 || Size < MAG_TileSize(Tile->NumLat, Tile->NumLon))
+        return FALSE;
+    Tile->LatMin = MAG_TileGetFloat(p + 12);
+    Tile->LonMin = MAG_TileGetFloat(p + 16);
+    Tile->LatStep = MAG_TileGetFloat(p + 20);
+    Tile->LonStep = MAG_TileGetFloat(p + 24);
+    Tile->DecimalYear = MAG_TileGetFloat(p + 28);
+    Tile->Height = MAG_TileGetFloat(p + 32);
+    Tile->DeclScale = MAG_TileGetFloat(p + 36);
+    Tile->InclScale = MAG_TileGetFloat(p + 40);
+    Tile->DeclError[MAG_TILE_BILINEAR] = MAG_TileGetFloat(p + 44);
+    Tile->DeclError[MAG_TILE_BICUBIC] = MAG_TileGetFloat(p + 48);
+    Tile->InclError[MAG_TILE_BILINEAR] = MAG_TileGetFloat(p + 52);
+    Tile->InclError[MAG_TILE_BICUBIC] = MAG_TileGetFloat(p + 56);
+    Tile->Checksum = MAG_TileGetU32(p + 60);
+    Tile->Samples = p + MAG_TILE_HEADER_SIZE;
+    if(!(Tile->LatStep > 0) || !(Tile->LonStep > 0))
+        return FALSE;
+    if(MAG_TileChecksum(Tile->Samples, 4 * (size_t) Tile->NumLat * Tile->NumLon) != Tile->Checksum)
+        return FALSE;
+    return TRUE;
+} /*MAG_TileOpen*/
+
+int MAG_TileLookup(const MAGtype_Tile *Tile, double Latitude, double Longitude, int Mode, double *Decl, double *Incl)
+
+/* Interpolates the declination and inclination of a tile.
+
+INPUT: Tile       Opened with MAG_TileOpen or MAG_TileEncode
+       Latitude   Geodetic latitude (degrees)
+       Longitude  Longitude (degrees), taken modulo 360 into the tile window
+       Mode       MAG_TILE_BILINEAR or MAG_TILE_BICUBIC
+OUTPUT: Decl  Declination (degrees, -180 to 180)
+        Incl  Inclination (degrees)
+        Returns FALSE if the location is outside the tile or not finite
+ */
+{
+    double x, y, u, v, LatMax, LonMax;
+    int i, j;
+
+    if(!isfinite(Latitude) || !isfinite(Longitude))
+        return FALSE;
+    LatMax = Tile->LatMin + (double) Tile->LatStep * (Tile->NumLat - 1);
+    LonMax = Tile->LonMin + (double) Tile->LonStep * (Tile->NumLon - 1);
+    Longitude = fmod(Longitude - Tile->LonMin, 360.0);
+    if(Longitude < 0)
+        Longitude += 360.0;
+    Longitude += Tile->LonMin;
+    if(Latitude < Tile->LatMin || Latitude > LatMax || Longitude > LonMax)
+        return FALSE;
+
+    y = (Latitude - Tile->LatMin) / Tile->LatStep;
+    x = (Longitude - Tile->LonMin) / Tile->LonStep;
+    i = (int) y;
+    j = (int) x;
+    if(i > Tile->NumLat - 2) i = Tile->NumLat > 1 ? Tile->NumLat - 2 : 0;
+    if(j > Tile->NumLon - 2) j = Tile->NumLon > 1 ? Tile->NumLon - 2 : 0;
+    u = y - i;
+    v = x - j;
+
+    *Decl = MAG_TileInterpolate(Tile, 0, i, j, u, v, Mode);
+    *Incl = MAG_TileInterpolate(Tile, 1, i, j, u, v, Mode);
+    return TRUE;
+} /*MAG_TileLookup*/
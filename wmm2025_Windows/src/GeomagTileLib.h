@@ -0,0 +1,72 @@
+/*
+ * Declination / inclination lookup tiles.
+ *
+ * A tile holds the declination and inclination of the model on a regular latitude / longitude window,
+ * for one date and one height above the ellipsoid, quantized to 16 bit integers. It is generated on a
+ * host by the wmm_tile program and looked up on the device without the spherical harmonic model, so
+ * this file and GeomagTileLib.c only depend on the C library.
+ *
+ * File layout, all fields little endian:
+ *
+ *   offset  type       field
+ *        0  char[4]    "WMMT"
+ *        4  uint16     Version (MAG_TILE_VERSION)
+ *        6  uint16     HeaderSize (MAG_TILE_HEADER_SIZE)
+ *        8  uint16     NumLat
+ *       10  uint16     NumLon
+ *       12  float32    LatMin, LonMin, LatStep, LonStep (degrees)
+ *       28  float32    DecimalYear, Height (km above the WGS-84 ellipsoid)
+ *       36  float32    DeclScale, InclScale (degrees per count)
+ *       44  float32    DeclError[2], InclError[2] (bilinear, bicubic error estimate against the model, degrees,
+ *                      sampled at generation, not a proven bound; see wmm_tile.c)
+ *       60  uint32     Checksum (32 bit FNV-1a of the samples)
+ *       64  int16      Decl[NumLat][NumLon], then Incl[NumLat][NumLon]
+ */
+
+#ifndef GEOMAGTILELIB_H
+#define GEOMAGTILELIB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef TRUE
+#define TRUE            ((int)1)
+#endif
+
+#ifndef FALSE
+#define FALSE           ((int)0)
+#endif
+
+#define MAG_TILE_VERSION 1
+#define MAG_TILE_HEADER_SIZE 64
+#define MAG_TILE_MAX_NODES 65535 /* Upper limit of NumLat and NumLon */
+
+#define MAG_TILE_BILINEAR 0
+#define MAG_TILE_BICUBIC 1
+
+typedef struct {
+    int NumLat; /* Number of latitude rows */
+    int NumLon; /* Number of longitude columns */
+    float LatMin; /* Latitude of the first row (degrees) */
+    float LonMin; /* Longitude of the first column (degrees) */
+    float LatStep; /* Row spacing (degrees) */
+    float LonStep; /* Column spacing (degrees) */
+    float DecimalYear; /* Date of the tile */
+    float Height; /* Height above the WGS-84 ellipsoid (km) */
+    float DeclScale; /* Degrees per declination count */
+    float InclScale; /* Degrees per inclination count */
+    float DeclError[2]; /* Declination error estimate, indexed by MAG_TILE_BILINEAR / MAG_TILE_BICUBIC */
+    float InclError[2]; /* Inclination error estimate */
+    uint32_t Checksum;
+    const unsigned char *Samples; /* Points into the tile buffer, not owned */
+} MAGtype_Tile;
+
+size_t MAG_TileSize(int NumLat, int NumLon);
+
+int MAG_TileEncode(MAGtype_Tile *Tile, const double *Decl, const double *Incl, unsigned char *Buffer);
+
+int MAG_TileOpen(const void *Buffer, size_t Size, MAGtype_Tile *Tile);
+
+int MAG_TileLookup(const MAGtype_Tile *Tile, double Latitude, double Longitude, int Mode, double *Decl, double *Incl);
+
+#endif /*GEOMAGTILELIB_H*/
@@ -107,6 +107,13 @@
 #define WGS84ON 1
 #define MSLON 2
 
+#define MAG_BATCH_BLOCK 32 /* Number of points evaluated together by MAG_GeomagBatch */
+#define MAG_FIXED_NMAX 12 /* Degree of the models evaluated by MAG_GeomagFixed */
+#define MAG_TRAJECTORY_LATITUDE_TOLERANCE 1e-4 /* Geocentric latitude change (deg, about 11 m) within which MAG_GeomagTrajectory reuses the Legendre functions */
+#define MAG_TRAJECTORY_RESEED_INTERVAL 1000 /* Fixes between two direct evaluations of the longitude sine and cosine */
+#define MAG_TRAJECTORY_MAX_STEP 1e-3 /* Longitude change (rad, about 6 km) above which the sine and cosine are evaluated directly */
+#define MAG_FIXED_NUMTERMS CALCULATE_NUMTERMS(MAG_FIXED_NMAX)
+
 
 /*
 Data types and prototype declaration for
@@ -211,6 +218,10 @@ typedef struct {
     int NumbGeoidElevs;
     int Geoid_Initialized; /* indicates successful initialization */
     int UseGeoid; /*Is the Geoid being used?*/
+    /* Used when GeoidHeightBuffer is NULL: returns the northwest, northeast, southwest and southeast heights (meters) of
+       the cell whose northwest post is at Row, Col, FALSE on failure (MAG_GeoidStorePosts of GeomagGeoidLib) */
+    int (*GetGeoidPosts)(void *GeoidData, int Row, int Col, double *Posts);
+    void *GeoidData;
 } MAGtype_Geoid;
 
 typedef struct {
@@ -220,6 +231,60 @@ typedef struct {
     MAGtype_GeoMagneticElements GradZ;            
 } MAGtype_Gradient;
 
+typedef struct {
+    double epoch; /* Base time of the model the basis was computed from (decimal years) */
+    MAGtype_MagneticResults MainField; /* Geodetic field components at epoch (nT) */
+    MAGtype_MagneticResults SecularVariation; /* Geodetic secular variation components (nT/yr) */
+    MAGtype_CoordGeodetic CoordGeodetic; /* Site of the basis, used for the grid variation */
+} MAGtype_SiteBasis;
+
+typedef struct {
+    int nMax; /* Maximum degree the buffers were sized for */
+    int NumTerms; /* (nMax + 1) * (nMax + 2) / 2 */
+    MAGtype_LegendreFunction LegendreFunction; /* Pcup and dPcup, NumTerms + 1 entries each */
+    MAGtype_SphericalHarmonicVariables SphVariables; /* nMax + 1 entries each */
+    double *PcupS; /* nMax + 1 entries, used by the summations at the geographic poles */
+    /* Recursion factors of the Legendre functions, computed for nMax on first use and read only afterwards */
+    int PcupLowTablesReady; /* schmidtQuasiNorm and RecursionK are set */
+    int PcupHighTablesReady; /* f1, f2 and PreSqr are set */
+    double *schmidtQuasiNorm; /* NumTerms + 1 entries, Schmidt quasi-normalization of MAG_PcupLow */
+    double *RecursionK; /* NumTerms + 1 entries, k of the MAG_PcupLow recursion */
+    double *f1; /* NumTerms + 1 entries, factors of the MAG_PcupHigh recursion */
+    double *f2; /* NumTerms + 1 entries, factors of the MAG_PcupHigh recursion */
+    double *PreSqr; /* NumTerms + 1 entries, sqrt(n) for n up to 2 nMax + 1, MAG_PcupHigh */
+} MAGtype_EvalContext;
+
+typedef struct {
+    MAGtype_EvalContext *Context; /* Legendre functions and spherical harmonic variables of the last fix */
+    double LatitudeTolerance; /* Geocentric latitude change (deg) within which the Legendre functions are reused, 0 to never reuse them */
+    int ReseedInterval; /* Incremental longitude updates between two direct evaluations */
+    int Valid; /* The tables below describe the last fix */
+    int nMax; /* Degree of the tables */
+    double lambda; /* Longitude of the trigonometric tables (deg) */
+    double cos_lambda, sin_lambda; /* Of lambda, updated by angle addition */
+    double phig; /* Geocentric latitude of the Legendre functions (deg) */
+    int StepsSinceSeed; /* Incremental longitude updates since the last direct evaluation */
+    unsigned long Fixes; /* Calls of MAG_GeomagTrajectory */
+    unsigned long LegendreUpdates; /* Fixes that recomputed the Legendre functions */
+    unsigned long Reseeds; /* Fixes that evaluated the longitude sine and cosine directly */
+} MAGtype_Trajectory;
+
+typedef struct {
+    MAGtype_MagneticModel *Source; /* Model the entry was time adjusted from, NULL if the entry is empty */
+    double DecimalYear;
+    MAGtype_MagneticModel *TimedMagneticModel;
+    unsigned long LastUse;
+} MAGtype_TimedModelCacheEntry;
+
+typedef struct {
+    int nMax; /* Maximum degree the entries were sized for */
+    int NumEntries;
+    MAGtype_TimedModelCacheEntry *Entries;
+    unsigned long Clock; /* Lookup counter, orders the entries by last use */
+    unsigned long Hits; /* Lookups answered without time adjusting the model */
+    unsigned long Misses; /* Lookups that called MAG_TimelyModifyMagneticModel */
+} MAGtype_TimedModelCache;
+
 typedef struct {
     char Longitude[40];
     char Latitude[40];
@@ -282,16 +347,72 @@ int MAG_Geomag(MAGtype_Ellipsoid Ellip,
         MAGtype_MagneticModel *TimedMagneticModel,
         MAGtype_GeoMagneticElements *GeoMagneticElements);
 
+int MAG_Geomag_ctx(MAGtype_EvalContext *Context,
+        MAGtype_Ellipsoid Ellip,
+        MAGtype_CoordSpherical CoordSpherical,
+        MAGtype_CoordGeodetic CoordGeodetic,
+        MAGtype_MagneticModel *TimedMagneticModel,
+        MAGtype_GeoMagneticElements *GeoMagneticElements);
+
+int MAG_GeomagFixed(MAGtype_Ellipsoid Ellip,
+        MAGtype_CoordSpherical CoordSpherical,
+        MAGtype_CoordGeodetic CoordGeodetic,
+        MAGtype_MagneticModel *TimedMagneticModel,
+        MAGtype_GeoMagneticElements *GeoMagneticElements);
+
+int MAG_GeomagBatch(MAGtype_Ellipsoid Ellip,
+        MAGtype_MagneticModel *MagneticModel,
+        int NumPoints,
+        const double *Latitude,
+        const double *Longitude,
+        const double *HeightAboveEllipsoid,
+        const double *DecimalYear,
+        MAGtype_GeoMagneticElements *GeoMagneticElements);
+
+int MAG_SiteBasis_ctx(MAGtype_EvalContext *Context,
+        MAGtype_Ellipsoid Ellip,
+        MAGtype_CoordSpherical CoordSpherical,
+        MAGtype_CoordGeodetic CoordGeodetic,
+        MAGtype_MagneticModel *MagneticModel,
+        MAGtype_SiteBasis *Basis);
+
+void MAG_SiteElements(const MAGtype_SiteBasis *Basis,
+        double DecimalYear,
+        MAGtype_GeoMagneticElements *GeoMagneticElements);
+
+int MAG_GeomagTrajectory(MAGtype_Trajectory *Trajectory,
+        MAGtype_Ellipsoid Ellip,
+        MAGtype_CoordGeodetic CoordGeodetic,
+        MAGtype_MagneticModel *MagneticModel,
+        double DecimalYear,
+        MAGtype_GeoMagneticElements *GeoMagneticElements);
+
+int MAG_SiteTimeSeries(MAGtype_Ellipsoid Ellip,
+        MAGtype_CoordGeodetic CoordGeodetic,
+        MAGtype_MagneticModel *MagneticModel,
+        int NumDates,
+        const double *DecimalYear,
+        MAGtype_GeoMagneticElements *GeoMagneticElements);
+
 void MAG_Gradient(MAGtype_Ellipsoid Ellip,
         MAGtype_CoordGeodetic CoordGeodetic, 
         MAGtype_MagneticModel *TimedMagneticModel,  
         MAGtype_Gradient *Gradient);
 
+void MAG_GradientAnalytic(MAGtype_Ellipsoid Ellip,
+        MAGtype_CoordGeodetic CoordGeodetic,
+        MAGtype_MagneticModel *TimedMagneticModel,
+        MAGtype_Gradient *Gradient);
+
 
 int MAG_robustReadMagneticModel_Large(char *filename, char* filenameSV, MAGtype_MagneticModel **MagneticModel);
 
 int MAG_robustReadMagModels(char *filename, MAGtype_MagneticModel *(*magneticmodels)[], int array_size);
 
+#ifdef MAG_EMBEDDED_WMM2025
+int MAG_GetEmbeddedModel(MAGtype_MagneticModel *MagneticModel);
+#endif
+
 int MAG_SetDefaults(MAGtype_Ellipsoid *Ellip, MAGtype_Geoid *Geoid);
 
 /*User Interface*/
@@ -318,6 +439,12 @@ MAGtype_MagneticModel *MAG_AllocateModelMemory(int NumTerms);
 
 MAGtype_SphericalHarmonicVariables *MAG_AllocateSphVarMemory(int nMax);
 
+MAGtype_EvalContext *MAG_AllocateEvalContext(int nMax);
+
+MAGtype_TimedModelCache *MAG_AllocateTimedModelCache(int NumEntries, int nMax);
+
+MAGtype_Trajectory *MAG_AllocateTrajectory(int nMax);
+
 void MAG_AssignHeaderValues(MAGtype_MagneticModel *model, char values[][MAXLINELENGTH]);
 
 void MAG_AssignMagneticModelCoeffs(MAGtype_MagneticModel *Assignee, MAGtype_MagneticModel *Source, int nMax, int nMaxSecVar);
@@ -330,6 +457,12 @@ int MAG_FreeMagneticModelMemory(MAGtype_MagneticModel *MagneticModel);
 
 int MAG_FreeSphVarMemory(MAGtype_SphericalHarmonicVariables *SphVar);
 
+int MAG_FreeEvalContext(MAGtype_EvalContext *Context);
+
+int MAG_FreeTimedModelCache(MAGtype_TimedModelCache *Cache);
+
+int MAG_FreeTrajectory(MAGtype_Trajectory *Trajectory);
+
 void MAG_PrintWMMFormat(char *filename, MAGtype_MagneticModel *MagneticModel);
 
 void MAG_PrintEMMFormat(char *filename, char *filenameSV, MAGtype_MagneticModel *MagneticModel);
@@ -406,6 +539,8 @@ int MAG_YearToDate(MAGtype_Date *Date);
 
 int MAG_AssociatedLegendreFunction(MAGtype_CoordSpherical CoordSpherical, int nMax, MAGtype_LegendreFunction *LegendreFunction);
 
+int MAG_AssociatedLegendreFunction_ctx(MAGtype_EvalContext *Context, MAGtype_CoordSpherical CoordSpherical, int nMax);
+
 int MAG_CheckGeographicPole(MAGtype_CoordGeodetic *CoordGeodetic);
 
 int MAG_ComputeSphericalHarmonicVariables(MAGtype_Ellipsoid Ellip,
@@ -416,6 +551,12 @@ int MAG_ComputeSphericalHarmonicVariables(MAGtype_Ellipsoid Ellip,
 void MAG_GradY(MAGtype_Ellipsoid Ellip, MAGtype_CoordSpherical CoordSpherical, MAGtype_CoordGeodetic CoordGeodetic,
         MAGtype_MagneticModel *TimedMagneticModel, MAGtype_GeoMagneticElements GeoMagneticElements, MAGtype_GeoMagneticElements *GradYElements);
 
+int MAG_GradY_ctx(MAGtype_EvalContext *Context, MAGtype_Ellipsoid Ellip, MAGtype_CoordSpherical CoordSpherical, MAGtype_CoordGeodetic CoordGeodetic,
+        MAGtype_MagneticModel *TimedMagneticModel, MAGtype_GeoMagneticElements GeoMagneticElements, MAGtype_GeoMagneticElements *GradYElements);
+
+int MAG_GradientSummation_ctx(MAGtype_EvalContext *Context, MAGtype_Ellipsoid Ellip, MAGtype_CoordSpherical CoordSpherical, MAGtype_CoordGeodetic CoordGeodetic,
+        MAGtype_MagneticModel *TimedMagneticModel, MAGtype_GeoMagneticElements GeoMagneticElements, MAGtype_Gradient *Gradient);
+
 void MAG_GradYSummation(MAGtype_LegendreFunction *LegendreFunction, MAGtype_MagneticModel *MagneticModel, MAGtype_SphericalHarmonicVariables SphVariables, MAGtype_CoordSpherical CoordSpherical, MAGtype_MagneticResults *GradY);
 
 int MAG_PcupHigh(double *Pcup, double *dPcup, double x, int nMax);
@@ -444,8 +585,24 @@ int MAG_SummationSpecial(MAGtype_MagneticModel *MagneticModel,
         MAGtype_CoordSpherical CoordSpherical,
         MAGtype_MagneticResults *MagneticResults);
 
+int MAG_SecVarSummation_ctx(MAGtype_EvalContext *Context,
+        MAGtype_MagneticModel *MagneticModel,
+        MAGtype_CoordSpherical CoordSpherical,
+        MAGtype_MagneticResults *MagneticResults);
+
+int MAG_Summation_ctx(MAGtype_EvalContext *Context,
+        MAGtype_MagneticModel *MagneticModel,
+        MAGtype_CoordSpherical CoordSpherical,
+        MAGtype_MagneticResults *MagneticResults);
+
 int MAG_TimelyModifyMagneticModel(MAGtype_Date UserDate, MAGtype_MagneticModel *MagneticModel, MAGtype_MagneticModel *TimedMagneticModel);
 
+MAGtype_MagneticModel *MAG_TimelyModifyMagneticModel_cache(MAGtype_TimedModelCache *Cache, MAGtype_Date UserDate, MAGtype_MagneticModel *MagneticModel);
+
+void MAG_ResetTimedModelCache(MAGtype_TimedModelCache *Cache);
+
+void MAG_ResetTrajectory(MAGtype_Trajectory *Trajectory);
+
 /*Geoid*/
 
 
@@ -7,6 +7,12 @@
 #include <assert.h>
 #include <time.h>
 #include "GeomagnetismHeader.h"
+#ifdef MAG_EMBEDDED_WMM2025
+#include "WMMEmbeddedCoefficients.h"
+#endif
+
+static void MAG_PcupHighTables(int nMax, double *f1, double *f2, double *PreSqr);
+static void MAG_PcupLowTables(int nMax, double *schmidtQuasiNorm, double *RecursionK);
 
 /* $Id: GeomagnetismLibrary.c 1521 2017-01-24 17:52:41Z awoods $
  *
@@ -140,39 +146,538 @@ INPUT: Ellip
 
 OUTPUT : GeoMagneticElements
 
-CALLS:  	MAG_AllocateLegendreFunctionMemory(NumTerms);  ( For storing the ALF functions )
-                     MAG_ComputeSphericalHarmonicVariables( Ellip, CoordSpherical, TimedMagneticModel->nMax, &SphVariables); (Compute Spherical Harmonic variables  )
-                     MAG_AssociatedLegendreFunction(CoordSpherical, TimedMagneticModel->nMax, LegendreFunction);  	Compute ALF
-                     MAG_Summation(LegendreFunction, TimedMagneticModel, SphVariables, CoordSpherical, &MagneticResultsSph);  Accumulate the spherical harmonic coefficients
-                     MAG_SecVarSummation(LegendreFunction, TimedMagneticModel, SphVariables, CoordSpherical, &MagneticResultsSphVar); Sum the Secular Variation Coefficients
+CALLS:  	MAG_AllocateEvalContext(TimedMagneticModel->nMax);  ( For storing the ALF functions and spherical harmonic variables )
+                     MAG_Geomag_ctx(Context, Ellip, CoordSpherical, CoordGeodetic, TimedMagneticModel, GeoMagneticElements);  Compute the elements
+                     MAG_FreeEvalContext(Context);
+
+ */
+{
+    MAGtype_EvalContext *Context;
+    int Flag;
+
+    Context = MAG_AllocateEvalContext(TimedMagneticModel->nMax); /* For storing the ALF functions and the spherical harmonic variables */
+    if(Context == NULL)
+        return FALSE;
+    Flag = MAG_Geomag_ctx(Context, Ellip, CoordSpherical, CoordGeodetic, TimedMagneticModel, GeoMagneticElements);
+    MAG_FreeEvalContext(Context);
+
+    return Flag;
+} /*MAG_Geomag*/
+
+int MAG_Geomag_ctx(MAGtype_EvalContext *Context, MAGtype_Ellipsoid Ellip, MAGtype_CoordSpherical CoordSpherical, MAGtype_CoordGeodetic CoordGeodetic,
+        MAGtype_MagneticModel *TimedMagneticModel, MAGtype_GeoMagneticElements *GeoMagneticElements)
+/*
+Same as MAG_Geomag, but all of the scratch memory is taken from an evaluation context allocated once
+with MAG_AllocateEvalContext. No heap memory is allocated or freed, so this is the function to use
+for repeated evaluations (sensor updates, files, grids). The context may be reused for any model
+whose nMax does not exceed the nMax it was allocated for. A context must not be shared between threads.
+
+INPUT: Context
+              Ellip
+              CoordSpherical
+              CoordGeodetic
+              TimedMagneticModel
+
+OUTPUT : GeoMagneticElements
+
+CALLS:  	MAG_ComputeSphericalHarmonicVariables(Ellip, CoordSpherical, TimedMagneticModel->nMax, &Context->SphVariables); (Compute Spherical Harmonic variables  )
+                     MAG_AssociatedLegendreFunction_ctx(Context, CoordSpherical, TimedMagneticModel->nMax);  	Compute ALF
+                     MAG_Summation_ctx(Context, TimedMagneticModel, CoordSpherical, &MagneticResultsSph);  Accumulate the spherical harmonic coefficients
+                     MAG_SecVarSummation_ctx(Context, TimedMagneticModel, CoordSpherical, &MagneticResultsSphVar); Sum the Secular Variation Coefficients
                      MAG_RotateMagneticVector(CoordSpherical, CoordGeodetic, MagneticResultsSph, &MagneticResultsGeo); Map the computed Magnetic fields to Geodetic coordinates
                      MAG_CalculateGeoMagneticElements(&MagneticResultsGeo, GeoMagneticElements);   Calculate the Geomagnetic elements
                      MAG_CalculateSecularVariationElements(MagneticResultsGeoVar, GeoMagneticElements); Calculate the secular variation of each of the Geomagnetic elements
 
  */
 {
-    MAGtype_LegendreFunction *LegendreFunction;
-    MAGtype_SphericalHarmonicVariables *SphVariables;
-    int NumTerms;
     MAGtype_MagneticResults MagneticResultsSph, MagneticResultsGeo, MagneticResultsSphVar, MagneticResultsGeoVar;
 
-    NumTerms = ((TimedMagneticModel->nMax + 1) * (TimedMagneticModel->nMax + 2) / 2); 
-    LegendreFunction = MAG_AllocateLegendreFunctionMemory(NumTerms); /* For storing the ALF functions */
-    SphVariables = MAG_AllocateSphVarMemory(TimedMagneticModel->nMax);
-    MAG_ComputeSphericalHarmonicVariables(Ellip, CoordSpherical, TimedMagneticModel->nMax, SphVariables); /* Compute Spherical Harmonic variables  */
-    MAG_AssociatedLegendreFunction(CoordSpherical, TimedMagneticModel->nMax, LegendreFunction); /* Compute ALF  */
-    MAG_Summation(LegendreFunction, TimedMagneticModel, *SphVariables, CoordSpherical, &MagneticResultsSph); /* Accumulate the spherical harmonic coefficients*/
-    MAG_SecVarSummation(LegendreFunction, TimedMagneticModel, *SphVariables, CoordSpherical, &MagneticResultsSphVar); /*Sum the Secular Variation Coefficients  */
+    if(Context == NULL || TimedMagneticModel->nMax > Context->nMax)
+        return FALSE;
+    MAG_ComputeSphericalHarmonicVariables(Ellip, CoordSpherical, TimedMagneticModel->nMax, &Context->SphVariables); /* Compute Spherical Harmonic variables  */
+    if(!MAG_AssociatedLegendreFunction_ctx(Context, CoordSpherical, TimedMagneticModel->nMax)) /* Compute ALF  */
+        return FALSE;
+    MAG_Summation_ctx(Context, TimedMagneticModel, CoordSpherical, &MagneticResultsSph); /* Accumulate the spherical harmonic coefficients*/
+    MAG_SecVarSummation_ctx(Context, TimedMagneticModel, CoordSpherical, &MagneticResultsSphVar); /*Sum the Secular Variation Coefficients  */
     MAG_RotateMagneticVector(CoordSpherical, CoordGeodetic, MagneticResultsSph, &MagneticResultsGeo); /* Map the computed Magnetic fields to Geodeitic coordinates  */
     MAG_RotateMagneticVector(CoordSpherical, CoordGeodetic, MagneticResultsSphVar, &MagneticResultsGeoVar); /* Map the secular variation field components to Geodetic coordinates*/
     MAG_CalculateGeoMagneticElements(&MagneticResultsGeo, GeoMagneticElements); /* Calculate the Geomagnetic elements, Equation 19 , WMM Technical report */
     MAG_CalculateSecularVariationElements(MagneticResultsGeoVar, GeoMagneticElements); /*Calculate the secular variation of each of the Geomagnetic elements*/
 
-    MAG_FreeLegendreMemory(LegendreFunction);
-    MAG_FreeSphVarMemory(SphVariables);
+    return TRUE;
+} /*MAG_Geomag_ctx*/
+
+typedef struct {
+    double DecimalYear;
+    int Index;
+} MAGtype_BatchKey;
+
+static int MAG_BatchKeyCompare(const void *a, const void *b)
+/* Orders batch points by date, keeping the input order for equal dates */
+{
+    const MAGtype_BatchKey *ka = (const MAGtype_BatchKey *) a, *kb = (const MAGtype_BatchKey *) b;
+
+    if(ka->DecimalYear < kb->DecimalYear)
+        return -1;
+    if(ka->DecimalYear > kb->DecimalYear)
+        return 1;
+    return (ka->Index > kb->Index) - (ka->Index < kb->Index);
+} /*MAG_BatchKeyCompare*/
+
+static void MAG_GeomagBatchBlock(MAGtype_EvalContext *Context, MAGtype_Ellipsoid Ellip, MAGtype_MagneticModel *TimedMagneticModel,
+        const MAGtype_BatchKey *Keys, int Count, const double *Latitude, const double *Longitude, const double *HeightAboveEllipsoid,
+        double *Pcup, double *dPcup, double *RelativeRadiusPower, double *cos_mlambda, double *sin_mlambda,
+        MAGtype_GeoMagneticElements *GeoMagneticElements)
+/* Evaluates up to MAG_BATCH_BLOCK points sharing one timed model. The Legendre functions and the
+spherical harmonic variables of the block are stored point-minor ([term * MAG_BATCH_BLOCK + point]) so that the
+summations run over contiguous points and can be vectorized. Every point is accumulated in the same order
+as MAG_Summation / MAG_SecVarSummation, so the results are identical to MAG_Geomag. */
+{
+    MAGtype_CoordSpherical CoordSpherical[MAG_BATCH_BLOCK];
+    MAGtype_CoordGeodetic CoordGeodetic[MAG_BATCH_BLOCK];
+    MAGtype_MagneticResults MagneticResultsSph, MagneticResultsGeo, MagneticResultsSphVar, MagneticResultsGeoVar;
+    double Bx[MAG_BATCH_BLOCK], By[MAG_BATCH_BLOCK], Bz[MAG_BATCH_BLOCK];
+    double BxVar[MAG_BATCH_BLOCK], ByVar[MAG_BATCH_BLOCK], BzVar[MAG_BATCH_BLOCK];
+    double G, H, cos_phi, *rr, *cm, *sm, *P, *dP;
+    int n, m, p, k, index, nMax, NumTerms;
+
+    nMax = TimedMagneticModel->nMax;
+    NumTerms = ((nMax + 1) * (nMax + 2) / 2);
+
+    /* Per point setup: spherical coordinates, (a/r)^(n+2), cos/sin(m lambda) and the ALF */
+    for(p = 0; p < Count; p++)
+    {
+        k = Keys[p].Index;
+        CoordGeodetic[p].phi = Latitude[k];
+        CoordGeodetic[p].lambda = Longitude[k];
+        CoordGeodetic[p].HeightAboveEllipsoid = HeightAboveEllipsoid[k];
+        CoordGeodetic[p].HeightAboveGeoid = HeightAboveEllipsoid[k];
+        CoordGeodetic[p].UseGeoid = 0;
+        MAG_GeodeticToSpherical(Ellip, CoordGeodetic[p], &CoordSpherical[p]);
+        MAG_ComputeSphericalHarmonicVariables(Ellip, CoordSpherical[p], nMax, &Context->SphVariables);
+        MAG_AssociatedLegendreFunction_ctx(Context, CoordSpherical[p], nMax);
+        for(n = 0; n <= nMax; n++)
+        {
+            RelativeRadiusPower[n * MAG_BATCH_BLOCK + p] = Context->SphVariables.RelativeRadiusPower[n];
+            cos_mlambda[n * MAG_BATCH_BLOCK + p] = Context->SphVariables.cos_mlambda[n];
+            sin_mlambda[n * MAG_BATCH_BLOCK + p] = Context->SphVariables.sin_mlambda[n];
+        }
+        for(index = 0; index < NumTerms; index++)
+        {
+            Pcup[index * MAG_BATCH_BLOCK + p] = Context->LegendreFunction.Pcup[index];
+            dPcup[index * MAG_BATCH_BLOCK + p] = Context->LegendreFunction.dPcup[index];
+        }
+        Bx[p] = By[p] = Bz[p] = 0.0;
+        BxVar[p] = ByVar[p] = BzVar[p] = 0.0;
+    }
+
+    /* Equations 10-12 in the WMM Technical report, see MAG_Summation */
+    for(n = 1; n <= nMax; n++)
+    {
+        rr = RelativeRadiusPower + n * MAG_BATCH_BLOCK;
+        for(m = 0; m <= n; m++)
+        {
+            index = (n * (n + 1) / 2 + m);
+            G = TimedMagneticModel->Main_Field_Coeff_G[index];
+            H = TimedMagneticModel->Main_Field_Coeff_H[index];
+            cm = cos_mlambda + m * MAG_BATCH_BLOCK;
+            sm = sin_mlambda + m * MAG_BATCH_BLOCK;
+            P = Pcup + index * MAG_BATCH_BLOCK;
+            dP = dPcup + index * MAG_BATCH_BLOCK;
+            for(p = 0; p < Count; p++)
+            {
+                Bz[p] -= rr[p] * (G * cm[p] + H * sm[p]) * (double) (n + 1) * P[p];
+                By[p] += rr[p] * (G * sm[p] - H * cm[p]) * (double) (m) * P[p];
+                Bx[p] -= rr[p] * (G * cm[p] + H * sm[p]) * dP[p];
+            }
+        }
+    }
+
+    /* Secular variation, see MAG_SecVarSummation */
+    for(n = 1; n <= TimedMagneticModel->nMaxSecVar; n++)
+    {
+        rr = RelativeRadiusPower + n * MAG_BATCH_BLOCK;
+        for(m = 0; m <= n; m++)
+        {
+            index = (n * (n + 1) / 2 + m);
+            G = TimedMagneticModel->Secular_Var_Coeff_G[index];
+            H = TimedMagneticModel->Secular_Var_Coeff_H[index];
+            cm = cos_mlambda + m * MAG_BATCH_BLOCK;
+            sm = sin_mlambda + m * MAG_BATCH_BLOCK;
+            P = Pcup + index * MAG_BATCH_BLOCK;
+            dP = dPcup + index * MAG_BATCH_BLOCK;
+            for(p = 0; p < Count; p++)
+            {
+                BzVar[p] -= rr[p] * (G * cm[p] + H * sm[p]) * (double) (n + 1) * P[p];
+                ByVar[p] += rr[p] * (G * sm[p] - H * cm[p]) * (double) (m) * P[p];
+                BxVar[p] -= rr[p] * (G * cm[p] + H * sm[p]) * dP[p];
+            }
+        }
+    }
+
+    for(p = 0; p < Count; p++)
+    {
+        k = Keys[p].Index;
+        cos_phi = cos(DEG2RAD(CoordSpherical[p].phig));
+        if(fabs(cos_phi) <= 1.0e-10)
+        {
+            /* Geographic pole: By needs MAG_SummationSpecial, use the scalar path */
+            MAG_Geomag_ctx(Context, Ellip, CoordSpherical[p], CoordGeodetic[p], TimedMagneticModel, &GeoMagneticElements[k]);
+            continue;
+        }
+        MagneticResultsSph.Bx = Bx[p];
+        MagneticResultsSph.By = By[p] / cos_phi;
+        MagneticResultsSph.Bz = Bz[p];
+        MagneticResultsSphVar.Bx = BxVar[p];
+        MagneticResultsSphVar.By = ByVar[p] / cos_phi;
+        MagneticResultsSphVar.Bz = BzVar[p];
+        MAG_RotateMagneticVector(CoordSpherical[p], CoordGeodetic[p], MagneticResultsSph, &MagneticResultsGeo);
+        MAG_RotateMagneticVector(CoordSpherical[p], CoordGeodetic[p], MagneticResultsSphVar, &MagneticResultsGeoVar);
+        MAG_CalculateGeoMagneticElements(&MagneticResultsGeo, &GeoMagneticElements[k]);
+        MAG_CalculateSecularVariationElements(MagneticResultsGeoVar, &GeoMagneticElements[k]);
+    }
+} /*MAG_GeomagBatchBlock*/
+
+int MAG_GeomagBatch(MAGtype_Ellipsoid Ellip, MAGtype_MagneticModel *MagneticModel, int NumPoints,
+        const double *Latitude, const double *Longitude, const double *HeightAboveEllipsoid, const double *DecimalYear,
+        MAGtype_GeoMagneticElements *GeoMagneticElements)
+/*
+Computes the magnetic field elements of NumPoints points given as separate (structure of arrays) inputs.
+This gives the same results as calling MAG_TimelyModifyMagneticModel and MAG_Geomag for each point, but
+the time adjusted coefficients are computed once per distinct date and the spherical harmonic summations
+are evaluated over blocks of MAG_BATCH_BLOCK points at a time.
+
+INPUT: Ellip
+              MagneticModel   The model as read from the coefficient file (not time adjusted)
+              NumPoints
+              Latitude        Geodetic latitude of each point (deg)
+              Longitude       Longitude of each point (deg)
+              HeightAboveEllipsoid  Height of each point above the WGS84 ellipsoid (km)
+              DecimalYear     Date of each point (decimal years)
+
+OUTPUT : GeoMagneticElements   NumPoints elements, in input order. GV is not computed (see MAG_CalculateGridVariation).
+
+CALLS:  	MAG_AllocateEvalContext, MAG_TimelyModifyMagneticModel, MAG_GeodeticToSpherical,
+                     MAG_ComputeSphericalHarmonicVariables, MAG_AssociatedLegendreFunction_ctx,
+                     MAG_RotateMagneticVector, MAG_CalculateGeoMagneticElements, MAG_CalculateSecularVariationElements
+ */
+{
+    MAGtype_EvalContext *Context;
+    MAGtype_MagneticModel *TimedMagneticModel;
+    MAGtype_BatchKey *Keys;
+    MAGtype_Date UserDate;
+    double *Pcup, *dPcup, *RelativeRadiusPower, *cos_mlambda, *sin_mlambda;
+    int i, start, end, nMax, NumTerms;
+
+    if(NumPoints <= 0)
+        return TRUE;
+    nMax = MagneticModel->nMax;
+    NumTerms = ((nMax + 1) * (nMax + 2) / 2);
+    Context = MAG_AllocateEvalContext(nMax);
+    TimedMagneticModel = MAG_AllocateModelMemory(NumTerms);
+    Keys = (MAGtype_BatchKey *) malloc(NumPoints * sizeof (MAGtype_BatchKey));
+    Pcup = (double *) malloc(NumTerms * MAG_BATCH_BLOCK * sizeof (double));
+    dPcup = (double *) malloc(NumTerms * MAG_BATCH_BLOCK * sizeof (double));
+    RelativeRadiusPower = (double *) malloc((nMax + 1) * MAG_BATCH_BLOCK * sizeof (double));
+    cos_mlambda = (double *) malloc((nMax + 1) * MAG_BATCH_BLOCK * sizeof (double));
+    sin_mlambda = (double *) malloc((nMax + 1) * MAG_BATCH_BLOCK * sizeof (double));
+    if(Context == NULL || TimedMagneticModel == NULL || Keys == NULL || Pcup == NULL || dPcup == NULL ||
+            RelativeRadiusPower == NULL || cos_mlambda == NULL || sin_mlambda == NULL)
+    {
+        MAG_Error(29);
+        MAG_FreeEvalContext(Context);
+        if(TimedMagneticModel)
+            MAG_FreeMagneticModelMemory(TimedMagneticModel);
+        free(Keys);
+        free(Pcup);
+        free(dPcup);
+        free(RelativeRadiusPower);
+        free(cos_mlambda);
+        free(sin_mlambda);
+        return FALSE;
+    }
+
+    /* Group the points by date so the model is time adjusted once per distinct date */
+    for(i = 0; i < NumPoints; i++)
+    {
+        Keys[i].DecimalYear = DecimalYear[i];
+        Keys[i].Index = i;
+    }
+    qsort(Keys, NumPoints, sizeof (MAGtype_BatchKey), MAG_BatchKeyCompare);
+
+    for(start = 0; start < NumPoints; start = end)
+    {
+        end = start + 1;
+        while(end < NumPoints && Keys[end].DecimalYear == Keys[start].DecimalYear)
+            end++;
+        UserDate.DecimalYear = Keys[start].DecimalYear;
+        MAG_TimelyModifyMagneticModel(UserDate, MagneticModel, TimedMagneticModel);
+        for(i = start; i < end; i += MAG_BATCH_BLOCK)
+        {
+            MAG_GeomagBatchBlock(Context, Ellip, TimedMagneticModel, Keys + i, (end - i < MAG_BATCH_BLOCK) ? end - i : MAG_BATCH_BLOCK,
+                    Latitude, Longitude, HeightAboveEllipsoid, Pcup, dPcup, RelativeRadiusPower, cos_mlambda, sin_mlambda,
+                    GeoMagneticElements);
+        }
+    }
 
+    MAG_FreeEvalContext(Context);
+    MAG_FreeMagneticModelMemory(TimedMagneticModel);
+    free(Keys);
+    free(Pcup);
+    free(dPcup);
+    free(RelativeRadiusPower);
+    free(cos_mlambda);
+    free(sin_mlambda);
     return TRUE;
-} /*MAG_Geomag*/
+} /*MAG_GeomagBatch*/
+
+int MAG_SiteBasis_ctx(MAGtype_EvalContext *Context, MAGtype_Ellipsoid Ellip, MAGtype_CoordSpherical CoordSpherical, MAGtype_CoordGeodetic CoordGeodetic,
+        MAGtype_MagneticModel *MagneticModel, MAGtype_SiteBasis *Basis)
+/*
+Computes the spatial basis of a time series at one site. Within an epoch the coefficients of the time
+adjusted model are G + (t - epoch) * SV (MAG_TimelyModifyMagneticModel), and the summations and the
+rotation are linear in the coefficients, so the field at any date is the field of the main coefficients
+plus (t - epoch) times the field of the secular variation coefficients. This function evaluates both
+once; MAG_SiteElements then produces the elements of any date from them without a summation.
+The results agree with MAG_TimelyModifyMagneticModel and MAG_Geomag up to the rounding of the regrouped
+sums (about 1e-10 nT), they are not bit identical.
+
+INPUT: Context
+              Ellip
+              CoordSpherical
+              CoordGeodetic
+              MagneticModel   The model as read from the coefficient file (not time adjusted)
+
+OUTPUT : Basis
+
+CALLS:  	MAG_ComputeSphericalHarmonicVariables, MAG_AssociatedLegendreFunction_ctx, MAG_Summation_ctx,
+                     MAG_SecVarSummation_ctx, MAG_RotateMagneticVector
+ */
+{
+    MAGtype_MagneticResults MagneticResultsSph, MagneticResultsSphVar;
+
+    if(Context == NULL || MagneticModel->nMax > Context->nMax)
+        return FALSE;
+    MAG_ComputeSphericalHarmonicVariables(Ellip, CoordSpherical, MagneticModel->nMax, &Context->SphVariables); /* Compute Spherical Harmonic variables  */
+    if(!MAG_AssociatedLegendreFunction_ctx(Context, CoordSpherical, MagneticModel->nMax)) /* Compute ALF  */
+        return FALSE;
+    MAG_Summation_ctx(Context, MagneticModel, CoordSpherical, &MagneticResultsSph); /* Field of the coefficients at epoch */
+    MAG_SecVarSummation_ctx(Context, MagneticModel, CoordSpherical, &MagneticResultsSphVar); /* Field of the secular variation coefficients */
+    MAG_RotateMagneticVector(CoordSpherical, CoordGeodetic, MagneticResultsSph, &Basis->MainField);
+    MAG_RotateMagneticVector(CoordSpherical, CoordGeodetic, MagneticResultsSphVar, &Basis->SecularVariation);
+    Basis->epoch = MagneticModel->epoch;
+    Basis->CoordGeodetic = CoordGeodetic;
+    return TRUE;
+} /*MAG_SiteBasis_ctx*/
+
+void MAG_SiteElements(const MAGtype_SiteBasis *Basis, double DecimalYear, MAGtype_GeoMagneticElements *GeoMagneticElements)
+/*
+Computes the geomagnetic elements and their rates of change at DecimalYear from a basis of MAG_SiteBasis_ctx.
+Only the elements are computed per date, the cost does not depend on the degree of the model.
+
+INPUT: Basis
+              DecimalYear
+
+OUTPUT : GeoMagneticElements
+
+CALLS:  	MAG_CalculateGeoMagneticElements, MAG_CalculateGridVariation, MAG_CalculateSecularVariationElements
+ */
+{
+    MAGtype_MagneticResults MagneticResultsGeo;
+    double dt = DecimalYear - Basis->epoch;
+
+    MagneticResultsGeo.Bx = Basis->MainField.Bx + dt * Basis->SecularVariation.Bx;
+    MagneticResultsGeo.By = Basis->MainField.By + dt * Basis->SecularVariation.By;
+    MagneticResultsGeo.Bz = Basis->MainField.Bz + dt * Basis->SecularVariation.Bz;
+    MAG_CalculateGeoMagneticElements(&MagneticResultsGeo, GeoMagneticElements);
+    MAG_CalculateGridVariation(Basis->CoordGeodetic, GeoMagneticElements);
+    MAG_CalculateSecularVariationElements(Basis->SecularVariation, GeoMagneticElements);
+} /*MAG_SiteElements*/
+
+int MAG_SiteTimeSeries(MAGtype_Ellipsoid Ellip, MAGtype_CoordGeodetic CoordGeodetic, MAGtype_MagneticModel *MagneticModel, int NumDates,
+        const double *DecimalYear, MAGtype_GeoMagneticElements *GeoMagneticElements)
+/*
+Computes the magnetic field elements of NumDates dates at one site. The spherical harmonic summations run
+once (MAG_SiteBasis_ctx), every date costs one MAG_SiteElements. The dates may be in any order.
+
+INPUT: Ellip
+              CoordGeodetic   The site, HeightAboveEllipsoid must be set (see MAG_ConvertGeoidToEllipsoidHeight)
+              MagneticModel   The model as read from the coefficient file (not time adjusted)
+              NumDates
+              DecimalYear     Date of each element (decimal years)
+
+OUTPUT : GeoMagneticElements   NumDates elements, in input order, including the grid variation
+
+CALLS:  	MAG_AllocateEvalContext, MAG_GeodeticToSpherical, MAG_SiteBasis_ctx, MAG_SiteElements
+ */
+{
+    MAGtype_EvalContext *Context;
+    MAGtype_CoordSpherical CoordSpherical;
+    MAGtype_SiteBasis Basis;
+    int i, Flag;
+
+    if(NumDates <= 0)
+        return TRUE;
+    Context = MAG_AllocateEvalContext(MagneticModel->nMax); /* Reports its own allocation errors */
+    if(Context == NULL)
+        return FALSE;
+    MAG_GeodeticToSpherical(Ellip, CoordGeodetic, &CoordSpherical);
+    Flag = MAG_SiteBasis_ctx(Context, Ellip, CoordSpherical, CoordGeodetic, MagneticModel, &Basis);
+    MAG_FreeEvalContext(Context);
+    if(!Flag)
+        return FALSE;
+    for(i = 0; i < NumDates; i++)
+        MAG_SiteElements(&Basis, DecimalYear[i], &GeoMagneticElements[i]);
+    return TRUE;
+} /*MAG_SiteTimeSeries*/
+
+static void MAG_TrajectorySummation(MAGtype_EvalContext *Context, MAGtype_MagneticModel *MagneticModel, MAGtype_CoordSpherical CoordSpherical,
+        MAGtype_MagneticResults *MagneticResultsSph, MAGtype_MagneticResults *MagneticResultsSphVar)
+/* MAG_Summation_ctx and MAG_SecVarSummation_ctx in one pass over the terms. The terms of each degree are summed
+before they are scaled by (a/r)^(n+2), so the results differ from the two summations by rounding. At the
+geographic poles the two summations are used. */
+{
+    const double *Pcup = Context->LegendreFunction.Pcup, *dPcup = Context->LegendreFunction.dPcup;
+    const double *cos_mlambda = Context->SphVariables.cos_mlambda, *sin_mlambda = Context->SphVariables.sin_mlambda;
+    double cos_phi, Bx, By, Bz, BxVar, ByVar, BzVar, A, B, AVar, BVar, Radius;
+    int m, n, index;
+
+    cos_phi = cos(DEG2RAD(CoordSpherical.phig));
+    if(fabs(cos_phi) <= 1.0e-10)
+    {
+        MAG_Summation_ctx(Context, MagneticModel, CoordSpherical, MagneticResultsSph);
+        MAG_SecVarSummation_ctx(Context, MagneticModel, CoordSpherical, MagneticResultsSphVar);
+        return;
+    }
+    MagneticModel->SecularVariationUsed = TRUE;
+    MagneticResultsSph->Bx = MagneticResultsSph->By = MagneticResultsSph->Bz = 0.0;
+    MagneticResultsSphVar->Bx = MagneticResultsSphVar->By = MagneticResultsSphVar->Bz = 0.0;
+    for(n = 1; n <= MagneticModel->nMax; n++)
+    {
+        Bx = By = Bz = BxVar = ByVar = BzVar = 0.0;
+        for(m = 0; m <= n; m++)
+        {
+            index = (n * (n + 1) / 2 + m);
+            A = MagneticModel->Main_Field_Coeff_G[index] * cos_mlambda[m] + MagneticModel->Main_Field_Coeff_H[index] * sin_mlambda[m];
+            B = MagneticModel->Main_Field_Coeff_G[index] * sin_mlambda[m] - MagneticModel->Main_Field_Coeff_H[index] * cos_mlambda[m];
+            Bz += A * Pcup[index];
+            By += B * (double) m * Pcup[index];
+            Bx += A * dPcup[index];
+            if(n <= MagneticModel->nMaxSecVar)
+            {
+                AVar = MagneticModel->Secular_Var_Coeff_G[index] * cos_mlambda[m] + MagneticModel->Secular_Var_Coeff_H[index] * sin_mlambda[m];
+                BVar = MagneticModel->Secular_Var_Coeff_G[index] * sin_mlambda[m] - MagneticModel->Secular_Var_Coeff_H[index] * cos_mlambda[m];
+                BzVar += AVar * Pcup[index];
+                ByVar += BVar * (double) m * Pcup[index];
+                BxVar += AVar * dPcup[index];
+            }
+        }
+        Radius = Context->SphVariables.RelativeRadiusPower[n];
+        MagneticResultsSph->Bz -= Radius * (double) (n + 1) * Bz;
+        MagneticResultsSph->By += Radius * By;
+        MagneticResultsSph->Bx -= Radius * Bx;
+        MagneticResultsSphVar->Bz -= Radius * (double) (n + 1) * BzVar;
+        MagneticResultsSphVar->By += Radius * ByVar;
+        MagneticResultsSphVar->Bx -= Radius * BxVar;
+    }
+    MagneticResultsSph->By /= cos_phi;
+    MagneticResultsSphVar->By /= cos_phi;
+} /*MAG_TrajectorySummation*/
+
+int MAG_GeomagTrajectory(MAGtype_Trajectory *Trajectory, MAGtype_Ellipsoid Ellip, MAGtype_CoordGeodetic CoordGeodetic,
+        MAGtype_MagneticModel *MagneticModel, double DecimalYear, MAGtype_GeoMagneticElements *GeoMagneticElements)
+/*
+Computes the magnetic field elements of one fix of a track (a vehicle or a survey line), where consecutive
+fixes are close together. The trajectory keeps the tables of the previous fix:
+ - the sine and cosine of the longitude are moved to the new fix by angle addition with the Taylor series of
+   the small longitude step, and cos(m lambda), sin(m lambda) follow by the recurrence of
+   MAG_ComputeSphericalHarmonicVariables. No trigonometric function of the longitude is evaluated, except
+   every ReseedInterval fixes and for steps above MAG_TRAJECTORY_MAX_STEP, which bounds the rounding drift.
+ - the Legendre functions are only recomputed when the geocentric latitude moved by more than
+   LatitudeTolerance. The field error of a reused set is the latitude change times the northward gradient,
+   about 0.1 nT for the WMM and the default MAG_TRAJECTORY_LATITUDE_TOLERANCE, far below the model uncertainty.
+   With LatitudeTolerance 0 the results agree with MAG_Geomag up to rounding.
+The model is not time adjusted: as in MAG_SiteBasis_ctx the main field and the secular variation are summed
+separately (in one pass over the terms), so the date of every fix is exact without a time adjusted model per fix.
+
+INPUT: Trajectory   Allocated by MAG_AllocateTrajectory for at least MagneticModel->nMax
+              Ellip
+              CoordGeodetic   The fix, HeightAboveEllipsoid must be set (see MAG_ConvertGeoidToEllipsoidHeight)
+              MagneticModel   The model as read from the coefficient file (not time adjusted)
+              DecimalYear     Date of the fix (decimal years)
+
+OUTPUT : GeoMagneticElements   Including the grid variation
+
+CALLS:  	MAG_GeodeticToSpherical, MAG_AssociatedLegendreFunction_ctx, MAG_TrajectorySummation,
+                     MAG_RotateMagneticVector, MAG_SiteElements
+ */
+{
+    MAGtype_EvalContext *Context = Trajectory->Context;
+    MAGtype_SphericalHarmonicVariables *SphVariables = &Context->SphVariables;
+    MAGtype_CoordSpherical CoordSpherical;
+    MAGtype_MagneticResults MagneticResultsSph, MagneticResultsSphVar;
+    MAGtype_SiteBasis Basis;
+    double delta, delta2, cos_delta, sin_delta, cos_lambda;
+    int m, n, nMax = MagneticModel->nMax;
+
+    if(nMax > Context->nMax)
+        return FALSE;
+    if(Trajectory->Valid && Trajectory->nMax != nMax)
+        Trajectory->Valid = FALSE; /* Tables of another model */
+    Trajectory->Fixes++;
+    MAG_GeodeticToSpherical(Ellip, CoordGeodetic, &CoordSpherical);
+
+    /* (a/r)^(n+2), as in MAG_ComputeSphericalHarmonicVariables */
+    SphVariables->RelativeRadiusPower[0] = (Ellip.re / CoordSpherical.r) * (Ellip.re / CoordSpherical.r);
+    for(n = 1; n <= nMax; n++)
+        SphVariables->RelativeRadiusPower[n] = SphVariables->RelativeRadiusPower[n - 1] * (Ellip.re / CoordSpherical.r);
+
+    delta = DEG2RAD(CoordSpherical.lambda - Trajectory->lambda);
+    if(!Trajectory->Valid || fabs(delta) > MAG_TRAJECTORY_MAX_STEP || Trajectory->StepsSinceSeed >= Trajectory->ReseedInterval)
+    {
+        Trajectory->cos_lambda = cos(DEG2RAD(CoordSpherical.lambda));
+        Trajectory->sin_lambda = sin(DEG2RAD(CoordSpherical.lambda));
+        Trajectory->StepsSinceSeed = 0;
+        Trajectory->Reseeds++;
+    } else if(delta != 0.0)
+    {
+        /* The truncated terms are below 1e-20 for steps up to MAG_TRAJECTORY_MAX_STEP */
+        delta2 = delta * delta;
+        cos_delta = 1.0 - delta2 / 2.0 * (1.0 - delta2 / 12.0 * (1.0 - delta2 / 30.0));
+        sin_delta = delta * (1.0 - delta2 / 6.0 * (1.0 - delta2 / 20.0));
+        cos_lambda = Trajectory->cos_lambda * cos_delta - Trajectory->sin_lambda * sin_delta;
+        Trajectory->sin_lambda = Trajectory->sin_lambda * cos_delta + Trajectory->cos_lambda * sin_delta;
+        Trajectory->cos_lambda = cos_lambda;
+        Trajectory->StepsSinceSeed++;
+    }
+    Trajectory->lambda = CoordSpherical.lambda;
+    SphVariables->cos_mlambda[0] = 1.0;
+    SphVariables->sin_mlambda[0] = 0.0;
+    for(m = 1; m <= nMax; m++)
+    {
+        SphVariables->cos_mlambda[m] = SphVariables->cos_mlambda[m - 1] * Trajectory->cos_lambda - SphVariables->sin_mlambda[m - 1] * Trajectory->sin_lambda;
+        SphVariables->sin_mlambda[m] = SphVariables->cos_mlambda[m - 1] * Trajectory->sin_lambda + SphVariables->sin_mlambda[m - 1] * Trajectory->cos_lambda;
+    }
+
+    if(!Trajectory->Valid || fabs(CoordSpherical.phig - Trajectory->phig) > Trajectory->LatitudeTolerance)
+    {
+        Trajectory->Valid = FALSE; /* Until the Legendre functions are complete */
+        if(!MAG_AssociatedLegendreFunction_ctx(Context, CoordSpherical, nMax))
+            return FALSE;
+        Trajectory->phig = CoordSpherical.phig;
+        Trajectory->LegendreUpdates++;
+    }
+    Trajectory->nMax = nMax;
+    Trajectory->Valid = TRUE;
+
+    MAG_TrajectorySummation(Context, MagneticModel, CoordSpherical, &MagneticResultsSph, &MagneticResultsSphVar);
+    MAG_RotateMagneticVector(CoordSpherical, CoordGeodetic, MagneticResultsSph, &Basis.MainField);
+    MAG_RotateMagneticVector(CoordSpherical, CoordGeodetic, MagneticResultsSphVar, &Basis.SecularVariation);
+    Basis.epoch = MagneticModel->epoch;
+    Basis.CoordGeodetic = CoordGeodetic;
+    MAG_SiteElements(&Basis, DecimalYear, GeoMagneticElements);
+    return TRUE;
+} /*MAG_GeomagTrajectory*/
 
 void MAG_Gradient(MAGtype_Ellipsoid Ellip, MAGtype_CoordGeodetic CoordGeodetic, MAGtype_MagneticModel *TimedMagneticModel, MAGtype_Gradient *Gradient)
 {
@@ -190,11 +695,15 @@ void MAG_Gradient(MAGtype_Ellipsoid Ellip, MAGtype_CoordGeodetic CoordGeodetic,
     MAGtype_CoordSpherical AdjCoordSpherical;
     MAGtype_CoordGeodetic AdjCoordGeodetic;
     MAGtype_GeoMagneticElements GeomagneticElements, AdjGeoMagneticElements[2];
+    MAGtype_EvalContext *Context;
 
+    Context = MAG_AllocateEvalContext(TimedMagneticModel->nMax); /* Shared by all of the evaluations below */
+    if(Context == NULL)
+        return;
 
     /*Initialization*/
     MAG_GeodeticToSpherical(Ellip, CoordGeodetic, &AdjCoordSpherical);
-    MAG_Geomag(Ellip, AdjCoordSpherical, CoordGeodetic, TimedMagneticModel, &GeomagneticElements);
+    MAG_Geomag_ctx(Context, Ellip, AdjCoordSpherical, CoordGeodetic, TimedMagneticModel, &GeomagneticElements);
     AdjCoordGeodetic = MAG_CoordGeodeticAssign(CoordGeodetic);
 
 
@@ -204,11 +713,11 @@ void MAG_Gradient(MAGtype_Ellipsoid Ellip, MAGtype_CoordGeodetic CoordGeodetic,
 
     AdjCoordGeodetic.phi = CoordGeodetic.phi + phiDelta;
     MAG_GeodeticToSpherical(Ellip, AdjCoordGeodetic, &AdjCoordSpherical);
-    MAG_Geomag(Ellip, AdjCoordSpherical, AdjCoordGeodetic, TimedMagneticModel, &AdjGeoMagneticElements[0]);
+    MAG_Geomag_ctx(Context, Ellip, AdjCoordSpherical, AdjCoordGeodetic, TimedMagneticModel, &AdjGeoMagneticElements[0]);
     MAG_SphericalToCartesian(AdjCoordSpherical, &x[0], &y[0], &z[0]);
     AdjCoordGeodetic.phi = CoordGeodetic.phi - phiDelta;
     MAG_GeodeticToSpherical(Ellip, AdjCoordGeodetic, &AdjCoordSpherical);
-    MAG_Geomag(Ellip, AdjCoordSpherical, AdjCoordGeodetic, TimedMagneticModel, &AdjGeoMagneticElements[1]);
+    MAG_Geomag_ctx(Context, Ellip, AdjCoordSpherical, AdjCoordGeodetic, TimedMagneticModel, &AdjGeoMagneticElements[1]);
     MAG_SphericalToCartesian(AdjCoordSpherical, &x[1], &y[1], &z[1]);
 
 
@@ -226,26 +735,180 @@ void MAG_Gradient(MAGtype_Ellipsoid Ellip, MAGtype_CoordGeodetic CoordGeodetic,
      small numbers, and fails to function correctly at all at the North Pole*/
     
     MAG_GeodeticToSpherical(Ellip, CoordGeodetic, &AdjCoordSpherical);
-    MAG_GradY(Ellip, AdjCoordSpherical, CoordGeodetic, TimedMagneticModel, GeomagneticElements, &(Gradient->GradLambda));
+    MAG_GradY_ctx(Context, Ellip, AdjCoordSpherical, CoordGeodetic, TimedMagneticModel, GeomagneticElements, &(Gradient->GradLambda));
     
     /*Gradient along z*/
     AdjCoordGeodetic.HeightAboveEllipsoid = CoordGeodetic.HeightAboveEllipsoid + hDelta;
     AdjCoordGeodetic.HeightAboveGeoid = CoordGeodetic.HeightAboveGeoid + hDelta;
     MAG_GeodeticToSpherical(Ellip, AdjCoordGeodetic, &AdjCoordSpherical);
-    MAG_Geomag(Ellip, AdjCoordSpherical, AdjCoordGeodetic, TimedMagneticModel, &AdjGeoMagneticElements[0]);
+    MAG_Geomag_ctx(Context, Ellip, AdjCoordSpherical, AdjCoordGeodetic, TimedMagneticModel, &AdjGeoMagneticElements[0]);
     MAG_SphericalToCartesian(AdjCoordSpherical, &x[0], &y[0], &z[0]);
     AdjCoordGeodetic.HeightAboveEllipsoid = CoordGeodetic.HeightAboveEllipsoid - hDelta;
     AdjCoordGeodetic.HeightAboveGeoid = CoordGeodetic.HeightAboveGeoid - hDelta;
     MAG_GeodeticToSpherical(Ellip, AdjCoordGeodetic, &AdjCoordSpherical);
-    MAG_Geomag(Ellip, AdjCoordSpherical, AdjCoordGeodetic, TimedMagneticModel, &AdjGeoMagneticElements[1]);
+    MAG_Geomag_ctx(Context, Ellip, AdjCoordSpherical, AdjCoordGeodetic, TimedMagneticModel, &AdjGeoMagneticElements[1]);
     MAG_SphericalToCartesian(AdjCoordSpherical, &x[1], &y[1], &z[1]);
 
     distance = sqrt((x[0] - x[1])*(x[0] - x[1])+(y[0] - y[1])*(y[0] - y[1])+(z[0] - z[1])*(z[0] - z[1]));
     Gradient->GradZ = MAG_GeoMagneticElementsSubtract(AdjGeoMagneticElements[0], AdjGeoMagneticElements[1]);
     Gradient->GradZ = MAG_GeoMagneticElementsScale(Gradient->GradZ, 1/distance);
     AdjCoordGeodetic = MAG_CoordGeodeticAssign(CoordGeodetic);
+    MAG_FreeEvalContext(Context);
 }
 
+static void MAG_GradientDirection(double dBdr[3], double dBdphig[3], double drdt, double dphigdt, double dpsidt, double dsdt, double Psi,
+        MAGtype_GeoMagneticElements GeoMagneticElements, MAGtype_GeoMagneticElements *GradElements)
+/* Chains the derivatives of the spherical components (Bx, By, Bz) with respect to the radius and the
+   geocentric latitude along one geodetic direction, rotates them as MAG_RotateMagneticVector does,
+   including the change of the angle Psi between the two latitudes, and scales them to the distance along
+   that direction. dphigdt and dpsidt are in radians. */
+{
+    MAGtype_MagneticResults GradResults;
+    double dBx, dBy, dBz;
+
+    dBx = (dBdr[0] * drdt + dBdphig[0] * dphigdt) / dsdt;
+    dBy = (dBdr[1] * drdt + dBdphig[1] * dphigdt) / dsdt;
+    dBz = (dBdr[2] * drdt + dBdphig[2] * dphigdt) / dsdt;
+    GradResults.Bx = dBx * cos(Psi) - dBz * sin(Psi) - GeoMagneticElements.Z * dpsidt / dsdt;
+    GradResults.By = dBy;
+    GradResults.Bz = dBx * sin(Psi) + dBz * cos(Psi) + GeoMagneticElements.X * dpsidt / dsdt;
+    MAG_CalculateGradientElements(GradResults, GeoMagneticElements, GradElements);
+} /*MAG_GradientDirection*/
+
+int MAG_GradientSummation_ctx(MAGtype_EvalContext *Context, MAGtype_Ellipsoid Ellip, MAGtype_CoordSpherical CoordSpherical,
+        MAGtype_CoordGeodetic CoordGeodetic, MAGtype_MagneticModel *TimedMagneticModel, MAGtype_GeoMagneticElements GeoMagneticElements,
+        MAGtype_Gradient *Gradient)
+/*
+Analytic version of MAG_Gradient. The main field series is differentiated term by term with respect to
+the radius and the geocentric latitude, using the Legendre functions and spherical harmonic variables
+already in the context for this point (as left by MAG_Geomag_ctx). The second derivative of the Legendre
+functions comes from the associated Legendre equation, written for the geocentric latitude phig
+        d2P/dphig2 = tan(phig) dP/dphig - (n(n+1) - m^2 / cos^2(phig)) P,
+so the whole gradient costs one more pass over the coefficients instead of four evaluations. The
+derivatives are then chained to the geodetic latitude and height, so GradPhi and GradZ are the limits of
+the central differences of MAG_Gradient. GradLambda is MAG_GradYSummation, as in MAG_Gradient.
+
+INPUT: Context  Holds the Legendre functions and spherical harmonic variables of CoordSpherical
+              Ellip
+              CoordSpherical
+              CoordGeodetic
+              TimedMagneticModel
+              GeoMagneticElements  Field at the point (MAG_Geomag_ctx)
+
+OUTPUT : Gradient  X, Y, Z, H, F, Decl, Incl and GV of GradPhi, GradLambda and GradZ (nT/km, deg/km)
+              Returns FALSE at the geographic poles, where the series is singular (use MAG_Gradient there),
+              or if the context is too small for the model
+
+CALLS:  	MAG_GradYSummation, MAG_RotateMagneticVector, MAG_CalculateGradientElements
+ */
+{
+    MAGtype_MagneticResults GradYResultsSph, GradYResultsGeo;
+    double dBdr[3] = {0, 0, 0}, dBdphig[3] = {0, 0, 0};
+    double cos_phi, sin_phi, tan_phi, C, S, rr, P, dP, d2P, SumY = 0;
+    double CosLat, SinLat, Den, rc, drc, xp, zp, dxp, dzp, r, drdt, dphigdt, Psi;
+    int n, m, index;
+
+    if(Context == NULL || TimedMagneticModel->nMax > Context->nMax)
+        return FALSE;
+    cos_phi = cos(DEG2RAD(CoordSpherical.phig));
+    if(fabs(cos_phi) <= 1.0e-10)
+        return FALSE;
+    sin_phi = sin(DEG2RAD(CoordSpherical.phig));
+    tan_phi = sin_phi / cos_phi;
+    r = CoordSpherical.r;
+
+    for(n = 1; n <= TimedMagneticModel->nMax; n++)
+    {
+        rr = Context->SphVariables.RelativeRadiusPower[n];
+        for(m = 0; m <= n; m++)
+        {
+            index = (n * (n + 1) / 2 + m);
+            C = TimedMagneticModel->Main_Field_Coeff_G[index] * Context->SphVariables.cos_mlambda[m] +
+                    TimedMagneticModel->Main_Field_Coeff_H[index] * Context->SphVariables.sin_mlambda[m];
+            S = TimedMagneticModel->Main_Field_Coeff_G[index] * Context->SphVariables.sin_mlambda[m] -
+                    TimedMagneticModel->Main_Field_Coeff_H[index] * Context->SphVariables.cos_mlambda[m];
+            P = Context->LegendreFunction.Pcup[index];
+            dP = Context->LegendreFunction.dPcup[index]; /* With respect to the latitude, see MAG_PcupLow */
+            d2P = tan_phi * dP - ((double) (n * (n + 1)) - (double) (m * m) / (cos_phi * cos_phi)) * P;
+
+            /* (a/r)^(n+2) gives the factor -(n+2)/r with respect to r */
+            dBdr[0] += (double) (n + 2) * rr * C * dP;
+            dBdr[1] -= (double) (n + 2) * rr * S * (double) (m) * P;
+            dBdr[2] += (double) (n + 2) * rr * C * (double) (n + 1) * P;
+            dBdphig[0] -= rr * C * d2P;
+            dBdphig[1] += rr * S * (double) (m) * dP;
+            dBdphig[2] -= rr * C * (double) (n + 1) * dP;
+            SumY += rr * S * (double) (m) * P;
+        }
+    }
+    dBdr[0] /= r;
+    dBdr[1] /= r * cos_phi;
+    dBdr[2] /= r;
+    dBdphig[1] = dBdphig[1] / cos_phi + SumY / cos_phi * tan_phi; /* By = SumY / cos(phig) */
+
+    /* Derivatives of the geocentric coordinates of MAG_GeodeticToSpherical */
+    CosLat = cos(DEG2RAD(CoordGeodetic.phi));
+    SinLat = sin(DEG2RAD(CoordGeodetic.phi));
+    Den = 1.0 - Ellip.epssq * SinLat * SinLat;
+    rc = Ellip.a / sqrt(Den);
+    drc = rc * Ellip.epssq * SinLat * CosLat / Den;
+    xp = (rc + CoordGeodetic.HeightAboveEllipsoid) * CosLat;
+    zp = (rc * (1.0 - Ellip.epssq) + CoordGeodetic.HeightAboveEllipsoid) * SinLat;
+    Psi = (M_PI / 180) * (CoordSpherical.phig - CoordGeodetic.phi);
+
+    /* Along the meridian, per km of arc */
+    dxp = drc * CosLat - (rc + CoordGeodetic.HeightAboveEllipsoid) * SinLat;
+    dzp = drc * (1.0 - Ellip.epssq) * SinLat + (rc * (1.0 - Ellip.epssq) + CoordGeodetic.HeightAboveEllipsoid) * CosLat;
+    drdt = (xp * dxp + zp * dzp) / r;
+    dphigdt = (xp * dzp - zp * dxp) / (r * r);
+    MAG_GradientDirection(dBdr, dBdphig, drdt, dphigdt, dphigdt - 1.0, sqrt(dxp * dxp + dzp * dzp), Psi, GeoMagneticElements,
+            &Gradient->GradPhi);
+
+    /* Down, per km of depth */
+    dxp = -CosLat;
+    dzp = -SinLat;
+    drdt = (xp * dxp + zp * dzp) / r;
+    dphigdt = (xp * dzp - zp * dxp) / (r * r);
+    MAG_GradientDirection(dBdr, dBdphig, drdt, dphigdt, dphigdt, 1.0, Psi, GeoMagneticElements, &Gradient->GradZ);
+
+    /* East */
+    MAG_GradYSummation(&Context->LegendreFunction, TimedMagneticModel, Context->SphVariables, CoordSpherical, &GradYResultsSph);
+    MAG_RotateMagneticVector(CoordSpherical, CoordGeodetic, GradYResultsSph, &GradYResultsGeo);
+    MAG_CalculateGradientElements(GradYResultsGeo, GeoMagneticElements, &Gradient->GradLambda);
+    return TRUE;
+} /*MAG_GradientSummation_ctx*/
+
+void MAG_GradientAnalytic(MAGtype_Ellipsoid Ellip, MAGtype_CoordGeodetic CoordGeodetic, MAGtype_MagneticModel *TimedMagneticModel, MAGtype_Gradient *Gradient)
+/*
+Same as MAG_Gradient, but the gradient is computed analytically with MAG_GradientSummation_ctx from a single
+evaluation of the field. At the geographic poles MAG_Gradient is used.
+
+INPUT: Ellip
+              CoordGeodetic
+              TimedMagneticModel
+
+OUTPUT : Gradient
+
+CALLS:  	MAG_AllocateEvalContext, MAG_GeodeticToSpherical, MAG_Geomag_ctx, MAG_GradientSummation_ctx, MAG_Gradient
+ */
+{
+    MAGtype_CoordSpherical CoordSpherical;
+    MAGtype_GeoMagneticElements GeomagneticElements;
+    MAGtype_EvalContext *Context;
+    int Flag;
+
+    Context = MAG_AllocateEvalContext(TimedMagneticModel->nMax);
+    if(Context == NULL)
+        return;
+    memset(Gradient, 0, sizeof (MAGtype_Gradient));
+    MAG_GeodeticToSpherical(Ellip, CoordGeodetic, &CoordSpherical);
+    Flag = MAG_Geomag_ctx(Context, Ellip, CoordSpherical, CoordGeodetic, TimedMagneticModel, &GeomagneticElements);
+    Flag = Flag && MAG_GradientSummation_ctx(Context, Ellip, CoordSpherical, CoordGeodetic, TimedMagneticModel, GeomagneticElements, Gradient);
+    MAG_FreeEvalContext(Context);
+    if(!Flag)
+        MAG_Gradient(Ellip, CoordGeodetic, TimedMagneticModel, Gradient);
+} /*MAG_GradientAnalytic*/
+
 int MAG_SetDefaults(MAGtype_Ellipsoid *Ellip, MAGtype_Geoid *Geoid)
 
 /*
@@ -274,6 +937,8 @@ int MAG_SetDefaults(MAGtype_Ellipsoid *Ellip, MAGtype_Geoid *Geoid)
     Geoid->NumbGeoidElevs = Geoid->NumbGeoidCols * Geoid->NumbGeoidRows;
     Geoid->Geoid_Initialized = 0; /*  Geoid will be initialized only if this is set to zero */
     Geoid->UseGeoid = MAG_USE_GEOID;
+    Geoid->GetGeoidPosts = NULL; /* Set with GeoidData to read the heights from a geoid store instead of GeoidHeightBuffer */
+    Geoid->GeoidData = NULL;
 
     return TRUE;
 } /*MAG_SetDefaults */
@@ -463,6 +1128,21 @@ CALLS : none
             printf("Please download this file from http://www.ngdc.noaa.gov/geomag/WMM/DoDWMM.shtml.  \n");
             printf("Replace the existing EGM9615.BIN file with the downloaded one\n");
             break;
+        case 25:
+            printf("\nError allocating in MAG_AllocateTimedModelCache\n");
+            break;
+        case 26:
+            printf("\nError reading the geoid heights in MAG_GetGeoidHeight\n");
+            break;
+        case 27:
+            printf("\nError allocating in MAG_AllocateTrajectory\n");
+            break;
+        case 28:
+            printf("\nError allocating in MAG_AllocateEvalContext\n");
+            break;
+        case 29:
+            printf("\nError allocating in MAG_GeomagBatch\n");
+            break;
     }
 } /*MAG_Error*/
 
@@ -869,6 +1549,134 @@ MAGtype_SphericalHarmonicVariables* MAG_AllocateSphVarMemory(int nMax)
     return SphVariables;
 } /*MAG_AllocateSphVarMemory*/
 
+MAGtype_EvalContext *MAG_AllocateEvalContext(int nMax)
+
+/* Allocate an evaluation context holding all of the scratch memory needed to evaluate a model of
+   degree up to nMax. Functions taking a context (MAG_Geomag_ctx, MAG_GradY_ctx, ...) do not
+   allocate any memory themselves. The recursion factors of MAG_PcupLow and MAG_PcupHigh are
+   computed for nMax the first time each recursion runs on the context and are only read afterwards,
+   so reusing a context for many points leaves no per point setup.
+
+ INPUT: nMax : int : Maximum degree of the models the context will be used with
+
+ OUTPUT:    Pointer to data structure MAGtype_EvalContext
+                        NULL: Failed to allocate memory
+
+CALLS : none
+ */
+{
+    MAGtype_EvalContext *Context;
+    int NumTerms;
+
+    Context = (MAGtype_EvalContext *) calloc(1, sizeof (MAGtype_EvalContext));
+    if(Context == NULL)
+    {
+        MAG_Error(28);
+        return NULL;
+    }
+    NumTerms = ((nMax + 1) * (nMax + 2) / 2);
+    Context->nMax = nMax;
+    Context->NumTerms = NumTerms;
+    Context->LegendreFunction.Pcup = (double *) malloc((NumTerms + 1) * sizeof ( double));
+    Context->LegendreFunction.dPcup = (double *) malloc((NumTerms + 1) * sizeof ( double));
+    Context->SphVariables.RelativeRadiusPower = (double *) malloc((nMax + 1) * sizeof ( double));
+    Context->SphVariables.cos_mlambda = (double *) malloc((nMax + 1) * sizeof ( double));
+    Context->SphVariables.sin_mlambda = (double *) malloc((nMax + 1) * sizeof ( double));
+    Context->PcupS = (double *) malloc((nMax + 1) * sizeof ( double));
+    Context->schmidtQuasiNorm = (double *) malloc((NumTerms + 1) * sizeof ( double));
+    Context->RecursionK = (double *) malloc((NumTerms + 1) * sizeof ( double));
+    Context->f1 = (double *) malloc((NumTerms + 1) * sizeof ( double));
+    Context->f2 = (double *) malloc((NumTerms + 1) * sizeof ( double));
+    Context->PreSqr = (double *) malloc((NumTerms + 1) * sizeof ( double));
+    if(Context->LegendreFunction.Pcup == NULL || Context->LegendreFunction.dPcup == NULL ||
+            Context->SphVariables.RelativeRadiusPower == NULL || Context->SphVariables.cos_mlambda == NULL ||
+            Context->SphVariables.sin_mlambda == NULL || Context->PcupS == NULL || Context->schmidtQuasiNorm == NULL ||
+            Context->RecursionK == NULL || Context->f1 == NULL || Context->f2 == NULL || Context->PreSqr == NULL)
+    {
+        MAG_Error(28);
+        MAG_FreeEvalContext(Context);
+        return NULL;
+    }
+    return Context;
+} /*MAG_AllocateEvalContext*/
+
+MAGtype_TimedModelCache *MAG_AllocateTimedModelCache(int NumEntries, int nMax)
+
+/* Allocate a cache of NumEntries time adjusted models of degree up to nMax, for
+   MAG_TimelyModifyMagneticModel_cache. One entry is enough for inputs whose date changes rarely
+   (files sorted or grouped by date); use one entry per date for inputs cycling through a few dates.
+
+ INPUT: NumEntries : int : Number of time adjusted models kept, at least 1
+        nMax : int : Maximum degree of the models the cache will be used with
+
+ OUTPUT:    Pointer to data structure MAGtype_TimedModelCache
+                        NULL: Failed to allocate memory
+
+CALLS : MAG_AllocateModelMemory
+ */
+{
+    MAGtype_TimedModelCache *Cache;
+    int i;
+
+    if(NumEntries < 1)
+        NumEntries = 1;
+    Cache = (MAGtype_TimedModelCache *) calloc(1, sizeof (MAGtype_TimedModelCache));
+    if(Cache != NULL)
+        Cache->Entries = (MAGtype_TimedModelCacheEntry *) calloc(NumEntries, sizeof (MAGtype_TimedModelCacheEntry));
+    if(Cache == NULL || Cache->Entries == NULL)
+    {
+        MAG_Error(25);
+        free(Cache);
+        return NULL;
+    }
+    Cache->nMax = nMax;
+    Cache->NumEntries = NumEntries;
+    for(i = 0; i < NumEntries; i++)
+    {
+        Cache->Entries[i].TimedMagneticModel = MAG_AllocateModelMemory((nMax + 1) * (nMax + 2) / 2);
+        if(Cache->Entries[i].TimedMagneticModel == NULL)
+        {
+            MAG_Error(25);
+            MAG_FreeTimedModelCache(Cache);
+            return NULL;
+        }
+    }
+    return Cache;
+} /*MAG_AllocateTimedModelCache*/
+
+MAGtype_Trajectory *MAG_AllocateTrajectory(int nMax)
+
+/* Allocate a trajectory for MAG_GeomagTrajectory with the tables of a model of degree up to nMax. The
+   Legendre functions are reused within MAG_TRAJECTORY_LATITUDE_TOLERANCE and the longitude is evaluated
+   directly every MAG_TRAJECTORY_RESEED_INTERVAL fixes; both may be changed before the first fix.
+
+ INPUT: nMax : int : Maximum degree of the models the trajectory will be used with
+
+ OUTPUT:    Pointer to data structure MAGtype_Trajectory
+                        NULL: Failed to allocate memory
+
+CALLS : MAG_AllocateEvalContext
+ */
+{
+    MAGtype_Trajectory *Trajectory;
+
+    Trajectory = (MAGtype_Trajectory *) calloc(1, sizeof (MAGtype_Trajectory));
+    if(Trajectory == NULL)
+    {
+        MAG_Error(27);
+        return NULL;
+    }
+    Trajectory->Context = MAG_AllocateEvalContext(nMax); /* Reports its own allocation errors */
+    if(Trajectory->Context == NULL)
+    {
+        free(Trajectory);
+        return NULL;
+    }
+    Trajectory->LatitudeTolerance = MAG_TRAJECTORY_LATITUDE_TOLERANCE;
+    Trajectory->ReseedInterval = MAG_TRAJECTORY_RESEED_INTERVAL;
+    return Trajectory;
+} /*MAG_AllocateTrajectory*/
+
 void MAG_AssignHeaderValues(MAGtype_MagneticModel *model, char values[][MAXLINELENGTH])
 {
     /*    MAGtype_Date releasedate; */
@@ -1136,14 +1944,77 @@ INPUT : LegendreFunction Pointer to data structure with the following elements
     return TRUE;
 } /*MAG_FreeSphVarMemory*/
 
-void MAG_PrintWMMFormat(char *filename, MAGtype_MagneticModel *MagneticModel)
-{
-    int index, n, m;
-    FILE *OUT;
-    MAGtype_Date Date;
-    char Datestring[11];
+int MAG_FreeEvalContext(MAGtype_EvalContext *Context)
 
-    Date.DecimalYear = MagneticModel->EditionDate;
+/* Free an evaluation context allocated by MAG_AllocateEvalContext.
+INPUT : Context Pointer to data structure MAGtype_EvalContext
+ OUTPUT: none
+ CALLS : none
+ */
+{
+    if(Context == NULL)
+        return TRUE;
+    free(Context->LegendreFunction.Pcup);
+    free(Context->LegendreFunction.dPcup);
+    free(Context->SphVariables.RelativeRadiusPower);
+    free(Context->SphVariables.cos_mlambda);
+    free(Context->SphVariables.sin_mlambda);
+    free(Context->PcupS);
+    free(Context->schmidtQuasiNorm);
+    free(Context->RecursionK);
+    free(Context->f1);
+    free(Context->f2);
+    free(Context->PreSqr);
+    free(Context);
+
+    return TRUE;
+} /*MAG_FreeEvalContext*/
+
+int MAG_FreeTimedModelCache(MAGtype_TimedModelCache *Cache)
+
+/* Free a cache allocated by MAG_AllocateTimedModelCache, including its time adjusted models.
+INPUT : Cache Pointer to data structure MAGtype_TimedModelCache
+ OUTPUT: none
+ CALLS : MAG_FreeMagneticModelMemory
+ */
+{
+    int i;
+
+    if(Cache == NULL)
+        return TRUE;
+    for(i = 0; i < Cache->NumEntries; i++)
+        if(Cache->Entries[i].TimedMagneticModel != NULL)
+            MAG_FreeMagneticModelMemory(Cache->Entries[i].TimedMagneticModel);
+    free(Cache->Entries);
+    free(Cache);
+
+    return TRUE;
+} /*MAG_FreeTimedModelCache*/
+
+int MAG_FreeTrajectory(MAGtype_Trajectory *Trajectory)
+
+/* Free a trajectory allocated by MAG_AllocateTrajectory.
+INPUT : Trajectory Pointer to data structure MAGtype_Trajectory
+ OUTPUT: none
+ CALLS : MAG_FreeEvalContext
+ */
+{
+    if(Trajectory == NULL)
+        return TRUE;
+    MAG_FreeEvalContext(Trajectory->Context);
+    free(Trajectory);
+
+    return TRUE;
+} /*MAG_FreeTrajectory*/
+
+void MAG_PrintWMMFormat(char *filename, MAGtype_MagneticModel *MagneticModel)
+{
+    int index, n, m;
+    FILE *OUT;
+    MAGtype_Date Date;
+    char Datestring[11];
+
+    Date.DecimalYear = MagneticModel->EditionDate;
     MAG_YearToDate(&Date);
     sprintf(Datestring, "%d/%d/%d", Date.Month, Date.Day, Date.Year);
     OUT = fopen(filename, "w");
@@ -2744,23 +3615,32 @@ int MAG_ComputeSphericalHarmonicVariables(MAGtype_Ellipsoid Ellip, MAGtype_Coord
 void MAG_GradY(MAGtype_Ellipsoid Ellip, MAGtype_CoordSpherical CoordSpherical, MAGtype_CoordGeodetic CoordGeodetic,
         MAGtype_MagneticModel *TimedMagneticModel, MAGtype_GeoMagneticElements GeoMagneticElements, MAGtype_GeoMagneticElements *GradYElements)
 {
-    MAGtype_LegendreFunction *LegendreFunction;
-    MAGtype_SphericalHarmonicVariables *SphVariables;
-    int NumTerms;
+    MAGtype_EvalContext *Context;
+
+    Context = MAG_AllocateEvalContext(TimedMagneticModel->nMax); /* For storing the ALF functions and the spherical harmonic variables */
+    if(Context == NULL)
+        return;
+    MAG_GradY_ctx(Context, Ellip, CoordSpherical, CoordGeodetic, TimedMagneticModel, GeoMagneticElements, GradYElements);
+    MAG_FreeEvalContext(Context);
+}
+
+int MAG_GradY_ctx(MAGtype_EvalContext *Context, MAGtype_Ellipsoid Ellip, MAGtype_CoordSpherical CoordSpherical, MAGtype_CoordGeodetic CoordGeodetic,
+        MAGtype_MagneticModel *TimedMagneticModel, MAGtype_GeoMagneticElements GeoMagneticElements, MAGtype_GeoMagneticElements *GradYElements)
+/* Same as MAG_GradY, but the scratch memory is taken from an evaluation context (see MAG_Geomag_ctx)
+   and no heap memory is allocated. Returns FALSE if the context is too small for the model. */
+{
     MAGtype_MagneticResults GradYResultsSph, GradYResultsGeo;
 
-    NumTerms = ((TimedMagneticModel->nMax + 1) * (TimedMagneticModel->nMax + 2) / 2); 
-    LegendreFunction = MAG_AllocateLegendreFunctionMemory(NumTerms); /* For storing the ALF functions */
-    SphVariables = MAG_AllocateSphVarMemory(TimedMagneticModel->nMax);
-    MAG_ComputeSphericalHarmonicVariables(Ellip, CoordSpherical, TimedMagneticModel->nMax, SphVariables); /* Compute Spherical Harmonic variables  */
-    MAG_AssociatedLegendreFunction(CoordSpherical, TimedMagneticModel->nMax, LegendreFunction); /* Compute ALF  */
-    MAG_GradYSummation(LegendreFunction, TimedMagneticModel, *SphVariables, CoordSpherical, &GradYResultsSph); /* Accumulate the spherical harmonic coefficients*/
+    if(Context == NULL || TimedMagneticModel->nMax > Context->nMax)
+        return FALSE;
+    MAG_ComputeSphericalHarmonicVariables(Ellip, CoordSpherical, TimedMagneticModel->nMax, &Context->SphVariables); /* Compute Spherical Harmonic variables  */
+    if(!MAG_AssociatedLegendreFunction_ctx(Context, CoordSpherical, TimedMagneticModel->nMax)) /* Compute ALF  */
+        return FALSE;
+    MAG_GradYSummation(&Context->LegendreFunction, TimedMagneticModel, Context->SphVariables, CoordSpherical, &GradYResultsSph); /* Accumulate the spherical harmonic coefficients*/
     MAG_RotateMagneticVector(CoordSpherical, CoordGeodetic, GradYResultsSph, &GradYResultsGeo); /* Map the computed Magnetic fields to Geodetic coordinates  */
     MAG_CalculateGradientElements(GradYResultsGeo, GeoMagneticElements, GradYElements); /* Calculate the Geomagnetic elements, Equation 18 , WMM Technical report */
-    
-    MAG_FreeLegendreMemory(LegendreFunction);
-    MAG_FreeSphVarMemory(SphVariables);
-}
+    return TRUE;
+} /*MAG_GradY_ctx*/
 
 void MAG_GradYSummation(MAGtype_LegendreFunction *LegendreFunction, MAGtype_MagneticModel *MagneticModel, MAGtype_SphericalHarmonicVariables SphVariables, MAGtype_CoordSpherical CoordSpherical, MAGtype_MagneticResults *GradY)
 {
@@ -2810,54 +3690,46 @@ void MAG_GradYSummation(MAGtype_LegendreFunction *LegendreFunction, MAGtype_Magn
     }
 }
 
-int MAG_PcupHigh(double *Pcup, double *dPcup, double x, int nMax)
-
-/*	This function evaluates all of the Schmidt-semi normalized associated Legendre
-        functions up to degree nMax. The functions are initially scaled by
-        10^280 sin^m in order to minimize the effects of underflow at large m
-        near the poles (see Holmes and Featherstone 2002, J. Geodesy, 76, 279-299).
-        Note that this function performs the same operation as MAG_PcupLow.
-        However this function also can be used for high degree (large nMax) models.
-
-        Calling Parameters:
-                INPUT
-                        nMax:	 Maximum spherical harmonic degree to compute.
-                        x:		cos(colatitude) or sin(latitude).
-
-                OUTPUT
-                        Pcup:	A vector of all associated Legendgre polynomials evaluated at
-                                        x up to nMax. The lenght must by greater or equal to (nMax+1)*(nMax+2)/2.
-                  dPcup:   Derivative of Pcup(x) with respect to latitude
-
-                CALLS : none
-        Notes:
-
+static void MAG_PcupHighTables(int nMax, double *f1, double *f2, double *PreSqr)
 
+/*	The recursion factors of MAG_PcupHigh. They only depend on the degree and order, so they are
+        computed once per context nMax, by MAG_AssociatedLegendreFunction_ctx on the first evaluation that
+        takes the MAG_PcupHigh path, and are valid for any smaller degree.
+        f1, f2 and PreSqr hold at least (nMax+1)*(nMax+2)/2 + 1 elements each.
+ */
+{
+    int k, m, n;
 
-  Adopted from the FORTRAN code written by Mark Wieczorek September 25, 2005.
+    for(n = 0; n <= 2 * nMax + 1; ++n)
+    {
+        PreSqr[n] = sqrt((double) (n));
+    }
 
-  Manoj Nair, Nov, 2009 Manoj.C.Nair@Noaa.Gov
+    k = 2;
 
-  Change from the previous version
-  The prevous version computes the derivatives as
-  dP(n,m)(x)/dx, where x = sin(latitude) (or cos(colatitude) ).
-  However, the WMM Geomagnetic routines requires dP(n,m)(x)/dlatitude.
-  Hence the derivatives are multiplied by sin(latitude).
-  Removed the options for CS phase and normalizations.
+    for(n = 2; n <= nMax; n++)
+    {
+        k = k + 1;
+        f1[k] = (double) (2 * n - 1) / (double) (n);
+        f2[k] = (double) (n - 1) / (double) (n);
+        for(m = 1; m <= n - 2; m++)
+        {
+            k = k + 1;
+            f1[k] = (double) (2 * n - 1) / PreSqr[n + m] / PreSqr[n - m];
+            f2[k] = PreSqr[n - m - 1] * PreSqr[n + m - 1] / PreSqr[n + m] / PreSqr[n - m];
+        }
+        k = k + 2;
+    }
+} /* MAG_PcupHighTables */
 
-  Note: In geomagnetism, the derivatives of ALF are usually found with
-  respect to the colatitudes. Here the derivatives are found with respect
-  to the latitude. The difference is a sign reversal for the derivative of
-  the Associated Legendre Functions.
+static int MAG_PcupHighScratch(double *Pcup, double *dPcup, double x, int nMax, const double *f1, const double *f2, const double *PreSqr)
 
-  The derivatives can't be computed for latitude = |90| degrees.
+/*	The recursion of MAG_PcupHigh. f1, f2 and PreSqr are the factors of MAG_PcupHighTables for nMax
+        or a larger degree; they are only read (see MAG_PcupHigh and MAGtype_EvalContext).
  */
 {
     double pm2, pm1, pmm, plm, rescalem, z, scalef;
-    double *f1, *f2, *PreSqr;
-    int k, kstart, m, n, NumTerms;
-
-    NumTerms = ((nMax + 1) * (nMax + 2) / 2);
+    int k, kstart, m, n;
 
     z = sqrt((1.0 - x)*(1.0 + x));
 
@@ -2875,53 +3747,8 @@ int MAG_PcupHigh(double *Pcup, double *dPcup, double x, int nMax)
     }
 
 
-    f1 = (double *) malloc((NumTerms + 1) * sizeof ( double));
-    if(f1 == NULL)
-    {
-        MAG_Error(18);
-        return FALSE;
-    }
-
-
-    PreSqr = (double *) malloc((NumTerms + 1) * sizeof ( double));
-
-    if(PreSqr == NULL)
-    {
-        MAG_Error(18);
-        return FALSE;
-    }
-
-    f2 = (double *) malloc((NumTerms + 1) * sizeof ( double));
-
-    if(f2 == NULL)
-    {
-        MAG_Error(18);
-        return FALSE;
-    }
-
     scalef = 1.0e-280;
 
-    for(n = 0; n <= 2 * nMax + 1; ++n)
-    {
-        PreSqr[n] = sqrt((double) (n));
-    }
-
-    k = 2;
-
-    for(n = 2; n <= nMax; n++)
-    {
-        k = k + 1;
-        f1[k] = (double) (2 * n - 1) / (double) (n);
-        f2[k] = (double) (n - 1) / (double) (n);
-        for(m = 1; m <= n - 2; m++)
-        {
-            k = k + 1;
-            f1[k] = (double) (2 * n - 1) / PreSqr[n + m] / PreSqr[n - m];
-            f2[k] = PreSqr[n - m - 1] * PreSqr[n + m - 1] / PreSqr[n + m] / PreSqr[n - m];
-        }
-        k = k + 2;
-    }
-
     /*z = sin (geocentric latitude) */
 
     pm2 = 1.0;
@@ -2981,17 +3808,18 @@ int MAG_PcupHigh(double *Pcup, double *dPcup, double x, int nMax)
     pmm = pmm / PreSqr[2 * nMax];
     Pcup[kstart] = pmm * rescalem;
     dPcup[kstart] = -(double) (nMax) * x * Pcup[kstart] / z;
-    free(f1);
-    free(PreSqr);
-    free(f2);
 
     return TRUE;
-} /* MAG_PcupHigh */
+} /* MAG_PcupHighScratch */
 
-int MAG_PcupLow(double *Pcup, double *dPcup, double x, int nMax)
+int MAG_PcupHigh(double *Pcup, double *dPcup, double x, int nMax)
 
-/*   This function evaluates all of the Schmidt-semi normalized associated Legendre
-        functions up to degree nMax.
+/*	This function evaluates all of the Schmidt-semi normalized associated Legendre
+        functions up to degree nMax. The functions are initially scaled by
+        10^280 sin^m in order to minimize the effects of underflow at large m
+        near the poles (see Holmes and Featherstone 2002, J. Geodesy, 76, 279-299).
+        Note that this function performs the same operation as MAG_PcupLow.
+        However this function also can be used for high degree (large nMax) models.
 
         Calling Parameters:
                 INPUT
@@ -3000,36 +3828,110 @@ int MAG_PcupLow(double *Pcup, double *dPcup, double x, int nMax)
 
                 OUTPUT
                         Pcup:	A vector of all associated Legendgre polynomials evaluated at
-                                        x up to nMax.
-                   dPcup: Derivative of Pcup(x) with respect to latitude
+                                        x up to nMax. The lenght must by greater or equal to (nMax+1)*(nMax+2)/2.
+                  dPcup:   Derivative of Pcup(x) with respect to latitude
 
-        Notes: Overflow may occur if nMax > 20 , especially for high-latitudes.
-        Use MAG_PcupHigh for large nMax.
+                CALLS : none
+        Notes:
 
-   Written by Manoj Nair, June, 2009 . Manoj.C.Nair@Noaa.Gov.
+
+
+  Adopted from the FORTRAN code written by Mark Wieczorek September 25, 2005.
+
+  Manoj Nair, Nov, 2009 Manoj.C.Nair@Noaa.Gov
+
+  Change from the previous version
+  The prevous version computes the derivatives as
+  dP(n,m)(x)/dx, where x = sin(latitude) (or cos(colatitude) ).
+  However, the WMM Geomagnetic routines requires dP(n,m)(x)/dlatitude.
+  Hence the derivatives are multiplied by sin(latitude).
+  Removed the options for CS phase and normalizations.
 
   Note: In geomagnetism, the derivatives of ALF are usually found with
   respect to the colatitudes. Here the derivatives are found with respect
   to the latitude. The difference is a sign reversal for the derivative of
   the Associated Legendre Functions.
+
+  The derivatives can't be computed for latitude = |90| degrees.
  */
 {
-    int n, m, index, index1, index2, NumTerms;
-    double k, z, *schmidtQuasiNorm;
-    Pcup[0] = 1.0;
-    dPcup[0] = 0.0;
-    /*sin (geocentric latitude) - sin_phi */
-    z = sqrt((1.0 - x) * (1.0 + x));
+    double *f1, *f2, *PreSqr;
+    int NumTerms, Flag;
 
     NumTerms = ((nMax + 1) * (nMax + 2) / 2);
-    schmidtQuasiNorm = (double *) malloc((NumTerms + 1) * sizeof ( double));
 
-    if(schmidtQuasiNorm == NULL)
+    f1 = (double *) malloc((NumTerms + 1) * sizeof ( double));
+    PreSqr = (double *) malloc((NumTerms + 1) * sizeof ( double));
+    f2 = (double *) malloc((NumTerms + 1) * sizeof ( double));
+    if(f1 == NULL || PreSqr == NULL || f2 == NULL)
     {
-        MAG_Error(19);
+        MAG_Error(18);
+        free(f1);
+        free(PreSqr);
+        free(f2);
         return FALSE;
     }
 
+    MAG_PcupHighTables(nMax, f1, f2, PreSqr);
+    Flag = MAG_PcupHighScratch(Pcup, dPcup, x, nMax, f1, f2, PreSqr);
+
+    free(f1);
+    free(PreSqr);
+    free(f2);
+
+    return Flag;
+} /* MAG_PcupHigh */
+
+static void MAG_PcupLowTables(int nMax, double *schmidtQuasiNorm, double *RecursionK)
+
+/*   The factors of MAG_PcupLow: the ratio between the Schmidt quasi-normalized and the Gauss-normalized
+        associated Legendre functions, and the k of the recursion in degree. Like MAG_PcupHighTables they
+        only depend on the degree and order and are valid for any smaller degree. Both arrays hold at
+        least (nMax+1)*(nMax+2)/2 + 1 elements.
+ */
+{
+    int n, m, index, index1;
+
+    schmidtQuasiNorm[0] = 1.0;
+    for(n = 1; n <= nMax; n++)
+    {
+        index = (n * (n + 1) / 2);
+        index1 = (n - 1) * n / 2;
+        /* for m = 0 */
+        schmidtQuasiNorm[index] = schmidtQuasiNorm[index1] * (double) (2 * n - 1) / (double) n;
+
+        for(m = 1; m <= n; m++)
+        {
+            index = (n * (n + 1) / 2 + m);
+            index1 = (n * (n + 1) / 2 + m - 1);
+            schmidtQuasiNorm[index] = schmidtQuasiNorm[index1] * sqrt((double) ((n - m + 1) * (m == 1 ? 2 : 1)) / (double) (n + m));
+        }
+
+    }
+
+    for(n = 0; n <= nMax; n++)
+    {
+        for(m = 0; m <= n; m++)
+        {
+            index = (n * (n + 1) / 2 + m);
+            RecursionK[index] = n > 1 ? (double) (((n - 1) * (n - 1)) - (m * m)) / (double) ((2 * n - 1) * (2 * n - 3)) : 0.0;
+        }
+    }
+} /*MAG_PcupLowTables */
+
+static int MAG_PcupLowScratch(double *Pcup, double *dPcup, double x, int nMax, const double *schmidtQuasiNorm, const double *RecursionK)
+
+/*   The recursion of MAG_PcupLow. schmidtQuasiNorm and RecursionK are the factors of MAG_PcupLowTables
+        for nMax or a larger degree; they are only read (see MAG_PcupLow and MAGtype_EvalContext).
+ */
+{
+    int n, m, index, index1, index2;
+    double k, z;
+    Pcup[0] = 1.0;
+    dPcup[0] = 0.0;
+    /*sin (geocentric latitude) - sin_phi */
+    z = sqrt((1.0 - x) * (1.0 + x));
+
     /*	 First,	Compute the Gauss-normalized associated Legendre  functions*/
     for(n = 1; n <= nMax; n++)
     {
@@ -3056,33 +3958,13 @@ int MAG_PcupLow(double *Pcup, double *dPcup, double x, int nMax)
                     dPcup[index] = x * dPcup[index2] - z * Pcup[index2];
                 } else
                 {
-                    k = (double) (((n - 1) * (n - 1)) - (m * m)) / (double) ((2 * n - 1) * (2 * n - 3));
+                    k = RecursionK[index];
                     Pcup[index] = x * Pcup[index2] - k * Pcup[index1];
                     dPcup[index] = x * dPcup[index2] - z * Pcup[index2] - k * dPcup[index1];
                 }
             }
         }
     }
-    /* Compute the ration between the the Schmidt quasi-normalized associated Legendre
-     * functions and the Gauss-normalized version. */
-
-    schmidtQuasiNorm[0] = 1.0;
-    for(n = 1; n <= nMax; n++)
-    {
-        index = (n * (n + 1) / 2);
-        index1 = (n - 1) * n / 2;
-        /* for m = 0 */
-        schmidtQuasiNorm[index] = schmidtQuasiNorm[index1] * (double) (2 * n - 1) / (double) n;
-
-        for(m = 1; m <= n; m++)
-        {
-            index = (n * (n + 1) / 2 + m);
-            index1 = (n * (n + 1) / 2 + m - 1);
-            schmidtQuasiNorm[index] = schmidtQuasiNorm[index1] * sqrt((double) ((n - m + 1) * (m == 1 ? 2 : 1)) / (double) (n + m));
-        }
-
-    }
-
     /* Converts the  Gauss-normalized associated Legendre
               functions to the Schmidt quasi-normalized version using pre-computed
               relation stored in the variable schmidtQuasiNorm */
@@ -3098,13 +3980,112 @@ int MAG_PcupLow(double *Pcup, double *dPcup, double x, int nMax)
             insted of co-latitude */
         }
     }
+    return TRUE;
+} /*MAG_PcupLowScratch */
 
-    if(schmidtQuasiNorm)
+int MAG_PcupLow(double *Pcup, double *dPcup, double x, int nMax)
+
+/*   This function evaluates all of the Schmidt-semi normalized associated Legendre
+        functions up to degree nMax.
+
+        Calling Parameters:
+                INPUT
+                        nMax:	 Maximum spherical harmonic degree to compute.
+                        x:		cos(colatitude) or sin(latitude).
+
+                OUTPUT
+                        Pcup:	A vector of all associated Legendgre polynomials evaluated at
+                                        x up to nMax.
+                   dPcup: Derivative of Pcup(x) with respect to latitude
+
+        Notes: Overflow may occur if nMax > 20 , especially for high-latitudes.
+        Use MAG_PcupHigh for large nMax.
+
+   Written by Manoj Nair, June, 2009 . Manoj.C.Nair@Noaa.Gov.
+
+  Note: In geomagnetism, the derivatives of ALF are usually found with
+  respect to the colatitudes. Here the derivatives are found with respect
+  to the latitude. The difference is a sign reversal for the derivative of
+  the Associated Legendre Functions.
+ */
+{
+    int NumTerms, Flag;
+    double *schmidtQuasiNorm, *RecursionK;
+
+    NumTerms = ((nMax + 1) * (nMax + 2) / 2);
+    schmidtQuasiNorm = (double *) malloc((NumTerms + 1) * sizeof ( double));
+    RecursionK = (double *) malloc((NumTerms + 1) * sizeof ( double));
+
+    if(schmidtQuasiNorm == NULL || RecursionK == NULL)
+    {
+        MAG_Error(19);
         free(schmidtQuasiNorm);
-    return TRUE;
+        free(RecursionK);
+        return FALSE;
+    }
+
+    MAG_PcupLowTables(nMax, schmidtQuasiNorm, RecursionK);
+    Flag = MAG_PcupLowScratch(Pcup, dPcup, x, nMax, schmidtQuasiNorm, RecursionK);
+
+    free(schmidtQuasiNorm);
+    free(RecursionK);
+    return Flag;
 } /*MAG_PcupLow */
 
-int MAG_SecVarSummation(MAGtype_LegendreFunction *LegendreFunction, MAGtype_MagneticModel *MagneticModel, MAGtype_SphericalHarmonicVariables SphVariables, MAGtype_CoordSpherical CoordSpherical, MAGtype_MagneticResults *MagneticResults)
+static int MAG_SecVarSummationSpecialScratch(MAGtype_MagneticModel *MagneticModel, MAGtype_SphericalHarmonicVariables SphVariables, MAGtype_CoordSpherical CoordSpherical, MAGtype_MagneticResults *MagneticResults, double *PcupS)
+{
+    /*Special calculation for the secular variation summation at the poles.
+    PcupS is caller supplied scratch memory of at least nMaxSecVar + 1 elements.
+
+
+    INPUT: MagneticModel
+               SphVariables
+               CoordSpherical
+    OUTPUT: MagneticResults
+    CALLS : none
+
+
+     */
+    int n, index;
+    double k, sin_phi, schmidtQuasiNorm1, schmidtQuasiNorm2, schmidtQuasiNorm3;
+
+
+    PcupS[0] = 1;
+    schmidtQuasiNorm1 = 1.0;
+
+    MagneticResults->By = 0.0;
+    sin_phi = sin(DEG2RAD(CoordSpherical.phig));
+
+    for(n = 1; n <= MagneticModel->nMaxSecVar; n++)
+    {
+        index = (n * (n + 1) / 2 + 1);
+        schmidtQuasiNorm2 = schmidtQuasiNorm1 * (double) (2 * n - 1) / (double) n;
+        schmidtQuasiNorm3 = schmidtQuasiNorm2 * sqrt((double) (n * 2) / (double) (n + 1));
+        schmidtQuasiNorm1 = schmidtQuasiNorm2;
+        if(n == 1)
+        {
+            PcupS[n] = PcupS[n - 1];
+        } else
+        {
+            k = (double) (((n - 1) * (n - 1)) - 1) / (double) ((2 * n - 1) * (2 * n - 3));
+            PcupS[n] = sin_phi * PcupS[n - 1] - k * PcupS[n - 2];
+        }
+
+        /*		  1 nMax  (n+2)    n     m            m           m
+                By =    SUM (a/r) (m)  SUM  [g cos(m p) + h sin(m p)] dP (sin(phi))
+                           n=1             m=0   n            n           n  */
+        /* Derivative with respect to longitude, divided by radius. */
+
+        MagneticResults->By += SphVariables.RelativeRadiusPower[n] *
+                (MagneticModel->Secular_Var_Coeff_G[index] * SphVariables.sin_mlambda[1] -
+                MagneticModel->Secular_Var_Coeff_H[index] * SphVariables.cos_mlambda[1])
+                * PcupS[n] * schmidtQuasiNorm3;
+    }
+
+    return TRUE;
+}/*MAG_SecVarSummationSpecialScratch */
+
+static int MAG_SecVarSummationScratch(MAGtype_LegendreFunction *LegendreFunction, MAGtype_MagneticModel *MagneticModel, MAGtype_SphericalHarmonicVariables SphVariables, MAGtype_CoordSpherical CoordSpherical, MAGtype_MagneticResults *MagneticResults, double *PcupS)
 {
     /*This Function sums the secular variation coefficients to get the secular variation of the Magnetic vector.
     INPUT :  LegendreFunction
@@ -3113,7 +4094,8 @@ int MAG_SecVarSummation(MAGtype_LegendreFunction *LegendreFunction, MAGtype_Magn
                     CoordSpherical
     OUTPUT : MagneticResults
 
-    CALLS : MAG_SecVarSummationSpecial
+    CALLS : MAG_SecVarSummationSpecial, or MAG_SecVarSummationSpecialScratch when PcupS
+            (nMaxSecVar + 1 elements of scratch memory) is supplied
 
      */
     int m, n, index;
@@ -3163,9 +4145,27 @@ int MAG_SecVarSummation(MAGtype_LegendreFunction *LegendreFunction, MAGtype_Magn
     } else
         /* Special calculation for component By at Geographic poles */
     {
-        MAG_SecVarSummationSpecial(MagneticModel, SphVariables, CoordSpherical, MagneticResults);
+        if(PcupS == NULL)
+            MAG_SecVarSummationSpecial(MagneticModel, SphVariables, CoordSpherical, MagneticResults);
+        else
+            MAG_SecVarSummationSpecialScratch(MagneticModel, SphVariables, CoordSpherical, MagneticResults, PcupS);
     }
     return TRUE;
+} /*MAG_SecVarSummationScratch*/
+
+int MAG_SecVarSummation(MAGtype_LegendreFunction *LegendreFunction, MAGtype_MagneticModel *MagneticModel, MAGtype_SphericalHarmonicVariables SphVariables, MAGtype_CoordSpherical CoordSpherical, MAGtype_MagneticResults *MagneticResults)
+{
+    /*This Function sums the secular variation coefficients to get the secular variation of the Magnetic vector.
+    INPUT :  LegendreFunction
+                    MagneticModel
+                    SphVariables
+                    CoordSpherical
+    OUTPUT : MagneticResults
+
+    CALLS : MAG_SecVarSummationScratch
+
+     */
+    return MAG_SecVarSummationScratch(LegendreFunction, MagneticModel, SphVariables, CoordSpherical, MagneticResults, NULL);
 } /*MAG_SecVarSummation*/
 
 int MAG_SecVarSummationSpecial(MAGtype_MagneticModel *MagneticModel, MAGtype_SphericalHarmonicVariables SphVariables, MAGtype_CoordSpherical CoordSpherical, MAGtype_MagneticResults *MagneticResults)
@@ -3177,12 +4177,12 @@ int MAG_SecVarSummationSpecial(MAGtype_MagneticModel *MagneticModel, MAGtype_Sph
                SphVariables
                CoordSpherical
     OUTPUT: MagneticResults
-    CALLS : none
+    CALLS : MAG_SecVarSummationSpecialScratch
 
 
      */
-    int n, index;
-    double k, sin_phi, *PcupS, schmidtQuasiNorm1, schmidtQuasiNorm2, schmidtQuasiNorm3;
+    int Flag;
+    double *PcupS;
 
     PcupS = (double *) malloc((MagneticModel->nMaxSecVar + 1) * sizeof (double));
 
@@ -3192,14 +4192,42 @@ int MAG_SecVarSummationSpecial(MAGtype_MagneticModel *MagneticModel, MAGtype_Sph
         return FALSE;
     }
 
+    Flag = MAG_SecVarSummationSpecialScratch(MagneticModel, SphVariables, CoordSpherical, MagneticResults, PcupS);
+
+    free(PcupS);
+    return Flag;
+}/*SecVarSummationSpecial*/
+
+static int MAG_SummationSpecialScratch(MAGtype_MagneticModel *MagneticModel, MAGtype_SphericalHarmonicVariables SphVariables, MAGtype_CoordSpherical CoordSpherical, MAGtype_MagneticResults *MagneticResults, double *PcupS)
+/* Special calculation for the component By at Geographic poles.
+PcupS is caller supplied scratch memory of at least nMax + 1 elements.
+Manoj Nair, June, 2009 manoj.c.nair@noaa.gov
+INPUT: MagneticModel
+           SphVariables
+           CoordSpherical
+OUTPUT: MagneticResults
+CALLS : none
+See Section 1.4, "SINGULARITIES AT THE GEOGRAPHIC POLES", WMM Technical report
+
+ */
+{
+    int n, index;
+    double k, sin_phi, schmidtQuasiNorm1, schmidtQuasiNorm2, schmidtQuasiNorm3;
+
+
     PcupS[0] = 1;
     schmidtQuasiNorm1 = 1.0;
 
     MagneticResults->By = 0.0;
     sin_phi = sin(DEG2RAD(CoordSpherical.phig));
 
-    for(n = 1; n <= MagneticModel->nMaxSecVar; n++)
+    for(n = 1; n <= MagneticModel->nMax; n++)
     {
+
+        /*Compute the ration between the Gauss-normalized associated Legendre
+  functions and the Schmidt quasi-normalized version. This is equivalent to
+  sqrt((m==0?1:2)*(n-m)!/(n+m!))*(2n-1)!!/(n-m)!  */
+
         index = (n * (n + 1) / 2 + 1);
         schmidtQuasiNorm2 = schmidtQuasiNorm1 * (double) (2 * n - 1) / (double) n;
         schmidtQuasiNorm3 = schmidtQuasiNorm2 * sqrt((double) (n * 2) / (double) (n + 1));
@@ -3216,20 +4244,18 @@ int MAG_SecVarSummationSpecial(MAGtype_MagneticModel *MagneticModel, MAGtype_Sph
         /*		  1 nMax  (n+2)    n     m            m           m
                 By =    SUM (a/r) (m)  SUM  [g cos(m p) + h sin(m p)] dP (sin(phi))
                            n=1             m=0   n            n           n  */
-        /* Derivative with respect to longitude, divided by radius. */
+        /* Equation 11 in the WMM Technical report. Derivative with respect to longitude, divided by radius. */
 
         MagneticResults->By += SphVariables.RelativeRadiusPower[n] *
-                (MagneticModel->Secular_Var_Coeff_G[index] * SphVariables.sin_mlambda[1] -
-                MagneticModel->Secular_Var_Coeff_H[index] * SphVariables.cos_mlambda[1])
+                (MagneticModel->Main_Field_Coeff_G[index] * SphVariables.sin_mlambda[1] -
+                MagneticModel->Main_Field_Coeff_H[index] * SphVariables.cos_mlambda[1])
                 * PcupS[n] * schmidtQuasiNorm3;
     }
 
-    if(PcupS)
-        free(PcupS);
     return TRUE;
-}/*SecVarSummationSpecial*/
+}/*MAG_SummationSpecialScratch */
 
-int MAG_Summation(MAGtype_LegendreFunction *LegendreFunction, MAGtype_MagneticModel *MagneticModel, MAGtype_SphericalHarmonicVariables SphVariables, MAGtype_CoordSpherical CoordSpherical, MAGtype_MagneticResults *MagneticResults)
+static int MAG_SummationScratch(MAGtype_LegendreFunction *LegendreFunction, MAGtype_MagneticModel *MagneticModel, MAGtype_SphericalHarmonicVariables SphVariables, MAGtype_CoordSpherical CoordSpherical, MAGtype_MagneticResults *MagneticResults, double *PcupS)
 {
     /* Computes Geomagnetic Field Elements X, Y and Z in Spherical coordinate system using
     spherical harmonic summation.
@@ -3249,7 +4275,8 @@ int MAG_Summation(MAGtype_LegendreFunction *LegendreFunction, MAGtype_MagneticMo
                     CoordSpherical
     OUTPUT : MagneticResults
 
-    CALLS : MAG_SummationSpecial
+    CALLS : MAG_SummationSpecial, or MAG_SummationSpecialScratch when PcupS
+            (nMax + 1 elements of scratch memory) is supplied
 
 
 
@@ -3309,9 +4336,28 @@ int MAG_Summation(MAGtype_LegendreFunction *LegendreFunction, MAGtype_MagneticMo
          * MAG_CheckGeographicPoles.
          */
     {
-        MAG_SummationSpecial(MagneticModel, SphVariables, CoordSpherical, MagneticResults);
+        if(PcupS == NULL)
+            MAG_SummationSpecial(MagneticModel, SphVariables, CoordSpherical, MagneticResults);
+        else
+            MAG_SummationSpecialScratch(MagneticModel, SphVariables, CoordSpherical, MagneticResults, PcupS);
     }
     return TRUE;
+}/*MAG_SummationScratch */
+
+int MAG_Summation(MAGtype_LegendreFunction *LegendreFunction, MAGtype_MagneticModel *MagneticModel, MAGtype_SphericalHarmonicVariables SphVariables, MAGtype_CoordSpherical CoordSpherical, MAGtype_MagneticResults *MagneticResults)
+{
+    /* Computes Geomagnetic Field Elements X, Y and Z in Spherical coordinate system using
+    spherical harmonic summation (see MAG_SummationScratch).
+
+    INPUT :  LegendreFunction
+                    MagneticModel
+                    SphVariables
+                    CoordSpherical
+    OUTPUT : MagneticResults
+
+    CALLS : MAG_SummationScratch
+     */
+    return MAG_SummationScratch(LegendreFunction, MagneticModel, SphVariables, CoordSpherical, MagneticResults, NULL);
 }/*MAG_Summation */
 
 int MAG_SummationSpecial(MAGtype_MagneticModel *MagneticModel, MAGtype_SphericalHarmonicVariables SphVariables, MAGtype_CoordSpherical CoordSpherical, MAGtype_MagneticResults *MagneticResults)
@@ -3321,13 +4367,13 @@ INPUT: MagneticModel
            SphVariables
            CoordSpherical
 OUTPUT: MagneticResults
-CALLS : none
+CALLS : MAG_SummationSpecialScratch
 See Section 1.4, "SINGULARITIES AT THE GEOGRAPHIC POLES", WMM Technical report
 
  */
 {
-    int n, index;
-    double k, sin_phi, *PcupS, schmidtQuasiNorm1, schmidtQuasiNorm2, schmidtQuasiNorm3;
+    int Flag;
+    double *PcupS;
 
     PcupS = (double *) malloc((MagneticModel->nMax + 1) * sizeof (double));
     if(PcupS == 0)
@@ -3336,46 +4382,10 @@ See Section 1.4, "SINGULARITIES AT THE GEOGRAPHIC POLES", WMM Technical report
         return FALSE;
     }
 
-    PcupS[0] = 1;
-    schmidtQuasiNorm1 = 1.0;
-
-    MagneticResults->By = 0.0;
-    sin_phi = sin(DEG2RAD(CoordSpherical.phig));
+    Flag = MAG_SummationSpecialScratch(MagneticModel, SphVariables, CoordSpherical, MagneticResults, PcupS);
 
-    for(n = 1; n <= MagneticModel->nMax; n++)
-    {
-
-        /*Compute the ration between the Gauss-normalized associated Legendre
-  functions and the Schmidt quasi-normalized version. This is equivalent to
-  sqrt((m==0?1:2)*(n-m)!/(n+m!))*(2n-1)!!/(n-m)!  */
-
-        index = (n * (n + 1) / 2 + 1);
-        schmidtQuasiNorm2 = schmidtQuasiNorm1 * (double) (2 * n - 1) / (double) n;
-        schmidtQuasiNorm3 = schmidtQuasiNorm2 * sqrt((double) (n * 2) / (double) (n + 1));
-        schmidtQuasiNorm1 = schmidtQuasiNorm2;
-        if(n == 1)
-        {
-            PcupS[n] = PcupS[n - 1];
-        } else
-        {
-            k = (double) (((n - 1) * (n - 1)) - 1) / (double) ((2 * n - 1) * (2 * n - 3));
-            PcupS[n] = sin_phi * PcupS[n - 1] - k * PcupS[n - 2];
-        }
-
-        /*		  1 nMax  (n+2)    n     m            m           m
-                By =    SUM (a/r) (m)  SUM  [g cos(m p) + h sin(m p)] dP (sin(phi))
-                           n=1             m=0   n            n           n  */
-        /* Equation 11 in the WMM Technical report. Derivative with respect to longitude, divided by radius. */
-
-        MagneticResults->By += SphVariables.RelativeRadiusPower[n] *
-                (MagneticModel->Main_Field_Coeff_G[index] * SphVariables.sin_mlambda[1] -
-                MagneticModel->Main_Field_Coeff_H[index] * SphVariables.cos_mlambda[1])
-                * PcupS[n] * schmidtQuasiNorm3;
-    }
-
-    if(PcupS)
-        free(PcupS);
-    return TRUE;
+    free(PcupS);
+    return Flag;
 }/*MAG_SummationSpecial */
 
 int MAG_TimelyModifyMagneticModel(MAGtype_Date UserDate, MAGtype_MagneticModel *MagneticModel, MAGtype_MagneticModel *TimedMagneticModel)
@@ -3421,6 +4431,334 @@ CALLS : none
     return TRUE;
 } /* MAG_TimelyModifyMagneticModel */
 
+MAGtype_MagneticModel *MAG_TimelyModifyMagneticModel_cache(MAGtype_TimedModelCache *Cache, MAGtype_Date UserDate, MAGtype_MagneticModel *MagneticModel)
+
+/* Same as MAG_TimelyModifyMagneticModel, but the time adjusted model is kept in Cache, keyed by the
+source model pointer and the decimal year. A lookup with the key of a kept entry returns that entry
+without adjusting the model again (a hit); otherwise the least recently used entry is adjusted (a miss).
+Cache->Hits and Cache->Misses count the lookups.
+
+The returned model belongs to the cache and stays valid until a later lookup replaces that entry, so
+with a single entry it is only valid until the next lookup with another key. Do not modify it. If the
+coefficients of a source model change in place, call MAG_ResetTimedModelCache.
+
+INPUT: Cache  Allocated with MAG_AllocateTimedModelCache
+           UserDate
+           MagneticModel  nMax must not exceed the nMax the cache was allocated for
+OUTPUT: Returns the time adjusted model, NULL if the model is too large for the cache
+CALLS : MAG_TimelyModifyMagneticModel
+ */
+{
+    MAGtype_TimedModelCacheEntry *Entry, *Oldest;
+    int i;
+
+    if(MagneticModel->nMax > Cache->nMax)
+        return NULL;
+    Cache->Clock++;
+    Oldest = &Cache->Entries[0];
+    for(i = 0; i < Cache->NumEntries; i++)
+    {
+        Entry = &Cache->Entries[i];
+        if(Entry->Source == MagneticModel && Entry->DecimalYear == UserDate.DecimalYear)
+        {
+            Entry->LastUse = Cache->Clock;
+            Cache->Hits++;
+            return Entry->TimedMagneticModel;
+        }
+        if(Entry->LastUse < Oldest->LastUse)
+            Oldest = Entry;
+    }
+    MAG_TimelyModifyMagneticModel(UserDate, MagneticModel, Oldest->TimedMagneticModel);
+    Oldest->Source = MagneticModel;
+    Oldest->DecimalYear = UserDate.DecimalYear;
+    Oldest->LastUse = Cache->Clock;
+    Cache->Misses++;
+    return Oldest->TimedMagneticModel;
+} /* MAG_TimelyModifyMagneticModel_cache */
+
+void MAG_ResetTimedModelCache(MAGtype_TimedModelCache *Cache)
+/* Empties the cache, so the next lookups time adjust the models again. The counters are kept. */
+{
+    int i;
+
+    for(i = 0; i < Cache->NumEntries; i++)
+    {
+        Cache->Entries[i].Source = NULL;
+        Cache->Entries[i].LastUse = 0;
+    }
+} /*MAG_ResetTimedModelCache*/
+
+void MAG_ResetTrajectory(MAGtype_Trajectory *Trajectory)
+/* Starts a new track: the next fix evaluates the longitude and the Legendre functions directly. The counters are kept. */
+{
+    Trajectory->Valid = FALSE;
+    Trajectory->StepsSinceSeed = 0;
+} /*MAG_ResetTrajectory*/
+
+int MAG_AssociatedLegendreFunction_ctx(MAGtype_EvalContext *Context, MAGtype_CoordSpherical CoordSpherical, int nMax)
+
+/* Same as MAG_AssociatedLegendreFunction, but the functions are stored in Context->LegendreFunction and
+   the recursion factors of MAG_PcupLow / MAG_PcupHigh are read from the context. The factors of each
+   recursion are computed for Context->nMax on its first use.
+INPUT  Context 	Evaluation context allocated for at least nMax
+           CoordSpherical
+           nMax
+OUTPUT  Context->LegendreFunction
+CALLS : MAG_PcupLowTables, MAG_PcupHighTables (once per context)
+ */
+{
+    double sin_phi;
+    int FLAG = 1;
+
+    if(nMax > Context->nMax)
+        return FALSE;
+    sin_phi = sin(DEG2RAD(CoordSpherical.phig)); /* sin  (geocentric latitude) */
+
+    if(nMax <= 16 || (1 - fabs(sin_phi)) < 1.0e-10) /* If nMax is less tha 16 or at the poles */
+    {
+        if(!Context->PcupLowTablesReady)
+        {
+            MAG_PcupLowTables(Context->nMax, Context->schmidtQuasiNorm, Context->RecursionK);
+            Context->PcupLowTablesReady = TRUE;
+        }
+        FLAG = MAG_PcupLowScratch(Context->LegendreFunction.Pcup, Context->LegendreFunction.dPcup, sin_phi, nMax, Context->schmidtQuasiNorm, Context->RecursionK);
+    } else
+    {
+        if(!Context->PcupHighTablesReady)
+        {
+            MAG_PcupHighTables(Context->nMax, Context->f1, Context->f2, Context->PreSqr);
+            Context->PcupHighTablesReady = TRUE;
+        }
+        FLAG = MAG_PcupHighScratch(Context->LegendreFunction.Pcup, Context->LegendreFunction.dPcup, sin_phi, nMax, Context->f1, Context->f2, Context->PreSqr);
+    }
+    if(FLAG == 0) /* Error while computing  Legendre variables*/
+        return FALSE;
+
+    return TRUE;
+} /*MAG_AssociatedLegendreFunction_ctx */
+
+int MAG_SecVarSummation_ctx(MAGtype_EvalContext *Context, MAGtype_MagneticModel *MagneticModel, MAGtype_CoordSpherical CoordSpherical, MAGtype_MagneticResults *MagneticResults)
+/* MAG_SecVarSummation using the Legendre functions, spherical harmonic variables and pole scratch memory of Context */
+{
+    return MAG_SecVarSummationScratch(&Context->LegendreFunction, MagneticModel, Context->SphVariables, CoordSpherical, MagneticResults, Context->PcupS);
+} /*MAG_SecVarSummation_ctx*/
+
+int MAG_Summation_ctx(MAGtype_EvalContext *Context, MAGtype_MagneticModel *MagneticModel, MAGtype_CoordSpherical CoordSpherical, MAGtype_MagneticResults *MagneticResults)
+/* MAG_Summation using the Legendre functions, spherical harmonic variables and pole scratch memory of Context */
+{
+    return MAG_SummationScratch(&Context->LegendreFunction, MagneticModel, Context->SphVariables, CoordSpherical, MagneticResults, Context->PcupS);
+} /*MAG_Summation_ctx*/
+
+#if MAG_FIXED_NMAX != 12
+#error MAG_FixedSchmidtQuasiNorm holds the factors of degree 12, regenerate it for the new MAG_FIXED_NMAX
+#endif
+
+/* Fully unrolls the order loops of MAG_GeomagFixed at -O2 as well, where GCC supports it. Unrolling the
+degree loops too makes the code larger and slower. */
+#if defined(__GNUC__) && __GNUC__ >= 8
+#define MAG_FIXED_UNROLL _Pragma("GCC unroll 16")
+#else
+#define MAG_FIXED_UNROLL
+#endif
+
+/* schmidtQuasiNorm and RecursionK of MAG_PcupLowTables for MAG_FIXED_NMAX, one degree per row, printed with
+17 significant digits so the values are the ones MAG_PcupLowTables computes */
+static const double MAG_FixedSchmidtQuasiNorm[MAG_FIXED_NUMTERMS + 1] = {
+    1,
+    1, 1,
+    1.5, 1.7320508075688772, 0.8660254037844386,
+    2.5, 3.0618621784789726, 1.9364916731037085, 0.79056941504209488,
+    4.375, 5.5339859052946636, 3.9131189606246322, 2.0916500663351889, 0.73950997288745202,
+    7.875, 10.16658128379447, 7.685213074469698, 4.7062126492541738, 2.2185299186623553, 0.7015607600201138,
+    14.4375, 18.903124741692839, 14.944232269507859, 9.9628215130052382, 5.4568620790707172, 2.3268138086232852, 0.67169328938139605,
+    26.8125, 35.469603513959669, 28.960809996010127, 20.478385136833914, 12.348930874776167, 6.1744654373880836, 2.4218245962496963, 0.6472598492877496,
+    50.2734375, 67.03125, 56.082367403612253, 41.41957332816817, 26.736219617835371, 14.830586268334102, 6.8652274293172546, 2.5068266169601756, 0.6267066542400439,
+    94.9609375, 127.40346687426536, 108.65004161512664, 82.982839993569982, 56.375738371688975, 33.69094768709671, 17.39793057467611, 7.5335249254737544, 2.5839777317091466, 0.60904939217552367,
+    180.42578125, 243.28607380714598, 210.69192030396434, 165.28034045942309, 116.87084953567937, 73.915615322315773, 41.320085114855779, 20.043185339772048, 8.1825961504122997, 2.6547847521179802, 0.59362791713657326,
+    344.44921875, 466.38644692864216, 409.04797337487776, 327.9680080977904, 239.5139682335957, 158.42359886807964, 94.117642301250768, 49.604352946160631, 22.760038068635609, 8.8149248398872544, 2.7203448649173199, 0.57997947393467897,
+    660.1943359375, 897.02746158524803, 795.12986069746626, 649.22081265302029, 486.91560948976519, 334.02135244518831, 208.29891011946015, 117.05388227149012, 58.526941135745062, 25.543251233216804, 9.4324706362690076, 2.7814838439702596, 0.56776801212685635
+};
+
+static const double MAG_FixedRecursionK[MAG_FIXED_NUMTERMS + 1] = {
+    0,
+    0, 0,
+    0.33333333333333331, 0, -1,
+    0.26666666666666666, 0.20000000000000001, 0, -0.33333333333333331,
+    0.25714285714285712, 0.22857142857142856, 0.14285714285714285, 0, -0.20000000000000001,
+    0.25396825396825395, 0.23809523809523808, 0.19047619047619047, 0.1111111111111111, 0, -0.14285714285714285,
+    0.25252525252525254, 0.24242424242424243, 0.21212121212121213, 0.16161616161616163, 0.090909090909090912, 0, -0.1111111111111111,
+    0.25174825174825177, 0.24475524475524477, 0.22377622377622378, 0.1888111888111888, 0.13986013986013987, 0.076923076923076927, 0, -0.090909090909090912,
+    0.25128205128205128, 0.24615384615384617, 0.23076923076923078, 0.20512820512820512, 0.16923076923076924, 0.12307692307692308, 0.066666666666666666, 0, -0.076923076923076927,
+    0.25098039215686274, 0.24705882352941178, 0.23529411764705882, 0.21568627450980393, 0.18823529411764706, 0.15294117647058825, 0.10980392156862745, 0.058823529411764705, 0, -0.066666666666666666,
+    0.25077399380804954, 0.24767801857585139, 0.23839009287925697, 0.22291021671826625, 0.20123839009287925, 0.17337461300309598, 0.13931888544891641, 0.099071207430340563, 0.052631578947368418, 0, -0.058823529411764705,
+    0.25062656641604009, 0.24812030075187969, 0.24060150375939848, 0.22807017543859648, 0.21052631578947367, 0.18796992481203006, 0.16040100250626566, 0.12781954887218044, 0.090225563909774431, 0.047619047619047616, 0, -0.052631578947368418,
+    0.25051759834368531, 0.2484472049689441, 0.24223602484472051, 0.2318840579710145, 0.21739130434782608, 0.19875776397515527, 0.17598343685300208, 0.14906832298136646, 0.11801242236024845, 0.082815734989648032, 0.043478260869565216, 0, -0.047619047619047616
+};
+
+int MAG_GeomagFixed(MAGtype_Ellipsoid Ellip, MAGtype_CoordSpherical CoordSpherical, MAGtype_CoordGeodetic CoordGeodetic,
+        MAGtype_MagneticModel *TimedMagneticModel, MAGtype_GeoMagneticElements *GeoMagneticElements)
+/*
+MAG_Geomag for models of degree MAG_FIXED_NMAX (12, the WMM) in both the main field and the secular
+variation. All scratch memory is local arrays of constant size and the normalization and recursion
+factors are constant tables. The Legendre recursion is split per degree into its general, subdiagonal
+and diagonal terms, so it has no branches, and the Schmidt normalization is applied as the terms are
+summed. The main field and secular variation summations run in one pass over the Legendre functions,
+each in its own accumulators. Every value is computed with the operations of MAG_PcupLow,
+MAG_ComputeSphericalHarmonicVariables, MAG_Summation and MAG_SecVarSummation, in the same order, so
+the results are bit identical to MAG_Geomag.
+
+INPUT: Ellip
+              CoordSpherical
+              CoordGeodetic
+              TimedMagneticModel  nMax and nMaxSecVar must both be MAG_FIXED_NMAX
+
+OUTPUT : GeoMagneticElements
+         Returns FALSE if the model is not of degree MAG_FIXED_NMAX
+
+CALLS:  	MAG_SummationSpecialScratch and MAG_SecVarSummationSpecialScratch (at the poles),
+                     MAG_RotateMagneticVector, MAG_CalculateGeoMagneticElements, MAG_CalculateSecularVariationElements
+ */
+{
+    double Pcup[MAG_FIXED_NUMTERMS + 1], dPcup[MAG_FIXED_NUMTERMS + 1];
+    double RelativeRadiusPower[MAG_FIXED_NMAX + 1], cos_mlambda[MAG_FIXED_NMAX + 1], sin_mlambda[MAG_FIXED_NMAX + 1];
+    double PcupS[MAG_FIXED_NMAX + 1];
+    const double *G = TimedMagneticModel->Main_Field_Coeff_G, *H = TimedMagneticModel->Main_Field_Coeff_H;
+    const double *SvG = TimedMagneticModel->Secular_Var_Coeff_G, *SvH = TimedMagneticModel->Secular_Var_Coeff_H;
+    MAGtype_SphericalHarmonicVariables SphVariables;
+    MAGtype_MagneticResults MagneticResultsSph, MagneticResultsGeo, MagneticResultsSphVar, MagneticResultsGeoVar;
+    double Bx, By, Bz, SvBx, SvBy, SvBz, cos_phi, cos_lambda, sin_lambda, x, z, p, dp, rc, rs, svc, svs;
+    int m, n, index, index1, index2;
+
+    if(TimedMagneticModel->nMax != MAG_FIXED_NMAX || TimedMagneticModel->nMaxSecVar != MAG_FIXED_NMAX)
+        return FALSE;
+
+    /* (a/r)^(n+2), cos(m lambda) and sin(m lambda) as MAG_ComputeSphericalHarmonicVariables */
+    cos_lambda = cos(DEG2RAD(CoordSpherical.lambda));
+    sin_lambda = sin(DEG2RAD(CoordSpherical.lambda));
+    RelativeRadiusPower[0] = (Ellip.re / CoordSpherical.r) * (Ellip.re / CoordSpherical.r);
+    cos_mlambda[0] = 1.0;
+    sin_mlambda[0] = 0.0;
+    cos_mlambda[1] = cos_lambda;
+    sin_mlambda[1] = sin_lambda;
+    for(n = 1; n <= MAG_FIXED_NMAX; n++)
+        RelativeRadiusPower[n] = RelativeRadiusPower[n - 1] * (Ellip.re / CoordSpherical.r);
+    for(m = 2; m <= MAG_FIXED_NMAX; m++)
+    {
+        cos_mlambda[m] = cos_mlambda[m - 1] * cos_lambda - sin_mlambda[m - 1] * sin_lambda;
+        sin_mlambda[m] = cos_mlambda[m - 1] * sin_lambda + sin_mlambda[m - 1] * cos_lambda;
+    }
+
+    /* Gauss-normalized associated Legendre functions as MAG_PcupLow, degree 1 and then per degree the
+     * terms of the two lower degrees, the subdiagonal term and the diagonal term */
+    x = sin(DEG2RAD(CoordSpherical.phig));
+    z = sqrt((1.0 - x) * (1.0 + x));
+    Pcup[0] = 1.0;
+    dPcup[0] = 0.0;
+    Pcup[1] = x * Pcup[0];
+    dPcup[1] = x * dPcup[0] - z * Pcup[0];
+    Pcup[2] = z * Pcup[0];
+    dPcup[2] = z * dPcup[0] + x * Pcup[0];
+    for(n = 2; n <= MAG_FIXED_NMAX; n++)
+    {
+        index = n * (n + 1) / 2;
+        index1 = (n - 2) * (n - 1) / 2;
+        index2 = (n - 1) * n / 2;
+        MAG_FIXED_UNROLL
+        for(m = 0; m < n - 1; m++)
+        {
+            Pcup[index + m] = x * Pcup[index2 + m] - MAG_FixedRecursionK[index + m] * Pcup[index1 + m];
+            dPcup[index + m] = x * dPcup[index2 + m] - z * Pcup[index2 + m] - MAG_FixedRecursionK[index + m] * dPcup[index1 + m];
+        }
+        Pcup[index + n - 1] = x * Pcup[index2 + n - 1];
+        dPcup[index + n - 1] = x * dPcup[index2 + n - 1] - z * Pcup[index2 + n - 1];
+        Pcup[index + n] = z * Pcup[index2 + n - 1];
+        dPcup[index + n] = z * dPcup[index2 + n - 1] + x * Pcup[index2 + n - 1];
+    }
+
+    /* Equations 10-12 and their secular variation, with the Schmidt quasi-normalized functions p and dp */
+    Bx = By = Bz = 0.0;
+    SvBx = SvBy = SvBz = 0.0;
+    for(n = 1; n <= MAG_FIXED_NMAX; n++)
+    {
+        index = n * (n + 1) / 2;
+        MAG_FIXED_UNROLL
+        for(m = 0; m <= n; m++, index++)
+        {
+            p = Pcup[index] * MAG_FixedSchmidtQuasiNorm[index];
+            dp = -dPcup[index] * MAG_FixedSchmidtQuasiNorm[index];
+            rc = RelativeRadiusPower[n] * (G[index] * cos_mlambda[m] + H[index] * sin_mlambda[m]);
+            rs = RelativeRadiusPower[n] * (G[index] * sin_mlambda[m] - H[index] * cos_mlambda[m]);
+            svc = RelativeRadiusPower[n] * (SvG[index] * cos_mlambda[m] + SvH[index] * sin_mlambda[m]);
+            svs = RelativeRadiusPower[n] * (SvG[index] * sin_mlambda[m] - SvH[index] * cos_mlambda[m]);
+            Bz -= rc * (double) (n + 1) * p;
+            By += rs * (double) (m) * p;
+            Bx -= rc * dp;
+            SvBz -= svc * (double) (n + 1) * p;
+            SvBy += svs * (double) (m) * p;
+            SvBx -= svc * dp;
+        }
+    }
+    MagneticResultsSph.Bx = Bx;
+    MagneticResultsSph.By = By;
+    MagneticResultsSph.Bz = Bz;
+    MagneticResultsSphVar.Bx = SvBx;
+    MagneticResultsSphVar.By = SvBy;
+    MagneticResultsSphVar.Bz = SvBz;
+    TimedMagneticModel->SecularVariationUsed = TRUE;
+
+    cos_phi = cos(DEG2RAD(CoordSpherical.phig));
+    if(fabs(cos_phi) > 1.0e-10)
+    {
+        MagneticResultsSph.By = MagneticResultsSph.By / cos_phi;
+        MagneticResultsSphVar.By = MagneticResultsSphVar.By / cos_phi;
+    } else
+        /* Special calculation for component By at Geographic poles */
+    {
+        SphVariables.RelativeRadiusPower = RelativeRadiusPower;
+        SphVariables.cos_mlambda = cos_mlambda;
+        SphVariables.sin_mlambda = sin_mlambda;
+        MAG_SummationSpecialScratch(TimedMagneticModel, SphVariables, CoordSpherical, &MagneticResultsSph, PcupS);
+        MAG_SecVarSummationSpecialScratch(TimedMagneticModel, SphVariables, CoordSpherical, &MagneticResultsSphVar, PcupS);
+    }
+
+    MAG_RotateMagneticVector(CoordSpherical, CoordGeodetic, MagneticResultsSph, &MagneticResultsGeo);
+    MAG_RotateMagneticVector(CoordSpherical, CoordGeodetic, MagneticResultsSphVar, &MagneticResultsGeoVar);
+    MAG_CalculateGeoMagneticElements(&MagneticResultsGeo, GeoMagneticElements);
+    MAG_CalculateSecularVariationElements(MagneticResultsGeoVar, GeoMagneticElements);
+
+    return TRUE;
+} /*MAG_GeomagFixed*/
+
+#ifdef MAG_EMBEDDED_WMM2025
+int MAG_GetEmbeddedModel(MAGtype_MagneticModel *MagneticModel)
+
+/* Fills a model with the WMM2025 coefficients compiled into the library (WMMEmbeddedCoefficients.h,
+written by wmm_embed), so no coefficient file has to be read. The coefficient arrays point at constant
+tables: they are read only, and the model must not be freed with MAG_FreeMagneticModelMemory. Use it as
+the source of MAG_TimelyModifyMagneticModel as usual.
+
+INPUT: none
+OUTPUT: MagneticModel  Header fields and array pointers
+CALLS : none
+ */
+{
+    memset(MagneticModel, 0, sizeof (MAGtype_MagneticModel));
+    MAG_strlcpy_equivalent(MagneticModel->ModelName, MAG_EMBEDDED_MODEL_NAME, sizeof (MagneticModel->ModelName));
+    MagneticModel->EditionDate = MAG_EMBEDDED_EDITION_DATE;
+    MagneticModel->epoch = MAG_EMBEDDED_EPOCH;
+    MagneticModel->nMax = MAG_EMBEDDED_NMAX;
+    MagneticModel->nMaxSecVar = MAG_EMBEDDED_NMAXSECVAR;
+    MagneticModel->SecularVariationUsed = TRUE;
+    MagneticModel->min_year = MAG_EMBEDDED_MIN_YEAR;
+    MagneticModel->CoefficientFileEndDate = MAG_EMBEDDED_END_DATE;
+    MagneticModel->Main_Field_Coeff_G = (double *) MAG_EmbeddedMain_Field_Coeff_G;
+    MagneticModel->Main_Field_Coeff_H = (double *) MAG_EmbeddedMain_Field_Coeff_H;
+    MagneticModel->Secular_Var_Coeff_G = (double *) MAG_EmbeddedSecular_Var_Coeff_G;
+    MagneticModel->Secular_Var_Coeff_H = (double *) MAG_EmbeddedSecular_Var_Coeff_H;
+    return TRUE;
+} /*MAG_GetEmbeddedModel*/
+#endif
+
 /*End of Spherical Harmonic Functions*/
 
 
@@ -3481,10 +4819,13 @@ int MAG_GetGeoidHeight(double Latitude,
  *    Longitude           : Geodetic longitude in radians          (input)
  *    DeltaHeight         : Height Adjustment, in meters.          (output)
  *    Geoid				  : MAGtype_Geoid with Geoid grid		   (input)
-        CALLS : none
+ *                          If GeoidHeightBuffer is NULL, the four heights around the
+ *                          location are read with Geoid->GetGeoidPosts instead.
+        CALLS : Geoid->GetGeoidPosts (without GeoidHeightBuffer)
  */
 {
     long Index;
+    double Posts[4];
     double DeltaX, DeltaY;
     double ElevationSE, ElevationSW, ElevationNE, ElevationNW;
     double OffsetX, OffsetY;
@@ -3529,13 +4870,27 @@ int MAG_GetGeoidHeight(double Latitude,
         if((PostY + 1) == Geoid->NumbGeoidRows)
             PostY--;
 
-        Index = (long) (PostY * Geoid->NumbGeoidCols + PostX);
-        ElevationNW = (double) Geoid->GeoidHeightBuffer[ Index ];
-        ElevationNE = (double) Geoid->GeoidHeightBuffer[ Index + 1 ];
+        if(Geoid->GeoidHeightBuffer == NULL && Geoid->GetGeoidPosts != NULL)
+        {
+            if(!Geoid->GetGeoidPosts(Geoid->GeoidData, (int) PostY, (int) PostX, Posts))
+            {
+                MAG_Error(26);
+                return (FALSE);
+            }
+            ElevationNW = Posts[0];
+            ElevationNE = Posts[1];
+            ElevationSW = Posts[2];
+            ElevationSE = Posts[3];
+        } else
+        {
+            Index = (long) (PostY * Geoid->NumbGeoidCols + PostX);
+            ElevationNW = (double) Geoid->GeoidHeightBuffer[ Index ];
+            ElevationNE = (double) Geoid->GeoidHeightBuffer[ Index + 1 ];
 
-        Index = (long) ((PostY + 1) * Geoid->NumbGeoidCols + PostX);
-        ElevationSW = (double) Geoid->GeoidHeightBuffer[ Index ];
-        ElevationSE = (double) Geoid->GeoidHeightBuffer[ Index + 1 ];
+            Index = (long) ((PostY + 1) * Geoid->NumbGeoidCols + PostX);
+            ElevationSW = (double) Geoid->GeoidHeightBuffer[ Index ];
+            ElevationSE = (double) Geoid->GeoidHeightBuffer[ Index + 1 ];
+        }
 
         /*  Perform Bi-Linear Interpolation to compute Height above Ellipsoid:        */
 
@@ -0,0 +1,94 @@
+/*
+ * WMM-2025 coefficients, generated by wmm_embed from WMM.COF. Do not edit.
+ * Included by GeomagnetismLibrary.c when MAG_EMBEDDED_WMM2025 is defined.
+ */
+
+#ifndef WMMEMBEDDEDCOEFFICIENTS_H
+#define WMMEMBEDDEDCOEFFICIENTS_H
+
+#define MAG_EMBEDDED_MODEL_NAME "WMM-2025"
+#define MAG_EMBEDDED_NMAX 12
+#define MAG_EMBEDDED_NMAXSECVAR 12
+#define MAG_EMBEDDED_EPOCH 2025
+#define MAG_EMBEDDED_EDITION_DATE 0
+#define MAG_EMBEDDED_MIN_YEAR 2024.8661202185792
+#define MAG_EMBEDDED_END_DATE 2030
+#define MAG_EMBEDDED_NUMTERMS 91 /* Entries per array, CALCULATE_NUMTERMS(nMax) + 1 */
+
+static const double MAG_EmbeddedMain_Field_Coeff_G[91] = {
+    0, -29351.8, -1410.8, -2556.6, 2951.1, 1649.3,
+    1361, -2404.1, 1243.8, 453.6, 895, 799.5,
+    55.7, -281.1, 12.1, -233.2, 368.9, 187.2,
+    -138.7, -142, 20.9, 64.4, 63.8, 76.9,
+    -115.7, -40.9, 14.9, -60.7, 79.5, -77,
+    -8.8, 59.3, 15.8, 2.5, -11.1, 14.2,
+    23.2, 10.8, -17.5, 2, -21.7, 16.9,
+    15, -16.8, 0.9, 4.6, 7.8, 3,
+    -0.2, -2.5, -13.1, 2.4, 8.6, -8.7,
+    -12.9, -1.3, -6.4, 0.2, 2, -1,
+    -0.6, -0.9, 1.5, 0.9, -2.7, -3.9,
+    2.9, -1.5, -2.5, 2.4, -0.6, -0.1,
+    -0.6, -0.1, 1.1, -1, -0.2, 2.6,
+    -2, -0.2, 0.3, 1.2, -1.3, 0.6,
+    0.6, 0.5, -0.1, -0.4, -0.2, -1.3,
+    -0.7
+};
+
+static const double MAG_EmbeddedMain_Field_Coeff_H[91] = {
+    0, 0, 4545.4, 0, -3133.6, -815.1,
+    0, -56.6, 237.5, -549.5, 0, 278.6,
+    -133.9, 212, -375.6, 0, 45.4, 220.2,
+    -122.9, 43, 106.1, 0, -18.4, 16.8,
+    48.8, -59.8, 10.9, 72.7, 0, -48.9,
+    -14.4, -1, 23.4, -7.4, -25.1, -2.3,
+    0, 7.1, -12.6, 11.4, -9.7, 12.7,
+    0.7, -5.2, 3.9, 0, -24.8, 12.2,
+    8.3, -3.3, -5.2, 7.2, -0.6, 0.8,
+    10, 0, 3.3, 0, 2.4, 5.3,
+    -9.1, 0.4, -4.2, -3.8, 0.9, -9.1,
+    0, 0, 2.9, -0.6, 0.2, 0.5,
+    -0.3, -1.2, -1.7, -2.9, -1.8, -2.3,
+    0, -1.3, 0.7, 1, -1.4, -0.0,
+    0.6, -0.1, 0.8, 0.1, -1, 0.1,
+    0.2
+};
+
+static const double MAG_EmbeddedSecular_Var_Coeff_G[91] = {
+    0, 12, 9.7, -11.6, -5.2, -8,
+    -1.3, -4.2, 0.4, -15.6, -1.6, -2.4,
+    -6, 5.6, -7, 0.6, 1.4, 0,
+    0.6, 2.2, 0.9, -0.2, -0.4, 0.9,
+    1.2, -0.9, 0.3, 0.9, -0.0, -0.1,
+    -0.1, 0.5, -0.1, -0.8, -0.8, 0.8,
+    -0.1, 0.2, 0, 0.5, -0.1, 0.3,
+    0.2, -0.0, 0.2, -0.0, -0.1, 0.1,
+    0.3, -0.3, 0, 0.3, -0.1, 0.1,
+    -0.1, 0.1, 0, 0.1, 0.1, -0.0,
+    -0.3, 0, -0.1, -0.1, -0.0, -0.0,
+    0, -0.0, 0, 0, 0, -0.1,
+    0, -0.0, -0.1, -0.1, -0.1, -0.1,
+    0, 0, -0.0, -0.0, -0.0, -0.0,
+    0.1, -0.0, 0, 0, -0.1, -0.0,
+    -0.1
+};
+
+static const double MAG_EmbeddedSecular_Var_Coeff_H[91] = {
+    0, 0, -21.5, 0, -27.7, -12.1,
+    0, 4, -0.3, -4.1, 0, -1.1,
+    4.1, 1.6, -4.4, 0, -0.5, 2.2,
+    0.4, 1.7, 1.9, 0, 0.3, -1.6,
+    -0.4, 0.9, 0.7, 0.9, 0, 0.6,
+    0.5, -0.8, 0, -1, 0.6, -0.2,
+    0, -0.2, 0.5, -0.4, 0.4, -0.5,
+    -0.6, 0.3, 0.2, 0, -0.3, 0.3,
+    -0.3, 0.3, 0.2, -0.1, -0.2, 0.4,
+    0.1, 0, 0, -0.0, -0.2, 0.1,
+    -0.1, 0.1, 0, -0.1, 0.2, -0.0,
+    0, -0.0, 0.1, -0.0, 0.1, -0.0,
+    -0.0, 0.1, -0.0, 0, 0, 0,
+    0, -0.0, 0, -0.1, 0.1, -0.0,
+    -0.0, -0.0, 0, -0.0, -0.0, 0,
+    -0.1
+};
+
+#endif /*WMMEMBEDDEDCOEFFICIENTS_H*/